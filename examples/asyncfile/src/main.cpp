@@ -0,0 +1,307 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include "thekogans/util/AsyncFile.h"
+#endif // !defined (TOOLCHAIN_OS_Windows)
+
+using namespace thekogans;
+
+namespace {
+    // Cheap and good enough to scatter offsets.
+    struct XorShift {
+        util::ui64 state;
+
+        explicit XorShift (util::ui64 seed) :
+            state (seed | 1) {}
+
+        util::ui64 Next () {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+    };
+
+    void Report (
+            const std::string &name,
+            bool write,
+            std::size_t operationCount,
+            std::size_t blockSize,
+            util::ui64 start,
+            util::ui64 end) {
+        util::f64 seconds =
+            util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end));
+        std::cout << name << (write ? " write: " : " read: ") <<
+            operationCount / seconds / 1000.0 << " KIOPS, " <<
+            operationCount * blockSize / seconds / (1024 * 1024) << " MB/s" << std::endl;
+    }
+
+    void BenchmarkSimpleFile (
+            const std::string &path,
+            bool write,
+            util::ui64 blockCount,
+            std::size_t blockSize,
+            std::size_t operationCount) {
+        util::SimpleFile file (
+            util::HostEndian,
+            path,
+            util::SimpleFile::ReadWrite);
+        std::vector<util::ui8> buffer (blockSize, 0x5a);
+        XorShift random (blockCount);
+        util::ui64 start = util::HRTimer::Click ();
+        for (std::size_t i = 0; i < operationCount; ++i) {
+            file.Seek ((random.Next () % blockCount) * blockSize, SEEK_SET);
+            if (write) {
+                file.Write (buffer.data (), blockSize);
+            }
+            else {
+                file.Read (buffer.data (), blockSize);
+            }
+        }
+        util::ui64 end = util::HRTimer::Click ();
+        Report ("SimpleFile", write, operationCount, blockSize, start, end);
+    }
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    // Keeps queueDepth operations in flight by submitting
+    // the next operation from the completion callback.
+    struct Driver : public util::AsyncFile::Callback {
+        THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Driver)
+
+        bool write;
+        util::ui64 blockCount;
+        std::size_t blockSize;
+        std::size_t operationCount;
+        std::vector<util::ui8> buffers;
+        XorShift random;
+        util::SpinLock spinLock;
+        std::size_t submitted;
+
+        Driver (
+            bool write_,
+            util::ui64 blockCount_,
+            std::size_t blockSize_,
+            std::size_t operationCount_,
+            std::size_t queueDepth) :
+            write (write_),
+            blockCount (blockCount_),
+            blockSize (blockSize_),
+            operationCount (operationCount_),
+            buffers (queueDepth * blockSize, 0x5a),
+            random (blockCount),
+            submitted (0) {}
+
+        // Submit the next operation (using the given slot's buffer).
+        void Next (
+                util::AsyncFile &file,
+                std::size_t slot) {
+            util::ui64 offset;
+            {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                if (submitted == operationCount) {
+                    return;
+                }
+                ++submitted;
+                offset = (random.Next () % blockCount) * blockSize;
+            }
+            util::AsyncFile::Operation::SharedPtr operation (
+                new util::AsyncFile::Operation (
+                    write ? util::AsyncFile::Operation::Write : util::AsyncFile::Operation::Read,
+                    offset,
+                    &buffers[slot * blockSize],
+                    blockSize,
+                    util::AsyncFile::Callback::SharedPtr (this),
+                    0));
+            operation->userData = (void *)slot;
+            file.Submit (std::vector<util::AsyncFile::Operation::SharedPtr> (1, operation));
+        }
+
+        virtual void OnComplete (
+                util::AsyncFile &file,
+                util::AsyncFile::Operation &operation) throw () override {
+            THEKOGANS_UTIL_TRY {
+                if (operation.errorCode != 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (operation.errorCode);
+                }
+                Next (file, (std::size_t)operation.userData);
+            }
+            THEKOGANS_UTIL_CATCH_AND_LOG
+        }
+    };
+
+    void BenchmarkAsyncFile (
+            const std::string &path,
+            util::AsyncFile::Backend backend,
+            bool write,
+            util::ui64 blockCount,
+            std::size_t blockSize,
+            std::size_t operationCount,
+            std::size_t queueDepth) {
+        util::AsyncFile file (path, O_RDWR, 0, queueDepth, backend, queueDepth);
+        Driver::SharedPtr driver (
+            new Driver (write, blockCount, blockSize, operationCount, queueDepth));
+        file.RegisterBuffers (
+            std::vector<std::pair<void *, std::size_t>> (1,
+                std::make_pair ((void *)driver->buffers.data (), driver->buffers.size ())));
+        util::ui64 start = util::HRTimer::Click ();
+        for (std::size_t i = 0; i < queueDepth; ++i) {
+            driver->Next (file, i);
+        }
+        // Wait for the driver to submit everything, then for the stragglers.
+        for (;;) {
+            file.WaitForIdle ();
+            util::LockGuard<util::SpinLock> guard (driver->spinLock);
+            if (driver->submitted == operationCount) {
+                break;
+            }
+        }
+        file.WaitForIdle ();
+        util::ui64 end = util::HRTimer::Click ();
+        Report (
+            std::string (file.GetBackend () == util::AsyncFile::BackendIoUring ?
+                "AsyncFile (io_uring" : "AsyncFile (thread pool") +
+                ", qd " + util::size_tTostring (queueDepth) + ")",
+            write, operationCount, blockSize, start, end);
+    }
+#endif // !defined (TOOLCHAIN_OS_Windows)
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        std::string path;
+        util::ui64 fileSize;
+        std::size_t blockSize;
+        std::size_t operationCount;
+        std::size_t maxQueueDepth;
+
+        Options () :
+            path ("asyncfile.dat"),
+            fileSize (256),
+            blockSize (4096),
+            operationCount (100000),
+            maxQueueDepth (64) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'p':
+                    path = value;
+                    break;
+                case 's':
+                    fileSize = util::stringToui64 (value.c_str ());
+                    break;
+                case 'b':
+                    blockSize = util::stringToui32 (value.c_str ());
+                    break;
+                case 'n':
+                    operationCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 'q':
+                    maxQueueDepth = util::stringToui32 (value.c_str ());
+                    break;
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "psbnq");
+    util::ui64 blockCount = options.blockSize > 0 ?
+        options.fileSize * 1024 * 1024 / options.blockSize : 0;
+    if (options.path.empty () || blockCount == 0 ||
+            options.operationCount == 0 || options.maxQueueDepth == 0) {
+        std::cout << "usage: " << argv[0] <<
+            " [-p:path] [-s:fileSize] [-b:blockSize] [-n:operationCount] [-q:maxQueueDepth]" << std::endl <<
+            "  -p file to create (default: asyncfile.dat)" << std::endl <<
+            "  -s file size in MB (default: 256)" << std::endl <<
+            "  -b block size (default: 4096)" << std::endl <<
+            "  -n random reads/writes per run (default: 100000)" << std::endl <<
+            "  -q maximum queue depth (default: 64, runs 1, 2, 4... up to it)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        {
+            // Lay the file out so that reads hit real blocks.
+            util::SimpleFile file (
+                util::HostEndian,
+                options.path,
+                util::SimpleFile::ReadWrite | util::SimpleFile::Create | util::SimpleFile::Truncate);
+            std::vector<util::ui8> buffer (options.blockSize, 0xa5);
+            for (util::ui64 i = 0; i < blockCount; ++i) {
+                file.Write (buffer.data (), options.blockSize);
+            }
+        }
+        for (int write = 0; write < 2; ++write) {
+            BenchmarkSimpleFile (
+                options.path,
+                write == 1,
+                blockCount,
+                options.blockSize,
+                options.operationCount);
+        #if !defined (TOOLCHAIN_OS_Windows)
+            util::AsyncFile::Backend backends[] = {
+                util::AsyncFile::BackendIoUring,
+                util::AsyncFile::BackendThreadPool
+            };
+            for (std::size_t i = 0; i < sizeof (backends) / sizeof (backends[0]); ++i) {
+                for (std::size_t queueDepth = 1;
+                        queueDepth <= options.maxQueueDepth; queueDepth *= 2) {
+                    THEKOGANS_UTIL_TRY {
+                        BenchmarkAsyncFile (
+                            options.path,
+                            backends[i],
+                            write == 1,
+                            blockCount,
+                            options.blockSize,
+                            options.operationCount,
+                            queueDepth);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        // io_uring is not available on this system.
+                        std::cout << exception.Report () << std::endl;
+                        break;
+                    }
+                }
+            }
+        #endif // !defined (TOOLCHAIN_OS_Windows)
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
@@ -0,0 +1,215 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+#if defined (THEKOGANS_UTIL_HAVE_ZLIB)
+    #include "thekogans/util/Deflate.h"
+#endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
+
+using namespace thekogans;
+
+#if defined (THEKOGANS_UTIL_HAVE_ZLIB)
+
+namespace {
+    // Compressible (but not trivially so) text like data.
+    util::Buffer GenerateData (std::size_t length) {
+        static const char *words[] = {
+            "the ", "quick ", "brown ", "fox ", "jumps ", "over ",
+            "lazy ", "dog ", "lorem ", "ipsum ", "dolor ", "sit\n"
+        };
+        util::Buffer buffer (util::HostEndian, length);
+        util::ui64 state = 0x9e3779b97f4a7c15ull;
+        while (buffer.GetDataAvailableForWriting () > 0) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            const char *word = words[state % (sizeof (words) / sizeof (words[0]))];
+            buffer.Write (word, std::min (strlen (word), buffer.GetDataAvailableForWriting ()));
+            if ((state >> 32) % 11 == 0 && buffer.GetDataAvailableForWriting () > 0) {
+                buffer << (util::ui8)(state >> 24);
+            }
+        }
+        return buffer;
+    }
+
+    util::Buffer ReadData (const std::string &path) {
+        util::ReadOnlyFile file (util::HostEndian, path);
+        util::Buffer buffer (util::HostEndian, (std::size_t)file.GetSize ());
+        buffer.AdvanceWriteOffset (
+            file.Read (buffer.GetWritePtr (), buffer.GetDataAvailableForWriting ()));
+        return buffer;
+    }
+
+    // Big enough for the worst case (incompressible data).
+    util::Buffer OutputBuffer (std::size_t length) {
+        return util::Buffer (util::HostEndian, length + length / 8 + 1024 * 1024);
+    }
+
+    void Report (
+            const std::string &name,
+            std::size_t inLength,
+            std::size_t outLength,
+            util::ui64 start,
+            util::ui64 end) {
+        util::f64 seconds =
+            util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end));
+        std::cout << name << ": " <<
+            inLength / seconds / (1024 * 1024) << " MB/s, " <<
+            inLength << " -> " << outLength << std::endl;
+    }
+
+    void Verify (
+            const std::string &name,
+            const util::Buffer &expected,
+            const util::Buffer &actual) {
+        if (expected.GetDataAvailableForReading () != actual.GetDataAvailableForReading () ||
+                memcmp (
+                    expected.GetReadPtr (),
+                    actual.GetReadPtr (),
+                    expected.GetDataAvailableForReading ()) != 0) {
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "%s: round trip failed.", name.c_str ());
+        }
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        std::string path;
+        std::size_t size;
+        std::size_t blockSize;
+        util::i32 level;
+
+        Options () :
+            size (64),
+            blockSize (util::DEFAULT_PARALLEL_DEFLATE_BLOCK_SIZE / 1024),
+            level (util::Deflater::BEST_LEVEL) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'p':
+                    path = value;
+                    break;
+                case 's':
+                    size = util::stringToui32 (value.c_str ());
+                    break;
+                case 'b':
+                    blockSize = util::stringToui32 (value.c_str ());
+                    break;
+                case 'l':
+                    level = util::stringToi32 (value.c_str ());
+                    break;
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "psbl");
+    if (options.size == 0 || options.blockSize < 32 ||
+            options.level < util::Deflater::DEFAULT_LEVEL ||
+            options.level > util::Deflater::BEST_LEVEL) {
+        std::cout << "usage: " << argv[0] <<
+            " [-p:path] [-s:size] [-b:blockSize] [-l:level]" << std::endl <<
+            "  -p file to compress (default: generated data)" << std::endl <<
+            "  -s generated data size in MB (default: 64)" << std::endl <<
+            "  -b parallel deflate block size in KB (>= 32, default: 128)" << std::endl <<
+            "  -l compression level (-1 - 9, default: 9)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        util::Buffer data = options.path.empty () ?
+            GenerateData (options.size * 1024 * 1024) : ReadData (options.path);
+        std::size_t length = data.GetDataAvailableForReading ();
+        // Single threaded streaming deflate (what Buffer::Deflate used to do).
+        util::Buffer deflated = OutputBuffer (length);
+        {
+            util::ui64 start = util::HRTimer::Click ();
+            util::Deflater deflater (deflated, util::Deflater::FORMAT_ZLIB, options.level);
+            deflater.Write (data.GetReadPtr (), length);
+            deflater.Finish ();
+            util::ui64 end = util::HRTimer::Click ();
+            Report ("Deflater", length, deflated.GetDataAvailableForReading (), start, end);
+        }
+        util::Buffer parallelDeflated = OutputBuffer (length);
+        {
+            util::ui64 start = util::HRTimer::Click ();
+            util::ParallelDeflate (data.GetReadPtr (), length, parallelDeflated,
+                util::Deflater::FORMAT_ZLIB, options.level, options.blockSize * 1024);
+            util::ui64 end = util::HRTimer::Click ();
+            Report ("ParallelDeflate", length,
+                parallelDeflated.GetDataAvailableForReading (), start, end);
+        }
+        {
+            util::ui64 start = util::HRTimer::Click ();
+            util::Buffer buffer = data.Deflate ();
+            util::ui64 end = util::HRTimer::Click ();
+            Report ("Buffer::Deflate", length, buffer.GetDataAvailableForReading (), start, end);
+        }
+        // Both streams must inflate back to the original.
+        {
+            util::Buffer inflated (util::HostEndian, length);
+            util::ui64 start = util::HRTimer::Click ();
+            util::Inflater inflater (inflated);
+            inflater.Write (deflated.GetReadPtr (), deflated.GetDataAvailableForReading ());
+            util::ui64 end = util::HRTimer::Click ();
+            Report ("Inflater", length, deflated.GetDataAvailableForReading (), start, end);
+            Verify ("Deflater", data, inflated);
+        }
+        {
+            util::ui64 start = util::HRTimer::Click ();
+            util::Buffer inflated = parallelDeflated.Inflate ();
+            util::ui64 end = util::HRTimer::Click ();
+            Report ("Buffer::Inflate", length,
+                parallelDeflated.GetDataAvailableForReading (), start, end);
+            Verify ("ParallelDeflate", data, inflated);
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
+
+#else // defined (THEKOGANS_UTIL_HAVE_ZLIB)
+
+int main (
+        int /*argc*/,
+        const char * /*argv*/ []) {
+    std::cout << "libthekogans_util was built without zlib." << std::endl;
+    return 0;
+}
+
+#endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
@@ -0,0 +1,228 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/Vectorizer.h"
+#include "thekogans/util/ParallelAlgorithms.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+
+using namespace thekogans;
+
+namespace {
+    util::f64 Elapsed (
+            util::ui64 start,
+            util::ui64 end) {
+        return util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end));
+    }
+
+    // Time serial and parallel, make sure they agree and report the speedup.
+    template<
+        typename Serial,
+        typename Parallel,
+        typename Check>
+    void Compare (
+            const std::string &name,
+            Serial serial,
+            Parallel parallel,
+            Check check) {
+        util::ui64 start = util::HRTimer::Click ();
+        serial ();
+        util::ui64 end = util::HRTimer::Click ();
+        util::f64 serialTime = Elapsed (start, end);
+        start = util::HRTimer::Click ();
+        parallel ();
+        end = util::HRTimer::Click ();
+        util::f64 parallelTime = Elapsed (start, end);
+        bool ok = check ();
+        std::cout << name << ": serial " << serialTime * 1e3 << " ms, parallel " <<
+            parallelTime * 1e3 << " ms, speedup " << serialTime / parallelTime <<
+            (ok ? "" : " (MISMATCH)") << std::endl;
+        if (!ok) {
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "%s: parallel and serial results differ.", name.c_str ());
+        }
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        std::size_t workerCount;
+        std::size_t size;
+
+        Options () :
+            workerCount (util::SystemInfo::Instance ().GetCPUCount ()),
+            size (16 * 1024 * 1024) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'w':
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 's':
+                    size = util::stringToui32 (value.c_str ());
+                    break;
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "ws");
+    if (options.workerCount == 0 || options.size == 0) {
+        std::cout << "usage: " << argv[0] << " [-w:workerCount] [-s:size]" << std::endl <<
+            "  -w vector width (default: CPU count)" << std::endl <<
+            "  -s element count (default: 16M)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        util::Vectorizer vectorizer (
+            options.workerCount,
+            THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+            THEKOGANS_UTIL_MAX_THREAD_AFFINITY);
+        std::cout << "size: " << options.size << ", width: " << vectorizer.GetWidth () << std::endl;
+        std::mt19937 random (0x5eed);
+        std::vector<util::ui32> keys (options.size);
+        for (std::size_t i = 0; i < options.size; ++i) {
+            keys[i] = random ();
+        }
+        std::vector<util::f64> values (options.size);
+        for (std::size_t i = 0; i < options.size; ++i) {
+            values[i] = (keys[i] & 0xffff) / 65536.0;
+        }
+        std::vector<util::f64> serialResult (options.size);
+        std::vector<util::f64> parallelResult (options.size);
+        auto work = [] (util::f64 value) -> util::f64 {
+            return std::sqrt (value) * std::sin (value);
+        };
+        Compare ("for_each",
+            [&] () {
+                std::for_each (serialResult.begin (), serialResult.end (),
+                    [] (util::f64 &value) {value = 1.0;});
+            },
+            [&] () {
+                util::ParallelForEach (parallelResult.begin (), parallelResult.end (),
+                    [] (util::f64 &value) {value = 1.0;}, 0, vectorizer);
+            },
+            [&] () {
+                return serialResult == parallelResult;
+            });
+        Compare ("transform",
+            [&] () {
+                std::transform (values.begin (), values.end (), serialResult.begin (), work);
+            },
+            [&] () {
+                util::ParallelTransform (values.begin (), values.end (),
+                    parallelResult.begin (), work, 0, vectorizer);
+            },
+            [&] () {
+                return serialResult == parallelResult;
+            });
+        // Integer sums so that the (reordered) parallel reduction is exact.
+        util::ui64 serialSum = 0;
+        util::ui64 parallelSum = 0;
+        Compare ("reduce",
+            [&] () {
+                serialSum = std::accumulate (keys.begin (), keys.end (), (util::ui64)0);
+            },
+            [&] () {
+                parallelSum = util::ParallelReduce (keys.begin (), keys.end (), (util::ui64)0,
+                    std::plus<util::ui64> (), 0, vectorizer);
+            },
+            [&] () {
+                return parallelSum == serialSum;
+            });
+        std::vector<util::ui64> serialScan (options.size);
+        std::vector<util::ui64> parallelScan (options.size);
+        Compare ("inclusive scan",
+            [&] () {
+                std::partial_sum (keys.begin (), keys.end (), serialScan.begin (),
+                    std::plus<util::ui64> ());
+            },
+            [&] () {
+                util::ParallelInclusiveScan (keys.begin (), keys.end (),
+                    parallelScan.begin (), std::plus<util::ui64> (), 0, vectorizer);
+            },
+            [&] () {
+                return serialScan == parallelScan;
+            });
+        Compare ("exclusive scan",
+            [&] () {
+                util::ui64 sum = 0;
+                for (std::size_t i = 0; i < options.size; ++i) {
+                    serialScan[i] = sum;
+                    sum += keys[i];
+                }
+            },
+            [&] () {
+                util::ParallelExclusiveScan (keys.begin (), keys.end (),
+                    parallelScan.begin (), (util::ui64)0, std::plus<util::ui64> (), 0, vectorizer);
+            },
+            [&] () {
+                return serialScan == parallelScan;
+            });
+        std::vector<util::ui32> serialKeys = keys;
+        std::vector<util::ui32> parallelKeys = keys;
+        Compare ("sort",
+            [&] () {
+                std::sort (serialKeys.begin (), serialKeys.end ());
+            },
+            [&] () {
+                util::ParallelSort (parallelKeys.begin (), parallelKeys.end (),
+                    std::less<util::ui32> (), 0, vectorizer);
+            },
+            [&] () {
+                return serialKeys == parallelKeys;
+            });
+        parallelKeys = keys;
+        Compare ("radix sort",
+            [&] () {
+                serialKeys = keys;
+                std::sort (serialKeys.begin (), serialKeys.end ());
+            },
+            [&] () {
+                util::ParallelRadixSort (parallelKeys.begin (), parallelKeys.end (), 0, vectorizer);
+            },
+            [&] () {
+                return serialKeys == parallelKeys;
+            });
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <vector>
+#include <iostream>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/CPUSet.h"
+#include "thekogans/util/CPUTopology.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/Vectorizer.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+
+using namespace thekogans;
+
+namespace {
+    // Memory bandwidth bound: a = b + scalar * c.
+    struct TriadJob : public util::Vectorizer::Job {
+        std::vector<util::f64> &a;
+        const std::vector<util::f64> &b;
+        const std::vector<util::f64> &c;
+        util::f64 scalar;
+
+        TriadJob (
+            std::vector<util::f64> &a_,
+            const std::vector<util::f64> &b_,
+            const std::vector<util::f64> &c_,
+            util::f64 scalar_) :
+            a (a_),
+            b (b_),
+            c (c_),
+            scalar (scalar_) {}
+
+        virtual void Execute (
+                std::size_t startIndex,
+                std::size_t endIndex,
+                std::size_t /*rank*/) throw () override {
+            for (; startIndex < endIndex; ++startIndex) {
+                a[startIndex] = b[startIndex] + scalar * c[startIndex];
+            }
+        }
+
+        virtual std::size_t Size () const throw () override {
+            return a.size ();
+        }
+    };
+
+    // Compute bound: evaluate a polynomial in place.
+    struct PolynomialJob : public util::Vectorizer::Job {
+        std::vector<util::f64> &a;
+
+        explicit PolynomialJob (std::vector<util::f64> &a_) :
+            a (a_) {}
+
+        virtual void Execute (
+                std::size_t startIndex,
+                std::size_t endIndex,
+                std::size_t /*rank*/) throw () override {
+            for (; startIndex < endIndex; ++startIndex) {
+                util::f64 x = a[startIndex];
+                util::f64 y = 0.0;
+                for (std::size_t i = 0; i < 16; ++i) {
+                    y = y * x + 1.0 / (i + 1);
+                }
+                a[startIndex] = y;
+            }
+        }
+
+        virtual std::size_t Size () const throw () override {
+            return a.size ();
+        }
+    };
+
+    util::f64 Time (
+            util::Vectorizer &vectorizer,
+            util::Vectorizer::Job &job,
+            std::size_t iterations) {
+        // Warm up (page in the arrays, wake the workers).
+        vectorizer.Execute (job);
+        util::ui64 start = util::HRTimer::Click ();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            vectorizer.Execute (job);
+        }
+        util::ui64 end = util::HRTimer::Click ();
+        return util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end));
+    }
+
+    void UnbindCurrentThread () {
+        // Vectorizer binds the calling thread (rank 0). Undo
+        // it so that every placement starts from scratch.
+        const std::vector<util::CPUTopology::LogicalCPU> &cpus =
+            util::CPUTopology::Instance ().GetCPUs ();
+        util::CPUSet all;
+        for (std::size_t i = 0, count = cpus.size (); i < count; ++i) {
+            all.Add (cpus[i].id);
+        }
+        util::Thread::SetThreadAffinity (util::Thread::GetCurrThreadHandle (), all);
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        std::size_t workerCount;
+        std::size_t elementCount;
+        std::size_t iterations;
+
+        Options () :
+            workerCount (util::SystemInfo::Instance ().GetCPUCount ()),
+            elementCount (16 * 1024 * 1024),
+            iterations (20) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'w':
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 'e':
+                    elementCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 'i':
+                    iterations = util::stringToui32 (value.c_str ());
+                    break;
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "wei");
+    if (options.workerCount == 0 || options.elementCount == 0 || options.iterations == 0) {
+        std::cout << "usage: " << argv[0] <<
+            " [-w:workerCount] [-e:elementCount] [-i:iterations]" << std::endl <<
+            "  -w vector width (default: CPU count)" << std::endl <<
+            "  -e number of f64 elements in each array (default: 16M)" << std::endl <<
+            "  -i timed iterations of each job (default: 20)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        util::CPUTopology::Instance ().Dump ();
+        std::cout << std::endl;
+        std::vector<util::f64> a (options.elementCount, 0.0);
+        std::vector<util::f64> b (options.elementCount, 1.0);
+        std::vector<util::f64> c (options.elementCount, 2.0);
+        TriadJob triadJob (a, b, c, 3.0);
+        PolynomialJob polynomialJob (a);
+        struct {
+            const char *name;
+            util::ui32 affinity;
+        } const placements[] = {
+            {"none", THEKOGANS_UTIL_MAX_THREAD_AFFINITY},
+            {"compact", THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY},
+            {"scatter", THEKOGANS_UTIL_SCATTER_THREAD_AFFINITY},
+            {"physical core", THEKOGANS_UTIL_PHYSICAL_CORE_THREAD_AFFINITY},
+            {"NUMA node", THEKOGANS_UTIL_NUMA_NODE_THREAD_AFFINITY}
+        };
+        for (std::size_t i = 0; i < sizeof (placements) / sizeof (placements[0]); ++i) {
+            UnbindCurrentThread ();
+            util::Vectorizer vectorizer (
+                options.workerCount,
+                THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+                placements[i].affinity);
+            util::f64 triadSeconds = Time (vectorizer, triadJob, options.iterations);
+            util::f64 polynomialSeconds = Time (vectorizer, polynomialJob, options.iterations);
+            // Triad reads two arrays and writes one.
+            util::f64 bytes = 3.0 * sizeof (util::f64) * options.elementCount * options.iterations;
+            util::f64 elements = (util::f64)options.elementCount * options.iterations;
+            std::cout << placements[i].name << " (" << options.workerCount << " workers): " <<
+                "triad " << bytes / triadSeconds / (1024 * 1024 * 1024) << " GB/s, " <<
+                "polynomial " << elements / polynomialSeconds / 1e6 << " Melements/s" << std::endl;
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Heap.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Reclaimer.h"
+#include "thekogans/util/HazardPointerReclaimer.h"
+#include "thekogans/util/EpochReclaimer.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+
+using namespace thekogans;
+
+namespace {
+    // Shared, read mostly object (think subscriber snapshot or map bucket).
+    // Heap backed, so Reclaimer::Retire (Node *) gives it back to the heap.
+    struct Node {
+        THEKOGANS_UTIL_DECLARE_HEAP_WITH_LOCK (Node, util::SpinLock)
+
+    public:
+        util::ui64 value;
+
+        explicit Node (util::ui64 value_ = 0) :
+            value (value_) {}
+    };
+
+    // The same object, shared the RefCounted way.
+    struct RefCountedNode : public util::RefCounted {
+        THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (RefCountedNode)
+
+        util::ui64 value;
+
+        explicit RefCountedNode (util::ui64 value_ = 0) :
+            value (value_) {}
+    };
+
+    // Keeps the compiler from optimizing the reads away.
+    volatile util::ui64 sink;
+
+    // Cheap, thread private random numbers.
+    inline util::ui64 Next (util::ui64 &state) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    struct Options : public util::CommandLineOptions {
+        std::size_t operationCount;
+        std::size_t readerCount;
+        std::size_t writerCount;
+        std::size_t slotCount;
+
+        Options () :
+            operationCount (10000000),
+            readerCount (std::thread::hardware_concurrency () > 1 ?
+                std::thread::hardware_concurrency () - 1 : 1),
+            writerCount (1),
+            slotCount (1024) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'n':
+                    operationCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 'r':
+                    readerCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 'w':
+                    writerCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 's':
+                    slotCount = util::stringToui32 (value.c_str ());
+                    break;
+            }
+        }
+    };
+
+    // Run reader on readerCount and writer on writerCount threads,
+    // (every thread performing operationCount operations) and report
+    // the read and write throughput separately.
+    template<
+        typename Reader,
+        typename Writer>
+    void Run (
+            const std::string &name,
+            const Options &options,
+            Reader reader,
+            Writer writer) {
+        std::size_t threadCount = options.readerCount + options.writerCount;
+        std::atomic<std::size_t> ready (0);
+        std::atomic<util::ui64> readTime (0);
+        std::atomic<util::ui64> writeTime (0);
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            bool isReader = i < options.readerCount;
+            threads.push_back (
+                std::thread (
+                    [&, i, isReader] () {
+                        util::ui64 state = i * 2654435761u + 1;
+                        ++ready;
+                        while (ready != threadCount) {
+                            std::this_thread::yield ();
+                        }
+                        util::ui64 start = util::HRTimer::Click ();
+                        if (isReader) {
+                            reader (options.operationCount, state);
+                        }
+                        else {
+                            writer (options.operationCount, state);
+                        }
+                        util::ui64 ellapsed =
+                            util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ());
+                        (isReader ? readTime : writeTime) += ellapsed;
+                    }));
+        }
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            threads[i].join ();
+        }
+        std::cout << name << " (" << options.readerCount << " readers, " <<
+            options.writerCount << " writers): ";
+        if (options.readerCount > 0) {
+            util::f64 seconds = util::HRTimer::ToSeconds (readTime) / options.readerCount;
+            std::cout << "read " << options.operationCount / seconds / 1000000.0 *
+                options.readerCount << " Mops/s (" <<
+                seconds * 1e9 / options.operationCount << " ns/op)";
+        }
+        if (options.writerCount > 0) {
+            util::f64 seconds = util::HRTimer::ToSeconds (writeTime) / options.writerCount;
+            std::cout << ", write " << options.operationCount / seconds / 1000000.0 *
+                options.writerCount << " Mops/s (" <<
+                seconds * 1e9 / options.operationCount << " ns/op)";
+        }
+        std::cout << std::endl;
+    }
+
+    void ReportStats (const util::Reclaimer::Stats &stats) {
+        std::cout << "    retired " << stats.retiredCount <<
+            ", reclaimed " << stats.reclaimedCount <<
+            ", pending " << stats.GetPendingCount () <<
+            ", scans " << stats.scanCount <<
+            ", threads " << stats.threadCount << std::endl;
+    }
+
+    std::vector<std::atomic<Node *>> *NewSlots (std::size_t slotCount) {
+        std::vector<std::atomic<Node *>> *slots =
+            new std::vector<std::atomic<Node *>> (slotCount);
+        for (std::size_t i = 0; i < slotCount; ++i) {
+            (*slots)[i].store (new Node (i));
+        }
+        return slots;
+    }
+
+    void DeleteSlots (std::vector<std::atomic<Node *>> *slots) {
+        for (std::size_t i = 0, count = slots->size (); i < count; ++i) {
+            delete (*slots)[i].load ();
+        }
+        delete slots;
+    }
+}
+
+THEKOGANS_UTIL_IMPLEMENT_HEAP_WITH_LOCK (Node, util::SpinLock)
+
+int main (
+        int argc,
+        const char *argv[]) {
+    Options options;
+    options.Parse (argc, argv, "nrws");
+    if (options.operationCount == 0 || options.slotCount == 0 ||
+            options.readerCount + options.writerCount == 0) {
+        std::cout << "usage: " << argv[0] <<
+            " [-n:operationCount] [-r:readerCount] [-w:writerCount] [-s:slotCount]" << std::endl <<
+            "  -n operations per thread (default: 10000000)" << std::endl <<
+            "  -r reader threads (default: hardware concurrency - 1)" << std::endl <<
+            "  -w writer threads (default: 1)" << std::endl <<
+            "  -s shared slots (default: 1024)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        const std::size_t slotCount = options.slotCount;
+        // Baseline: no reclamation at all. Replaced nodes are
+        // kept until the end, so the reads are unprotected.
+        {
+            std::vector<std::atomic<Node *>> *slots = NewSlots (slotCount);
+            std::vector<std::vector<Node *>> leaked (options.writerCount);
+            std::atomic<std::size_t> writerIndex (0);
+            Run ("no reclamation (leak)", options,
+                [slots, slotCount] (std::size_t operationCount, util::ui64 &state) {
+                    util::ui64 sum = 0;
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        sum += (*slots)[Next (state) % slotCount].load (
+                            std::memory_order_acquire)->value;
+                    }
+                    sink = sum;
+                },
+                [slots, slotCount, &leaked, &writerIndex] (std::size_t operationCount, util::ui64 &state) {
+                    std::vector<Node *> &nodes = leaked[writerIndex++];
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        nodes.push_back (
+                            (*slots)[Next (state) % slotCount].exchange (
+                                new Node (i), std::memory_order_acq_rel));
+                    }
+                });
+            for (std::size_t i = 0, count = leaked.size (); i < count; ++i) {
+                for (std::size_t j = 0, nodeCount = leaked[i].size (); j < nodeCount; ++j) {
+                    delete leaked[i][j];
+                }
+            }
+            DeleteSlots (slots);
+        }
+        // RefCounted: every read bumps (and drops) the shared count.
+        {
+            std::vector<RefCountedNode::SharedPtr> slots (slotCount);
+            std::vector<util::SpinLock> locks (slotCount);
+            for (std::size_t i = 0; i < slotCount; ++i) {
+                slots[i] = util::RefCounted::Make<RefCountedNode> (i);
+            }
+            Run ("RefCounted::SharedPtr", options,
+                [&slots, &locks, slotCount] (std::size_t operationCount, util::ui64 &state) {
+                    util::ui64 sum = 0;
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        std::size_t slot = Next (state) % slotCount;
+                        RefCountedNode::SharedPtr node;
+                        {
+                            util::LockGuard<util::SpinLock> guard (locks[slot]);
+                            node = slots[slot];
+                        }
+                        sum += node->value;
+                    }
+                    sink = sum;
+                },
+                [&slots, &locks, slotCount] (std::size_t operationCount, util::ui64 &state) {
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        std::size_t slot = Next (state) % slotCount;
+                        RefCountedNode::SharedPtr node = util::RefCounted::Make<RefCountedNode> (i);
+                        {
+                            util::LockGuard<util::SpinLock> guard (locks[slot]);
+                            slots[slot].Swap (node);
+                        }
+                        // node (now the old one) is released outside the lock.
+                    }
+                });
+        }
+        // Hazard pointers: a store and a load per read.
+        {
+            util::HazardPointerReclaimer reclaimer;
+            std::vector<std::atomic<Node *>> *slots = NewSlots (slotCount);
+            Run ("HazardPointerReclaimer", options,
+                [slots, slotCount, &reclaimer] (std::size_t operationCount, util::ui64 &state) {
+                    util::ui64 sum = 0;
+                    util::HazardPointerReclaimer::Guard guard (reclaimer);
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        sum += guard.Protect ((*slots)[Next (state) % slotCount])->value;
+                    }
+                    sink = sum;
+                },
+                [slots, slotCount, &reclaimer] (std::size_t operationCount, util::ui64 &state) {
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        reclaimer.Retire (
+                            (*slots)[Next (state) % slotCount].exchange (
+                                new Node (i), std::memory_order_acq_rel));
+                    }
+                });
+            ReportStats (reclaimer.GetStats ());
+            DeleteSlots (slots);
+        }
+        // Epochs: a critical section per read.
+        {
+            util::EpochReclaimer reclaimer;
+            std::vector<std::atomic<Node *>> *slots = NewSlots (slotCount);
+            Run ("EpochReclaimer", options,
+                [slots, slotCount, &reclaimer] (std::size_t operationCount, util::ui64 &state) {
+                    util::ui64 sum = 0;
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        util::EpochReclaimer::Guard guard (reclaimer);
+                        sum += (*slots)[Next (state) % slotCount].load (
+                            std::memory_order_acquire)->value;
+                    }
+                    sink = sum;
+                },
+                [slots, slotCount, &reclaimer] (std::size_t operationCount, util::ui64 &state) {
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        reclaimer.Retire (
+                            (*slots)[Next (state) % slotCount].exchange (
+                                new Node (i), std::memory_order_acq_rel));
+                    }
+                });
+            ReportStats (reclaimer.GetStats ());
+            DeleteSlots (slots);
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
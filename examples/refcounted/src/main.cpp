@@ -0,0 +1,203 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+
+using namespace thekogans;
+
+namespace {
+    // Typical small RefCounted object (think Job or JSON value).
+    struct Node : public util::RefCounted {
+        THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Node)
+
+        util::ui64 id;
+        util::ui64 payload[4];
+
+        explicit Node (util::ui64 id_ = 0) :
+                id (id_) {
+            payload[0] = payload[1] = payload[2] = payload[3] = id;
+        }
+    };
+
+    // The previous scheme's counting: sequentially consistent ++/--.
+    struct SeqCstCounted {
+        std::atomic<util::ui32> shared;
+
+        SeqCstCounted () :
+            shared (1) {}
+
+        void AddRef () {
+            ++shared;
+        }
+        void Release () {
+            --shared;
+        }
+    };
+
+    void Report (
+            const std::string &name,
+            std::size_t threadCount,
+            std::size_t operationCount,
+            util::ui64 start,
+            util::ui64 end) {
+        util::f64 seconds =
+            util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end));
+        std::cout << name << " (" << threadCount << " threads): " <<
+            operationCount * threadCount / seconds / 1000000.0 << " Mops/s, " <<
+            seconds * 1e9 / operationCount << " ns/op" << std::endl;
+    }
+
+    // Run body on threadCount threads and time the lot.
+    template<typename Body>
+    void Run (
+            const std::string &name,
+            std::size_t threadCount,
+            std::size_t operationCount,
+            Body body) {
+        std::atomic<std::size_t> ready (0);
+        std::vector<std::thread> threads;
+        util::ui64 start = util::HRTimer::Click ();
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            threads.push_back (
+                std::thread (
+                    [&ready, threadCount, operationCount, &body] () {
+                        ++ready;
+                        while (ready != threadCount) {
+                            std::this_thread::yield ();
+                        }
+                        body (operationCount);
+                    }));
+        }
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            threads[i].join ();
+        }
+        util::ui64 end = util::HRTimer::Click ();
+        Report (name, threadCount, operationCount, start, end);
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        std::size_t operationCount;
+        std::size_t threadCount;
+
+        Options () :
+            operationCount (10000000),
+            threadCount (std::thread::hardware_concurrency ()) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'n':
+                    operationCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 't':
+                    threadCount = util::stringToui32 (value.c_str ());
+                    break;
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "nt");
+    if (options.operationCount == 0 || options.threadCount == 0) {
+        std::cout << "usage: " << argv[0] << " [-n:operationCount] [-t:threadCount]" << std::endl <<
+            "  -n operations per thread (default: 10000000)" << std::endl <<
+            "  -t maximum thread count (default: hardware concurrency, runs 1, 2, 4... up to it)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        for (std::size_t threadCount = 1; threadCount <= options.threadCount; threadCount *= 2) {
+            // SharedPtr copy/destroy on a shared object (the count is contended).
+            {
+                SeqCstCounted counted;
+                Run ("seq_cst ++/-- (previous scheme)", threadCount, options.operationCount,
+                    [&counted] (std::size_t operationCount) {
+                        for (std::size_t i = 0; i < operationCount; ++i) {
+                            counted.AddRef ();
+                            counted.Release ();
+                        }
+                    });
+            }
+            {
+                Node::SharedPtr node = util::RefCounted::Make<Node> ();
+                Run ("SharedPtr copy/destroy", threadCount, options.operationCount,
+                    [&node] (std::size_t operationCount) {
+                        for (std::size_t i = 0; i < operationCount; ++i) {
+                            Node::SharedPtr copy (node);
+                        }
+                    });
+                Node::WeakPtr weak (node);
+                Run ("WeakPtr::GetSharedPtr", threadCount, options.operationCount,
+                    [&weak] (std::size_t operationCount) {
+                        for (std::size_t i = 0; i < operationCount; ++i) {
+                            Node::SharedPtr copy = weak.GetSharedPtr ();
+                        }
+                    });
+            }
+            // Object churn: create and destroy (thread private objects).
+            Run ("new Node (object + References)", threadCount, options.operationCount / 4,
+                [] (std::size_t operationCount) {
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        Node::SharedPtr node (new Node (i));
+                    }
+                });
+            Run ("RefCounted::Make<Node> (single allocation)", threadCount, options.operationCount / 4,
+                [] (std::size_t operationCount) {
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        Node::SharedPtr node = util::RefCounted::Make<Node> (i);
+                    }
+                });
+            Run ("RefCounted::Make<Node> + WeakPtr", threadCount, options.operationCount / 4,
+                [] (std::size_t operationCount) {
+                    for (std::size_t i = 0; i < operationCount; ++i) {
+                        Node::WeakPtr weak;
+                        {
+                            Node::SharedPtr node = util::RefCounted::Make<Node> (i);
+                            weak = node;
+                        }
+                        if (!weak.IsExpired ()) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "WeakPtr outlived it's object.");
+                        }
+                    }
+                });
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
@@ -19,6 +19,7 @@
 #include "thekogans/util/Flags.h"
 #include "thekogans/util/SystemInfo.h"
 #include "thekogans/util/CPU.h"
+#include "thekogans/util/CPUTopology.h"
 
 using namespace thekogans;
 
@@ -29,5 +30,7 @@ int main (
     util::SystemInfo::Instance ().Dump ();
     std::cout << std::endl << "CPU:" << std::endl;
     util::CPU::Instance ().Dump ();
+    std::cout << std::endl << "CPUTopology:" << std::endl;
+    util::CPUTopology::Instance ().Dump ();
     return 0;
 }
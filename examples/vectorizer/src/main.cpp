@@ -0,0 +1,226 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstddef>
+#include <cmath>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/Vectorizer.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+
+using namespace thekogans;
+
+namespace {
+    // Tiny kernel: scale a short vector. Per call the work is
+    // a few hundred nanoseconds, so the cost is all latency.
+    struct ScaleJob : public util::Vectorizer::Job {
+        std::vector<util::f32> &data;
+        util::f32 factor;
+
+        ScaleJob (
+            std::vector<util::f32> &data_,
+            util::f32 factor_) :
+            data (data_),
+            factor (factor_) {}
+
+        virtual void Execute (
+                std::size_t startIndex,
+                std::size_t endIndex,
+                std::size_t /*rank*/) throw () override {
+            for (; startIndex < endIndex; ++startIndex) {
+                data[startIndex] *= factor;
+            }
+        }
+
+        virtual std::size_t Size () const throw () override {
+            return data.size ();
+        }
+    };
+
+    // Uneven kernel: the cost of element i grows with i, so equal
+    // chunks leave the low ranks idle while the high ones finish.
+    struct TriangleJob : public util::Vectorizer::Job {
+        std::size_t size;
+        std::vector<util::f64> sums;
+
+        explicit TriangleJob (std::size_t size_) :
+            size (size_) {}
+
+        virtual void Prolog (std::size_t chunks) throw () override {
+            sums.assign (chunks, 0.0);
+        }
+
+        virtual void Execute (
+                std::size_t startIndex,
+                std::size_t endIndex,
+                std::size_t rank) throw () override {
+            util::f64 sum = 0.0;
+            for (; startIndex < endIndex; ++startIndex) {
+                for (std::size_t j = 0; j < startIndex; ++j) {
+                    sum += std::sqrt ((util::f64)j);
+                }
+            }
+            // Dynamic schedules call Execute more than once per rank.
+            sums[rank] += sum;
+        }
+
+        virtual std::size_t Size () const throw () override {
+            return size;
+        }
+    };
+
+    const char *ScheduleName (util::Vectorizer::Schedule schedule) {
+        return
+            schedule == util::Vectorizer::ScheduleStatic ? "static" :
+            schedule == util::Vectorizer::ScheduleDynamic ? "dynamic" : "guided";
+    }
+
+    util::f64 Elapsed (
+            util::ui64 start,
+            util::ui64 end) {
+        return util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end));
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        std::size_t workerCount;
+        std::size_t size;
+        std::size_t iterations;
+
+        Options () :
+            workerCount (util::SystemInfo::Instance ().GetCPUCount ()),
+            size (1024),
+            iterations (100000) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'w':
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 's':
+                    size = util::stringToui32 (value.c_str ());
+                    break;
+                case 'i':
+                    iterations = util::stringToui32 (value.c_str ());
+                    break;
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "wsi");
+    if (options.workerCount == 0 || options.size == 0 || options.iterations == 0) {
+        std::cout << "usage: " << argv[0] << " [-w:workerCount] [-s:size] [-i:iterations]" << std::endl <<
+            "  -w vector width (default: CPU count)" << std::endl <<
+            "  -s tiny job size (default: 1024)" << std::endl <<
+            "  -i tiny job iterations (default: 100000)" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        util::Vectorizer vectorizer (
+            options.workerCount,
+            THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+            THEKOGANS_UTIL_MAX_THREAD_AFFINITY);
+        std::vector<util::f32> data (options.size, 1.0f);
+        util::Vectorizer::Schedule schedules[] = {
+            util::Vectorizer::ScheduleStatic,
+            util::Vectorizer::ScheduleDynamic,
+            util::Vectorizer::ScheduleGuided
+        };
+        // Tiny job latency (round trip through the barrier).
+        {
+            ScaleJob job (data, 1.0f);
+            util::ui64 start = util::HRTimer::Click ();
+            for (std::size_t i = 0; i < options.iterations; ++i) {
+                job.Execute (0, job.Size (), 0);
+            }
+            util::ui64 end = util::HRTimer::Click ();
+            std::cout << "inline: " <<
+                Elapsed (start, end) * 1e6 / options.iterations << " us/job" << std::endl;
+            for (std::size_t i = 0; i < sizeof (schedules) / sizeof (schedules[0]); ++i) {
+                start = util::HRTimer::Click ();
+                for (std::size_t j = 0; j < options.iterations; ++j) {
+                    vectorizer.Execute (job, SIZE_T_MAX, schedules[i]);
+                }
+                end = util::HRTimer::Click ();
+                std::cout << ScheduleName (schedules[i]) << " (" << vectorizer.GetWidth () <<
+                    " wide): " << Elapsed (start, end) * 1e6 / options.iterations <<
+                    " us/job" << std::endl;
+            }
+        }
+        // Uneven job.
+        for (std::size_t i = 0; i < sizeof (schedules) / sizeof (schedules[0]); ++i) {
+            TriangleJob job (8192);
+            util::ui64 start = util::HRTimer::Click ();
+            vectorizer.Execute (job, SIZE_T_MAX, schedules[i]);
+            util::ui64 end = util::HRTimer::Click ();
+            std::cout << "uneven " << ScheduleName (schedules[i]) << ": " <<
+                Elapsed (start, end) * 1e3 << " ms" << std::endl;
+        }
+        // Concurrent callers (the losers run their job inline).
+        {
+            std::size_t threadCount = 4;
+            std::atomic<std::size_t> ready (0);
+            std::vector<std::thread> threads;
+            util::ui64 start = util::HRTimer::Click ();
+            for (std::size_t i = 0; i < threadCount; ++i) {
+                threads.push_back (
+                    std::thread (
+                        [&vectorizer, &ready, threadCount, &options] () {
+                            std::vector<util::f32> data (options.size, 1.0f);
+                            ScaleJob job (data, 1.0f);
+                            ++ready;
+                            while (ready != threadCount) {
+                                std::this_thread::yield ();
+                            }
+                            for (std::size_t j = 0; j < options.iterations; ++j) {
+                                vectorizer.Execute (job, SIZE_T_MAX, util::Vectorizer::ScheduleDynamic);
+                            }
+                        }));
+            }
+            for (std::size_t i = 0; i < threadCount; ++i) {
+                threads[i].join ();
+            }
+            util::ui64 end = util::HRTimer::Click ();
+            std::cout << threadCount << " concurrent callers: " <<
+                Elapsed (start, end) * 1e6 / (threadCount * options.iterations) <<
+                " us/job" << std::endl;
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
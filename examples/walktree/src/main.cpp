@@ -0,0 +1,199 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <list>
+#include <iostream>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Path.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Directory.h"
+#include "thekogans/util/DirectoryWalker.h"
+#include "thekogans/util/JobQueue.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/ConsoleLogger.h"
+#include "thekogans/util/Exception.h"
+
+using namespace thekogans;
+
+namespace {
+    // Create a synthetic tree of (roughly) entryCount entries.
+    // Every directory gets filesPerFolder files and
+    // foldersPerFolder sub-directories (breadth first).
+    void CreateTree (
+            const std::string &path,
+            util::ui64 entryCount,
+            util::ui32 filesPerFolder = 90,
+            util::ui32 foldersPerFolder = 10) {
+        util::Directory::Create (path);
+        std::list<std::string> folders;
+        folders.push_back (path);
+        util::ui64 entries = 0;
+        while (entries < entryCount && !folders.empty ()) {
+            std::string folder = folders.front ();
+            folders.pop_front ();
+            for (util::ui32 i = 0; i < filesPerFolder && entries < entryCount; ++i, ++entries) {
+                util::SimpleFile file (
+                    util::HostEndian,
+                    util::MakePath (folder, util::FormatString ("file%u", i)),
+                    util::SimpleFile::WriteOnly |
+                    util::SimpleFile::Create |
+                    util::SimpleFile::Truncate);
+                file.Write (folder.c_str (), folder.size ());
+            }
+            for (util::ui32 i = 0; i < foldersPerFolder && entries < entryCount; ++i, ++entries) {
+                std::string subFolder = util::MakePath (folder, util::FormatString ("folder%u", i));
+                util::Directory::Create (subFolder, false);
+                folders.push_back (subFolder);
+            }
+        }
+    }
+
+    void GetSummary (
+            const std::string &path,
+            util::DirectoryWalker::Summary &summary) {
+        util::Directory directory (path,
+            util::Directory::ENTRY_TYPE | util::Directory::ENTRY_SIZE);
+        util::Directory::Entry entry;
+        for (bool gotEntry = directory.GetFirstEntry (entry);
+                gotEntry; gotEntry = directory.GetNextEntry (entry)) {
+            if (!util::IsDotOrDotDot (entry.name.c_str ())) {
+                if (entry.type == util::Directory::Entry::Folder) {
+                    ++summary.folders;
+                    GetSummary (util::MakePath (path, entry.name), summary);
+                }
+                else if (entry.type == util::Directory::Entry::File) {
+                    ++summary.files;
+                    summary.size += entry.size;
+                }
+                else if (entry.type == util::Directory::Entry::Link) {
+                    ++summary.links;
+                }
+                else {
+                    ++summary.other;
+                }
+            }
+        }
+    }
+
+    void PrintSummary (
+            const char *label,
+            const util::DirectoryWalker::Summary &summary,
+            util::ui64 start,
+            util::ui64 end) {
+        std::cout << label << ": " <<
+            summary.files << " files, " <<
+            summary.folders << " folders, " <<
+            summary.links << " links, " <<
+            summary.size << " bytes in " <<
+            util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end)) <<
+            " seconds" << std::endl;
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        util::ui64 createCount;
+        std::size_t workerCount;
+        bool deleteTree;
+        std::string path;
+
+        Options () :
+            createCount (0),
+            workerCount (util::SystemInfo::Instance ().GetCPUCount ()),
+            deleteTree (false) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'c':
+                    createCount = util::stringToui64 (value.c_str ());
+                    break;
+                case 'w':
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                case 'd':
+                    deleteTree = true;
+                    break;
+            }
+        }
+        virtual void DoPath (const std::string &value) {
+            path = value;
+        }
+    } options;
+    options.Parse (argc, argv, "cwd");
+    if (options.path.empty () || options.workerCount == 0) {
+        std::cout << "usage: " << argv[0] <<
+            " [-c:entryCount] [-w:workerCount] [-d] path" << std::endl <<
+            "  -c create a synthetic tree of entryCount entries (ex: -c:1000000)" << std::endl <<
+            "  -w number of DirectoryWalker workers (default: CPU count)" << std::endl <<
+            "  -d delete the tree (in parallel) when done" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_LOG_INIT (
+        util::LoggerMgr::Debug,
+        util::LoggerMgr::All);
+    THEKOGANS_UTIL_LOG_ADD_LOGGER (
+        util::Logger::SharedPtr (new util::ConsoleLogger));
+    THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
+    THEKOGANS_UTIL_TRY {
+        if (options.createCount > 0) {
+            std::cout << "Creating " << options.createCount <<
+                " entries in " << options.path << std::endl;
+            CreateTree (options.path, options.createCount);
+        }
+        {
+            util::DirectoryWalker::Summary summary;
+            util::ui64 start = util::HRTimer::Click ();
+            GetSummary (options.path, summary);
+            util::ui64 end = util::HRTimer::Click ();
+            PrintSummary ("Serial", summary, start, end);
+        }
+        util::JobQueue jobQueue (
+            "walktree",
+            util::RunLoop::JobExecutionPolicy::SharedPtr (
+                new util::RunLoop::FIFOJobExecutionPolicy),
+            options.workerCount);
+        {
+            util::ui64 start = util::HRTimer::Click ();
+            util::DirectoryWalker::Summary summary =
+                util::DirectoryWalker::GetSummary (options.path, jobQueue);
+            util::ui64 end = util::HRTimer::Click ();
+            PrintSummary (
+                util::FormatString ("Parallel (" THEKOGANS_UTIL_SIZE_T_FORMAT " workers)",
+                    options.workerCount).c_str (),
+                summary, start, end);
+        }
+        if (options.deleteTree) {
+            util::ui64 start = util::HRTimer::Click ();
+            util::DirectoryWalker::Delete (options.path, jobQueue);
+            util::ui64 end = util::HRTimer::Click ();
+            std::cout << "Parallel delete: " <<
+                util::HRTimer::ToSeconds (util::HRTimer::ComputeElapsedTime (start, end)) <<
+                " seconds" << std::endl;
+        }
+    }
+    THEKOGANS_UTIL_CATCH_AND_LOG
+    return 0;
+}
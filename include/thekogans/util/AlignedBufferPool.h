@@ -0,0 +1,158 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_AlignedBufferPool_h)
+#define __thekogans_util_AlignedBufferPool_h
+
+#include <cstddef>
+#include <vector>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Allocator.h"
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/util/AlignedAllocator.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Buffer.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct AlignedBufferPool AlignedBufferPool.h thekogans/util/AlignedBufferPool.h
+        ///
+        /// \brief
+        /// AlignedBufferPool is an \see{Allocator} that hands out fixed size,
+        /// aligned blocks and keeps the freed ones around for reuse. It's meant
+        /// for direct (unbuffered) I/O where both the memory and the transfer
+        /// size must be multiples of the device block size (see \see{DirectFile}),
+        /// and where allocating (and page faulting) a multi-megabyte block per
+        /// write is a waste. Since AlignedBufferPool is an Allocator, \see{Buffer}s
+        /// created with it return their block to the pool when they are destroyed:
+        ///
+        /// \code{.cpp}
+        /// thekogans::util::DirectFile file (
+        ///     thekogans::util::HostEndian, path,
+        ///     thekogans::util::SimpleFile::WriteOnly |
+        ///     thekogans::util::SimpleFile::Create |
+        ///     thekogans::util::SimpleFile::Truncate);
+        /// thekogans::util::AlignedBufferPool pool (
+        ///     1024 * 1024, file.GetBlockSize ());
+        /// while (...) {
+        ///     thekogans::util::Buffer buffer = pool.GetBuffer ();
+        ///     // Fill the buffer.
+        ///     file.Write (buffer.GetReadPtr (), buffer.GetDataAvailableForReading ());
+        /// }
+        /// \endcode
+        ///
+        /// NOTE: Requests larger than the pool's buffer size are passed through
+        /// to the \see{AlignedAllocator} (they are aligned, but not pooled).
+        /// VERY IMPORTANT: The pool must outlive every block (\see{Buffer})
+        /// allocated from it.
+
+        struct _LIB_THEKOGANS_UTIL_DECL AlignedBufferPool : public Allocator {
+        private:
+            /// \brief
+            /// Size of pooled blocks.
+            const std::size_t bufferSize;
+            /// \brief
+            /// Block alignment (power of 2).
+            const std::size_t alignment;
+            /// \brief
+            /// Maximum number of free blocks to keep around.
+            const std::size_t maxFreeBuffers;
+            /// \brief
+            /// Allocator used to allocate the blocks.
+            AlignedAllocator allocator;
+            /// \brief
+            /// Free blocks.
+            std::vector<void *> freeBuffers;
+            /// \brief
+            /// Synchronization lock.
+            SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] bufferSize_ Size of pooled blocks (rounded up to alignment_).
+            /// \param[in] alignment_ Block alignment (power of 2). Use
+            /// \see{DirectFile::GetBlockSize} for direct I/O.
+            /// \param[in] maxFreeBuffers_ Maximum number of free blocks to keep around.
+            /// \param[in] initialBuffers Number of blocks to allocate up front.
+            AlignedBufferPool (
+                std::size_t bufferSize_,
+                std::size_t alignment_,
+                std::size_t maxFreeBuffers_ = 16,
+                std::size_t initialBuffers = 0);
+            /// \brief
+            /// dtor. Free the pooled blocks.
+            virtual ~AlignedBufferPool ();
+
+            /// \brief
+            /// Return allocator name.
+            /// \return Allocator name.
+            virtual const char *GetName () const override {
+                return "AlignedBufferPool";
+            }
+
+            /// \brief
+            /// Allocate an aligned block. If size <= bufferSize, the block
+            /// comes from the pool (and is bufferSize long).
+            /// \param[in] size Block size to allocate.
+            /// \return Pointer to the aligned block.
+            virtual void *Alloc (std::size_t size) override;
+            /// \brief
+            /// Return the block to the pool.
+            /// \param[in] ptr Block pointer returned by Alloc.
+            /// \param[in] size Block size passed to Alloc.
+            virtual void Free (
+                void *ptr,
+                std::size_t size) override;
+
+            /// \brief
+            /// Return a \see{Buffer} wrapping a pooled block. The
+            /// block returns to the pool when the buffer is destroyed.
+            /// \param[in] endianness How multi-byte values are stored.
+            /// \return Empty (writeOffset == 0) buffer of length bufferSize.
+            inline Buffer GetBuffer (Endianness endianness = HostEndian) {
+                return Buffer (endianness, bufferSize, 0, 0, this);
+            }
+
+            /// \brief
+            /// Return the size of pooled blocks.
+            /// \return Size of pooled blocks.
+            inline std::size_t GetBufferSize () const {
+                return bufferSize;
+            }
+            /// \brief
+            /// Return the block alignment.
+            /// \return Block alignment.
+            inline std::size_t GetAlignment () const {
+                return alignment;
+            }
+            /// \brief
+            /// Return the number of free blocks in the pool.
+            /// \return Number of free blocks in the pool.
+            std::size_t GetFreeCount ();
+
+            /// \brief
+            /// AlignedBufferPool is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (AlignedBufferPool)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_AlignedBufferPool_h)
@@ -0,0 +1,473 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (TOOLCHAIN_OS_Windows)
+
+#if !defined (__thekogans_util_AsyncFile_h)
+#define __thekogans_util_AsyncFile_h
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstddef>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/Event.h"
+#include "thekogans/util/TimeSpec.h"
+#include "thekogans/util/RunLoop.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct AsyncFile AsyncFile.h thekogans/util/AsyncFile.h
+        ///
+        /// \brief
+        /// AsyncFile performs positional file I/O with submit/complete semantics.
+        /// Unlike \see{File}, which issues one blocking syscall at a time, AsyncFile
+        /// lets you keep up to queueDepth operations outstanding. That's what it
+        /// takes to saturate a modern (NVMe) device. On Linux (5.6+) operations
+        /// are submitted to an io_uring. Everywhere else (or if the kernel does
+        /// not support io_uring, or it's disabled by policy) they are executed by
+        /// a pool of worker threads using pread/pwrite/fsync. Completions are
+        /// delivered to an \see{AsyncFile::Callback} (on the completion thread),
+        /// a \see{RunLoop} (\see{AsyncFile::RunLoopCallback}), or you can simply
+        /// \see{AsyncFile::Operation::Wait} for them. Here is a canonical use case:
+        ///
+        /// \code{.cpp}
+        /// thekogans::util::AsyncFile file (path, O_RDWR | O_CREAT);
+        /// for (std::size_t i = 0; i < chunkCount; ++i) {
+        ///     file.Write (i * chunkSize, chunks[i], chunkSize, callback);
+        /// }
+        /// // Make the last write durable before reporting success.
+        /// file.WriteAndSync (
+        ///     chunkCount * chunkSize, trailer, trailerSize)->Wait ();
+        /// \endcode
+        ///
+        /// NOTE: Buffers must stay valid (and unmodified for writes) until their
+        /// operation completes. Operations are independent (the order in which
+        /// they complete is unspecified) unless they are submitted as a linked
+        /// chain (see \see{AsyncFile::Submit}).
+
+        struct _LIB_THEKOGANS_UTIL_DECL AsyncFile {
+            /// \brief
+            /// Backend used to execute operations.
+            enum Backend {
+                /// \brief
+                /// io_uring if available, thread pool otherwise.
+                BackendAuto,
+                /// \brief
+                /// io_uring (Linux 5.6+). The ctor throws if it's not available.
+                BackendIoUring,
+                /// \brief
+                /// A pool of worker threads performing blocking I/O.
+                BackendThreadPool
+            };
+
+            struct Operation;
+
+            /// \struct AsyncFile::Callback AsyncFile.h thekogans/util/AsyncFile.h
+            ///
+            /// \brief
+            /// Derive from Callback to receive operation completions.
+            struct _LIB_THEKOGANS_UTIL_DECL Callback : public RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Callback)
+
+                /// \brief
+                /// dtor.
+                virtual ~Callback () {}
+
+                /// \brief
+                /// Called when an operation completes.
+                /// NOTE: Unless the callback is a \see{RunLoopCallback}, it's called
+                /// on the AsyncFile completion thread. Do as little as possible (or
+                /// submit the next operation) and return. Operations submitted from
+                /// the callback never block waiting for queue space (they can
+                /// temporarily exceed the queue depth).
+                /// \param[in] file AsyncFile that executed the operation.
+                /// \param[in] operation Completed operation.
+                virtual void OnComplete (
+                    AsyncFile & /*file*/,
+                    Operation & /*operation*/) throw () = 0;
+            };
+
+            /// \struct AsyncFile::RunLoopCallback AsyncFile.h thekogans/util/AsyncFile.h
+            ///
+            /// \brief
+            /// RunLoopCallback delivers completions as jobs on the given \see{RunLoop}.
+            struct _LIB_THEKOGANS_UTIL_DECL RunLoopCallback : public Callback {
+                /// \brief
+                /// Run loop on which to deliver completions.
+                RunLoop &runLoop;
+                /// \brief
+                /// Callback to call on the run loop.
+                Callback::SharedPtr callback;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] runLoop_ Run loop on which to deliver completions.
+                /// \param[in] callback_ Callback to call on the run loop.
+                RunLoopCallback (
+                    RunLoop &runLoop_,
+                    Callback::SharedPtr callback_) :
+                    runLoop (runLoop_),
+                    callback (callback_) {}
+
+                /// \brief
+                /// Enqueue a job on the run loop that will call callback.
+                /// NOTE: The AsyncFile must outlive the job.
+                /// \param[in] file AsyncFile that executed the operation.
+                /// \param[in] operation Completed operation.
+                virtual void OnComplete (
+                    AsyncFile &file,
+                    Operation &operation) throw () override;
+            };
+
+            /// \struct AsyncFile::Operation AsyncFile.h thekogans/util/AsyncFile.h
+            ///
+            /// \brief
+            /// Operation describes a single read, write or sync, and after it
+            /// completes, holds it's result.
+            struct _LIB_THEKOGANS_UTIL_DECL Operation : public RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Operation)
+
+                /// \brief
+                /// Operation type.
+                enum Type {
+                    /// \brief
+                    /// Read length bytes at offset in to buffer.
+                    Read,
+                    /// \brief
+                    /// Write length bytes from buffer at offset.
+                    Write,
+                    /// \brief
+                    /// Flush data and metadata (fsync).
+                    Sync,
+                    /// \brief
+                    /// Flush data (fdatasync).
+                    DataSync
+                };
+                /// \brief
+                /// Operation type.
+                Type type;
+                /// \brief
+                /// File offset (Read/Write).
+                ui64 offset;
+                /// \brief
+                /// Buffer to read in to/write from (Read/Write).
+                void *buffer;
+                /// \brief
+                /// Number of bytes to read/write (Read/Write).
+                std::size_t length;
+                /// \brief
+                /// If >= 0, index of the registered buffer (see
+                /// \see{AsyncFile::RegisterBuffers}) containing buffer.
+                i32 bufferIndex;
+                /// \brief
+                /// Completion callback (can be null).
+                Callback::SharedPtr callback;
+                /// \brief
+                /// After completion, number of bytes read/written. Like
+                /// pread/pwrite this can be less than length.
+                std::size_t count;
+                /// \brief
+                /// After completion, 0 == success, otherwise the error code.
+                /// Operations following a failed one in a linked chain
+                /// complete with ECANCELED.
+                THEKOGANS_UTIL_ERROR_CODE errorCode;
+                /// \brief
+                /// Optional user data.
+                void *userData;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] type_ Operation type.
+                /// \param[in] offset_ File offset.
+                /// \param[in] buffer_ Buffer to read in to/write from.
+                /// \param[in] length_ Number of bytes to read/write.
+                /// \param[in] callback_ Completion callback.
+                /// \param[in] bufferIndex_ Registered buffer index (-1 == not registered).
+                Operation (
+                    Type type_,
+                    ui64 offset_ = 0,
+                    void *buffer_ = 0,
+                    std::size_t length_ = 0,
+                    Callback::SharedPtr callback_ = Callback::SharedPtr (),
+                    i32 bufferIndex_ = -1) :
+                    type (type_),
+                    offset (offset_),
+                    buffer (buffer_),
+                    length (length_),
+                    bufferIndex (bufferIndex_),
+                    callback (callback_),
+                    count (0),
+                    errorCode (0),
+                    userData (0),
+                    finished (false) {}
+
+                /// \brief
+                /// Return true if the operation completed.
+                /// \return true == the operation completed.
+                inline bool IsCompleted () const {
+                    return finished.load (std::memory_order_acquire);
+                }
+                /// \brief
+                /// Return true if the operation completed without error.
+                /// \return true == the operation completed without error.
+                inline bool IsSucceeded () const {
+                    return IsCompleted () && errorCode == 0;
+                }
+                /// \brief
+                /// Wait for the operation to complete.
+                /// \param[in] timeSpec How long to wait for the operation to complete.
+                /// IMPORTANT: timeSpec is a relative value.
+                /// \return true == completed, false == timed out.
+                inline bool Wait (const TimeSpec &timeSpec = TimeSpec::Infinite) {
+                    return completed.Wait (timeSpec);
+                }
+
+            private:
+                /// \brief
+                /// Set when the operation completes.
+                std::atomic<bool> finished;
+                /// \brief
+                /// Signaled when the operation completes.
+                Event completed;
+
+                /// \brief
+                /// AsyncFile needs access to finished and completed.
+                friend struct AsyncFile;
+
+                /// \brief
+                /// Operation is neither copy constructable, nor assignable.
+                THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Operation)
+            };
+
+        private:
+            /// \brief
+            /// File path.
+            std::string path;
+            /// \brief
+            /// OS file handle.
+            THEKOGANS_UTIL_HANDLE handle;
+            /// \brief
+            /// Maximum number of outstanding operations.
+            const std::size_t queueDepth;
+            /// \brief
+            /// Convenient typedef for std::pair<void *, std::size_t>.
+            typedef std::pair<void *, std::size_t> RegisteredBuffer;
+            /// \brief
+            /// Registered buffers.
+            std::vector<RegisteredBuffer> registeredBuffers;
+            /// \brief
+            /// Number of outstanding operations.
+            std::size_t inFlight;
+            /// \brief
+            /// Synchronization mutex.
+            Mutex mutex;
+            /// \brief
+            /// Signaled when operations complete.
+            Condition operationCompleted;
+            /// \struct AsyncFile::Engine AsyncFile.h thekogans/util/AsyncFile.h
+            ///
+            /// \brief
+            /// Forward declaration of the backend interface.
+            struct Engine;
+            /// \brief
+            /// io_uring or thread pool.
+            std::unique_ptr<Engine> engine;
+
+        public:
+            /// \brief
+            /// ctor. Open the given file.
+            /// \param[in] path_ File to open.
+            /// \param[in] flags POSIX open flags (O_DIRECT is allowed).
+            /// \param[in] mode POSIX open mode.
+            /// \param[in] queueDepth_ Maximum number of outstanding operations.
+            /// \param[in] backend Backend to use to execute operations.
+            /// \param[in] workerCount Number of threads in the thread pool backend.
+            AsyncFile (
+                const std::string &path_,
+                i32 flags = O_RDWR | O_CREAT,
+                i32 mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH,
+                std::size_t queueDepth_ = 64,
+                Backend backend = BackendAuto,
+                std::size_t workerCount = 4);
+            /// \brief
+            /// dtor. Wait for outstanding operations to complete and close the file.
+            ~AsyncFile ();
+
+            /// \brief
+            /// Return the file path.
+            /// \return File path.
+            inline const std::string &GetPath () const {
+                return path;
+            }
+            /// \brief
+            /// Return the OS file handle.
+            /// \return OS file handle.
+            inline THEKOGANS_UTIL_HANDLE GetHandle () const {
+                return handle;
+            }
+            /// \brief
+            /// Return the maximum number of outstanding operations.
+            /// \return Maximum number of outstanding operations.
+            inline std::size_t GetQueueDepth () const {
+                return queueDepth;
+            }
+            /// \brief
+            /// Return the backend executing the operations.
+            /// \return BackendIoUring or BackendThreadPool.
+            Backend GetBackend () const;
+
+            /// \brief
+            /// Register buffers with the kernel. Registered buffers are
+            /// pinned once instead of on every operation. Read/Write
+            /// operations whose bufferIndex is >= 0 must fall within the
+            /// registered buffer at that index. Use this with a pool of
+            /// \see{AlignedAllocator} backed buffers that you reuse.
+            /// NOTE: Can only be called when no operations are outstanding.
+            /// Replaces previously registered buffers.
+            /// \param[in] buffers Buffers (pointer, length) to register.
+            void RegisterBuffers (const std::vector<std::pair<void *, std::size_t>> &buffers);
+            /// \brief
+            /// Unregister previously registered buffers.
+            /// NOTE: Can only be called when no operations are outstanding.
+            void UnregisterBuffers ();
+
+            /// \brief
+            /// Submit a read.
+            /// \param[in] offset File offset to read from.
+            /// \param[out] buffer Buffer to read in to.
+            /// \param[in] length Number of bytes to read.
+            /// \param[in] callback Completion callback.
+            /// \param[in] bufferIndex Registered buffer index (-1 == not registered).
+            /// \return The submitted \see{Operation}.
+            Operation::SharedPtr Read (
+                ui64 offset,
+                void *buffer,
+                std::size_t length,
+                Callback::SharedPtr callback = Callback::SharedPtr (),
+                i32 bufferIndex = -1);
+            /// \brief
+            /// Submit a write.
+            /// \param[in] offset File offset to write to.
+            /// \param[in] buffer Buffer to write.
+            /// \param[in] length Number of bytes to write.
+            /// \param[in] callback Completion callback.
+            /// \param[in] bufferIndex Registered buffer index (-1 == not registered).
+            /// \return The submitted \see{Operation}.
+            Operation::SharedPtr Write (
+                ui64 offset,
+                const void *buffer,
+                std::size_t length,
+                Callback::SharedPtr callback = Callback::SharedPtr (),
+                i32 bufferIndex = -1);
+            /// \brief
+            /// Submit a sync.
+            /// \param[in] dataOnly true == fdatasync, false == fsync.
+            /// \param[in] callback Completion callback.
+            /// \return The submitted \see{Operation}.
+            Operation::SharedPtr Sync (
+                bool dataOnly = false,
+                Callback::SharedPtr callback = Callback::SharedPtr ());
+            /// \brief
+            /// Submit a write followed by a sync as a linked chain. The sync
+            /// only starts after the write completes, and is cancelled if
+            /// the write fails.
+            /// \param[in] offset File offset to write to.
+            /// \param[in] buffer Buffer to write.
+            /// \param[in] length Number of bytes to write.
+            /// \param[in] callback Completion callback (for both operations).
+            /// \param[in] dataOnly true == fdatasync, false == fsync.
+            /// \param[in] bufferIndex Registered buffer index (-1 == not registered).
+            /// \return The submitted sync \see{Operation}. When it succeeds
+            /// the data is durable.
+            Operation::SharedPtr WriteAndSync (
+                ui64 offset,
+                const void *buffer,
+                std::size_t length,
+                Callback::SharedPtr callback = Callback::SharedPtr (),
+                bool dataOnly = true,
+                i32 bufferIndex = -1);
+            /// \brief
+            /// Submit a batch of operations with a single system call.
+            /// If there's not enough room in the queue, Submit blocks
+            /// (unless called from a completion callback) until there is.
+            /// \param[in] operations Operations to submit.
+            /// \param[in] linked true == the operations form a chain. Each
+            /// operation starts after the previous one completes. If one fails
+            /// the rest complete with ECANCELED. false == the operations are
+            /// independent.
+            void Submit (
+                const std::vector<Operation::SharedPtr> &operations,
+                bool linked = false);
+
+            /// \brief
+            /// Return the number of outstanding operations.
+            /// \return Number of outstanding operations.
+            std::size_t GetInFlightCount ();
+            /// \brief
+            /// Wait for all outstanding operations to complete.
+            /// \param[in] timeSpec How long to wait.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == all operations completed, false == timed out.
+            bool WaitForIdle (const TimeSpec &timeSpec = TimeSpec::Infinite);
+
+        private:
+            /// \brief
+            /// Called by the engine when an operation completes.
+            /// \param[in] operation Completed operation (released by Complete).
+            /// \param[in] count Bytes transferred.
+            /// \param[in] errorCode 0 == success.
+            void Complete (
+                Operation *operation,
+                std::size_t count,
+                THEKOGANS_UTIL_ERROR_CODE errorCode);
+
+            /// \struct AsyncFile::IoUringEngine AsyncFile.h thekogans/util/AsyncFile.h
+            ///
+            /// \brief
+            /// io_uring backend (Linux).
+            struct IoUringEngine;
+            /// \struct AsyncFile::ThreadPoolEngine AsyncFile.h thekogans/util/AsyncFile.h
+            ///
+            /// \brief
+            /// Thread pool backend.
+            struct ThreadPoolEngine;
+
+            /// \brief
+            /// AsyncFile is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (AsyncFile)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_AsyncFile_h)
+
+#endif // !defined (TOOLCHAIN_OS_Windows)
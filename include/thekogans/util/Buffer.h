@@ -322,7 +322,8 @@ namespace thekogans {
 
         #if defined (THEKOGANS_UTIL_HAVE_ZLIB)
             /// \brief
-            /// Use zlib to compress the buffer.
+            /// Use zlib to compress the buffer. Large buffers are compressed
+            /// in parallel on the \see{GlobalVectorizer} (see \see{ParallelDeflate}).
             /// \param[in] allocator Allocator for the returned buffer.
             /// \return A buffer containing deflated data.
             virtual Buffer Deflate (Allocator *allocator = &DefaultAllocator::Instance ());
@@ -0,0 +1,121 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_CPUSet_h)
+#define __thekogans_util_CPUSet_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct CPUSet CPUSet.h thekogans/util/CPUSet.h
+        ///
+        /// \brief
+        /// CPUSet is a sorted set of logical processor ids. It's used to
+        /// describe the topology (\see{CPUTopology}) and to bind threads
+        /// to more than one processor (\see{Thread::SetThreadAffinity}).
+        /// The string representation is the same as the one used by Linux
+        /// (/sys/devices/system/cpu/online, taskset -c...): "0-3,8,10-11".
+
+        struct _LIB_THEKOGANS_UTIL_DECL CPUSet {
+            /// \brief
+            /// Sorted, unique logical processor ids.
+            std::vector<ui32> cpus;
+
+            /// \brief
+            /// ctor. Create an empty set.
+            CPUSet () {}
+            /// \brief
+            /// ctor. Create a set containing a single processor.
+            /// \param[in] cpu Processor id.
+            explicit CPUSet (ui32 cpu) :
+                cpus (1, cpu) {}
+
+            /// \brief
+            /// Return the number of processors in the set.
+            /// \return Number of processors in the set.
+            inline std::size_t GetCount () const {
+                return cpus.size ();
+            }
+            /// \brief
+            /// Return true if the set is empty.
+            /// \return true == the set is empty.
+            inline bool IsEmpty () const {
+                return cpus.empty ();
+            }
+            /// \brief
+            /// Empty the set.
+            inline void Clear () {
+                cpus.clear ();
+            }
+
+            /// \brief
+            /// Add a processor to the set.
+            /// \param[in] cpu Processor id to add.
+            void Add (ui32 cpu);
+            /// \brief
+            /// Add all processors in the given set to this one.
+            /// \param[in] cpuSet Set to merge.
+            void Add (const CPUSet &cpuSet);
+            /// \brief
+            /// Return true if the given processor is in the set.
+            /// \param[in] cpu Processor id to check.
+            /// \return true == the processor is in the set.
+            bool Contains (ui32 cpu) const;
+
+            /// \brief
+            /// Parse a list like "0-3,8,10-11".
+            /// \param[in] list List to parse.
+            /// \return CPUSet represented by the list.
+            static CPUSet FromString (const std::string &list);
+            /// \brief
+            /// Format the set as a list like "0-3,8,10-11".
+            /// \return Set formatted as a list.
+            std::string ToString () const;
+        };
+
+        /// \brief
+        /// Compare two CPUSets for equality.
+        /// \param[in] cpuSet1 First set to compare.
+        /// \param[in] cpuSet2 Second set to compare.
+        /// \return true == cpuSet1 == cpuSet2.
+        inline bool operator == (
+                const CPUSet &cpuSet1,
+                const CPUSet &cpuSet2) {
+            return cpuSet1.cpus == cpuSet2.cpus;
+        }
+
+        /// \brief
+        /// Compare two CPUSets for inequality.
+        /// \param[in] cpuSet1 First set to compare.
+        /// \param[in] cpuSet2 Second set to compare.
+        /// \return true == cpuSet1 != cpuSet2.
+        inline bool operator != (
+                const CPUSet &cpuSet1,
+                const CPUSet &cpuSet2) {
+            return cpuSet1.cpus != cpuSet2.cpus;
+        }
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_CPUSet_h)
@@ -0,0 +1,244 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_CPUTopology_h)
+#define __thekogans_util_CPUTopology_h
+
+#include <cstddef>
+#include <vector>
+#include <iostream>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CPUSet.h"
+#include "thekogans/util/Singleton.h"
+#include "thekogans/util/SpinLock.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct CPUTopology CPUTopology.h thekogans/util/CPUTopology.h
+        ///
+        /// \brief
+        /// CPUTopology is a system wide singleton that describes how the
+        /// logical processors are organized in to sockets (packages),
+        /// physical cores (SMT siblings), NUMA nodes and shared caches.
+        /// On Linux the topology comes from /sys/devices/system, on Windows
+        /// from GetLogicalProcessorInformationEx and on OS X from sysctl
+        /// (which does not expose processor ids, so SMT siblings are assumed
+        /// to be numbered consecutively).
+        ///
+        /// CPUTopology also implements the worker placement policies used by
+        /// \see{JobQueue}, \see{Pipeline} and \see{Vectorizer}. Pass one of
+        /// the following as workerAffinity:
+        ///
+        /// - THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY: fill one core (all it's
+        ///   SMT siblings), then the next core on the same socket/node...
+        ///   Best for workers that share data (caches).
+        /// - THEKOGANS_UTIL_SCATTER_THREAD_AFFINITY: spread workers across
+        ///   sockets first, then cores, and only then SMT siblings.
+        ///   Best for memory bandwidth bound workers.
+        /// - THEKOGANS_UTIL_PHYSICAL_CORE_THREAD_AFFINITY: bind every worker to
+        ///   a different physical core (letting it float between the core's
+        ///   SMT siblings).
+        /// - THEKOGANS_UTIL_NUMA_NODE_THREAD_AFFINITY: divide the workers evenly
+        ///   among the NUMA nodes and let them float within their node.
+        ///
+        /// Any other value (except THEKOGANS_UTIL_MAX_THREAD_AFFINITY) is
+        /// interpreted as a logical processor id.
+
+        struct _LIB_THEKOGANS_UTIL_DECL CPUTopology : public Singleton<CPUTopology, SpinLock> {
+            /// \struct CPUTopology::LogicalCPU CPUTopology.h thekogans/util/CPUTopology.h
+            ///
+            /// \brief
+            /// Where a logical processor lives.
+            struct _LIB_THEKOGANS_UTIL_DECL LogicalCPU {
+                /// \brief
+                /// Logical processor id (as used by affinity apis).
+                ui32 id;
+                /// \brief
+                /// Index in to sockets.
+                ui32 socket;
+                /// \brief
+                /// Index in to cores.
+                ui32 core;
+                /// \brief
+                /// SMT sibling index within the core.
+                ui32 thread;
+                /// \brief
+                /// Index in to nodes.
+                ui32 node;
+
+                /// \brief
+                /// ctor.
+                LogicalCPU () :
+                    id (0),
+                    socket (0),
+                    core (0),
+                    thread (0),
+                    node (0) {}
+            };
+
+            /// \struct CPUTopology::Cache CPUTopology.h thekogans/util/CPUTopology.h
+            ///
+            /// \brief
+            /// A cache and the logical processors sharing it.
+            struct _LIB_THEKOGANS_UTIL_DECL Cache {
+                /// \brief
+                /// Cache types.
+                enum Type {
+                    /// \brief
+                    /// Data cache.
+                    Data,
+                    /// \brief
+                    /// Instruction cache.
+                    Instruction,
+                    /// \brief
+                    /// Unified (data and instruction) cache.
+                    Unified
+                };
+                /// \brief
+                /// Cache level (1, 2, 3...).
+                ui32 level;
+                /// \brief
+                /// Cache type.
+                Type type;
+                /// \brief
+                /// Cache size in bytes.
+                ui64 size;
+                /// \brief
+                /// Cache line size in bytes.
+                ui32 lineSize;
+                /// \brief
+                /// Logical processors sharing this cache.
+                CPUSet cpus;
+
+                /// \brief
+                /// ctor.
+                Cache () :
+                    level (0),
+                    type (Unified),
+                    size (0),
+                    lineSize (0) {}
+            };
+
+        private:
+            /// \brief
+            /// Logical processors sorted by id.
+            std::vector<LogicalCPU> cpus;
+            /// \brief
+            /// Logical processors of each socket.
+            std::vector<CPUSet> sockets;
+            /// \brief
+            /// Logical processors (SMT siblings) of each physical core.
+            std::vector<CPUSet> cores;
+            /// \brief
+            /// Logical processors of each NUMA node.
+            std::vector<CPUSet> nodes;
+            /// \brief
+            /// Caches (every shared cache is listed once).
+            std::vector<Cache> caches;
+            /// \brief
+            /// Logical processors in compact placement order.
+            std::vector<ui32> compactOrder;
+            /// \brief
+            /// Logical processors in scatter placement order.
+            std::vector<ui32> scatterOrder;
+            /// \brief
+            /// Physical cores in scatter placement order.
+            std::vector<ui32> coreOrder;
+
+        public:
+            /// \brief
+            /// ctor. Discover the topology.
+            CPUTopology ();
+
+            /// \brief
+            /// Return the logical processors.
+            /// \return Logical processors sorted by id.
+            inline const std::vector<LogicalCPU> &GetCPUs () const {
+                return cpus;
+            }
+            /// \brief
+            /// Return the sockets.
+            /// \return Logical processors of each socket.
+            inline const std::vector<CPUSet> &GetSockets () const {
+                return sockets;
+            }
+            /// \brief
+            /// Return the physical cores.
+            /// \return Logical processors of each physical core.
+            inline const std::vector<CPUSet> &GetCores () const {
+                return cores;
+            }
+            /// \brief
+            /// Return the NUMA nodes.
+            /// \return Logical processors of each NUMA node.
+            inline const std::vector<CPUSet> &GetNodes () const {
+                return nodes;
+            }
+            /// \brief
+            /// Return the caches.
+            /// \return Caches.
+            inline const std::vector<Cache> &GetCaches () const {
+                return caches;
+            }
+
+            /// \brief
+            /// Return the logical processors sharing the given level
+            /// (data or unified) cache with the given processor.
+            /// \param[in] cpu Logical processor id.
+            /// \param[in] level Cache level.
+            /// \return Logical processors sharing the cache (empty if unknown).
+            CPUSet GetCacheSiblings (
+                ui32 cpu,
+                ui32 level) const;
+
+            /// \brief
+            /// Resolve a worker affinity (placement policy or logical
+            /// processor id) to the processors a given worker should run on.
+            /// \param[in] affinity One of the THEKOGANS_UTIL_*_THREAD_AFFINITY
+            /// placement policies, a logical processor id, or
+            /// THEKOGANS_UTIL_MAX_THREAD_AFFINITY.
+            /// \param[in] worker Worker index.
+            /// \param[in] workerCount Number of workers being placed.
+            /// \return Processors the worker should be bound to (empty ==
+            /// no binding).
+            CPUSet GetWorkerAffinity (
+                ui32 affinity,
+                std::size_t worker,
+                std::size_t workerCount) const;
+
+            /// \brief
+            /// Dump the topology to std::ostream.
+            /// \param[in] stream Stream to dump to.
+            void Dump (std::ostream &stream = std::cout) const;
+
+        private:
+            /// \brief
+            /// Called by the ctor after the platform specific discovery
+            /// filled in cpus to build the derived sets and placement orders.
+            void Build ();
+
+            /// \brief
+            /// CPUTopology is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (CPUTopology)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_CPUTopology_h)
@@ -0,0 +1,713 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_ConcurrentHashMap_h)
+#define __thekogans_util_ConcurrentHashMap_h
+
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <unordered_set>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Allocator.h"
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/util/EpochReclaimer.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct ConcurrentHashMap ConcurrentHashMap.h thekogans/util/ConcurrentHashMap.h
+        ///
+        /// \brief
+        /// ConcurrentHashMap is an open addressing (linear probing) hash map
+        /// designed for read mostly registries. Lookups are lock free: they
+        /// run inside an \see{EpochReclaimer::Guard} and never write to shared
+        /// memory. Writers are serialized per stripe (a key's stripe is picked
+        /// by it's hash), so writers of unrelated keys proceed in parallel.
+        ///
+        /// Slots hold pointers to immutable entries. Replacing or erasing a
+        /// key publishes a new entry (or a tombstone) and retires the old one
+        /// to the \see{EpochReclaimer}, so a reader never sees a torn value.
+        ///
+        /// Growing doesn't stop the world. When a table gets 3/4 full, a bigger
+        /// one is chained to it and entries are moved over one stripe at a time
+        /// (under that stripe's lock). A writer moves it's own stripe before
+        /// touching the new table, and helps with a couple of others after it's
+        /// done. Readers follow the chain, so they see every key wherever it
+        /// happens to be. Once all stripes are moved, the old table is retired.
+        /// Entries are moved by pointer, which means the address of a value
+        /// stays put until it's key is erased or reassigned.
+        ///
+        /// Entries and tables are allocated with the given \see{Allocator}.
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// util::ConcurrentHashMap<std::string, ui32> ports;
+        ///
+        /// // Writers.
+        /// ports.Insert ("http", 80);
+        /// ports.Assign ("http", 8080);
+        ///
+        /// // Readers (any number of threads, no locks).
+        /// ui32 port;
+        /// if (ports.Find ("http", port)) {
+        ///     ...
+        /// }
+        /// \endcode
+
+        template<
+            typename Key,
+            typename Value,
+            typename Hasher = std::hash<Key>,
+            typename KeyEqual = std::equal_to<Key>>
+        struct ConcurrentHashMap {
+            enum {
+                /// \brief
+                /// Default initial capacity.
+                DEFAULT_CAPACITY = 16,
+                /// \brief
+                /// Default number of writer stripes.
+                DEFAULT_STRIPE_COUNT = 16,
+                /// \brief
+                /// Number of stripes a writer helps move after it's done.
+                MIGRATION_HELP_COUNT = 2
+            };
+
+        private:
+            /// \struct ConcurrentHashMap::Entry ConcurrentHashMap.h thekogans/util/ConcurrentHashMap.h
+            ///
+            /// \brief
+            /// An immutable key/value pair.
+            struct Entry {
+                /// \brief
+                /// Key.
+                const Key key;
+                /// \brief
+                /// Value.
+                const Value value;
+                /// \brief
+                /// Mixed key hash.
+                const std::size_t hash;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] key_ Key.
+                /// \param[in] value_ Value.
+                /// \param[in] hash_ Mixed key hash.
+                Entry (
+                    const Key &key_,
+                    const Value &value_,
+                    std::size_t hash_) :
+                    key (key_),
+                    value (value_),
+                    hash (hash_) {}
+            };
+
+            /// \struct ConcurrentHashMap::Table ConcurrentHashMap.h thekogans/util/ConcurrentHashMap.h
+            ///
+            /// \brief
+            /// Header of a slot array. The slots and the per stripe migration
+            /// flags live in the same block, right after the header.
+            struct Table {
+                /// \brief
+                /// Number of slots (power of 2).
+                const std::size_t capacity;
+                /// \brief
+                /// Slots.
+                std::atomic<Entry *> *slots;
+                /// \brief
+                /// true == stripe was moved to next (guarded by the stripe lock).
+                bool *migrated;
+                /// \brief
+                /// Number of claimed (and reserved) slots.
+                std::atomic<std::size_t> used;
+                /// \brief
+                /// Number of stripes moved to next.
+                std::atomic<std::size_t> migratedCount;
+                /// \brief
+                /// The table we're growing in to.
+                std::atomic<Table *> next;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] capacity_ Number of slots.
+                /// \param[in] stripeCount Number of writer stripes.
+                Table (
+                        std::size_t capacity_,
+                        std::size_t stripeCount) :
+                        capacity (capacity_),
+                        slots (reinterpret_cast<std::atomic<Entry *> *> (this + 1)),
+                        migrated (reinterpret_cast<bool *> (slots + capacity)),
+                        used (0),
+                        migratedCount (0),
+                        next (0) {
+                    for (std::size_t i = 0; i < capacity; ++i) {
+                        new (&slots[i]) std::atomic<Entry *> (0);
+                    }
+                    for (std::size_t i = 0; i < stripeCount; ++i) {
+                        migrated[i] = false;
+                    }
+                }
+            };
+
+            /// \brief
+            /// Allocator for entries and tables.
+            Allocator &allocator;
+            /// \brief
+            /// Retired entries and tables go here.
+            EpochReclaimer &reclaimer;
+            /// \brief
+            /// Key hasher.
+            Hasher hasher;
+            /// \brief
+            /// Key comparator.
+            KeyEqual keyEqual;
+            /// \brief
+            /// Number of writer stripes (power of 2).
+            const std::size_t stripeCount;
+            /// \brief
+            /// Writer stripe locks.
+            SpinLock *stripes;
+            /// \brief
+            /// Serializes chaining a new table.
+            SpinLock resizeLock;
+            /// \brief
+            /// Oldest table in the chain.
+            std::atomic<Table *> current;
+            /// \brief
+            /// Number of keys.
+            std::atomic<std::size_t> size;
+            /// \brief
+            /// Next stripe to help move.
+            std::atomic<std::size_t> migrationCursor;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] capacity Initial capacity (rounded up to a power of 2).
+            /// \param[in] stripeCount_ Number of writer stripes (rounded up to a power of 2).
+            /// \param[in] allocator_ Allocator for entries and tables.
+            /// \param[in] reclaimer_ Retired entries and tables go here.
+            /// \param[in] hasher_ Key hasher.
+            /// \param[in] keyEqual_ Key comparator.
+            explicit ConcurrentHashMap (
+                    std::size_t capacity = DEFAULT_CAPACITY,
+                    std::size_t stripeCount_ = DEFAULT_STRIPE_COUNT,
+                    Allocator &allocator_ = DefaultAllocator::Instance (),
+                    EpochReclaimer &reclaimer_ = GlobalEpochReclaimer::Instance (),
+                    const Hasher &hasher_ = Hasher (),
+                    const KeyEqual &keyEqual_ = KeyEqual ()) :
+                    allocator (allocator_),
+                    reclaimer (reclaimer_),
+                    hasher (hasher_),
+                    keyEqual (keyEqual_),
+                    stripeCount (RoundUp (stripeCount_, 1)),
+                    stripes (new SpinLock[stripeCount]),
+                    current (0),
+                    size (0),
+                    migrationCursor (0) {
+                current.store (NewTable (RoundUp (capacity, 8)), std::memory_order_release);
+            }
+            /// \brief
+            /// dtor. The map must not be in use by other threads.
+            ~ConcurrentHashMap () {
+                Table *table = current.load (std::memory_order_acquire);
+                while (table != 0) {
+                    for (std::size_t i = 0; i < table->capacity; ++i) {
+                        Entry *entry = table->slots[i].load (std::memory_order_relaxed);
+                        if (IsEntry (entry)) {
+                            DeleteEntry (entry, sizeof (Entry), &allocator);
+                        }
+                    }
+                    Table *next = table->next.load (std::memory_order_relaxed);
+                    allocator.Free (table, GetTableSize (table->capacity));
+                    table = next;
+                }
+                delete [] stripes;
+            }
+
+            /// \brief
+            /// Return the number of keys in the map.
+            /// \return Number of keys in the map.
+            inline std::size_t Size () const {
+                return size.load (std::memory_order_relaxed);
+            }
+            /// \brief
+            /// Return true if the map is empty.
+            /// \return true == the map is empty.
+            inline bool IsEmpty () const {
+                return Size () == 0;
+            }
+
+            /// \brief
+            /// Lock free lookup.
+            /// \param[in] key Key to lookup.
+            /// \param[out] value Where to copy the value.
+            /// \return true == found, false == not found.
+            bool Find (
+                    const Key &key,
+                    Value &value) const {
+                EpochReclaimer::Guard guard (reclaimer);
+                const Entry *entry = FindEntry (key, Hash (key));
+                if (entry != 0) {
+                    value = entry->value;
+                    return true;
+                }
+                return false;
+            }
+            /// \brief
+            /// Lock free lookup returning the value in place. The pointer is
+            /// valid for as long as the caller holds an \see{EpochReclaimer::Guard}
+            /// on the map's reclaimer or, if the key is never erased or reassigned
+            /// (typical of registries populated at startup), for the life of the map.
+            /// \param[in] key Key to lookup.
+            /// \return Pointer to the value, 0 if not found.
+            const Value *Find (const Key &key) const {
+                EpochReclaimer::Guard guard (reclaimer);
+                const Entry *entry = FindEntry (key, Hash (key));
+                return entry != 0 ? &entry->value : 0;
+            }
+            /// \brief
+            /// Lock free membership test.
+            /// \param[in] key Key to lookup.
+            /// \return true == the key is in the map.
+            bool Contains (const Key &key) const {
+                EpochReclaimer::Guard guard (reclaimer);
+                return FindEntry (key, Hash (key)) != 0;
+            }
+
+            /// \brief
+            /// Add the given key/value if the key is not already in the map.
+            /// \param[in] key Key to add.
+            /// \param[in] value Value to add.
+            /// \return true == added, false == the key is already in the map.
+            bool Insert (
+                    const Key &key,
+                    const Value &value) {
+                return Write (key, &value, false);
+            }
+            /// \brief
+            /// Add the given key/value, or replace the value if the key is
+            /// already in the map. Readers see either the old or the new value.
+            /// \param[in] key Key to add/update.
+            /// \param[in] value New value.
+            /// \return true == added, false == replaced.
+            bool Assign (
+                    const Key &key,
+                    const Value &value) {
+                return Write (key, &value, true);
+            }
+            /// \brief
+            /// Remove the given key.
+            /// \param[in] key Key to remove.
+            /// \return true == removed, false == the key was not in the map.
+            bool Erase (const Key &key) {
+                return Write (key, 0, true);
+            }
+
+            /// \brief
+            /// Call the given visitor with every key/value in the map. Iteration
+            /// is lock free and weakly consistent: keys added or removed while it
+            /// runs might or might not be visited, but no key is visited twice.
+            /// The visitor must not write to the map.
+            /// \param[in] visitor Called with (const Key &, const Value &).
+            template<typename Visitor>
+            void ForEach (Visitor visitor) const {
+                EpochReclaimer::Guard guard (reclaimer);
+                Table *table = current.load (std::memory_order_acquire);
+                if (table->next.load (std::memory_order_acquire) == 0) {
+                    for (std::size_t i = 0; i < table->capacity; ++i) {
+                        const Entry *entry = table->slots[i].load (std::memory_order_acquire);
+                        if (IsEntry (entry)) {
+                            visitor (entry->key, entry->value);
+                        }
+                    }
+                }
+                else {
+                    // We're growing. An entry can be seen in the old
+                    // table and (after it's moved) in the new one.
+                    std::unordered_set<const Entry *> visited;
+                    for (; table != 0; table = table->next.load (std::memory_order_acquire)) {
+                        for (std::size_t i = 0; i < table->capacity; ++i) {
+                            const Entry *entry = table->slots[i].load (std::memory_order_acquire);
+                            if (IsEntry (entry) && visited.insert (entry).second) {
+                                visitor (entry->key, entry->value);
+                            }
+                        }
+                    }
+                }
+            }
+
+        private:
+            /// \brief
+            /// Erased slot marker.
+            /// \return Erased slot marker.
+            static inline Entry *Tombstone () {
+                return reinterpret_cast<Entry *> (1);
+            }
+            /// \brief
+            /// Moved to next table marker.
+            /// \return Moved slot marker.
+            static inline Entry *Moved () {
+                return reinterpret_cast<Entry *> (2);
+            }
+            /// \brief
+            /// Return true if the slot value is a real entry.
+            /// \param[in] entry Slot value.
+            /// \return true == entry is neither empty nor a marker.
+            static inline bool IsEntry (const Entry *entry) {
+                return entry != 0 && entry != Tombstone () && entry != Moved ();
+            }
+            /// \brief
+            /// Round the given value up to the next power of 2.
+            /// \param[in] value Value to round up.
+            /// \param[in] minValue Smallest value to return.
+            /// \return Smallest power of 2 >= max (value, minValue).
+            static std::size_t RoundUp (
+                    std::size_t value,
+                    std::size_t minValue) {
+                std::size_t result = minValue;
+                while (result < value) {
+                    result <<= 1;
+                }
+                return result;
+            }
+
+            /// \brief
+            /// Hash the key. Hashers like std::hash<int> are the identity, so
+            /// run the result through a 64 bit finalizer (murmur3 fmix64) to
+            /// spread the keys over both the slots and the stripes.
+            /// \param[in] key Key to hash.
+            /// \return Mixed hash.
+            std::size_t Hash (const Key &key) const {
+                ui64 hash = (ui64)hasher (key);
+                hash ^= hash >> 33;
+                hash *= THEKOGANS_UTIL_UI64_LITERAL (0xff51afd7ed558ccd);
+                hash ^= hash >> 33;
+                hash *= THEKOGANS_UTIL_UI64_LITERAL (0xc4ceb9fe1a85ec53);
+                hash ^= hash >> 33;
+                return (std::size_t)hash;
+            }
+            /// \brief
+            /// Return the key's stripe. Slots are picked with the low
+            /// bits of the hash, stripes with the high ones.
+            /// \param[in] hash Mixed hash.
+            /// \return Stripe index.
+            inline std::size_t GetStripe (std::size_t hash) const {
+                return (hash >> (sizeof (std::size_t) * 4)) & (stripeCount - 1);
+            }
+
+            /// \brief
+            /// Return the size of the block holding a table of the given capacity.
+            /// \param[in] capacity Number of slots.
+            /// \return Table block size.
+            inline std::size_t GetTableSize (std::size_t capacity) const {
+                return sizeof (Table) +
+                    capacity * sizeof (std::atomic<Entry *>) +
+                    stripeCount * sizeof (bool);
+            }
+            /// \brief
+            /// Allocate a new table.
+            /// \param[in] capacity Number of slots.
+            /// \return New table.
+            Table *NewTable (std::size_t capacity) {
+                return new (allocator.Alloc (GetTableSize (capacity)))
+                    Table (capacity, stripeCount);
+            }
+            /// \brief
+            /// Allocate a new entry.
+            /// \param[in] key Key.
+            /// \param[in] value Value.
+            /// \param[in] hash Mixed key hash.
+            /// \return New entry.
+            Entry *NewEntry (
+                    const Key &key,
+                    const Value &value,
+                    std::size_t hash) {
+                void *block = allocator.Alloc (sizeof (Entry));
+                try {
+                    return new (block) Entry (key, value, hash);
+                }
+                catch (...) {
+                    allocator.Free (block, sizeof (Entry));
+                    throw;
+                }
+            }
+            /// \brief
+            /// \see{Reclaimer::Deleter} for entries.
+            /// \param[in] object Entry to delete.
+            /// \param[in] size sizeof (Entry).
+            /// \param[in] context Allocator the entry came from.
+            static void DeleteEntry (
+                    void *object,
+                    std::size_t size,
+                    void *context) {
+                static_cast<Entry *> (object)->~Entry ();
+                static_cast<Allocator *> (context)->Free (object, size);
+            }
+
+            /// \brief
+            /// Lock free lookup. Must be called inside a Guard.
+            /// \param[in] key Key to lookup.
+            /// \param[in] hash Mixed key hash.
+            /// \return Entry, 0 if not found.
+            const Entry *FindEntry (
+                    const Key &key,
+                    std::size_t hash) const {
+                // While growing, a key is in exactly one of the chained tables.
+                // It's moved to the next one before it's old slot is marked as
+                // moved, so walking the chain oldest to newest can't miss it.
+                for (Table *table = current.load (std::memory_order_acquire);
+                        table != 0; table = table->next.load (std::memory_order_acquire)) {
+                    std::size_t mask = table->capacity - 1;
+                    for (std::size_t i = hash & mask, probes = 0;
+                            probes < table->capacity; i = (i + 1) & mask, ++probes) {
+                        const Entry *entry = table->slots[i].load (std::memory_order_acquire);
+                        if (entry == 0) {
+                            break;
+                        }
+                        if (IsEntry (entry) && entry->hash == hash && keyEqual (entry->key, key)) {
+                            return entry;
+                        }
+                    }
+                }
+                return 0;
+            }
+
+            /// \brief
+            /// Insert, assign or erase.
+            /// \param[in] key Key to write.
+            /// \param[in] value New value (0 == erase).
+            /// \param[in] assign true == replace an existing value.
+            /// \return Insert/Assign: true == added. Erase: true == removed.
+            bool Write (
+                    const Key &key,
+                    const Value *value,
+                    bool assign) {
+                std::size_t hash = Hash (key);
+                std::size_t stripe = GetStripe (hash);
+                EpochReclaimer::Guard guard (reclaimer);
+                bool result;
+                {
+                    LockGuard<SpinLock> lock (stripes[stripe]);
+                    result = WriteStripe (key, hash, stripe, value, assign);
+                }
+                HelpMigrate ();
+                return result;
+            }
+            /// \brief
+            /// Insert, assign or erase. The stripe lock must be held.
+            /// \param[in] key Key to write.
+            /// \param[in] hash Mixed key hash.
+            /// \param[in] stripe Key stripe.
+            /// \param[in] value New value (0 == erase).
+            /// \param[in] assign true == replace an existing value.
+            /// \return Insert/Assign: true == added. Erase: true == removed.
+            bool WriteStripe (
+                    const Key &key,
+                    std::size_t hash,
+                    std::size_t stripe,
+                    const Value *value,
+                    bool assign) {
+                Table *table = GetWriteTable (
+                    current.load (std::memory_order_acquire), stripe);
+                for (;;) {
+                    // We own the stripe in the newest table, so no one
+                    // else can add, change or move any of it's keys.
+                    std::size_t mask = table->capacity - 1;
+                    std::size_t i = hash & mask;
+                    Entry *entry;
+                    while ((entry = table->slots[i].load (std::memory_order_acquire)) != 0) {
+                        if (IsEntry (entry) && entry->hash == hash && keyEqual (entry->key, key)) {
+                            if (value == 0) {
+                                table->slots[i].store (Tombstone (), std::memory_order_release);
+                                size.fetch_sub (1, std::memory_order_relaxed);
+                                reclaimer.Retire (entry, sizeof (Entry), DeleteEntry, &allocator);
+                                return true;
+                            }
+                            if (assign) {
+                                table->slots[i].store (
+                                    NewEntry (key, *value, hash), std::memory_order_release);
+                                reclaimer.Retire (entry, sizeof (Entry), DeleteEntry, &allocator);
+                            }
+                            return false;
+                        }
+                        i = (i + 1) & mask;
+                    }
+                    if (value == 0) {
+                        return false;
+                    }
+                    if (Reserve (*table)) {
+                        Claim (*table, i, NewEntry (key, *value, hash));
+                        size.fetch_add (1, std::memory_order_relaxed);
+                        return true;
+                    }
+                    table = GetWriteTable (Grow (*table, stripe), stripe);
+                }
+            }
+
+            /// \brief
+            /// Reserve a slot in the given table. Tables are grown when they
+            /// get 3/4 full, leaving the last quarter for the entries moved in
+            /// from the previous table (see Grow).
+            /// \param[in] table Table to reserve a slot in.
+            /// \return true == reserved, false == time to grow.
+            bool Reserve (Table &table) {
+                if (table.used.fetch_add (1, std::memory_order_relaxed) <
+                        table.capacity - table.capacity / 4) {
+                    return true;
+                }
+                table.used.fetch_sub (1, std::memory_order_relaxed);
+                return false;
+            }
+            /// \brief
+            /// Put the entry in the first empty slot starting with the given one.
+            /// Writers of other stripes race us for the empty slots. The slot
+            /// must have been reserved.
+            /// \param[in] table Table to put the entry in.
+            /// \param[in] index Slot to start with.
+            /// \param[in] entry Entry to put in.
+            void Claim (
+                    Table &table,
+                    std::size_t index,
+                    Entry *entry) {
+                std::size_t mask = table.capacity - 1;
+                for (;; index = (index + 1) & mask) {
+                    Entry *expected = 0;
+                    if (table.slots[index].load (std::memory_order_relaxed) == 0 &&
+                            table.slots[index].compare_exchange_strong (
+                                expected, entry, std::memory_order_release, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+            }
+
+            /// \brief
+            /// Chain a bigger table to the given one (if someone hasn't
+            /// done it already) and move the given stripe to it.
+            /// \param[in] table Table that got full.
+            /// \param[in] stripe Stripe we own.
+            /// \return The chained table.
+            Table *Grow (
+                    Table &table,
+                    std::size_t stripe) {
+                Table *next = table.next.load (std::memory_order_acquire);
+                if (next == 0) {
+                    LockGuard<SpinLock> guard (resizeLock);
+                    next = table.next.load (std::memory_order_acquire);
+                    if (next == 0) {
+                        // Entries moved in from this table can't exceed the number
+                        // of keys plus one in flight writer per stripe. Make sure
+                        // they fit in to the quarter Reserve leaves free.
+                        next = NewTable (
+                            RoundUp (4 * (Size () + stripeCount + 1), table.capacity));
+                        table.next.store (next, std::memory_order_release);
+                    }
+                }
+                MigrateStripe (table, *next, stripe);
+                return next;
+            }
+            /// \brief
+            /// Move the given stripe down the chain, starting with the given
+            /// table, and return the newest table. The stripe lock must be held.
+            /// \param[in] table Table to start with.
+            /// \param[in] stripe Stripe to move.
+            /// \return Newest table.
+            Table *GetWriteTable (
+                    Table *table,
+                    std::size_t stripe) {
+                for (Table *next = table->next.load (std::memory_order_acquire);
+                        next != 0; table = next, next = table->next.load (std::memory_order_acquire)) {
+                    if (!table->migrated[stripe]) {
+                        MigrateStripe (*table, *next, stripe);
+                    }
+                }
+                return table;
+            }
+            /// \brief
+            /// Move the entries belonging to the given stripe to the next
+            /// table. The stripe lock must be held.
+            /// \param[in] table Table to move the entries from.
+            /// \param[in] next Table to move the entries to.
+            /// \param[in] stripe Stripe to move.
+            void MigrateStripe (
+                    Table &table,
+                    Table &next,
+                    std::size_t stripe) {
+                std::size_t mask = next.capacity - 1;
+                for (std::size_t i = 0; i < table.capacity; ++i) {
+                    Entry *entry = table.slots[i].load (std::memory_order_acquire);
+                    if (IsEntry (entry) && GetStripe (entry->hash) == stripe) {
+                        // Publish the entry in the new table before marking
+                        // the old slot, so that readers see it in one or the other.
+                        next.used.fetch_add (1, std::memory_order_relaxed);
+                        Claim (next, entry->hash & mask, entry);
+                        table.slots[i].store (Moved (), std::memory_order_release);
+                    }
+                }
+                table.migrated[stripe] = true;
+                if (table.migratedCount.fetch_add (1, std::memory_order_acq_rel) + 1 == stripeCount) {
+                    RetireMigratedTables ();
+                }
+            }
+            /// \brief
+            /// Unlink and retire fully moved tables from the head of the chain.
+            void RetireMigratedTables () {
+                Table *table = current.load (std::memory_order_acquire);
+                Table *next;
+                while ((next = table->next.load (std::memory_order_acquire)) != 0 &&
+                        table->migratedCount.load (std::memory_order_acquire) == stripeCount) {
+                    if (current.compare_exchange_strong (table, next, std::memory_order_acq_rel)) {
+                        // Readers that still hold it don't look at the entries
+                        // (they're all moved), only the markers.
+                        reclaimer.Retire (table, GetTableSize (table->capacity), allocator);
+                        table = next;
+                    }
+                }
+            }
+            /// \brief
+            /// If we're growing, move a few stripes whose locks are free. This
+            /// guarantees progress for stripes that are rarely written to.
+            void HelpMigrate () {
+                for (std::size_t i = 0; i < MIGRATION_HELP_COUNT; ++i) {
+                    Table *table = current.load (std::memory_order_acquire);
+                    if (table->next.load (std::memory_order_acquire) == 0) {
+                        break;
+                    }
+                    std::size_t stripe =
+                        migrationCursor.fetch_add (1, std::memory_order_relaxed) & (stripeCount - 1);
+                    if (stripes[stripe].TryAcquire ()) {
+                        GetWriteTable (table, stripe);
+                        stripes[stripe].Release ();
+                    }
+                }
+            }
+
+            /// \brief
+            /// ConcurrentHashMap is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (ConcurrentHashMap)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_ConcurrentHashMap_h)
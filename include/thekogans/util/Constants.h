@@ -176,6 +176,13 @@ namespace thekogans {
         /// Ethernet MAC length.
         const std::size_t MAC_LENGTH = 6;
 
+        /// \brief
+        /// Assumed cache line size. Used to keep data written by
+        /// different threads on separate lines (avoid false sharing).
+    #if !defined (THEKOGANS_UTIL_CACHE_LINE_SIZE)
+        #define THEKOGANS_UTIL_CACHE_LINE_SIZE 64
+    #endif // !defined (THEKOGANS_UTIL_CACHE_LINE_SIZE)
+
         /// \brief
         /// Fudge factor. Every routine which compares
         /// two f32s takes an eps parameter. eps defaults
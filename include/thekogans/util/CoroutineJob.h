@@ -0,0 +1,468 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_CoroutineJob_h)
+#define __thekogans_util_CoroutineJob_h
+
+#if defined (__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+    /// \def THEKOGANS_UTIL_HAVE_COROUTINES
+    /// Defined when the compiler supports C++20 coroutines.
+    #define THEKOGANS_UTIL_HAVE_COROUTINES
+#endif // defined (__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#if defined (THEKOGANS_UTIL_HAVE_COROUTINES)
+
+#include <coroutine>
+#include <exception>
+#include <atomic>
+#include <vector>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/TimeSpec.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/RunLoop.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct CoroutineJob CoroutineJob.h thekogans/util/CoroutineJob.h
+        ///
+        /// \brief
+        /// CoroutineJob is a \see{RunLoop::Job} whose body is a C++20 coroutine.
+        /// Instead of blocking a worker while it waits for a timer, another job
+        /// or a file descriptor, a CoroutineJob suspends (co_await) and gives
+        /// the worker back to the \see{RunLoop}. When the wait is over the job
+        /// is resumed on it's run loop (not necessarily on the same worker).
+        /// This allows thousands of concurrent logical tasks to share a
+        /// handful of worker threads. Here's how to use it:
+        ///
+        /// \code{.cpp}
+        /// struct FetchJob : public util::CoroutineJob {
+        ///     FetchJob (util::RunLoop &runLoop) :
+        ///         util::CoroutineJob (runLoop) {}
+        ///
+        ///     virtual Task Run () override {
+        ///         while (co_await WaitReadable (socket)) {
+        ///             ...
+        ///             if (!co_await SleepFor (util::TimeSpec::FromMilliseconds (100))) {
+        ///                 break;
+        ///             }
+        ///         }
+        ///     }
+        /// };
+        ///
+        /// util::JobQueue jobQueue ("Fetch", ...);
+        /// util::RunLoop::Job::SharedPtr job (new FetchJob (jobQueue));
+        /// jobQueue.EnqJob (job);
+        /// ...
+        /// job->Wait ();
+        /// \endcode
+        ///
+        /// Every co_await returns true if the wait completed and false if the
+        /// job should stop what it's doing (it was cancelled, or it's run loop
+        /// is being stopped). Cancel wakes a suspended job immediately.
+        /// A suspended job stays in the Running state. It's not in the run loop
+        /// pending or running lists, so use Wait (not RunLoop::WaitForIdle) to
+        /// wait for it to complete.
+        ///
+        /// IMPORTANT: The job must be enqueued on the run loop passed to the
+        /// ctor. If it's not, it fails with THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL.
+        /// The run loop must outlive the jobs suspended on it. Jobs waiting to
+        /// be resumed on a stopped run loop are resumed when it's restarted,
+        /// and cancelled when it's destroyed.
+        ///
+        /// NOTE: CoroutineJob is only available when compiling with C++20
+        /// (or later). THEKOGANS_UTIL_HAVE_COROUTINES is defined when it is.
+
+        struct _LIB_THEKOGANS_UTIL_DECL CoroutineJob : public RunLoop::Job {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (CoroutineJob)
+
+            /// \struct CoroutineJob::Task CoroutineJob.h thekogans/util/CoroutineJob.h
+            ///
+            /// \brief
+            /// Return type of Run. Owns the coroutine frame.
+            struct _LIB_THEKOGANS_UTIL_DECL Task {
+                /// \struct CoroutineJob::Task::promise_type CoroutineJob.h thekogans/util/CoroutineJob.h
+                ///
+                /// \brief
+                /// Coroutine promise. The coroutine starts suspended (it's resumed
+                /// by Execute), and stays suspended at the end so that the job can
+                /// inspect the outcome before destroying the frame.
+                struct promise_type {
+                    /// \brief
+                    /// Exception thrown out of Run (if any).
+                    std::exception_ptr exception;
+
+                    /// \brief
+                    /// Create the Task owning this coroutine.
+                    /// \return Task owning this coroutine.
+                    Task get_return_object () {
+                        return Task (std::coroutine_handle<promise_type>::from_promise (*this));
+                    }
+                    /// \brief
+                    /// Don't run the body until Execute resumes it.
+                    /// \return std::suspend_always.
+                    std::suspend_always initial_suspend () noexcept {
+                        return std::suspend_always ();
+                    }
+                    /// \brief
+                    /// Keep the frame around after the body completes.
+                    /// \return std::suspend_always.
+                    std::suspend_always final_suspend () noexcept {
+                        return std::suspend_always ();
+                    }
+                    /// \brief
+                    /// Run completed (co_return).
+                    void return_void () {}
+                    /// \brief
+                    /// Run threw. Save the exception so that the job can fail.
+                    void unhandled_exception () {
+                        exception = std::current_exception ();
+                    }
+                };
+
+                /// \brief
+                /// Coroutine handle.
+                std::coroutine_handle<promise_type> handle;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] handle_ Coroutine handle.
+                explicit Task (std::coroutine_handle<promise_type> handle_ =
+                    std::coroutine_handle<promise_type> ()) :
+                    handle (handle_) {}
+                /// \brief
+                /// Move ctor.
+                /// \param[in] other Task to take the coroutine from.
+                Task (Task &&other) noexcept :
+                        handle (other.handle) {
+                    other.handle = std::coroutine_handle<promise_type> ();
+                }
+                /// \brief
+                /// dtor. Destroy the coroutine frame.
+                ~Task () {
+                    if (handle) {
+                        handle.destroy ();
+                    }
+                }
+
+                /// \brief
+                /// Move assignment operator.
+                /// \param[in] other Task to take the coroutine from.
+                /// \return *this.
+                Task &operator = (Task &&other) noexcept {
+                    if (&other != this) {
+                        if (handle) {
+                            handle.destroy ();
+                        }
+                        handle = other.handle;
+                        other.handle = std::coroutine_handle<promise_type> ();
+                    }
+                    return *this;
+                }
+
+                /// \brief
+                /// Return true if the coroutine was started and has not completed yet.
+                /// \return true == the coroutine is suspended.
+                inline bool IsSuspended () const {
+                    return handle && !handle.done ();
+                }
+
+                /// \brief
+                /// Task is not copy constructable, nor assignable.
+                Task (const Task &) = delete;
+                Task &operator = (const Task &) = delete;
+            };
+
+            /// \struct CoroutineJob::Awaiter CoroutineJob.h thekogans/util/CoroutineJob.h
+            ///
+            /// \brief
+            /// Returned by Yield, SleepFor, Await, WaitReadable and WaitWritable.
+            /// The wait itself is armed by the job after the coroutine suspends
+            /// (and the worker is no longer using the frame).
+            struct _LIB_THEKOGANS_UTIL_DECL Awaiter {
+                /// \brief
+                /// Job that's waiting.
+                CoroutineJob &job;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] job_ Job that's waiting.
+                explicit Awaiter (CoroutineJob &job_) :
+                    job (job_) {}
+
+                /// \brief
+                /// Don't suspend if the job should stop, or if there's nothing to wait for.
+                /// \return true == don't suspend.
+                bool await_ready () const;
+                /// \brief
+                /// The coroutine is suspended. Return to Execute (or ResumeJob).
+                void await_suspend (std::coroutine_handle<>) const {}
+                /// \brief
+                /// Called when the coroutine is resumed.
+                /// \return true == the wait completed, false == the job should stop.
+                bool await_resume () const;
+            };
+
+        private:
+            /// \brief
+            /// \see{RunLoop} on which the job is resumed.
+            RunLoop &runLoop;
+            /// \brief
+            /// How often to check on non CoroutineJob jobs passed to Await.
+            const TimeSpec pollInterval;
+            /// \brief
+            /// Coroutine returned by Run.
+            Task task;
+            /// \brief
+            /// Valid while the coroutine is running (for ShouldStop).
+            const std::atomic<bool> *done;
+            /// \struct CoroutineJob::WaitInfo CoroutineJob.h thekogans/util/CoroutineJob.h
+            ///
+            /// \brief
+            /// What the suspended coroutine is waiting for.
+            struct WaitInfo {
+                /// \brief
+                /// Wait types.
+                enum Type {
+                    /// \brief
+                    /// Resume as soon as possible.
+                    Yield,
+                    /// \brief
+                    /// Resume after timeSpec.
+                    Timer,
+                    /// \brief
+                    /// Resume when job completes.
+                    Job,
+                    /// \brief
+                    /// Resume when handle is readable.
+                    Readable,
+                    /// \brief
+                    /// Resume when handle is writable.
+                    Writable
+                } type;
+                /// \brief
+                /// Timer interval.
+                TimeSpec timeSpec;
+                /// \brief
+                /// Job to wait for.
+                RunLoop::Job::SharedPtr job;
+                /// \brief
+                /// Handle to wait on.
+                THEKOGANS_UTIL_HANDLE handle;
+
+                /// \brief
+                /// ctor.
+                WaitInfo () :
+                    type (Yield),
+                    timeSpec (TimeSpec::Zero),
+                    handle (THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {}
+            } wait;
+            /// \brief
+            /// Incremented every time a wait is armed.
+            ui64 generation;
+            /// \brief
+            /// Generation of the armed wait (0 == not armed). Whoever
+            /// manages to reset it gets to resume the coroutine.
+            std::atomic<ui64> armed;
+            /// \struct CoroutineJob::Continuation CoroutineJob.h thekogans/util/CoroutineJob.h
+            ///
+            /// \brief
+            /// A CoroutineJob waiting for this one to complete.
+            struct Continuation {
+                /// \brief
+                /// Waiting job.
+                SharedPtr job;
+                /// \brief
+                /// Waiting job wait generation.
+                ui64 generation;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] job_ Waiting job.
+                /// \param[in] generation_ Waiting job wait generation.
+                Continuation (
+                    SharedPtr job_,
+                    ui64 generation_) :
+                    job (job_),
+                    generation (generation_) {}
+            };
+            /// \brief
+            /// CoroutineJobs waiting for this one to complete.
+            std::vector<Continuation> continuations;
+            /// \brief
+            /// Synchronization lock for continuations.
+            SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] runLoop_ \see{RunLoop} on which the job will be enqueued
+            /// (and resumed).
+            /// \param[in] pollInterval_ How often to check on non CoroutineJob
+            /// jobs passed to Await.
+            /// \param[in] id Job id.
+            CoroutineJob (
+                RunLoop &runLoop_,
+                const TimeSpec &pollInterval_ = TimeSpec::FromMilliseconds (10),
+                const Id &id = GUID::FromRandom ().ToString ()) :
+                RunLoop::Job (id),
+                runLoop (runLoop_),
+                pollInterval (pollInterval_),
+                done (0),
+                generation (0),
+                armed (0) {}
+
+            /// \brief
+            /// Return the \see{RunLoop} the job runs on.
+            /// \return \see{RunLoop} the job runs on.
+            inline RunLoop &GetRunLoop () const {
+                return runLoop;
+            }
+
+            /// \brief
+            /// Cancel the job. If it's suspended, resume it right
+            /// away (the pending co_await will return false).
+            virtual void Cancel () override;
+
+        protected:
+            /// \brief
+            /// The body of the job. Implement it as a coroutine (use co_await
+            /// with the awaiters below and, optionally, co_return).
+            /// \return Task owning the coroutine.
+            virtual Task Run () = 0;
+
+            /// \brief
+            /// Return true if the job should stop what it's doing and exit.
+            /// Use it in Run between co_awaits.
+            /// \return true == Job should stop what it's doing and exit.
+            inline bool ShouldStop () const {
+                return done != 0 ? RunLoop::Job::ShouldStop (*done) : IsCancelled () || IsFailed ();
+            }
+
+            /// \brief
+            /// Give the worker to other jobs and continue as soon as possible.
+            /// \return Awaiter.
+            Awaiter Yield ();
+            /// \brief
+            /// Suspend for the given interval.
+            /// \param[in] timeSpec How long to sleep.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return Awaiter.
+            Awaiter SleepFor (const TimeSpec &timeSpec);
+            /// \brief
+            /// Suspend until the given (already enqueued) job completes.
+            /// CoroutineJobs resume their waiters when they complete. Other
+            /// jobs are checked every pollInterval.
+            /// \param[in] job Job to wait for.
+            /// \return Awaiter.
+            Awaiter Await (RunLoop::Job::SharedPtr job);
+            /// \brief
+            /// Suspend until the given handle becomes readable.
+            /// \param[in] handle Handle to wait on.
+            /// \return Awaiter.
+            Awaiter WaitReadable (THEKOGANS_UTIL_HANDLE handle);
+            /// \brief
+            /// Suspend until the given handle becomes writable.
+            /// \param[in] handle Handle to wait on.
+            /// \return Awaiter.
+            Awaiter WaitWritable (THEKOGANS_UTIL_HANDLE handle);
+
+            // RunLoop::Job
+            /// \brief
+            /// Start the coroutine and run it until it suspends or completes.
+            /// \param[in] done If true, this flag indicates that
+            /// the job should stop what it's doing, and exit.
+            virtual void Execute (const std::atomic<bool> &done) throw () override;
+            /// \brief
+            /// A suspended job is not done yet. Leave it's disposition alone.
+            /// \param[in] done false == job completed successfully, otherwise
+            /// job was forced to exit Execute because the run loop was stopped.
+            virtual void Succeed (const std::atomic<bool> &done) override;
+            /// \brief
+            /// When the run loop is done with a suspended job, arm it's wait
+            /// instead of completing it.
+            /// \param[in] state_ New job state.
+            virtual void SetState (State state_) override;
+
+        private:
+            /// \brief
+            /// Resume the coroutine and run it until it suspends or completes.
+            /// \param[in] done_ If true, this flag indicates that
+            /// the job should stop what it's doing, and exit.
+            void Step (const std::atomic<bool> &done_);
+            /// \brief
+            /// Arm the wait the coroutine suspended on.
+            void Arm ();
+            /// \brief
+            /// Arm the wait the coroutine suspended on with the given generation.
+            /// \param[in] generation_ Wait generation.
+            void Arm (ui64 generation_);
+            /// \brief
+            /// Take ownership of the coroutine if the given generation is still armed.
+            /// \param[in] generation_ Wait generation.
+            /// \return true == the caller gets to resume (or abandon) the coroutine.
+            bool Disarm (ui64 generation_);
+            /// \brief
+            /// Called by ResumeJob when the wait is over.
+            /// \param[in] generation_ Wait generation.
+            /// \param[in] done_ If true, this flag indicates that
+            /// the job should stop what it's doing, and exit.
+            void Resume (
+                ui64 generation_,
+                const std::atomic<bool> &done_);
+            /// \brief
+            /// Called by ResumeJob when it will never execute
+            /// (the run loop was stopped). Cancel the job.
+            /// \param[in] generation_ Wait generation.
+            void Abandon (ui64 generation_);
+            /// \brief
+            /// Enqueue a ResumeJob for the given generation on our run loop.
+            /// \param[in] generation_ Wait generation.
+            void EnqResumeJob (ui64 generation_);
+            /// \brief
+            /// Ask to be resumed when this job completes.
+            /// \param[in] job Waiting job.
+            /// \param[in] generation_ Waiting job wait generation.
+            /// \return true == registered, false == this job has already completed.
+            bool AddContinuation (
+                CoroutineJob &job,
+                ui64 generation_);
+            /// \brief
+            /// Destroy the coroutine, complete the job and resume the continuations.
+            void Complete ();
+
+            /// \brief
+            /// Resumes the coroutine on the run loop.
+            struct ResumeJob;
+            /// \brief
+            /// Waits for handle readiness.
+            struct HandleWaiter;
+
+            /// \brief
+            /// CoroutineJob is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (CoroutineJob)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_UTIL_HAVE_COROUTINES)
+
+#endif // !defined (__thekogans_util_CoroutineJob_h)
@@ -0,0 +1,268 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_Deflate_h)
+#define __thekogans_util_Deflate_h
+
+#if defined (THEKOGANS_UTIL_HAVE_ZLIB)
+
+#include <cstddef>
+#include <memory>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Vectorizer.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct Deflater Deflate.h thekogans/util/Deflate.h
+        ///
+        /// \brief
+        /// Deflater is a streaming zlib compressor. Feed it the data a chunk at
+        /// a time (Write), and it writes the compressed stream to the given
+        /// \see{Serializer} (\see{File}, \see{Buffer}...) as it goes. Memory use
+        /// is bounded by chunkSize regardless of how much data goes through it.
+        ///
+        /// \code{.cpp}
+        /// thekogans::util::ReadOnlyFile in (thekogans::util::HostEndian, "snapshot");
+        /// thekogans::util::SimpleFile out (thekogans::util::HostEndian, "snapshot.gz",
+        ///     thekogans::util::SimpleFile::WriteOnly |
+        ///     thekogans::util::SimpleFile::Create |
+        ///     thekogans::util::SimpleFile::Truncate);
+        /// thekogans::util::Deflater deflater (out, thekogans::util::Deflater::FORMAT_GZIP);
+        /// deflater.Write (in);
+        /// deflater.Finish ();
+        /// \endcode
+
+        struct _LIB_THEKOGANS_UTIL_DECL Deflater {
+            /// \enum
+            /// Compressed stream format.
+            enum Format {
+                /// \brief
+                /// zlib (RFC 1950) stream.
+                FORMAT_ZLIB,
+                /// \brief
+                /// gzip (RFC 1952) stream.
+                FORMAT_GZIP,
+                /// \brief
+                /// Raw deflate (RFC 1951) stream.
+                FORMAT_RAW
+            };
+            /// \enum
+            /// Compression levels.
+            enum {
+                /// \brief
+                /// zlib default (currently 6).
+                DEFAULT_LEVEL = -1,
+                /// \brief
+                /// Fastest.
+                FASTEST_LEVEL = 1,
+                /// \brief
+                /// Smallest.
+                BEST_LEVEL = 9
+            };
+            /// \enum
+            /// Default internal buffer size.
+            enum {
+                DEFAULT_CHUNK_SIZE = 64 * 1024
+            };
+
+        private:
+            /// \brief
+            /// Where the compressed stream goes.
+            Serializer &out;
+            /// \struct Deflater::Stream Deflate.cpp thekogans/util/Deflate.cpp
+            ///
+            /// \brief
+            /// Hides zlib.
+            struct Stream;
+            /// \brief
+            /// zlib stream.
+            std::unique_ptr<Stream> stream;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[out] out_ Where the compressed stream goes.
+            /// \param[in] format Compressed stream format.
+            /// \param[in] level Compression level (0 - 9, DEFAULT_LEVEL).
+            /// \param[in] chunkSize Internal output buffer size.
+            Deflater (
+                Serializer &out_,
+                Format format = FORMAT_ZLIB,
+                i32 level = DEFAULT_LEVEL,
+                std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+            /// \brief
+            /// dtor. NOTE: Does not call Finish.
+            ~Deflater ();
+
+            /// \brief
+            /// Compress the given chunk.
+            /// \param[in] data Chunk to compress.
+            /// \param[in] length Chunk length.
+            void Write (
+                const void *data,
+                std::size_t length);
+            /// \brief
+            /// Compress everything that can be read from the given serializer.
+            /// \param[in] in Serializer to read from (until it's Read returns 0).
+            /// \return Number of bytes read from in.
+            ui64 Write (Serializer &in);
+            /// \brief
+            /// Flush all pending output to a byte boundary (Z_SYNC_FLUSH).
+            /// The stream can be continued after.
+            void Flush ();
+            /// \brief
+            /// Complete the stream (write the trailer). No more writes are
+            /// allowed after Finish.
+            void Finish ();
+
+            /// \brief
+            /// Return the number of bytes consumed.
+            /// \return Number of bytes consumed.
+            ui64 GetTotalIn () const;
+            /// \brief
+            /// Return the number of bytes produced.
+            /// \return Number of bytes produced.
+            ui64 GetTotalOut () const;
+
+        private:
+            /// \brief
+            /// Run deflate until it has nothing more to say.
+            /// \param[in] flush zlib flush mode.
+            void Pump (int flush);
+
+            /// \brief
+            /// Deflater is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Deflater)
+        };
+
+        /// \struct Inflater Deflate.h thekogans/util/Deflate.h
+        ///
+        /// \brief
+        /// Inflater is a streaming zlib decompressor. Feed it the compressed
+        /// stream a chunk at a time (Write), and it writes the decompressed
+        /// data to the given \see{Serializer} as it goes. zlib and gzip streams
+        /// are detected automatically (including multi-member gzip files),
+        /// raw deflate streams must be asked for explicitly.
+
+        struct _LIB_THEKOGANS_UTIL_DECL Inflater {
+        private:
+            /// \brief
+            /// Where the decompressed data goes.
+            Serializer &out;
+            /// \struct Inflater::Stream Deflate.cpp thekogans/util/Deflate.cpp
+            ///
+            /// \brief
+            /// Hides zlib.
+            struct Stream;
+            /// \brief
+            /// zlib stream.
+            std::unique_ptr<Stream> stream;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[out] out_ Where the decompressed data goes.
+            /// \param[in] raw true == raw deflate stream,
+            /// false == zlib or gzip (auto detected).
+            /// \param[in] chunkSize Internal output buffer size.
+            Inflater (
+                Serializer &out_,
+                bool raw = false,
+                std::size_t chunkSize = Deflater::DEFAULT_CHUNK_SIZE);
+            /// \brief
+            /// dtor.
+            ~Inflater ();
+
+            /// \brief
+            /// Decompress the given chunk.
+            /// \param[in] data Chunk to decompress.
+            /// \param[in] length Chunk length.
+            /// \return true == the end of the compressed stream was reached.
+            bool Write (
+                const void *data,
+                std::size_t length);
+            /// \brief
+            /// Decompress everything that can be read from the given serializer.
+            /// \param[in] in Serializer to read from (until it's Read returns 0
+            /// or the end of the compressed stream is reached).
+            /// \return Number of bytes read from in.
+            ui64 Write (Serializer &in);
+
+            /// \brief
+            /// Return true if the end of the compressed stream was reached.
+            /// \return true == the end of the compressed stream was reached.
+            bool IsFinished () const;
+
+            /// \brief
+            /// Return the number of bytes consumed.
+            /// \return Number of bytes consumed.
+            ui64 GetTotalIn () const;
+            /// \brief
+            /// Return the number of bytes produced.
+            /// \return Number of bytes produced.
+            ui64 GetTotalOut () const;
+
+            /// \brief
+            /// Inflater is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Inflater)
+        };
+
+        /// \brief
+        /// Default \see{ParallelDeflate} block size.
+        const std::size_t DEFAULT_PARALLEL_DEFLATE_BLOCK_SIZE = 128 * 1024;
+
+        /// \brief
+        /// pigz style parallel deflate. The input is split in to blocks that are
+        /// compressed concurrently on the given \see{Vectorizer}. Each block is
+        /// primed with the 32KB of input preceding it (so the compression ratio
+        /// is within a fraction of a percent of single threaded deflate) and
+        /// ends on a byte boundary (Z_SYNC_FLUSH). The blocks are stitched
+        /// together in order, and wrapped in a zlib or gzip header and trailer
+        /// (the checksums are combined from per block checksums). The result is
+        /// a single, standard stream that any inflater (including \see{Inflater}
+        /// and Buffer::Inflate) can decompress.
+        /// NOTE: The output is written in batches, so memory use is bounded by
+        /// roughly 2 * batch of blocks, not by the input size.
+        /// VERY IMPORTANT: \see{Vectorizer} is not re-entrant. Don't call
+        /// ParallelDeflate from a job running on the same vectorizer.
+        /// \param[in] data Data to compress.
+        /// \param[in] length Data length.
+        /// \param[out] out Where the compressed stream goes.
+        /// \param[in] format Compressed stream format.
+        /// \param[in] level Compression level (0 - 9, Deflater::DEFAULT_LEVEL).
+        /// \param[in] blockSize Size of blocks compressed concurrently (>= 32KB).
+        /// \param[in] vectorizer Vectorizer to compress the blocks on.
+        /// \return Number of compressed bytes written.
+        _LIB_THEKOGANS_UTIL_DECL ui64 _LIB_THEKOGANS_UTIL_API ParallelDeflate (
+            const void *data,
+            std::size_t length,
+            Serializer &out,
+            Deflater::Format format = Deflater::FORMAT_ZLIB,
+            i32 level = Deflater::DEFAULT_LEVEL,
+            std::size_t blockSize = DEFAULT_PARALLEL_DEFLATE_BLOCK_SIZE,
+            Vectorizer &vectorizer = GlobalVectorizer::Instance ());
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
+
+#endif // !defined (__thekogans_util_Deflate_h)
@@ -38,6 +38,11 @@
 #endif // defined (TOOLCHAIN_OS_Windows)
 #include <cctype>
 #include <string>
+#include <list>
+#if defined (TOOLCHAIN_OS_Linux)
+    #include <vector>
+    #include <map>
+#endif // defined (TOOLCHAIN_OS_Linux)
 #include "pugixml/pugixml.hpp"
 #include "thekogans/util/Config.h"
 #include "thekogans/util/Types.h"
@@ -46,6 +51,7 @@
 #include "thekogans/util/OwnerMap.h"
 #include "thekogans/util/Singleton.h"
 #include "thekogans/util/SpinLock.h"
+#include "thekogans/util/TimeSpec.h"
 #include "thekogans/util/Thread.h"
 #include "thekogans/util/Serializable.h"
 
@@ -94,8 +100,11 @@ namespace thekogans {
             /// change notification singleton. It will watch
             /// a requested directory for changes and notify
             /// the callback when something interesting happens.
-            /// Watcher is NOT recursive. If you want to watch
-            /// all directories in a given branch, do something
+            /// By default Watcher is NOT recursive. On Linux and
+            /// Windows, pass recursive = true to AddWatch to watch
+            /// the whole branch (on Linux, watches for new
+            /// sub-directories are added as they appear). On OS X
+            /// (or if you need per directory watch ids) do something
             /// like this:
             ///
             /// \code{.cpp}
@@ -169,6 +178,8 @@ namespace thekogans {
                 /// Convenient typedef for THEKOGANS_UTIL_HANDLE.
                 typedef THEKOGANS_UTIL_HANDLE WatchId;
 
+                struct Event;
+
                 /// \struct Directory::Watcher::EventSink Directory.h thekogans/util/Directory.h
                 ///
                 /// \brief
@@ -217,6 +228,27 @@ namespace thekogans {
                         WatchId watchId,
                         const std::string &directory,
                         const Directory::Entry &entry) {}
+                    /// \brief
+                    /// Called with a batch of coalesced events once a
+                    /// watch's coalescing window closes (see AddWatch).
+                    /// The default implementation calls HandleAdd,
+                    /// HandleDelete and HandleModified for each event.
+                    /// \param[in] watchId Watch id of the affected directory.
+                    /// \param[in] events Coalesced events (in the order they first occurred).
+                    virtual void HandleEvents (
+                        WatchId watchId,
+                        const std::list<Event> &events);
+                    /// \brief
+                    /// Called when the system event queue overflowed and
+                    /// events were lost. By the time this is called the
+                    /// Watcher has rescanned the watched branch and
+                    /// re-synced it's watches. The sink should rescan the
+                    /// directory to bring it's own state up to date.
+                    /// \param[in] watchId Watch id of the affected directory.
+                    /// \param[in] directory Path of the watched directory.
+                    virtual void HandleOverflow (
+                        WatchId watchId,
+                        const std::string &directory) {}
                 };
 
                 struct Watch;
@@ -229,6 +261,13 @@ namespace thekogans {
                 /// \brief
                 /// Handle to epoll queue that will listen for async events.
                 THEKOGANS_UTIL_HANDLE epollHandle;
+                /// \brief
+                /// typedef for std::map<THEKOGANS_UTIL_HANDLE, Watch *>.
+                typedef std::map<THEKOGANS_UTIL_HANDLE, Watch *> SubWatches;
+                /// \brief
+                /// Maps sub-directory watch descriptors of recursive
+                /// watches to the watch they belong to.
+                SubWatches subWatches;
             #endif // defined (TOOLCHAIN_OS_Linux)
                 /// \brief
                 /// typedef for OwnerMap<WatchId, Watch>.
@@ -253,10 +292,19 @@ namespace thekogans {
                 /// Add a directory to watch for changes.
                 /// \param[in] directory Directory to watch.
                 /// \param[in] evenSink Event sink to notify of changes.
+                /// \param[in] recursive true == watch the whole branch
+                /// rooted at directory (Linux and Windows only).
+                /// \param[in] coalescingWindow If not TimeSpec::Zero,
+                /// events are accumulated for this long, duplicate and
+                /// self-cancelling ones merged, and the result delivered
+                /// to EventSink::HandleEvents as a batch (Linux only).
+                /// IMPORTANT: coalescingWindow is a relative value.
                 /// \return Newly added watch id.
                 WatchId AddWatch (
                     const std::string &directory,
-                    EventSink &evenSink);
+                    EventSink &evenSink,
+                    bool recursive = false,
+                    const TimeSpec &coalescingWindow = TimeSpec::Zero);
                 /// \brief
                 /// Given a watch id, return associated directory.
                 /// \param[in] watchId A watch id returned by AddWatch.
@@ -274,11 +322,54 @@ namespace thekogans {
                 /// Thread override to listen for and dispatch
                 /// change notifications.
                 virtual void Run () throw () override;
+
+            #if defined (TOOLCHAIN_OS_Linux)
+            private:
+                /// \brief
+                /// Deliver the batches of all watches whose coalescing
+                /// window closed, and return how long until the next one does.
+                /// \return Milliseconds to the next deadline (-1 == none pending).
+                int FlushEvents ();
+                /// \brief
+                /// Handle an inotify queue overflow by resyncing
+                /// all watches and notifying their sinks.
+                void HandleOverflow ();
+            #endif // defined (TOOLCHAIN_OS_Linux)
+            };
+
+            /// \brief
+            /// Directory::Entry fields GetFirstEntry/GetNextEntry
+            /// are asked to fill in. Entry::name is always filled.
+            /// On Linux, entries whose fields can be satisfied by
+            /// the d_type returned by getdents64 are returned without
+            /// a stat call. For all others, statx is asked only for
+            /// the requested fields. On other platforms the complete
+            /// entry is always returned.
+            enum {
+                /// \brief
+                /// Entry::type.
+                ENTRY_TYPE = 1,
+                /// \brief
+                /// Entry::mode/attributes.
+                ENTRY_MODE = 2,
+                /// \brief
+                /// Entry::lastStatusDate/creationDate,
+                /// lastAccessedDate and lastModifiedDate.
+                ENTRY_DATES = 4,
+                /// \brief
+                /// Entry::size.
+                ENTRY_SIZE = 8,
+                /// \brief
+                /// All of the above.
+                ENTRY_ALL = ENTRY_TYPE | ENTRY_MODE | ENTRY_DATES | ENTRY_SIZE
             };
 
             /// \brief
             /// Directory path.
             const std::string path;
+            /// \brief
+            /// Entry fields to fill in (see ENTRY_* above).
+            const ui32 entryFields;
         #if defined (TOOLCHAIN_OS_Windows)
             /// \brief
             /// Windows directory traversal handle.
@@ -289,6 +380,33 @@ namespace thekogans {
             /// \brief
             /// Windows directory creation date and time.
             i64 creationDate;
+        #elif defined (TOOLCHAIN_OS_Linux)
+            /// \brief
+            /// Default getdents64 buffer size. Big enough to
+            /// retrieve a few thousand entries per system call.
+            enum {
+                DEFAULT_BUFFER_SIZE = 64 * 1024
+            };
+            /// \brief
+            /// Linux directory traversal handle. It's also
+            /// used as the base for fstatat/statx calls to
+            /// avoid resolving the directory path for every entry.
+            THEKOGANS_UTIL_HANDLE handle;
+            /// \brief
+            /// Buffer getdents64 reads entries in to.
+            std::vector<ui8> buffer;
+            /// \brief
+            /// Offset of the next entry in buffer.
+            std::size_t bufferOffset;
+            /// \brief
+            /// Number of valid bytes in buffer.
+            std::size_t bufferLength;
+            /// \brief
+            /// Permission flags.
+            i32 mode;
+            /// \brief
+            /// POSIX directory last status date and time.
+            i64 lastStatusDate;
         #else // defined (TOOLCHAIN_OS_Windows)
             /// \brief
             /// POSIX directory traversal handle.
@@ -310,7 +428,10 @@ namespace thekogans {
             /// \brief
             /// ctor.
             /// \param[in] path_ The path this Directory object represents.
-            explicit Directory (const std::string &path_);
+            /// \param[in] entryFields_ Entry fields to fill in (see ENTRY_* above).
+            explicit Directory (
+                const std::string &path_,
+                ui32 entryFields_ = ENTRY_ALL);
             /// \brief
             /// dtor.
             ~Directory ();
@@ -615,6 +736,16 @@ namespace thekogans {
             void GetEntry (
                 const WIN32_FIND_DATAW &findData,
                 Entry &entry) const;
+        #elif defined (TOOLCHAIN_OS_Linux)
+            /// \brief
+            /// Linux directory traversal get entry.
+            /// \param[in] name Entry name.
+            /// \param[in] d_type Entry type as returned by getdents64.
+            /// \param[out] entry Entry info.
+            void GetEntry (
+                const char *name,
+                ui8 d_type,
+                Entry &entry) const;
         #else // defined (TOOLCHAIN_OS_Windows)
             /// \brief
             /// POSIX directory traversal get entry.
@@ -626,6 +757,51 @@ namespace thekogans {
         #endif // defined (TOOLCHAIN_OS_Windows)
         };
 
+        /// \struct Directory::Watcher::Event Directory.h thekogans/util/Directory.h
+        ///
+        /// \brief
+        /// A (coalesced) change event delivered to
+        /// Directory::Watcher::EventSink::HandleEvents.
+        struct _LIB_THEKOGANS_UTIL_DECL Directory::Watcher::Event {
+            /// \brief
+            /// Event type.
+            enum {
+                /// \brief
+                /// Entry was added.
+                Add,
+                /// \brief
+                /// Entry was deleted.
+                Delete,
+                /// \brief
+                /// Entry was modified.
+                Modified
+            };
+            /// \brief
+            /// Event type.
+            ui8 type;
+            /// \brief
+            /// Path of the directory containing the entry. For
+            /// recursive watches this is the sub-directory the
+            /// change occurred in.
+            std::string directory;
+            /// \brief
+            /// Affected entry. For Delete events, only entry.name is valid.
+            Entry entry;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] type_ Event type.
+            /// \param[in] directory_ Path of the directory containing the entry.
+            /// \param[in] entry_ Affected entry.
+            Event (
+                ui8 type_,
+                const std::string &directory_,
+                const Entry &entry_) :
+                type (type_),
+                directory (directory_),
+                entry (entry_) {}
+        };
+
         /// \brief
         /// Compare two directory entries for equality.
         /// \param[in] entry1 First entry to compare.
@@ -0,0 +1,222 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_DirectoryWalker_h)
+#define __thekogans_util_DirectoryWalker_h
+
+#include <string>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Directory.h"
+#include "thekogans/util/RunLoop.h"
+#include "thekogans/util/JobQueuePool.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct DirectoryWalker DirectoryWalker.h thekogans/util/DirectoryWalker.h
+        ///
+        /// \brief
+        /// DirectoryWalker walks a directory tree in parallel. Every
+        /// sub-directory is scanned by a job on the given \see{RunLoop}
+        /// (usually a multi-worker \see{JobQueue}) or on \see{JobQueue}s
+        /// borrowed from a \see{JobQueuePool}. To keep memory bounded on
+        /// very wide trees, at most maxInFlight directory jobs are queued
+        /// at any one time. Once that limit is reached, sub-directories
+        /// are scanned in-line by the thread that found them.
+        ///
+        /// Here is a canonical use case:
+        ///
+        /// \code{.cpp}
+        /// struct Visitor : public thekogans::util::DirectoryWalker::Visitor {
+        ///     virtual bool Filter (
+        ///             const std::string &directory,
+        ///             const thekogans::util::Directory::Entry &entry) override {
+        ///         // Don't descend in to .git directories.
+        ///         return entry.type != thekogans::util::Directory::Entry::Folder ||
+        ///             entry.name != ".git";
+        ///     }
+        ///     virtual void VisitEntry (
+        ///             const std::string &directory,
+        ///             const thekogans::util::Directory::Entry &entry) override {
+        ///         // Called concurrently from multiple threads.
+        ///     }
+        /// } visitor;
+        /// thekogans::util::JobQueue jobQueue (
+        ///     "DirectoryWalker",
+        ///     thekogans::util::RunLoop::JobExecutionPolicy::SharedPtr (
+        ///         new thekogans::util::RunLoop::FIFOJobExecutionPolicy),
+        ///     thekogans::util::SystemInfo::Instance ().GetCPUCount ());
+        /// thekogans::util::DirectoryWalker::Walk (path, visitor, jobQueue);
+        /// \endcode
+        ///
+        /// IMPORTANT: Walk blocks until the whole tree has been visited.
+        /// Do not call it from one of the workers of the run loop doing
+        /// the walk, as that worker will not be available to service it.
+
+        struct _LIB_THEKOGANS_UTIL_DECL DirectoryWalker {
+            /// \struct DirectoryWalker::Visitor DirectoryWalker.h thekogans/util/DirectoryWalker.h
+            ///
+            /// \brief
+            /// Visitor receives walk notifications. Since directories are
+            /// scanned in parallel, all methods can be called concurrently
+            /// from multiple threads and must be thread safe.
+            struct _LIB_THEKOGANS_UTIL_DECL Visitor {
+                /// \brief
+                /// dtor.
+                virtual ~Visitor () {}
+
+                /// \brief
+                /// Called for every entry (except '.' and '..') before it's visited.
+                /// \param[in] directory Path of the directory containing the entry.
+                /// \param[in] entry Entry to filter.
+                /// \return true == visit the entry (and if it's a folder, descend
+                /// in to it), false == skip the entry (and prune the branch).
+                virtual bool Filter (
+                        const std::string & /*directory*/,
+                        const Directory::Entry & /*entry*/) {
+                    return true;
+                }
+                /// \brief
+                /// Called for every entry that passed the Filter.
+                /// \param[in] directory Path of the directory containing the entry.
+                /// \param[in] entry Entry being visited.
+                virtual void VisitEntry (
+                    const std::string & /*directory*/,
+                    const Directory::Entry & /*entry*/) {}
+                /// \brief
+                /// Called once all the entries of a directory, and all it's
+                /// sub-directories have been visited (post-order). The root
+                /// of the walk is included.
+                /// \param[in] directory Path of the directory that was left.
+                virtual void LeaveDirectory (const std::string & /*directory*/) {}
+                /// \brief
+                /// Called when an error occurs scanning a directory. The
+                /// walk continues with the rest of the tree.
+                /// \param[in] directory Path of the directory being scanned.
+                /// \param[in] exception Exception representing the error.
+                virtual void HandleError (
+                    const std::string & /*directory*/,
+                    const Exception & /*exception*/) {}
+            };
+
+            /// \brief
+            /// Default maximum number of directory jobs queued at one time.
+            enum {
+                DEFAULT_MAX_IN_FLIGHT = 1024
+            };
+
+            /// \brief
+            /// Walk the tree rooted at the given path using the given run loop.
+            /// \param[in] path Root of the tree to walk.
+            /// \param[in] visitor \see{Visitor} to notify.
+            /// \param[in] runLoop \see{RunLoop} to scan sub-directories on.
+            /// \param[in] entryFields \see{Directory} entry fields the visitor needs.
+            /// \param[in] maxInFlight Maximum number of directory jobs queued at one time.
+            /// \return true == the whole tree was walked, false == the run loop
+            /// was stopped (or the jobs cancelled) before the walk completed.
+            static bool Walk (
+                const std::string &path,
+                Visitor &visitor,
+                RunLoop &runLoop,
+                ui32 entryFields = Directory::ENTRY_TYPE,
+                std::size_t maxInFlight = DEFAULT_MAX_IN_FLIGHT);
+            /// \brief
+            /// Walk the tree rooted at the given path using \see{JobQueue}s
+            /// borrowed from the given pool. Sub-directory jobs are distributed
+            /// round-robin among the borrowed queues.
+            /// \param[in] path Root of the tree to walk.
+            /// \param[in] visitor \see{Visitor} to notify.
+            /// \param[in] jobQueuePool \see{JobQueuePool} to borrow \see{JobQueue}s from.
+            /// \param[in] jobQueueCount Maximum number of \see{JobQueue}s to borrow.
+            /// \param[in] entryFields \see{Directory} entry fields the visitor needs.
+            /// \param[in] maxInFlight Maximum number of directory jobs queued at one time.
+            /// \return true == the whole tree was walked, false == the run loop
+            /// was stopped (or the jobs cancelled) before the walk completed.
+            static bool Walk (
+                const std::string &path,
+                Visitor &visitor,
+                JobQueuePool &jobQueuePool,
+                std::size_t jobQueueCount,
+                ui32 entryFields = Directory::ENTRY_TYPE,
+                std::size_t maxInFlight = DEFAULT_MAX_IN_FLIGHT);
+
+            /// \struct DirectoryWalker::Summary DirectoryWalker.h thekogans/util/DirectoryWalker.h
+            ///
+            /// \brief
+            /// Tree entry counts and total size returned by GetSummary.
+            struct _LIB_THEKOGANS_UTIL_DECL Summary {
+                /// \brief
+                /// Number of regular files.
+                ui64 files;
+                /// \brief
+                /// Number of directories (not including the root).
+                ui64 folders;
+                /// \brief
+                /// Number of symbolic links.
+                ui64 links;
+                /// \brief
+                /// Number of other entries (devices, pipes, sockets...).
+                ui64 other;
+                /// \brief
+                /// Number of directories that could not be scanned.
+                ui64 errors;
+                /// \brief
+                /// Total size (in bytes) of all regular files.
+                ui64 size;
+
+                /// \brief
+                /// ctor.
+                Summary () :
+                    files (0),
+                    folders (0),
+                    links (0),
+                    other (0),
+                    errors (0),
+                    size (0) {}
+            };
+
+            /// \brief
+            /// Count the entries, and total the file sizes of the given tree.
+            /// \param[in] path Root of the tree to summarize.
+            /// \param[in] runLoop \see{RunLoop} to scan sub-directories on.
+            /// \param[in] maxInFlight Maximum number of directory jobs queued at one time.
+            /// \return \see{Summary}.
+            static Summary GetSummary (
+                const std::string &path,
+                RunLoop &runLoop,
+                std::size_t maxInFlight = DEFAULT_MAX_IN_FLIGHT);
+
+            /// \brief
+            /// Parallel version of Directory::Delete (path, true). Files are
+            /// deleted as they are found, directories once they are empty.
+            /// If anything could not be deleted, the first error is rethrown
+            /// after the walk completes.
+            /// \param[in] path Root of the tree to delete.
+            /// \param[in] runLoop \see{RunLoop} to scan sub-directories on.
+            /// \param[in] maxInFlight Maximum number of directory jobs queued at one time.
+            static void Delete (
+                const std::string &path,
+                RunLoop &runLoop,
+                std::size_t maxInFlight = DEFAULT_MAX_IN_FLIGHT);
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_DirectoryWalker_h)
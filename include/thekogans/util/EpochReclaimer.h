@@ -0,0 +1,207 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_EpochReclaimer_h)
+#define __thekogans_util_EpochReclaimer_h
+
+#include <cstddef>
+#include <atomic>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Singleton.h"
+#include "thekogans/util/Reclaimer.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct EpochReclaimer EpochReclaimer.h thekogans/util/EpochReclaimer.h
+        ///
+        /// \brief
+        /// EpochReclaimer is a \see{Reclaimer} domain based on epochs. Readers
+        /// bracket their access to shared objects with a \see{Guard} (a critical
+        /// section) that announces the global epoch the reader entered in. Objects
+        /// are stamped with the epoch they were retired in, and the global epoch
+        /// only advances once every reader inside a critical section has caught up
+        /// with it. An object retired in epoch e is therefore freed once the global
+        /// epoch reaches e + 2, as no reader can still be in a critical section that
+        /// started before it was unlinked.
+        ///
+        /// Entering and leaving a critical section costs two stores (and a fence) to
+        /// the thread's own cache line, and a critical section can read any number
+        /// of objects, which makes epochs the cheaper choice for short readers
+        /// traversing many nodes. The flip side is that a reader stalled inside a
+        /// critical section holds up the reclamation of everything retired after it
+        /// entered. If that's a concern, use \see{HazardPointerReclaimer}.
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// bool Contains (const List &list, ui32 value) {
+        ///     util::EpochReclaimer::Guard guard;
+        ///     // No node reachable from list.head will be freed
+        ///     // until guard goes out of scope.
+        ///     for (Node *node = list.head.load (); node != 0; node = node->next.load ()) {
+        ///         if (node->value == value) {
+        ///             return true;
+        ///         }
+        ///     }
+        ///     return false;
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_UTIL_DECL EpochReclaimer : public Reclaimer {
+            enum {
+                /// \brief
+                /// Default retireThreshold.
+                DEFAULT_RETIRE_THRESHOLD = 64
+            };
+
+        protected:
+            /// \struct EpochReclaimer::ThreadRecord EpochReclaimer.h thekogans/util/EpochReclaimer.h
+            ///
+            /// \brief
+            /// Forward declaration of the thread record holding the reader's epoch.
+            struct ThreadRecord;
+
+        public:
+            /// \struct EpochReclaimer::Guard EpochReclaimer.h thekogans/util/EpochReclaimer.h
+            ///
+            /// \brief
+            /// A read side critical section. Objects reachable when the Guard was
+            /// created stay valid until it goes out of scope. Guards nest (only the
+            /// outermost one enters/leaves the critical section), but are not
+            /// shareable between threads.
+            struct _LIB_THEKOGANS_UTIL_DECL Guard {
+            private:
+                /// \brief
+                /// The calling thread's record.
+                ThreadRecord &record;
+
+            public:
+                /// \brief
+                /// ctor. Enter the critical section.
+                /// \param[in] reclaimer Domain the objects being read are retired to.
+                explicit Guard (
+                    EpochReclaimer &reclaimer = GetGlobalEpochReclaimer ());
+                /// \brief
+                /// dtor. Leave the critical section.
+                ~Guard ();
+
+                /// \brief
+                /// Guard is neither copy constructable, nor assignable.
+                THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Guard)
+            };
+
+        protected:
+            /// \brief
+            /// Global epoch.
+            std::atomic<ui64> epoch;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] retireThreshold Scan the thread's retired
+            /// list once it's this long.
+            explicit EpochReclaimer (
+                std::size_t retireThreshold = DEFAULT_RETIRE_THRESHOLD) :
+                Reclaimer (retireThreshold),
+                epoch (0) {}
+
+            /// \brief
+            /// Return the global epoch.
+            /// \return Global epoch.
+            inline ui64 GetEpoch () const {
+                return epoch.load (std::memory_order_relaxed);
+            }
+
+        protected:
+            /// \struct EpochReclaimer::ThreadRecord EpochReclaimer.h thekogans/util/EpochReclaimer.h
+            ///
+            /// \brief
+            /// Adds the reader's epoch to \see{Reclaimer::ThreadRecord}.
+            struct ThreadRecord : public Reclaimer::ThreadRecord {
+                /// \brief
+                /// (epoch << 1) | 1 while in a critical section, 0 otherwise.
+                std::atomic<ui64> readerEpoch;
+                /// \brief
+                /// Guard nesting level (only touched by the owning thread).
+                std::size_t nestingLevel;
+
+                /// \brief
+                /// ctor.
+                ThreadRecord () :
+                    readerEpoch (0),
+                    nestingLevel (0) {}
+
+                /// \brief
+                /// Leave the critical section.
+                virtual void Clear () override;
+            };
+
+            // Reclaimer
+            /// \brief
+            /// Create a new thread record.
+            /// \return New thread record.
+            virtual Reclaimer::ThreadRecord *NewThreadRecord () override;
+            /// \brief
+            /// Stamp the object with the global epoch.
+            /// \param[in] object Object being retired.
+            virtual void OnRetire (RetiredObject &object) override;
+            /// \brief
+            /// Try to advance the global epoch, and free the retired
+            /// objects that are two epochs old.
+            /// \param[in, out] retired List of retired objects to scan.
+            /// \return Number of objects freed.
+            virtual std::size_t Scan (RetiredObjects &retired) override;
+
+        private:
+            /// \brief
+            /// Advance the global epoch if every reader in
+            /// a critical section has seen the current one.
+            void TryAdvanceEpoch ();
+
+            /// \brief
+            /// Return the GlobalEpochReclaimer (used by the Guard ctor
+            /// default argument, as the global isn't defined yet).
+            /// \return GlobalEpochReclaimer::Instance ().
+            static EpochReclaimer &GetGlobalEpochReclaimer ();
+        };
+
+        /// \struct GlobalEpochReclaimer EpochReclaimer.h thekogans/util/EpochReclaimer.h
+        ///
+        /// \brief
+        /// The process wide \see{EpochReclaimer} domain. Keep in mind that a stalled
+        /// reader holds up reclamation for everyone sharing the domain. Structures
+        /// whose readers might block inside a critical section deserve their own.
+
+        struct _LIB_THEKOGANS_UTIL_DECL GlobalEpochReclaimer :
+                public EpochReclaimer,
+                public Singleton<GlobalEpochReclaimer, SpinLock> {
+            /// \brief
+            /// ctor.
+            /// \param[in] retireThreshold Scan the thread's retired
+            /// list once it's this long.
+            explicit GlobalEpochReclaimer (
+                std::size_t retireThreshold = DEFAULT_RETIRE_THRESHOLD) :
+                EpochReclaimer (retireThreshold) {}
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_EpochReclaimer_h)
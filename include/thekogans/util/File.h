@@ -43,11 +43,13 @@
 #endif // defined (TOOLCHAIN_OS_Windows)
 #include <cstdio>
 #include <string>
+#include <memory>
 #include "thekogans/util/Config.h"
 #include "thekogans/util/Types.h"
 #include "thekogans/util/TimeSpec.h"
 #include "thekogans/util/Serializer.h"
 #include "thekogans/util/Buffer.h"
+#include "thekogans/util/AlignedAllocator.h"
 #include "thekogans/util/GUID.h"
 #include "thekogans/util/Exception.h"
 
@@ -416,6 +418,173 @@ namespace thekogans {
             THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (TenantFile)
         };
 
+        /// \struct DirectFile File.h thekogans/util/File.h
+        ///
+        /// \brief
+        /// DirectFile bypasses the page cache (O_DIRECT on Linux, F_NOCACHE
+        /// on OS X, FILE_FLAG_NO_BUFFERING on Windows). That's what you want
+        /// when writing (or reading) multi-GB files sequentially: the data is
+        /// DMA'd straight from your buffers instead of being copied in to the
+        /// page cache (and evicting everything else in it). Direct I/O requires
+        /// the memory, the file offset and the transfer size to be multiples of
+        /// the device block size (\see{GetBlockSize}). DirectFile enforces that
+        /// for you: aligned requests go straight to the device, everything else
+        /// goes through an aligned staging buffer. Sequential writes of any size
+        /// are gathered in the stage and written a stage at a time, the
+        /// unaligned head and tail of a write are read-modify-written, and
+        /// on Flush/Close the padded tail block is truncated back to the
+        /// logical file size. For best performance write from
+        /// \see{AlignedBufferPool} buffers in multiples of the block size.
+        ///
+        /// NOTE: DirectFile keeps it's own file position (it uses positional
+        /// I/O) and ignores the Append flag's O_APPEND semantics (it just
+        /// positions the file at the end after opening).
+        /// VERY IMPORTANT: Until Flush (or Close) is called, the tail of the
+        /// last write might still be in the stage and the file on disk might
+        /// be longer than GetSize (padded to a block boundary).
+
+        struct _LIB_THEKOGANS_UTIL_DECL DirectFile : public SimpleFile {
+        private:
+            /// \brief
+            /// Device block size (alignment of memory, offsets and sizes).
+            std::size_t blockSize;
+            /// \brief
+            /// Requested stage size.
+            std::size_t requestedStageSize;
+            /// \brief
+            /// Stage size (multiple of blockSize).
+            std::size_t stageSize;
+            /// \brief
+            /// Allocator for the stage.
+            std::unique_ptr<AlignedAllocator> allocator;
+            /// \brief
+            /// Staging buffer for unaligned I/O.
+            ui8 *stage;
+            /// \brief
+            /// File offset of stage[0] (block aligned).
+            ui64 stageOffset;
+            /// \brief
+            /// Number of valid (dirty) bytes in the stage.
+            std::size_t stageLength;
+            /// \brief
+            /// Logical file position.
+            ui64 position;
+            /// \brief
+            /// Logical file size.
+            ui64 size;
+            /// \brief
+            /// Size of the file on disk (can be padded past size).
+            ui64 diskSize;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] endianness File endianness.
+            /// \param[in] path Path to file to open.
+            /// \param[in] flags \see{SimpleFile} flags.
+            /// \param[in] stageSize_ Size of the staging buffer (rounded
+            /// up to a multiple of the block size).
+            DirectFile (
+                Endianness endianness,
+                const std::string &path,
+                i32 flags = ReadWrite | Create,
+                std::size_t stageSize_ = 1024 * 1024);
+            /// \brief
+            /// dtor. Flush the stage and close the file.
+            virtual ~DirectFile ();
+
+            /// \brief
+            /// Return the device block size. Memory, offsets and sizes that
+            /// are multiples of it go straight to the device.
+            /// \return Device block size.
+            inline std::size_t GetBlockSize () const {
+                return blockSize;
+            }
+
+            /// \brief
+            /// Open the file for direct I/O.
+            /// \param[in] path Path to file to open.
+            /// \param[in] flags \see{SimpleFile} flags.
+            /// \param[in] mode Not used. Here to match the signature of \see{File::Open}.
+            virtual void Open (
+                const std::string &path,
+                i32 flags = ReadWrite | Create,
+                i32 mode = 0) override;
+            /// \brief
+            /// Flush the stage, trim the padded tail and close the file.
+            virtual void Close () override;
+            /// \brief
+            /// Flush the stage, trim the padded tail and sync the file.
+            virtual void Flush () override;
+
+            // Serializer
+            /// \brief
+            /// Read bytes from the file.
+            /// \param[out] buffer Where to place the bytes.
+            /// \param[in] count Number of bytes to read.
+            /// \return Number of bytes actually read.
+            virtual std::size_t Read (
+                void *buffer,
+                std::size_t count) override;
+            /// \brief
+            /// Write bytes to the file.
+            /// \param[in] buffer Where the bytes come from.
+            /// \param[in] count Number of bytes to write.
+            /// \return Number of bytes actually written.
+            virtual std::size_t Write (
+                const void *buffer,
+                std::size_t count) override;
+
+            /// \brief
+            /// Return the file pointer position.
+            /// \return The file pointer position.
+            virtual i64 Tell () const override;
+            /// \brief
+            /// Reposition the file pointer.
+            /// \param[in] offset Offset to move relative to fromWhere.
+            /// \param[in] fromWhere SEEK_SET, SEEK_CUR or SEEK_END.
+            /// \return The new file pointer position.
+            virtual i64 Seek (
+                i64 offset,
+                i32 fromWhere) override;
+            /// \brief
+            /// Return the logical file size in bytes.
+            /// \return File size in bytes.
+            virtual ui64 GetSize () const override;
+            /// \brief
+            /// Truncates or expands the file.
+            /// \param[in] newSize New size to set the file to.
+            virtual void SetSize (ui64 newSize) override;
+
+        private:
+            /// \brief
+            /// Write the stage (padded to a block boundary) to disk.
+            void FlushStage ();
+            /// \brief
+            /// Positional read.
+            /// \param[out] buffer Where to place the bytes.
+            /// \param[in] count Number of bytes to read.
+            /// \param[in] offset File offset to read from.
+            /// \return Number of bytes read.
+            std::size_t PRead (
+                void *buffer,
+                std::size_t count,
+                ui64 offset);
+            /// \brief
+            /// Positional write of all count bytes.
+            /// \param[in] buffer Where the bytes come from.
+            /// \param[in] count Number of bytes to write.
+            /// \param[in] offset File offset to write to.
+            void PWrite (
+                const void *buffer,
+                std::size_t count,
+                ui64 offset);
+
+            /// \brief
+            /// DirectFile is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (DirectFile)
+        };
+
     } // namespace util
 } // namespace thekogans
 
@@ -20,8 +20,14 @@
 
 #include <string>
 #include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
 #include "thekogans/util/Logger.h"
 #include "thekogans/util/File.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/TimeSpec.h"
+#include "thekogans/util/Timer.h"
+#include "thekogans/util/JobQueue.h"
+#include "thekogans/util/Mutex.h"
 
 namespace thekogans {
     namespace util {
@@ -33,8 +39,18 @@ namespace thekogans {
         /// file. If archive_ = true, the log file is rotated. Two
         /// backups are created (*.1, and *.2). Older archives will be
         /// dropped.
+        ///
+        /// Entries are not written to the file one at a time. They are
+        /// coalesced in to a write buffer which is committed to the file
+        /// in a single write when it fills up, when flushInterval expires,
+        /// or when Flush is called. When the log file grows past maxLogFileSize
+        /// it is renamed out of the way and a fresh one is started. Shifting
+        /// (and optionally compressing) the archives is done on a private
+        /// \see{JobQueue} so that it never stalls the logger.
 
-        struct _LIB_THEKOGANS_UTIL_DECL FileLogger : public Logger {
+        struct _LIB_THEKOGANS_UTIL_DECL FileLogger :
+                public Logger,
+                public Timer::Callback {
         private:
             /// \brief
             /// Path to a file that will hold the log.
@@ -49,8 +65,27 @@ namespace thekogans {
             /// Max log file size before archiving.
             std::size_t maxLogFileSize;
             /// \brief
+            /// true = Deflate archived logs (*.1.z, *.2.z...).
+            bool compressArchives;
+            /// \brief
+            /// Entries are accumulated here before being written to the file.
+            Buffer buffer;
+            /// \brief
             /// File to log to.
             SimpleFile file;
+            /// \brief
+            /// Current log file size. Kept here to avoid calling stat for every entry.
+            ui64 fileSize;
+            /// \brief
+            /// Archives are rotated (and compressed) on this queue.
+            /// Created on first rotation.
+            JobQueue::SharedPtr archiveQueue;
+            /// \brief
+            /// Synchronization mutex (Log and Alarm run on different threads).
+            Mutex mutex;
+            /// \brief
+            /// Periodically flushes the buffer.
+            Timer timer;
 
         public:
             enum {
@@ -59,7 +94,14 @@ namespace thekogans {
                 DEFAULT_ARCHIVE_COUNT = 2,
                 /// \brief
                 /// Default max log file size before archiving.
-                DEFAULT_MAX_LOG_FILE_SIZE = 2 * 1024 * 1024
+                DEFAULT_MAX_LOG_FILE_SIZE = 2 * 1024 * 1024,
+                /// \brief
+                /// Default write buffer size.
+                DEFAULT_MAX_BUFFER_SIZE = 64 * 1024,
+                /// \brief
+                /// Default number of milliseconds entries are
+                /// allowed to stay in the buffer.
+                DEFAULT_FLUSH_INTERVAL = 1000
             };
 
             /// \brief
@@ -69,17 +111,27 @@ namespace thekogans {
             /// \param[in] archiveCount_ Number of archives before we start droping.
             /// \param[in] maxLogFileSize_ Max log file size before archiving.
             /// \param[in] level \see{LoggerMgr::level} this logger will log up to.
+            /// \param[in] compressArchives_ true = Deflate archived logs.
+            /// NOTE: Ignored if util was built without THEKOGANS_UTIL_HAVE_ZLIB.
+            /// \param[in] maxBufferSize Write buffer size. 0 = write each entry
+            /// as it arrives.
+            /// \param[in] flushInterval How long entries are allowed to sit in the
+            /// buffer before being written to the file. TimeSpec::Zero = only flush
+            /// when the buffer fills up or when Flush is called.
             FileLogger (
                 const std::string &path_,
                 bool archive_ = true,
                 std::size_t archiveCount_ = DEFAULT_ARCHIVE_COUNT,
                 std::size_t maxLogFileSize_ = DEFAULT_MAX_LOG_FILE_SIZE,
-                ui32 level = MaxLevel) :
-                Logger (level),
-                path (path_),
-                archive (archive_),
-                archiveCount (archiveCount_),
-                maxLogFileSize (maxLogFileSize_) {}
+                ui32 level = MaxLevel,
+                bool compressArchives_ = false,
+                std::size_t maxBufferSize = DEFAULT_MAX_BUFFER_SIZE,
+                const TimeSpec &flushInterval =
+                    TimeSpec::FromMilliseconds (DEFAULT_FLUSH_INTERVAL));
+            /// \brief
+            /// dtor.
+            /// Commit the buffer and wait for pending archive rotations.
+            virtual ~FileLogger ();
 
             // Logger
             /// \brief
@@ -98,19 +150,28 @@ namespace thekogans {
             /// Flush the logger buffers.
             /// \param[in] timeSpec How long to wait for logger to complete.
             /// IMPORTANT: timeSpec is a relative value.
-            virtual void Flush (const TimeSpec & /*timeSpec*/ = TimeSpec::Infinite) override {
-                if (file.IsOpen ()) {
-                    file.Flush ();
-                }
-            }
+            virtual void Flush (const TimeSpec &timeSpec = TimeSpec::Infinite) override;
 
         private:
+            // Timer::Callback
+            /// \brief
+            /// Called every flushInterval to commit the buffer.
+            /// \param[in] timer Timer that fired.
+            virtual void Alarm (Timer & /*timer*/) throw () override;
+
+            /// \brief
+            /// Write the buffer contents to the file.
+            /// NOTE: Must be called with mutex held.
+            void FlushBuffer ();
+
             /// \brief
             /// If archive == true, rotate the log.
+            /// NOTE: Must be called with mutex held.
             void ArchiveLog ();
 
             /// \brief
             /// (Re)Open the log file. Create the directory path if it doesn't exist.
+            /// NOTE: Must be called with mutex held.
             void OpenFile ();
 
             /// \brief
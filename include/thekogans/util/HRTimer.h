@@ -65,7 +65,7 @@ namespace thekogans {
             static ui64 ComputeElapsedTime (
                     ui64 start,
                     ui64 stop) {
-                return stop > start ? stop - start : UI64_MAX - (start - stop);
+                return stop >= start ? stop - start : UI64_MAX - (start - stop);
             }
 
             // NOTE: The following two methods convert a relative
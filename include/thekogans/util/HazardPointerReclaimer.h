@@ -0,0 +1,232 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_HazardPointerReclaimer_h)
+#define __thekogans_util_HazardPointerReclaimer_h
+
+#include <cstddef>
+#include <atomic>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Singleton.h"
+#include "thekogans/util/Reclaimer.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct HazardPointerReclaimer HazardPointerReclaimer.h thekogans/util/HazardPointerReclaimer.h
+        ///
+        /// \brief
+        /// HazardPointerReclaimer is a \see{Reclaimer} domain based on hazard
+        /// pointers. Before dereferencing a shared pointer, a reader publishes
+        /// it in one of it's thread's hazard pointer slots (\see{Guard::Protect}),
+        /// and a retired object is only freed once it's not in any thread's slots.
+        /// Readers pay one store and one load per protected pointer, memory held
+        /// by stalled readers is bounded (a reader can pin at most HAZARD_POINTER_COUNT
+        /// objects) and a scan costs O(retired + threads * HAZARD_POINTER_COUNT).
+        /// Use it when readers hold on to objects for a long (or unpredictable) time.
+        /// If readers are short and you care more about read side cost, use
+        /// \see{EpochReclaimer}. Here's a typical read:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// std::atomic<Config *> config;
+        ///
+        /// std::string GetValue (const std::string &key) {
+        ///     util::HazardPointerReclaimer::Guard guard;
+        ///     Config *current = guard.Protect (config);
+        ///     // current can't be freed until guard goes out of scope.
+        ///     return current->GetValue (key);
+        /// }
+        ///
+        /// void SetConfig (Config *newConfig) {
+        ///     util::GlobalHazardPointerReclaimer::Instance ().Retire (
+        ///         config.exchange (newConfig));
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_UTIL_DECL HazardPointerReclaimer : public Reclaimer {
+            enum {
+                /// \brief
+                /// Hazard pointer slots per thread (max live Guards per thread).
+                HAZARD_POINTER_COUNT = 8,
+                /// \brief
+                /// Default retireThreshold. The scan threshold is also
+                /// scaled with the number of threads so that, on average,
+                /// at least half of the objects scanned are freed.
+                DEFAULT_RETIRE_THRESHOLD = 64
+            };
+
+        protected:
+            /// \struct HazardPointerReclaimer::ThreadRecord HazardPointerReclaimer.h
+            /// thekogans/util/HazardPointerReclaimer.h
+            ///
+            /// \brief
+            /// Forward declaration of the thread record holding the hazard pointers.
+            struct ThreadRecord;
+
+        public:
+            /// \struct HazardPointerReclaimer::Guard HazardPointerReclaimer.h
+            /// thekogans/util/HazardPointerReclaimer.h
+            ///
+            /// \brief
+            /// A hazard pointer. Guard owns one of the calling thread's hazard
+            /// pointer slots for it's lifetime. The object it protects can't be
+            /// freed until the Guard is Reset, protects something else or goes
+            /// out of scope. Guards are not shareable between threads.
+            struct _LIB_THEKOGANS_UTIL_DECL Guard {
+            private:
+                /// \brief
+                /// The slot's thread record.
+                ThreadRecord &record;
+                /// \brief
+                /// Our slot index.
+                std::size_t index;
+                /// \brief
+                /// Our slot.
+                std::atomic<void *> *hazardPointer;
+
+            public:
+                /// \brief
+                /// ctor. Acquire a hazard pointer slot.
+                /// \param[in] reclaimer Domain the protected objects are retired to.
+                explicit Guard (
+                    HazardPointerReclaimer &reclaimer =
+                        GetGlobalHazardPointerReclaimer ());
+                /// \brief
+                /// dtor. Release the hazard pointer slot.
+                ~Guard ();
+
+                /// \brief
+                /// Load the given pointer and protect the object it points to.
+                /// \param[in] source Shared pointer to load.
+                /// \return The protected object (0 if source was 0).
+                template<typename T>
+                T *Protect (const std::atomic<T *> &source) {
+                    T *object = source.load (std::memory_order_acquire);
+                    for (;;) {
+                        // Publish, then make sure the object is still
+                        // reachable. If it is, a writer that unlinks it
+                        // from now on will see our hazard pointer when
+                        // it scans.
+                        hazardPointer->store (object, std::memory_order_seq_cst);
+                        T *current = source.load (std::memory_order_seq_cst);
+                        if (current == object) {
+                            return object;
+                        }
+                        object = current;
+                    }
+                }
+                /// \brief
+                /// Protect an object known to be reachable (the caller
+                /// already holds it through another Guard).
+                /// \param[in] object Object to protect.
+                inline void Set (void *object) {
+                    hazardPointer->store (object, std::memory_order_seq_cst);
+                }
+                /// \brief
+                /// Stop protecting the object.
+                inline void Reset () {
+                    hazardPointer->store (0, std::memory_order_release);
+                }
+
+                /// \brief
+                /// Guard is neither copy constructable, nor assignable.
+                THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Guard)
+            };
+
+            /// \brief
+            /// ctor.
+            /// \param[in] retireThreshold Scan the thread's retired
+            /// list once it's this long.
+            explicit HazardPointerReclaimer (
+                std::size_t retireThreshold = DEFAULT_RETIRE_THRESHOLD) :
+                Reclaimer (retireThreshold) {}
+
+        protected:
+            /// \struct HazardPointerReclaimer::ThreadRecord HazardPointerReclaimer.h
+            /// thekogans/util/HazardPointerReclaimer.h
+            ///
+            /// \brief
+            /// Adds the hazard pointer slots to \see{Reclaimer::ThreadRecord}.
+            struct ThreadRecord : public Reclaimer::ThreadRecord {
+                /// \brief
+                /// Hazard pointer slots.
+                std::atomic<void *> hazardPointers[HAZARD_POINTER_COUNT];
+                /// \brief
+                /// Bit mask of slots owned by Guards (only
+                /// touched by the owning thread).
+                ui32 usedHazardPointers;
+
+                /// \brief
+                /// ctor.
+                ThreadRecord ();
+
+                /// \brief
+                /// Clear the hazard pointers.
+                virtual void Clear () override;
+            };
+
+            // Reclaimer
+            /// \brief
+            /// Create a new thread record.
+            /// \return New thread record.
+            virtual Reclaimer::ThreadRecord *NewThreadRecord () override;
+            /// \brief
+            /// Free the retired objects that are not protected by any hazard pointer.
+            /// \param[in, out] retired List of retired objects to scan.
+            /// \return Number of objects freed.
+            virtual std::size_t Scan (RetiredObjects &retired) override;
+            /// \brief
+            /// Return max (retireThreshold, 2 * threads * HAZARD_POINTER_COUNT).
+            /// \return Scan threshold.
+            virtual std::size_t GetScanThreshold () const override;
+
+        private:
+            /// \brief
+            /// Return the GlobalHazardPointerReclaimer (used by the Guard ctor
+            /// default argument, as the global isn't defined yet).
+            /// \return GlobalHazardPointerReclaimer::Instance ().
+            static HazardPointerReclaimer &GetGlobalHazardPointerReclaimer ();
+        };
+
+        /// \struct GlobalHazardPointerReclaimer HazardPointerReclaimer.h
+        /// thekogans/util/HazardPointerReclaimer.h
+        ///
+        /// \brief
+        /// The process wide \see{HazardPointerReclaimer} domain. Unless the objects
+        /// you protect need to be isolated (or scanned on a different schedule),
+        /// this is the domain to use.
+
+        struct _LIB_THEKOGANS_UTIL_DECL GlobalHazardPointerReclaimer :
+                public HazardPointerReclaimer,
+                public Singleton<GlobalHazardPointerReclaimer, SpinLock> {
+            /// \brief
+            /// ctor.
+            /// \param[in] retireThreshold Scan the thread's retired
+            /// list once it's this long.
+            explicit GlobalHazardPointerReclaimer (
+                std::size_t retireThreshold = DEFAULT_RETIRE_THRESHOLD) :
+                HazardPointerReclaimer (retireThreshold) {}
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_HazardPointerReclaimer_h)
@@ -0,0 +1,311 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_Histogram_h)
+#define __thekogans_util_Histogram_h
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Serializable.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct Histogram Histogram.h thekogans/util/Histogram.h
+        ///
+        /// \brief
+        /// Histogram is an HDR style, log bucketed histogram of ui64 values
+        /// (typically \see{HRTimer} intervals). Every power of two range is
+        /// split in to SUB_BUCKET_COUNT linear sub-buckets, which bounds the
+        /// relative error of the reported percentiles to 1 / SUB_BUCKET_COUNT
+        /// (6.25%) over the whole ui64 range in a fixed BUCKET_COUNT buckets.
+        /// Values below SUB_BUCKET_COUNT are recorded exactly. Histogram is
+        /// a plain value (not thread safe). To record from multiple threads
+        /// use \see{ConcurrentHistogram} and take Histogram snapshots of it.
+
+        struct _LIB_THEKOGANS_UTIL_DECL Histogram : public Serializable {
+            /// \brief
+            /// Histogram is a \see{Serializable}.
+            THEKOGANS_UTIL_DECLARE_SERIALIZABLE (Histogram, SpinLock)
+
+            enum {
+                /// \brief
+                /// Number of bits used for the linear sub-buckets.
+                SUB_BUCKET_BITS = 4,
+                /// \brief
+                /// Number of linear sub-buckets per power of two.
+                SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,
+                /// \brief
+                /// Number of buckets needed to cover the ui64 range.
+                BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT
+            };
+
+            /// \brief
+            /// Number of values recorded.
+            ui64 count;
+            /// \brief
+            /// Sum of the values recorded.
+            ui64 total;
+            /// \brief
+            /// Smallest value recorded.
+            ui64 min;
+            /// \brief
+            /// Largest value recorded.
+            ui64 max;
+            /// \brief
+            /// Bucket counts (empty until the first value is recorded).
+            std::vector<ui64> buckets;
+
+            /// \brief
+            /// ctor.
+            Histogram () :
+                count (0),
+                total (0),
+                min (0),
+                max (0) {}
+            /// \brief
+            /// ctor.
+            /// \param[in] histogram Histogram to copy.
+            Histogram (const Histogram &histogram) :
+                count (histogram.count),
+                total (histogram.total),
+                min (histogram.min),
+                max (histogram.max),
+                buckets (histogram.buckets) {}
+
+            /// \brief
+            /// Assignment operator.
+            /// \param[in] histogram Histogram to assign.
+            /// \return *this.
+            Histogram &operator = (const Histogram &histogram);
+
+            /// \brief
+            /// Return the index of the bucket the given value falls in to.
+            /// \param[in] value Value whose bucket index to return.
+            /// \return Bucket index.
+            static std::size_t GetBucketIndex (ui64 value);
+            /// \brief
+            /// Return the smallest value that falls in to the given bucket.
+            /// \param[in] index Bucket index.
+            /// \return Smallest value that falls in to the given bucket.
+            static ui64 GetBucketLowerBound (std::size_t index);
+            /// \brief
+            /// Return the largest value that falls in to the given bucket.
+            /// \param[in] index Bucket index.
+            /// \return Largest value that falls in to the given bucket.
+            static ui64 GetBucketUpperBound (std::size_t index);
+
+            /// \brief
+            /// Record a value.
+            /// \param[in] value Value to record.
+            void Record (ui64 value);
+            /// \brief
+            /// Add the values recorded in the given histogram to this one.
+            /// \param[in] histogram Histogram to merge.
+            void Merge (const Histogram &histogram);
+
+            /// \brief
+            /// Return the average of the values recorded.
+            /// \return Average of the values recorded (0 if empty).
+            inline ui64 GetMean () const {
+                return count > 0 ? total / count : 0;
+            }
+            /// \brief
+            /// Return the value at the given percentile. The returned value
+            /// is the upper bound of the bucket holding that percentile
+            /// (clamped to [min, max]).
+            /// \param[in] percentile Percentile to return [0.0, 100.0].
+            /// \return Value at the given percentile (0 if empty).
+            ui64 GetPercentile (f64 percentile) const;
+
+            /// \brief
+            /// Reset the histogram.
+            void Reset ();
+
+        protected:
+            // Serializable
+            /// \brief
+            /// Return the serialized key size.
+            /// \return Serialized key size.
+            virtual std::size_t Size () const override;
+
+            /// \brief
+            /// Read the key from the given serializer.
+            /// \param[in] header \see{Serializable::BinHeader}.
+            /// \param[in] serializer \see{Serializer} to read the key from.
+            virtual void Read (
+                const BinHeader & /*header*/,
+                Serializer &serializer) override;
+            /// \brief
+            /// Write the key to the given serializer.
+            /// \param[out] serializer \see{Serializer} to write the key to.
+            virtual void Write (Serializer &serializer) const override;
+
+            /// \brief
+            /// "Histogram"
+            static const char * const TAG_HISTOGRAM;
+            /// \brief
+            /// "Count"
+            static const char * const ATTR_COUNT;
+            /// \brief
+            /// "Total"
+            static const char * const ATTR_TOTAL;
+            /// \brief
+            /// "Min"
+            static const char * const ATTR_MIN;
+            /// \brief
+            /// "Max"
+            static const char * const ATTR_MAX;
+            /// \brief
+            /// "Mean"
+            static const char * const ATTR_MEAN;
+            /// \brief
+            /// "P50"
+            static const char * const ATTR_P50;
+            /// \brief
+            /// "P90"
+            static const char * const ATTR_P90;
+            /// \brief
+            /// "P99"
+            static const char * const ATTR_P99;
+            /// \brief
+            /// "P999"
+            static const char * const ATTR_P999;
+            /// \brief
+            /// "Buckets"
+            static const char * const TAG_BUCKETS;
+            /// \brief
+            /// "Bucket"
+            static const char * const TAG_BUCKET;
+            /// \brief
+            /// "Index"
+            static const char * const ATTR_INDEX;
+
+            /// \brief
+            /// Read the Serializable from an XML DOM.
+            /// \param[in] header \see{Serializable::TextHeader}.
+            /// \param[in] node XML DOM representation of a Serializable.
+            virtual void Read (
+                const TextHeader & /*header*/,
+                const pugi::xml_node &node) override;
+            /// \brief
+            /// Write the Serializable to the XML DOM.
+            /// \param[out] node Parent node.
+            virtual void Write (pugi::xml_node &node) const override;
+
+            /// \brief
+            /// Read a Serializable from an JSON DOM.
+            /// \param[in] node JSON DOM representation of a Serializable.
+            virtual void Read (
+                const TextHeader & /*header*/,
+                const JSON::Object &object) override;
+            /// \brief
+            /// Write a Serializable to the JSON DOM.
+            /// \param[out] node Parent node.
+            virtual void Write (JSON::Object &object) const override;
+
+        private:
+            /// \brief
+            /// Add count values to the given bucket.
+            /// \param[in] index Bucket index.
+            /// \param[in] count_ Number of values to add.
+            void AddToBucket (
+                std::size_t index,
+                ui64 count_);
+
+            /// \brief
+            /// ConcurrentHistogram builds snapshots bucket by bucket.
+            friend struct ConcurrentHistogram;
+        };
+
+        /// \brief
+        /// Implement Histogram extraction operators.
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_EXTRACTION_OPERATORS (Histogram)
+
+        /// \brief
+        /// Implement Histogram value parser.
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_VALUE_PARSER (Histogram)
+
+        /// \struct ConcurrentHistogram Histogram.h thekogans/util/Histogram.h
+        ///
+        /// \brief
+        /// ConcurrentHistogram is a \see{Histogram} that any number of threads
+        /// can record in to without taking a lock. Every recording thread is
+        /// assigned one of shardCount shards (round robin, on first use), and
+        /// the shards are allocated lazily. A pool of N workers therefore pays
+        /// for (at most) N shards and, as long as N <= shardCount, never
+        /// shares a cache line with another worker. Readers merge the shards
+        /// in to a \see{Histogram} snapshot, again without locking. The
+        /// snapshot is not atomic with respect to concurrent recorders (a
+        /// value being recorded might be in count, but not yet in it's bucket),
+        /// which is the right trade off for monitoring.
+
+        struct _LIB_THEKOGANS_UTIL_DECL ConcurrentHistogram {
+            /// \brief
+            /// Default number of shards.
+            static const std::size_t DEFAULT_SHARD_COUNT = 16;
+
+        private:
+            /// \struct ConcurrentHistogram::Shard Histogram.h thekogans/util/Histogram.h
+            ///
+            /// \brief
+            /// Forward declaration of the per thread shard.
+            struct Shard;
+            /// \brief
+            /// Number of shards.
+            const std::size_t shardCount;
+            /// \brief
+            /// Lazily allocated shards.
+            std::atomic<Shard *> *shards;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] shardCount_ Number of shards.
+            explicit ConcurrentHistogram (std::size_t shardCount_ = DEFAULT_SHARD_COUNT);
+            /// \brief
+            /// dtor.
+            ~ConcurrentHistogram ();
+
+            /// \brief
+            /// Record a value. Lock free.
+            /// \param[in] value Value to record.
+            void Record (ui64 value);
+
+            /// \brief
+            /// Merge the shards in to the given histogram. Lock free.
+            /// \param[out] histogram Where to put the snapshot.
+            void Snapshot (Histogram &histogram) const;
+
+            /// \brief
+            /// Reset the histogram. Values recorded concurrently
+            /// with Reset might be (partially) lost.
+            void Reset ();
+
+            /// \brief
+            /// ConcurrentHistogram is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (ConcurrentHistogram)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_Histogram_h)
@@ -415,6 +415,10 @@ namespace thekogans {
                         if (prev (node) != 0) {
                             next (prev (node)) = node;
                         }
+                        else {
+                            assert (before == head);
+                            head = node;
+                        }
                         prev (before) = node;
                         contains (node) = true;
                         ++count;
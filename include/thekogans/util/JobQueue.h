@@ -20,6 +20,7 @@
 
 #include <memory>
 #include <string>
+#include <atomic>
 #include "thekogans/util/Config.h"
 #include "thekogans/util/Types.h"
 #include "thekogans/util/Constants.h"
@@ -30,6 +31,7 @@
 #include "thekogans/util/Condition.h"
 #include "thekogans/util/Singleton.h"
 #include "thekogans/util/SpinLock.h"
+#include "thekogans/util/MPMCQueue.h"
 
 namespace thekogans {
     namespace util {
@@ -42,6 +44,26 @@ namespace thekogans {
         /// As you add jobs to the queue, the next idle worker removes and executes them.
         /// The queue can be either FIFO or LIFO. While very usefull on it's own, JobQueue
         /// also forms the basis for \see{Pipeline} and \see{JobQueuePool}.
+        ///
+        /// If created with handoffCapacity > 0, the queue also has a bounded, lock-free
+        /// handoff ring (\see{MPMCQueue}). Jobs added with \see{HandoffJob} bypass the
+        /// jobsMutex: the producer pays for a CAS, and only takes the lock to wake a
+        /// sleeping worker. When the ring is full, HandoffJob blocks until a worker
+        /// makes room (backpressure). \see{RunJobInline} lets the caller execute a job
+        /// on it's own thread when the queue has nothing queued and a free worker slot
+        /// (the queue never runs more than workerCount jobs at once, so a single worker
+        /// queue stays serial). Handed off jobs are not added to the pending/running
+        /// job lists. They are counted by \see{WaitForIdle}, and cancelled by \see{Stop},
+        /// but to cancel one individually, call it's Cancel. Pause only holds back the
+        /// pending jobs.
+        ///
+        /// If created with 0 < minWorkerCount < workerCount, the queue is elastic.
+        /// It starts with minWorkerCount workers and adds one more (up to workerCount)
+        /// every spawnDelay for as long as there are more jobs waiting than there are
+        /// idle workers to run them. The backlog is checked when jobs are enqueued, and
+        /// when workers dequeue them. A worker that had nothing to do for idleTimeout
+        /// retires (but the queue never drops below minWorkerCount). The scaling events
+        /// are reported in \see{RunLoop::Stats}.
 
         struct _LIB_THEKOGANS_UTIL_DECL JobQueue : public RunLoop {
             /// \brief
@@ -64,9 +86,20 @@ namespace thekogans {
                 THEKOGANS_UTIL_DECLARE_HEAP_WITH_LOCK (State, SpinLock)
 
                 /// \brief
-                /// Number of workers servicing the queue.
+                /// Max number of workers servicing the queue.
                 const std::size_t workerCount;
                 /// \brief
+                /// Min number of workers servicing the queue
+                /// (== workerCount unless the queue is elastic).
+                const std::size_t minWorkerCount;
+                /// \brief
+                /// How long an elastic queue worker stays idle before retiring.
+                const TimeSpec idleTimeout;
+                /// \brief
+                /// How long a backlog has to persist before an elastic
+                /// queue adds a worker (and between additions).
+                const TimeSpec spawnDelay;
+                /// \brief
                 /// \Worker thread priority.
                 const i32 workerPriority;
                 /// \brief
@@ -76,6 +109,44 @@ namespace thekogans {
                 /// Called to initialize/uninitialize the worker thread.
                 WorkerCallback *workerCallback;
                 /// \brief
+                /// Lock-free handoff ring (0 == no handoff).
+                std::unique_ptr<MPMCQueue<Job *>> handoffJobs;
+                /// \brief
+                /// Count of handed off jobs that are not finished yet.
+                std::atomic<std::size_t> handoffJobCount;
+                /// \brief
+                /// Count of jobs executing (handoff mode only). Workers and
+                /// \see{RunJobInline} acquire one of workerCount slots
+                /// before executing a job.
+                std::atomic<std::size_t> busyWorkers;
+                /// \brief
+                /// Count of workers waiting on jobsNotEmpty.
+                std::atomic<std::size_t> sleepingWorkers;
+                /// \brief
+                /// Count of producers waiting on handoffNotFull.
+                std::atomic<std::size_t> waitingProducers;
+                /// \brief
+                /// Handoff ring high-water mark (see \see{RunLoop::Stats}).
+                std::atomic<std::size_t> maxHandoffDepth;
+                /// \brief
+                /// Signaled when a handoff job is taken off the ring.
+                Condition handoffNotFull;
+                /// \brief
+                /// Count of workers looking for a job (elastic queue backlog check).
+                std::atomic<std::size_t> idleWorkers;
+                /// \brief
+                /// When the current backlog was first seen (0 == no backlog).
+                std::atomic<ui64> backlogStart;
+                /// \brief
+                /// Count of workers added to drain a backlog (see \see{RunLoop::Stats}).
+                std::atomic<std::size_t> spawnedWorkers;
+                /// \brief
+                /// Count of idle workers retired (see \see{RunLoop::Stats}).
+                std::atomic<std::size_t> retiredWorkers;
+                /// \brief
+                /// Worker count high-water mark (see \see{RunLoop::Stats}).
+                std::atomic<std::size_t> maxWorkers;
+                /// \brief
                 /// Forward declaration of Worker.
                 struct Worker;
                 enum {
@@ -105,11 +176,18 @@ namespace thekogans {
                     /// ctor.
                     /// \param[in] state_ \see{State} used by the worker to process jobs.
                     /// \param[in] name Worker thread name.
+                    /// \param[in] index Worker index (used to place the worker
+                    /// if workerAffinity is a \see{CPUTopology} placement policy).
                     Worker (State::SharedPtr state_,
-                            const std::string &name = std::string ()) :
+                            const std::string &name = std::string (),
+                            std::size_t index = 0) :
                             Thread (name),
                             state (state_) {
-                        Create (state->workerPriority, state->workerAffinity);
+                        Create (
+                            state->workerPriority,
+                            state->workerAffinity,
+                            index,
+                            state->workerCount);
                     }
 
                 private:
@@ -136,6 +214,13 @@ namespace thekogans {
                 /// \param[in] workerAffinity_ Worker thread processor affinity.
                 /// \param[in] workerCallback_ Called to initialize/uninitialize
                 /// the worker thread.
+                /// \param[in] handoffCapacity Handoff ring capacity (0 == no handoff).
+                /// \param[in] minWorkerCount_ Min workers to service the queue
+                /// (0 == workerCount_, the queue is not elastic).
+                /// \param[in] idleTimeout_ How long an elastic queue worker
+                /// stays idle before retiring.
+                /// \param[in] spawnDelay_ How long a backlog has to persist
+                /// before an elastic queue adds a worker.
                 State (
                     const std::string &name = std::string (),
                     JobExecutionPolicy::SharedPtr jobExecutionPolicy =
@@ -143,12 +228,93 @@ namespace thekogans {
                     std::size_t workerCount_ = 1,
                     i32 workerPriority_ = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
                     ui32 workerAffinity_ = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
-                    WorkerCallback *workerCallback_ = 0) :
+                    WorkerCallback *workerCallback_ = 0,
+                    std::size_t handoffCapacity = 0,
+                    std::size_t minWorkerCount_ = 0,
+                    const TimeSpec &idleTimeout_ = TimeSpec::FromSeconds (60),
+                    const TimeSpec &spawnDelay_ = TimeSpec::FromMilliseconds (10)) :
                     RunLoop::State (name, jobExecutionPolicy),
                     workerCount (workerCount_),
+                    minWorkerCount (minWorkerCount_ > 0 && minWorkerCount_ < workerCount_ ?
+                        minWorkerCount_ : workerCount_),
+                    idleTimeout (idleTimeout_),
+                    spawnDelay (spawnDelay_),
                     workerPriority (workerPriority_),
                     workerAffinity (workerAffinity_),
-                    workerCallback (workerCallback_) {}
+                    workerCallback (workerCallback_),
+                    handoffJobs (handoffCapacity > 0 ? new MPMCQueue<Job *> (handoffCapacity) : 0),
+                    handoffJobCount (0),
+                    busyWorkers (0),
+                    sleepingWorkers (0),
+                    waitingProducers (0),
+                    maxHandoffDepth (0),
+                    handoffNotFull (jobsMutex),
+                    idleWorkers (0),
+                    backlogStart (0),
+                    spawnedWorkers (0),
+                    retiredWorkers (0),
+                    maxWorkers (0) {}
+
+                /// \brief
+                /// Return true if the queue adds and retires workers with load.
+                /// \return true == the queue is elastic.
+                inline bool IsElastic () const {
+                    return minWorkerCount < workerCount;
+                }
+
+                /// \brief
+                /// Used internally by worker(s) in handoff mode to get the next
+                /// job (from the ring first, then from pendingJobs). The returned
+                /// job holds an execution slot.
+                /// \param[out] handoff true == the job came off the ring.
+                /// \param[in] timeSpec How long to wait for a job.
+                /// IMPORTANT: timeSpec is a relative value.
+                /// \return The next job to execute (0 == done or timed out).
+                Job *DeqHandoffJob (
+                    bool &handoff,
+                    const TimeSpec &timeSpec = TimeSpec::Infinite);
+                /// \brief
+                /// Execute the given job on the calling thread and report back.
+                /// \param[in] job Job to execute.
+                /// \param[in] handoff true == the job was handed off (see DeqHandoffJob).
+                void ExecuteJob (
+                    Job *job,
+                    bool handoff);
+                /// \brief
+                /// Called after each handed off job is completed.
+                /// Used to update state and \see{RunLoop::Stats}.
+                /// \param[in] job Completed job.
+                /// \param[in] start Completed job start time.
+                /// \param[in] end Completed job end time.
+                void FinishedHandoffJob (
+                    Job *job,
+                    ui64 start,
+                    ui64 end);
+                /// \brief
+                /// Try to acquire an execution slot.
+                /// \return true == acquired.
+                bool AcquireSlot ();
+                /// \brief
+                /// Release an execution slot acquired with AcquireSlot,
+                /// and wake a sleeping worker if there's work waiting for it.
+                void ReleaseSlot ();
+                /// \brief
+                /// Return true if there are no jobs in the queue (pending,
+                /// running or handed off). jobsMutex must be locked.
+                /// \return true == no jobs in the queue.
+                bool IsEmpty () const;
+                /// \brief
+                /// Create a worker and add it to the list. workersMutex must be locked.
+                void AddWorker ();
+                /// \brief
+                /// If the queue is elastic, and there have been more jobs waiting
+                /// than idle workers to run them for at least spawnDelay, add a worker.
+                void GrowWorkers ();
+                /// \brief
+                /// Called by an idle worker of an elastic queue to ask if it can retire.
+                /// \param[in] worker Worker that timed out waiting for a job.
+                /// \return true == the worker was removed from the list and should exit.
+                bool RetireWorker (Worker *worker);
             };
 
         protected:
@@ -164,8 +330,17 @@ namespace thekogans {
             /// \param[in] maxPendingJobs Max pending queue jobs.
             /// \param[in] workerCount Max workers to service the queue.
             /// \param[in] workerPriority Worker thread priority.
-            /// \param[in] workerAffinity Worker thread processor affinity.
+            /// \param[in] workerAffinity Worker thread processor affinity (a processor id,
+            /// or one of the \see{CPUTopology} placement policies).
             /// \param[in] workerCallback Called to initialize/uninitialize the worker thread(s).
+            /// \param[in] handoffCapacity Capacity of the lock-free handoff ring
+            /// (0 == no ring, \see{HandoffJob} is the same as EnqJob).
+            /// \param[in] minWorkerCount Min workers to service the queue
+            /// (0 == workerCount, the queue is not elastic).
+            /// \param[in] idleTimeout How long an elastic queue worker stays
+            /// idle before retiring.
+            /// \param[in] spawnDelay How long a backlog has to persist before
+            /// an elastic queue adds a worker.
             JobQueue (
                 const std::string &name = std::string (),
                 JobExecutionPolicy::SharedPtr jobExecutionPolicy =
@@ -173,12 +348,21 @@ namespace thekogans {
                 std::size_t workerCount = 1,
                 i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
                 ui32 workerAffinity = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
-                WorkerCallback *workerCallback = 0);
+                WorkerCallback *workerCallback = 0,
+                std::size_t handoffCapacity = 0,
+                std::size_t minWorkerCount = 0,
+                const TimeSpec &idleTimeout = TimeSpec::FromSeconds (60),
+                const TimeSpec &spawnDelay = TimeSpec::FromMilliseconds (10));
             /// \brief
             /// dtor. Stop the queue.
             virtual ~JobQueue ();
 
             // RunLoop
+            /// \brief
+            /// Bring the lambda overloads in to scope.
+            using RunLoop::EnqJob;
+            using RunLoop::EnqJobFront;
+
             /// \brief
             /// Create the worker(s), and start waiting for jobs. The
             /// ctor calls this member, but if you ever need to stop
@@ -205,6 +389,68 @@ namespace thekogans {
             /// Return true is the run loop is running (Start was called).
             /// \return true is the run loop is running (Start was called).
             virtual bool IsRunning () override;
+            /// \brief
+            /// Continue the paused queue.
+            virtual void Continue () override;
+            /// \brief
+            /// Wait until all pending, running and handed off jobs are done.
+            /// \param[in] timeSpec How long to wait for the queue to become idle.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == the queue is idle, false == timed out.
+            virtual bool WaitForIdle (const TimeSpec &timeSpec = TimeSpec::Infinite) override;
+            /// \brief
+            /// Return true if the queue has no pending, running or handed off jobs.
+            /// \return true if the queue has no pending, running or handed off jobs.
+            virtual bool IsIdle () override;
+            /// \brief
+            /// Enqueue a job to be executed by the queue workers. If the
+            /// queue is elastic, add a worker if there's a backlog.
+            /// \param[in] job Job to enqueue.
+            /// \param[in] wait Wait for job to finish. Used for synchronous job execution.
+            /// \param[in] timeSpec How long to wait for the job to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == !wait || WaitForJob (...)
+            virtual bool EnqJob (
+                Job::SharedPtr job,
+                bool wait = false,
+                const TimeSpec &timeSpec = TimeSpec::Infinite) override;
+            /// \brief
+            /// Enqueue a job to be executed next by the queue workers. If
+            /// the queue is elastic, add a worker if there's a backlog.
+            /// \param[in] job Job to enqueue.
+            /// \param[in] wait Wait for job to finish. Used for synchronous job execution.
+            /// \param[in] timeSpec How long to wait for the job to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == !wait || WaitForJob (...)
+            virtual bool EnqJobFront (
+                Job::SharedPtr job,
+                bool wait = false,
+                const TimeSpec &timeSpec = TimeSpec::Infinite) override;
+            /// \brief
+            /// Return a snapshot of the queue stats. In handoff mode, queueDepth
+            /// and maxQueueDepth include the jobs on the ring. workerCount and
+            /// friends report the workers (and the elastic scaling events).
+            /// \return A snapshot of the queue stats.
+            virtual Stats GetStats () override;
+            /// \brief
+            /// Reset the queue stats.
+            virtual void ResetStats () override;
+
+            /// \brief
+            /// Hand the given job off to the workers through the lock-free ring.
+            /// If the ring is full, block until a worker takes a job off it. If
+            /// the queue was created without a ring, or is stopped, this is the
+            /// same as EnqJob.
+            /// \param[in] job Job to hand off.
+            void HandoffJob (Job::SharedPtr job);
+            /// \brief
+            /// If nothing is queued on the ring and a worker slot is free, execute
+            /// the given job on the calling thread (saving the context switch and
+            /// keeping the data the job is working on hot in the caller's cache).
+            /// \param[in] job Job to execute.
+            /// \return true == the job was executed, false == the queue is busy
+            /// (or has no ring), call HandoffJob instead.
+            bool RunJobInline (Job::SharedPtr job);
 
         protected:
             /// \brief
@@ -74,6 +74,12 @@ namespace thekogans {
         /// By passing util::JobQueue::SharedPtr in to the Job's ctor we guarantee
         /// that the \see{JobQueue} will be returned back to the pool as soon
         /// as the Job goes out of scope (as Job will be the last reference).
+        ///
+        /// The pool grows on demand (up to maxJobQueues), and shrinks back to
+        /// minJobQueues when all borrowed \see{JobQueue}s are returned. Once
+        /// exhausted, \see{GetJobQueue} waits for a \see{JobQueue} to be returned.
+        /// If minWorkerCount < workerCount, the pool \see{JobQueue}s are elastic
+        /// (see \see{JobQueue}). The scaling events are reported by \see{GetStats}.
 
         struct _LIB_THEKOGANS_UTIL_DECL JobQueuePool {
         private:
@@ -93,6 +99,16 @@ namespace thekogans {
             /// Number of worker threads servicing the \see{JobQueue}.
             const std::size_t workerCount;
             /// \brief
+            /// Min number of worker threads servicing an elastic \see{JobQueue}.
+            const std::size_t minWorkerCount;
+            /// \brief
+            /// How long an elastic \see{JobQueue} worker stays idle before retiring.
+            const TimeSpec idleTimeout;
+            /// \brief
+            /// How long a backlog has to persist before an elastic
+            /// \see{JobQueue} adds a worker.
+            const TimeSpec spawnDelay;
+            /// \brief
             /// \see{JobQueue} worker thread priority.
             const i32 workerPriority;
             /// \brief
@@ -143,6 +159,12 @@ namespace thekogans {
                 /// \param[in] workerAffinity \see{JobQueue} worker thread processor affinity.
                 /// \param[in] workerCallback Called to initialize/uninitialize the
                 /// \see{JobQueue} worker thread(s).
+                /// \param[in] minWorkerCount Min number of worker threads servicing
+                /// the \see{JobQueue} (0 == workerCount, the queue is not elastic).
+                /// \param[in] idleTimeout How long an elastic \see{JobQueue}
+                /// worker stays idle before retiring.
+                /// \param[in] spawnDelay How long a backlog has to persist before
+                /// an elastic \see{JobQueue} adds a worker.
                 /// \param[in] jobQueuePool_ JobQueuePool to which this jobQueue belongs.
                 JobQueue (
                     const std::string &name,
@@ -151,6 +173,9 @@ namespace thekogans {
                     i32 workerPriority,
                     ui32 workerAffinity,
                     WorkerCallback *workerCallback,
+                    std::size_t minWorkerCount,
+                    const TimeSpec &idleTimeout,
+                    const TimeSpec &spawnDelay,
                     JobQueuePool &jobQueuePool_) :
                     util::JobQueue (
                         name,
@@ -158,7 +183,11 @@ namespace thekogans {
                         workerCount,
                         workerPriority,
                         workerAffinity,
-                        workerCallback),
+                        workerCallback,
+                        0,
+                        minWorkerCount,
+                        idleTimeout,
+                        spawnDelay),
                     jobQueuePool (jobQueuePool_) {}
 
             protected:
@@ -195,8 +224,66 @@ namespace thekogans {
             /// \brief
             /// Synchronization condition variable.
             Condition idle;
+            /// \brief
+            /// Signaled when a borrowed \see{JobQueue} is returned.
+            Condition jobQueueAvailable;
+            /// \brief
+            /// Count of \see{JobQueue}s created (see \see{Stats}).
+            std::size_t createdJobQueues;
+            /// \brief
+            /// Count of \see{JobQueue}s deleted (see \see{Stats}).
+            std::size_t deletedJobQueues;
+            /// \brief
+            /// \see{JobQueue} count high-water mark (see \see{Stats}).
+            std::size_t maxJobQueueCount;
+            /// \brief
+            /// Count of \see{GetJobQueue} calls that found the pool exhausted.
+            std::size_t exhaustedCount;
+            /// \brief
+            /// Count of \see{GetJobQueue} calls that timed out.
+            std::size_t timedOutCount;
 
         public:
+            /// \struct JobQueuePool::Stats JobQueuePool.h thekogans/util/JobQueuePool.h
+            ///
+            /// \brief
+            /// A snapshot of the pool size and scaling events.
+            struct Stats {
+                /// \brief
+                /// Number of \see{JobQueue}s ready to be borrowed.
+                std::size_t availableJobQueues;
+                /// \brief
+                /// Number of borrowed \see{JobQueue}s.
+                std::size_t borrowedJobQueues;
+                /// \brief
+                /// Number of \see{JobQueue}s the pool grew by.
+                std::size_t createdJobQueues;
+                /// \brief
+                /// Number of \see{JobQueue}s the pool shrunk by.
+                std::size_t deletedJobQueues;
+                /// \brief
+                /// Most \see{JobQueue}s the pool ever had.
+                std::size_t maxJobQueueCount;
+                /// \brief
+                /// Number of times \see{GetJobQueue} found the pool
+                /// exhausted (and had to wait, or fail).
+                std::size_t exhaustedCount;
+                /// \brief
+                /// Number of times \see{GetJobQueue} gave up waiting.
+                std::size_t timedOutCount;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    availableJobQueues (0),
+                    borrowedJobQueues (0),
+                    createdJobQueues (0),
+                    deletedJobQueues (0),
+                    maxJobQueueCount (0),
+                    exhaustedCount (0),
+                    timedOutCount (0) {}
+            };
+
             /// \brief
             /// ctor.
             /// \param[in] minJobQueues_ Minimum \see{JobQueue}s to keep in the pool.
@@ -208,6 +295,12 @@ namespace thekogans {
             /// \param[in] workerAffinity_ \see{JobQueue} worker thread processor affinity.
             /// \param[in] workerCallback_ Called to initialize/uninitialize the \see{JobQueue}
             /// worker thread.
+            /// \param[in] minWorkerCount_ Min number of worker threads servicing
+            /// the \see{JobQueue} (0 == workerCount_, the queues are not elastic).
+            /// \param[in] idleTimeout_ How long an elastic \see{JobQueue}
+            /// worker stays idle before retiring.
+            /// \param[in] spawnDelay_ How long a backlog has to persist before
+            /// an elastic \see{JobQueue} adds a worker.
             JobQueuePool (
                 std::size_t minJobQueues_,
                 std::size_t maxJobQueues_,
@@ -217,16 +310,19 @@ namespace thekogans {
                 std::size_t workerCount_ = 1,
                 i32 workerPriority_ = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
                 ui32 workerAffinity_ = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
-                RunLoop::WorkerCallback *workerCallback_ = 0);
+                RunLoop::WorkerCallback *workerCallback_ = 0,
+                std::size_t minWorkerCount_ = 0,
+                const TimeSpec &idleTimeout_ = TimeSpec::FromSeconds (60),
+                const TimeSpec &spawnDelay_ = TimeSpec::FromMilliseconds (10));
             /// \brief
             /// dtor.
             virtual ~JobQueuePool ();
 
             /// \brief
-            /// Acquire a \see{JobQueue} from the pool.
-            /// \param[in] retries Number of times to retry if a \see{JobQueue} is not
-            /// immediately available.
-            /// \param[in] timeSpec How long to wait between retries.
+            /// Acquire a \see{JobQueue} from the pool (growing it if needed).
+            /// \param[in] retries Number of times to wait for a \see{JobQueue}
+            /// to be returned if the pool is exhausted.
+            /// \param[in] timeSpec How long to wait each time.
             /// IMPORTANT: timeSpec is a relative value.
             /// \return A \see{JobQueue} from the pool (JobQueue::SharedPtr () if pool is exhausted).
             util::JobQueue::SharedPtr GetJobQueue (
@@ -268,10 +364,19 @@ namespace thekogans {
             /// \return true == this pool has no outstanding \see{JobQueue}s.
             bool IsIdle ();
 
+            /// \brief
+            /// Return a snapshot of the pool stats.
+            /// \return A snapshot of the pool stats.
+            Stats GetStats ();
+            /// \brief
+            /// Reset the pool scaling event counters.
+            void ResetStats ();
+
         private:
             /// \brief
             /// Used by \see{GetJobQueue} to acquire a \see{JobQueue} from the pool.
-            /// \return \see{JobQueue} pointer.
+            /// mutex must be locked.
+            /// \return \see{JobQueue} pointer (0 == the pool is exhausted).
             JobQueue *AcquireJobQueue ();
             /// \brief
             /// Used by \see{JobQueue} to release itself to the pool.
@@ -314,6 +419,12 @@ namespace thekogans {
             /// \param[in] workerAffinity \see{JobQueue} worker thread processor affinity.
             /// \param[in] workerCallback Called to initialize/uninitialize the \see{JobQueue}
             /// thread.
+            /// \param[in] minWorkerCount Min number of worker threads servicing
+            /// the \see{JobQueue} (0 == workerCount, the queues are not elastic).
+            /// \param[in] idleTimeout How long an elastic \see{JobQueue}
+            /// worker stays idle before retiring.
+            /// \param[in] spawnDelay How long a backlog has to persist before
+            /// an elastic \see{JobQueue} adds a worker.
             GlobalJobQueuePool (
                 std::size_t minJobQueues = 0,
                 std::size_t maxJobQueues = 0,
@@ -323,7 +434,10 @@ namespace thekogans {
                 std::size_t workerCount = 1,
                 i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
                 ui32 workerAffinity = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
-                RunLoop::WorkerCallback *workerCallback = 0) :
+                RunLoop::WorkerCallback *workerCallback = 0,
+                std::size_t minWorkerCount = 0,
+                const TimeSpec &idleTimeout = TimeSpec::FromSeconds (60),
+                const TimeSpec &spawnDelay = TimeSpec::FromMilliseconds (10)) :
                 JobQueuePool (
                     minJobQueues,
                     maxJobQueues,
@@ -332,7 +446,10 @@ namespace thekogans {
                     workerCount,
                     workerPriority,
                     workerAffinity,
-                    workerCallback) {}
+                    workerCallback,
+                    minWorkerCount,
+                    idleTimeout,
+                    spawnDelay) {}
         };
 
     } // namespace util
@@ -35,6 +35,7 @@
     #define STAT_FUNC stat
     #define LSTAT_FUNC lstat
     #define FSTAT_FUNC fstat
+    #define FSTATAT_FUNC fstatat
     #define LSEEK_FUNC lseek
     #define FTRUNCATE_FUNC ftruncate
 #elif defined (TOOLCHAIN_ARCH_x86_64) || defined (TOOLCHAIN_ARCH_ppc64) || defined (TOOLCHAIN_ARCH_arm64)
@@ -42,6 +43,7 @@
     #define STAT_FUNC stat64
     #define LSTAT_FUNC lstat64
     #define FSTAT_FUNC fstat64
+    #define FSTATAT_FUNC fstatat64
     #define LSEEK_FUNC lseek64
     #define FTRUNCATE_FUNC ftruncate64
 #else // defined (TOOLCHAIN_ARCH_i386) || defined (TOOLCHAIN_ARCH_ppc) || defined (TOOLCHAIN_ARCH_arm)
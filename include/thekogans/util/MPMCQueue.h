@@ -0,0 +1,202 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_MPMCQueue_h)
+#define __thekogans_util_MPMCQueue_h
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Constants.h"
+#include "thekogans/util/Exception.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct MPMCQueue MPMCQueue.h thekogans/util/MPMCQueue.h
+        ///
+        /// \brief
+        /// MPMCQueue is a bounded, lock-free, multiple producer, multiple
+        /// consumer ring (Dmitry Vyukov's algorithm). Every cell carries a
+        /// sequence number that tells producers and consumers whose turn it
+        /// is, so Push and Pop cost one CAS (on the shared position) and no
+        /// locks. The queue never allocates after construction. When it's
+        /// full Push fails, and it's up to the caller to decide what to do
+        /// (wait, drop, or fall back to a slower path).
+        ///
+        /// NOTE: T must be default constructable and assignable. The queue
+        /// is meant for small values (pointers, handles...).
+
+        template<typename T>
+        struct MPMCQueue {
+        private:
+            /// \struct MPMCQueue::Cell MPMCQueue.h thekogans/util/MPMCQueue.h
+            ///
+            /// \brief
+            /// Ring cell.
+            struct Cell {
+                /// \brief
+                /// == position: free for the producer at position.
+                /// == position + 1: full, ready for the consumer at position.
+                std::atomic<std::size_t> sequence;
+                /// \brief
+                /// Cell value.
+                T value;
+            };
+            /// \brief
+            /// Ring cells.
+            std::unique_ptr<Cell[]> cells;
+            /// \brief
+            /// Capacity - 1 (capacity is a power of 2).
+            const std::size_t mask;
+            /// \brief
+            /// Keep producers and consumers on separate cache lines.
+            ui8 pad0[THEKOGANS_UTIL_CACHE_LINE_SIZE];
+            /// \brief
+            /// Next position to push to.
+            std::atomic<std::size_t> pushPosition;
+            /// \brief
+            /// Keep producers and consumers on separate cache lines.
+            ui8 pad1[THEKOGANS_UTIL_CACHE_LINE_SIZE - sizeof (std::atomic<std::size_t>)];
+            /// \brief
+            /// Next position to pop from.
+            std::atomic<std::size_t> popPosition;
+            /// \brief
+            /// Keep producers and consumers on separate cache lines.
+            ui8 pad2[THEKOGANS_UTIL_CACHE_LINE_SIZE - sizeof (std::atomic<std::size_t>)];
+
+            /// \brief
+            /// Round the given capacity up to a power of 2.
+            /// \param[in] capacity Requested capacity.
+            /// \return capacity rounded up to a power of 2 (at least 2).
+            static std::size_t RoundCapacity (std::size_t capacity) {
+                std::size_t result = 2;
+                while (result < capacity) {
+                    result <<= 1;
+                }
+                return result;
+            }
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] capacity Maximum number of values in the queue
+            /// (rounded up to a power of 2).
+            explicit MPMCQueue (std::size_t capacity) :
+                    cells (new Cell[RoundCapacity (capacity)]),
+                    mask (RoundCapacity (capacity) - 1),
+                    pushPosition (0),
+                    popPosition (0) {
+                if (capacity == 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                for (std::size_t i = 0; i <= mask; ++i) {
+                    cells[i].sequence.store (i, std::memory_order_relaxed);
+                }
+            }
+
+            /// \brief
+            /// Return the queue capacity.
+            /// \return Queue capacity.
+            inline std::size_t GetCapacity () const {
+                return mask + 1;
+            }
+            /// \brief
+            /// Return the number of values in the queue. Since other threads
+            /// keep pushing and popping, the result is only a snapshot.
+            /// \return Number of values in the queue.
+            inline std::size_t GetSize () const {
+                std::size_t pop = popPosition.load (std::memory_order_acquire);
+                std::size_t push = pushPosition.load (std::memory_order_acquire);
+                return push > pop ? push - pop : 0;
+            }
+            /// \brief
+            /// Return true if the queue is empty (snapshot, see GetSize).
+            /// \return true == the queue is empty.
+            inline bool IsEmpty () const {
+                return GetSize () == 0;
+            }
+
+            /// \brief
+            /// Push a value on to the queue.
+            /// \param[in] value Value to push.
+            /// \return true == pushed, false == the queue is full.
+            bool Push (const T &value) {
+                std::size_t position = pushPosition.load (std::memory_order_relaxed);
+                for (;;) {
+                    Cell &cell = cells[position & mask];
+                    std::size_t sequence = cell.sequence.load (std::memory_order_acquire);
+                    std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+                    if (diff == 0) {
+                        if (pushPosition.compare_exchange_weak (
+                                position, position + 1, std::memory_order_relaxed)) {
+                            cell.value = value;
+                            cell.sequence.store (position + 1, std::memory_order_release);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0) {
+                        // The consumer one lap behind has not freed this cell yet.
+                        return false;
+                    }
+                    else {
+                        position = pushPosition.load (std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            /// \brief
+            /// Pop a value off the queue.
+            /// \param[out] value Where to put the popped value.
+            /// \return true == popped, false == the queue is empty.
+            bool Pop (T &value) {
+                std::size_t position = popPosition.load (std::memory_order_relaxed);
+                for (;;) {
+                    Cell &cell = cells[position & mask];
+                    std::size_t sequence = cell.sequence.load (std::memory_order_acquire);
+                    std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(position + 1);
+                    if (diff == 0) {
+                        if (popPosition.compare_exchange_weak (
+                                position, position + 1, std::memory_order_relaxed)) {
+                            value = cell.value;
+                            cell.value = T ();
+                            cell.sequence.store (position + mask + 1, std::memory_order_release);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0) {
+                        // The producer has not filled this cell yet.
+                        return false;
+                    }
+                    else {
+                        position = popPosition.load (std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            /// \brief
+            /// MPMCQueue is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (MPMCQueue)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_MPMCQueue_h)
@@ -0,0 +1,352 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_MappedFile_h)
+#define __thekogans_util_MappedFile_h
+
+#include <string>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct MappedRegion MappedFile.h thekogans/util/MappedFile.h
+        ///
+        /// \brief
+        /// MappedRegion is a view of (part of) a \see{MappedFile}. The view
+        /// stays valid for as long as the region is alive, even if the
+        /// \see{MappedFile} that created it is closed. Use \see{MappedReadBuffer}
+        /// and \see{MappedWriteBuffer} to \see{Serializer} straight from/to
+        /// the mapping.
+
+        struct _LIB_THEKOGANS_UTIL_DECL MappedRegion : public RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (MappedRegion)
+
+            /// \brief
+            /// Access pattern hints (see Advise).
+            enum Advice {
+                /// \brief
+                /// No special treatment.
+                AdviceNormal,
+                /// \brief
+                /// Expect sequential access (aggressive read ahead).
+                AdviceSequential,
+                /// \brief
+                /// Expect random access (no read ahead).
+                AdviceRandom,
+                /// \brief
+                /// The range will be needed soon (prefetch it).
+                AdviceWillNeed,
+                /// \brief
+                /// The range won't be needed soon (pages can be dropped).
+                AdviceDontNeed,
+                /// \brief
+                /// Back the range with huge pages (Linux transparent huge pages).
+                AdviceHugePage
+            };
+
+        private:
+            /// \brief
+            /// Start of the mapping (aligned on allocation granularity).
+            void *base;
+            /// \brief
+            /// Length of the mapping starting at base.
+            std::size_t baseLength;
+            /// \brief
+            /// Start of the region (base + offset % granularity).
+            ui8 *data;
+            /// \brief
+            /// Region length.
+            std::size_t length;
+            /// \brief
+            /// Region offset in the file.
+            ui64 offset;
+            /// \brief
+            /// true == read-only view.
+            bool readOnly;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] base_ Start of the mapping.
+            /// \param[in] baseLength_ Length of the mapping.
+            /// \param[in] data_ Start of the region.
+            /// \param[in] length_ Region length.
+            /// \param[in] offset_ Region offset in the file.
+            /// \param[in] readOnly_ true == read-only view.
+            MappedRegion (
+                void *base_,
+                std::size_t baseLength_,
+                ui8 *data_,
+                std::size_t length_,
+                ui64 offset_,
+                bool readOnly_) :
+                base (base_),
+                baseLength (baseLength_),
+                data (data_),
+                length (length_),
+                offset (offset_),
+                readOnly (readOnly_) {}
+
+        public:
+            /// \brief
+            /// dtor. Unmap the view.
+            virtual ~MappedRegion ();
+
+            /// \brief
+            /// Return the start of the region.
+            /// \return Start of the region.
+            inline ui8 *GetData () const {
+                return data;
+            }
+            /// \brief
+            /// Return the region length.
+            /// \return Region length.
+            inline std::size_t GetLength () const {
+                return length;
+            }
+            /// \brief
+            /// Return the region offset in the file.
+            /// \return Region offset in the file.
+            inline ui64 GetOffset () const {
+                return offset;
+            }
+            /// \brief
+            /// Return true if the view is read-only.
+            /// \return true == the view is read-only.
+            inline bool IsReadOnly () const {
+                return readOnly;
+            }
+
+            /// \brief
+            /// Give the kernel a hint about how a range of the region will be accessed.
+            /// On Windows only AdviceWillNeed has an effect (PrefetchVirtualMemory).
+            /// \param[in] advice One of the Advice* values above.
+            /// \param[in] offset_ Start of the range (relative to the region).
+            /// \param[in] length_ Length of the range (0 == to the end of the region).
+            void Advise (
+                Advice advice,
+                std::size_t offset_ = 0,
+                std::size_t length_ = 0);
+            /// \brief
+            /// Start reading a range of the region in to memory. Equivalent to
+            /// Advise (AdviceWillNeed, ...).
+            /// \param[in] offset_ Start of the range (relative to the region).
+            /// \param[in] length_ Length of the range (0 == to the end of the region).
+            inline void Prefetch (
+                    std::size_t offset_ = 0,
+                    std::size_t length_ = 0) {
+                Advise (AdviceWillNeed, offset_, length_);
+            }
+            /// \brief
+            /// Flush modified pages of a range of the region to the file.
+            /// \param[in] wait true == block until the pages are written,
+            /// false == schedule the write and return.
+            /// \param[in] offset_ Start of the range (relative to the region).
+            /// \param[in] length_ Length of the range (0 == to the end of the region).
+            void Sync (
+                bool wait = true,
+                std::size_t offset_ = 0,
+                std::size_t length_ = 0);
+
+        private:
+            /// \brief
+            /// Validate the given range and return it's page aligned bounds.
+            /// \param[in] offset_ Start of the range (relative to the region).
+            /// \param[in] length_ Length of the range (0 == to the end of the region).
+            /// \param[out] start Page aligned start of the range.
+            /// \param[out] size Length of the range from start.
+            void GetRange (
+                std::size_t offset_,
+                std::size_t length_,
+                ui8 *&start,
+                std::size_t &size) const;
+
+            /// \brief
+            /// MappedFile creates regions.
+            friend struct MappedFile;
+
+            /// \brief
+            /// MappedRegion is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (MappedRegion)
+        };
+
+        /// \struct MappedFile MappedFile.h thekogans/util/MappedFile.h
+        ///
+        /// \brief
+        /// MappedFile maps (parts of) a file in to memory. Unlike \see{File},
+        /// which copies data through user space buffers, MappedFile gives
+        /// direct access to the page cache. Here is a canonical use case:
+        ///
+        /// \code{.cpp}
+        /// thekogans::util::MappedFile file (path);
+        /// thekogans::util::MappedRegion::SharedPtr region = file.Map ();
+        /// region->Advise (thekogans::util::MappedRegion::AdviceSequential);
+        /// thekogans::util::MappedReadBuffer buffer (
+        ///     thekogans::util::LittleEndian, region);
+        /// buffer >> ...;
+        /// \endcode
+
+        struct _LIB_THEKOGANS_UTIL_DECL MappedFile {
+        private:
+            /// \brief
+            /// File path.
+            std::string path;
+            /// \brief
+            /// OS file handle.
+            THEKOGANS_UTIL_HANDLE handle;
+        #if defined (TOOLCHAIN_OS_Windows)
+            /// \brief
+            /// Windows file mapping handle.
+            THEKOGANS_UTIL_HANDLE mapping;
+        #endif // defined (TOOLCHAIN_OS_Windows)
+            /// \brief
+            /// File size.
+            ui64 size;
+            /// \brief
+            /// true == file was opened read-only.
+            bool readOnly;
+
+        public:
+            /// \brief
+            /// ctor. Open the given file for mapping.
+            /// \param[in] path_ File to open.
+            /// \param[in] readOnly_ true == open read-only (only read-only
+            /// regions can be mapped), false == open for reading and writing.
+            /// \param[in] size_ If !readOnly_ and size_ > 0 the file is created
+            /// (if it does not exist) and grown (never shrunk) to size_.
+            explicit MappedFile (
+                const std::string &path_,
+                bool readOnly_ = true,
+                ui64 size_ = 0);
+            /// \brief
+            /// dtor. Close the file. Mapped regions stay valid.
+            ~MappedFile ();
+
+            /// \brief
+            /// Return the file path.
+            /// \return File path.
+            inline const std::string &GetPath () const {
+                return path;
+            }
+            /// \brief
+            /// Return the file size.
+            /// \return File size.
+            inline ui64 GetSize () const {
+                return size;
+            }
+            /// \brief
+            /// Return true if the file was opened read-only.
+            /// \return true == the file was opened read-only.
+            inline bool IsReadOnly () const {
+                return readOnly;
+            }
+
+            /// \brief
+            /// Map a region of the file.
+            /// \param[in] offset Region offset (does not need to be page aligned).
+            /// \param[in] length Region length (0 == to the end of the file).
+            /// \param[in] readOnly_ true == map a read-only view. Read-write views
+            /// are shared (changes are written back to the file).
+            /// \return A new \see{MappedRegion}.
+            MappedRegion::SharedPtr Map (
+                ui64 offset = 0,
+                std::size_t length = 0,
+                bool readOnly_ = true);
+
+            /// \brief
+            /// MappedFile is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (MappedFile)
+        };
+
+        /// \struct MappedReadBuffer MappedFile.h thekogans/util/MappedFile.h
+        ///
+        /// \brief
+        /// MappedReadBuffer is a \see{TenantReadBuffer} that keeps the
+        /// \see{MappedRegion} it wraps alive.
+
+        struct _LIB_THEKOGANS_UTIL_DECL MappedReadBuffer : public TenantReadBuffer {
+            /// \brief
+            /// Region being read.
+            MappedRegion::SharedPtr region;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] endianness How multi-byte values are stored.
+            /// \param[in] region_ Region to read.
+            /// \param[in] readOffset Offset at which to read.
+            MappedReadBuffer (
+                Endianness endianness,
+                MappedRegion::SharedPtr region_,
+                std::size_t readOffset = 0) :
+                TenantReadBuffer (
+                    endianness,
+                    region_->GetData (),
+                    region_->GetLength (),
+                    readOffset),
+                region (region_) {}
+
+            /// \brief
+            /// MappedReadBuffer is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (MappedReadBuffer)
+        };
+
+        /// \struct MappedWriteBuffer MappedFile.h thekogans/util/MappedFile.h
+        ///
+        /// \brief
+        /// MappedWriteBuffer is a \see{TenantWriteBuffer} that keeps the
+        /// (read-write) \see{MappedRegion} it wraps alive.
+
+        struct _LIB_THEKOGANS_UTIL_DECL MappedWriteBuffer : public TenantWriteBuffer {
+            /// \brief
+            /// Region being written.
+            MappedRegion::SharedPtr region;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] endianness How multi-byte values are stored.
+            /// \param[in] region_ Region to write (must not be read-only).
+            /// \param[in] writeOffset Offset at which to write.
+            MappedWriteBuffer (
+                    Endianness endianness,
+                    MappedRegion::SharedPtr region_,
+                    std::size_t writeOffset = 0) :
+                    TenantWriteBuffer (
+                        endianness,
+                        region_->GetData (),
+                        region_->GetLength (),
+                        writeOffset),
+                    region (region_) {
+                if (region->IsReadOnly ()) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Can't write to a read-only MappedRegion.");
+                }
+            }
+
+            /// \brief
+            /// MappedWriteBuffer is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (MappedWriteBuffer)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_MappedFile_h)
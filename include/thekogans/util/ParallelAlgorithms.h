@@ -0,0 +1,735 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_ParallelAlgorithms_h)
+#define __thekogans_util_ParallelAlgorithms_h
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <exception>
+#include <type_traits>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Constants.h"
+#include "thekogans/util/Vectorizer.h"
+
+// Parallel versions of the most common std:: algorithms. They hide the
+// Vectorizer::Job boilerplate (Prolog/Execute/Epilog, per rank partial
+// results) behind the familiar iterator interfaces:
+//
+// std::vector<thekogans::util::f32> values = ...;
+// thekogans::util::ParallelTransform (
+//     values.begin (), values.end (), values.begin (),
+//     [] (thekogans::util::f32 value) {return value * 2.0f;});
+// thekogans::util::f32 sum = thekogans::util::ParallelReduce (
+//     values.begin (), values.end (), 0.0f, std::plus<thekogans::util::f32> ());
+// thekogans::util::ParallelSort (values.begin (), values.end ());
+//
+// All algorithms run on the given Vectorizer (GlobalVectorizer by default)
+// with dynamic scheduling. If grainSize == 0, the grain is picked based on
+// the input size and the vector width (about 8 chunks per rank, but never
+// less than PARALLEL_MIN_GRAIN_SIZE elements). Inputs that fit in one
+// grain are processed serially on the calling thread. Exceptions thrown by
+// the user functions are caught on the worker and rethrown (the first one)
+// from the algorithm after all ranks are done.
+// NOTE: Iterators must be random access.
+
+namespace thekogans {
+    namespace util {
+
+        /// \brief
+        /// Smallest number of elements adaptive grain sizing will hand to a rank.
+        /// For expensive per element functions pass an explicit (smaller) grainSize.
+        const std::size_t PARALLEL_MIN_GRAIN_SIZE = 1024;
+
+        namespace detail {
+            /// \brief
+            /// Pick a grain size for size elements on a vector width wide.
+            /// \param[in] size Number of elements.
+            /// \param[in] width Vector width.
+            /// \param[in] grainSize User supplied grain size (0 = adaptive).
+            /// \return Grain size.
+            inline std::size_t GetGrainSize (
+                    std::size_t size,
+                    std::size_t width,
+                    std::size_t grainSize) {
+                return grainSize != 0 ? grainSize :
+                    std::max<std::size_t> (size / (8 * width), PARALLEL_MIN_GRAIN_SIZE);
+            }
+
+            /// \struct Padded ParallelAlgorithms.h thekogans/util/ParallelAlgorithms.h
+            ///
+            /// \brief
+            /// Per rank partial result. The padding keeps ranks
+            /// from fighting over the same cache line.
+            template<typename T>
+            struct Padded {
+                /// \brief
+                /// Partial result.
+                T value;
+                /// \brief
+                /// true == value holds a partial result.
+                bool set;
+                /// \brief
+                /// Padding.
+                ui8 pad[THEKOGANS_UTIL_CACHE_LINE_SIZE];
+
+                /// \brief
+                /// ctor.
+                Padded () :
+                    value (),
+                    set (false) {}
+
+                /// \brief
+                /// Fold a partial result in to this one.
+                /// \param[in] partial Partial result to fold in.
+                /// \param[in] op Binary operation.
+                template<typename BinaryOperation>
+                void Fold (
+                        const T &partial,
+                        BinaryOperation &op) {
+                    if (set) {
+                        value = op (value, partial);
+                    }
+                    else {
+                        value = partial;
+                        set = true;
+                    }
+                }
+            };
+
+            /// \brief
+            /// Run function (startIndex, endIndex, rank) over [0, size)
+            /// in grain sized chunks on the given vectorizer.
+            /// \param[in] size Number of elements.
+            /// \param[in] grainSize Grain size (0 = adaptive).
+            /// \param[in] vectorizer Vectorizer to run on.
+            /// \param[in] function Function to call for every chunk.
+            template<typename Function>
+            void ForRange (
+                    std::size_t size,
+                    std::size_t grainSize,
+                    Vectorizer &vectorizer,
+                    Function &function) {
+                if (size > 0) {
+                    grainSize = GetGrainSize (size, vectorizer.GetWidth (), grainSize);
+                    if (size <= grainSize || vectorizer.GetWidth () == 1) {
+                        function (0, size, 0);
+                    }
+                    else {
+                        struct Job : public Vectorizer::Job {
+                            std::size_t size;
+                            Function &function;
+                            std::atomic<bool> failed;
+                            std::exception_ptr exception;
+
+                            Job (
+                                std::size_t size_,
+                                Function &function_) :
+                                size (size_),
+                                function (function_),
+                                failed (false) {}
+
+                            virtual void Execute (
+                                    std::size_t startIndex,
+                                    std::size_t endIndex,
+                                    std::size_t rank) throw () override {
+                                if (!failed.load (std::memory_order_relaxed)) {
+                                    try {
+                                        function (startIndex, endIndex, rank);
+                                    }
+                                    catch (...) {
+                                        bool expected = false;
+                                        if (failed.compare_exchange_strong (expected, true)) {
+                                            exception = std::current_exception ();
+                                        }
+                                    }
+                                }
+                            }
+
+                            virtual std::size_t Size () const throw () override {
+                                return size;
+                            }
+                        } job (size, function);
+                        vectorizer.Execute (job, grainSize, Vectorizer::ScheduleDynamic);
+                        if (job.exception) {
+                            std::rethrow_exception (job.exception);
+                        }
+                    }
+                }
+            }
+
+            /// \brief
+            /// Return the number of elements to take from a (the rest coming
+            /// from b) for the first diagonal elements of merge (a, b).
+            /// Ties go to a (same as std::merge).
+            template<
+                typename Iterator1,
+                typename Iterator2,
+                typename Compare>
+            std::size_t MergePathSplit (
+                    Iterator1 a,
+                    std::size_t aSize,
+                    Iterator2 b,
+                    std::size_t bSize,
+                    std::size_t diagonal,
+                    Compare &compare) {
+                std::size_t lo = diagonal > bSize ? diagonal - bSize : 0;
+                std::size_t hi = std::min (diagonal, aSize);
+                while (lo < hi) {
+                    std::size_t i = lo + (hi - lo) / 2;
+                    std::size_t j = diagonal - i;
+                    if (j > 0 && i < aSize && !compare (b[j - 1], a[i])) {
+                        lo = i + 1;
+                    }
+                    else {
+                        hi = i;
+                    }
+                }
+                return lo;
+            }
+
+            /// \brief
+            /// Merge (moving) [a, a + aSize) and [b, b + bSize) in to out in parallel.
+            /// The output is cut in to grain sized pieces whose merge path splits
+            /// are all found up front (the merges move from the very elements
+            /// the searches look at).
+            template<
+                typename Iterator1,
+                typename Iterator2,
+                typename OutputIterator,
+                typename Compare>
+            void ParallelMerge (
+                    Iterator1 a,
+                    std::size_t aSize,
+                    Iterator2 b,
+                    std::size_t bSize,
+                    OutputIterator out,
+                    Compare &compare,
+                    std::size_t grainSize,
+                    Vectorizer &vectorizer) {
+                std::size_t size = aSize + bSize;
+                grainSize = GetGrainSize (size, vectorizer.GetWidth (), grainSize);
+                std::size_t pieceCount = (size + grainSize - 1) / grainSize;
+                std::vector<std::size_t> splits (pieceCount + 1);
+                for (std::size_t i = 0; i <= pieceCount; ++i) {
+                    splits[i] = MergePathSplit (a, aSize, b, bSize,
+                        std::min (i * grainSize, size), compare);
+                }
+                auto merge = [&] (
+                        std::size_t startPiece,
+                        std::size_t endPiece,
+                        std::size_t /*rank*/) {
+                    std::size_t startIndex = std::min (startPiece * grainSize, size);
+                    std::size_t endIndex = std::min (endPiece * grainSize, size);
+                    std::size_t i0 = splits[startPiece];
+                    std::size_t i1 = splits[endPiece];
+                    std::merge (
+                        std::make_move_iterator (a + i0),
+                        std::make_move_iterator (a + i1),
+                        std::make_move_iterator (b + (startIndex - i0)),
+                        std::make_move_iterator (b + (endIndex - i1)),
+                        out + startIndex,
+                        compare);
+                };
+                ForRange (pieceCount, 1, vectorizer, merge);
+            }
+
+            /// \brief
+            /// One LSD radix sort pass (8 bits at shift) from src to dst.
+            /// \return false == all keys have the same digit (nothing was moved).
+            template<
+                typename SourceIterator,
+                typename DestinationIterator,
+                typename Key>
+            bool RadixPass (
+                    SourceIterator src,
+                    DestinationIterator dst,
+                    std::size_t size,
+                    std::size_t blockSize,
+                    std::size_t blockCount,
+                    ui32 shift,
+                    Key key,
+                    std::vector<std::size_t> &counts,
+                    Vectorizer &vectorizer) {
+                auto histogram = [&] (
+                        std::size_t startBlock,
+                        std::size_t endBlock,
+                        std::size_t /*rank*/) {
+                    for (; startBlock < endBlock; ++startBlock) {
+                        std::size_t *blockCounts = &counts[startBlock * 256];
+                        std::fill (blockCounts, blockCounts + 256, 0);
+                        for (std::size_t i = startBlock * blockSize,
+                                end = std::min (i + blockSize, size); i < end; ++i) {
+                            ++blockCounts[(key (src[i]) >> shift) & 0xff];
+                        }
+                    }
+                };
+                ForRange (blockCount, 1, vectorizer, histogram);
+                // Turn the counts in to starting offsets (digit major, block minor
+                // to keep the sort stable).
+                std::size_t offset = 0;
+                for (std::size_t digit = 0; digit < 256; ++digit) {
+                    std::size_t digitCount = 0;
+                    for (std::size_t block = 0; block < blockCount; ++block) {
+                        std::size_t count = counts[block * 256 + digit];
+                        counts[block * 256 + digit] = offset + digitCount;
+                        digitCount += count;
+                    }
+                    if (digitCount == size) {
+                        return false;
+                    }
+                    offset += digitCount;
+                }
+                auto scatter = [&] (
+                        std::size_t startBlock,
+                        std::size_t endBlock,
+                        std::size_t /*rank*/) {
+                    for (; startBlock < endBlock; ++startBlock) {
+                        std::size_t *blockOffsets = &counts[startBlock * 256];
+                        for (std::size_t i = startBlock * blockSize,
+                                end = std::min (i + blockSize, size); i < end; ++i) {
+                            dst[blockOffsets[(key (src[i]) >> shift) & 0xff]++] = src[i];
+                        }
+                    }
+                };
+                ForRange (blockCount, 1, vectorizer, scatter);
+                return true;
+            }
+        } // namespace detail
+
+        /// \brief
+        /// Call function (i) for every i in [first, last).
+        /// \param[in] first First index.
+        /// \param[in] last One past the last index.
+        /// \param[in] function Function to call.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        template<typename Function>
+        void ParallelFor (
+                std::size_t first,
+                std::size_t last,
+                Function function,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            if (first < last) {
+                auto chunk = [&] (
+                        std::size_t startIndex,
+                        std::size_t endIndex,
+                        std::size_t /*rank*/) {
+                    for (; startIndex < endIndex; ++startIndex) {
+                        function (first + startIndex);
+                    }
+                };
+                detail::ForRange (last - first, grainSize, vectorizer, chunk);
+            }
+        }
+
+        /// \brief
+        /// Call function (*it) for every it in [first, last).
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[in] function Function to call.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        template<
+            typename Iterator,
+            typename Function>
+        void ParallelForEach (
+                Iterator first,
+                Iterator last,
+                Function function,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            auto chunk = [&] (
+                    std::size_t startIndex,
+                    std::size_t endIndex,
+                    std::size_t /*rank*/) {
+                for (Iterator it = first + startIndex, end = first + endIndex; it != end; ++it) {
+                    function (*it);
+                }
+            };
+            detail::ForRange (last - first, grainSize, vectorizer, chunk);
+        }
+
+        /// \brief
+        /// Parallel std::transform: *(result + i) = op (*(first + i)).
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[out] result Where to put the results (can be first).
+        /// \param[in] op Unary operation.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        /// \return One past the last result.
+        template<
+            typename InputIterator,
+            typename OutputIterator,
+            typename UnaryOperation>
+        OutputIterator ParallelTransform (
+                InputIterator first,
+                InputIterator last,
+                OutputIterator result,
+                UnaryOperation op,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            auto chunk = [&] (
+                    std::size_t startIndex,
+                    std::size_t endIndex,
+                    std::size_t /*rank*/) {
+                std::transform (first + startIndex, first + endIndex, result + startIndex, op);
+            };
+            std::size_t size = last - first;
+            detail::ForRange (size, grainSize, vectorizer, chunk);
+            return result + size;
+        }
+
+        /// \brief
+        /// Parallel std::reduce. Every rank folds it's chunks in to it's own
+        /// (cache line padded) accumulator, and the accumulators are folded
+        /// in to init at the end.
+        /// NOTE: op must be associative and commutative (chunks are
+        /// handed out dynamically, so the order is not preserved).
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[in] init Initial value.
+        /// \param[in] op Binary operation.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        /// \return init op *first op ... op *(last - 1).
+        template<
+            typename Iterator,
+            typename T,
+            typename BinaryOperation>
+        T ParallelReduce (
+                Iterator first,
+                Iterator last,
+                T init,
+                BinaryOperation op,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            std::vector<detail::Padded<T>> partials (vectorizer.GetWidth ());
+            auto chunk = [&] (
+                    std::size_t startIndex,
+                    std::size_t endIndex,
+                    std::size_t rank) {
+                T partial = first[startIndex];
+                for (++startIndex; startIndex < endIndex; ++startIndex) {
+                    partial = op (partial, first[startIndex]);
+                }
+                partials[rank].Fold (partial, op);
+            };
+            detail::ForRange (last - first, grainSize, vectorizer, chunk);
+            for (std::size_t i = 0, count = partials.size (); i < count; ++i) {
+                if (partials[i].set) {
+                    init = op (init, partials[i].value);
+                }
+            }
+            return init;
+        }
+
+        namespace detail {
+            /// \brief
+            /// Three phase parallel scan: 1. reduce every block, 2. scan the
+            /// block sums (serially, there are only a few), 3. scan every
+            /// block seeded with it's carry in.
+            template<
+                typename InputIterator,
+                typename OutputIterator,
+                typename T,
+                typename BinaryOperation>
+            OutputIterator ParallelScan (
+                    InputIterator first,
+                    InputIterator last,
+                    OutputIterator result,
+                    const T *init,
+                    bool inclusive,
+                    BinaryOperation &op,
+                    std::size_t grainSize,
+                    Vectorizer &vectorizer) {
+                std::size_t size = last - first;
+                if (size > 0) {
+                    grainSize = GetGrainSize (size, vectorizer.GetWidth (), grainSize);
+                    // One block (no reduce pass) if there's no one to share the work with.
+                    std::size_t blockCount = vectorizer.GetWidth () == 1 ? 1 : std::min (
+                        (size + grainSize - 1) / grainSize, 4 * vectorizer.GetWidth ());
+                    std::size_t blockSize = (size + blockCount - 1) / blockCount;
+                    blockCount = (size + blockSize - 1) / blockSize;
+                    std::vector<Padded<T>> carries (blockCount);
+                    if (blockCount > 1) {
+                        auto reduce = [&] (
+                                std::size_t startBlock,
+                                std::size_t endBlock,
+                                std::size_t /*rank*/) {
+                            for (; startBlock < endBlock; ++startBlock) {
+                                std::size_t i = startBlock * blockSize;
+                                std::size_t end = std::min (i + blockSize, size);
+                                T sum = first[i];
+                                for (++i; i < end; ++i) {
+                                    sum = op (sum, first[i]);
+                                }
+                                carries[startBlock].value = sum;
+                            }
+                        };
+                        ForRange (blockCount, 1, vectorizer, reduce);
+                    }
+                    // Block sums -> carry ins.
+                    Padded<T> carry;
+                    if (init != 0) {
+                        carry.Fold (*init, op);
+                    }
+                    for (std::size_t block = 0; block < blockCount; ++block) {
+                        T sum = carries[block].value;
+                        carries[block].value = carry.value;
+                        carries[block].set = carry.set;
+                        carry.Fold (sum, op);
+                    }
+                    auto scan = [&] (
+                            std::size_t startBlock,
+                            std::size_t endBlock,
+                            std::size_t /*rank*/) {
+                        for (; startBlock < endBlock; ++startBlock) {
+                            Padded<T> sum = carries[startBlock];
+                            for (std::size_t i = startBlock * blockSize,
+                                    end = std::min (i + blockSize, size); i < end; ++i) {
+                                // Careful, result can be first.
+                                T value = first[i];
+                                if (inclusive) {
+                                    sum.Fold (value, op);
+                                    result[i] = sum.value;
+                                }
+                                else {
+                                    result[i] = sum.value;
+                                    sum.Fold (value, op);
+                                }
+                            }
+                        }
+                    };
+                    ForRange (blockCount, 1, vectorizer, scan);
+                }
+                return result + size;
+            }
+        } // namespace detail
+
+        /// \brief
+        /// Parallel std::inclusive_scan: *(result + i) = *first op ... op *(first + i).
+        /// NOTE: op must be associative.
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[out] result Where to put the results (can be first).
+        /// \param[in] op Binary operation.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        /// \return One past the last result.
+        template<
+            typename InputIterator,
+            typename OutputIterator,
+            typename BinaryOperation>
+        OutputIterator ParallelInclusiveScan (
+                InputIterator first,
+                InputIterator last,
+                OutputIterator result,
+                BinaryOperation op,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            typedef typename std::iterator_traits<InputIterator>::value_type T;
+            return detail::ParallelScan (first, last, result,
+                (const T *)0, true, op, grainSize, vectorizer);
+        }
+
+        /// \brief
+        /// Parallel std::exclusive_scan: *(result + i) = init op *first op ... op *(first + i - 1).
+        /// NOTE: op must be associative.
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[out] result Where to put the results (can be first).
+        /// \param[in] init Initial value.
+        /// \param[in] op Binary operation.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        /// \return One past the last result.
+        template<
+            typename InputIterator,
+            typename OutputIterator,
+            typename T,
+            typename BinaryOperation>
+        OutputIterator ParallelExclusiveScan (
+                InputIterator first,
+                InputIterator last,
+                OutputIterator result,
+                T init,
+                BinaryOperation op,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            return detail::ParallelScan (first, last, result,
+                &init, false, op, grainSize, vectorizer);
+        }
+
+        /// \brief
+        /// Parallel merge sort. The sequence is cut in to (a power of 2 >= vector
+        /// width) runs that are std::sort(ed) concurrently. The runs are then merged
+        /// pairwise (ping-ponging through a buffer) with every merge split in to
+        /// independent pieces along it's merge path. Like std::sort, it's not stable.
+        /// NOTE: The value type must be default constructible and movable.
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[in] compare Less than comparison.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        template<
+            typename Iterator,
+            typename Compare>
+        void ParallelSort (
+                Iterator first,
+                Iterator last,
+                Compare compare,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            typedef typename std::iterator_traits<Iterator>::value_type T;
+            std::size_t size = last - first;
+            std::size_t width = vectorizer.GetWidth ();
+            if (width == 1 || size <= detail::GetGrainSize (size, width, grainSize)) {
+                std::sort (first, last, compare);
+                return;
+            }
+            std::size_t runCount = 1;
+            while (runCount < width) {
+                runCount *= 2;
+            }
+            std::size_t runSize = (size + runCount - 1) / runCount;
+            auto sortRuns = [&] (
+                    std::size_t startRun,
+                    std::size_t endRun,
+                    std::size_t /*rank*/) {
+                for (; startRun < endRun; ++startRun) {
+                    std::size_t start = std::min (startRun * runSize, size);
+                    std::size_t end = std::min (start + runSize, size);
+                    std::sort (first + start, first + end, compare);
+                }
+            };
+            detail::ForRange (runCount, 1, vectorizer, sortRuns);
+            std::vector<T> buffer (size);
+            bool inBuffer = false;
+            for (; runSize < size; runSize *= 2) {
+                for (std::size_t start = 0; start < size; start += 2 * runSize) {
+                    std::size_t middle = std::min (start + runSize, size);
+                    std::size_t end = std::min (start + 2 * runSize, size);
+                    if (inBuffer) {
+                        detail::ParallelMerge (
+                            buffer.begin () + start, middle - start,
+                            buffer.begin () + middle, end - middle,
+                            first + start, compare, grainSize, vectorizer);
+                    }
+                    else {
+                        detail::ParallelMerge (
+                            first + start, middle - start,
+                            first + middle, end - middle,
+                            buffer.begin () + start, compare, grainSize, vectorizer);
+                    }
+                }
+                inBuffer = !inBuffer;
+            }
+            if (inBuffer) {
+                auto moveBack = [&] (
+                        std::size_t startIndex,
+                        std::size_t endIndex,
+                        std::size_t /*rank*/) {
+                    std::move (buffer.begin () + startIndex,
+                        buffer.begin () + endIndex, first + startIndex);
+                };
+                detail::ForRange (size, grainSize, vectorizer, moveBack);
+            }
+        }
+
+        /// \brief
+        /// Parallel merge sort using operator <.
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        template<typename Iterator>
+        void ParallelSort (
+                Iterator first,
+                Iterator last) {
+            ParallelSort (first, last,
+                std::less<typename std::iterator_traits<Iterator>::value_type> ());
+        }
+
+        /// \brief
+        /// Parallel LSD radix sort (8 bits per pass) for integral keys. Every pass
+        /// builds per block histograms concurrently, turns them in to (stable)
+        /// per block offsets, and scatters the blocks concurrently. Passes where
+        /// all keys share the same digit are skipped. Signed keys are handled by
+        /// flipping the sign bit.
+        /// \param[in] first First element.
+        /// \param[in] last One past the last element.
+        /// \param[in] grainSize Grain size (0 = adaptive).
+        /// \param[in] vectorizer Vectorizer to run on.
+        template<typename Iterator>
+        void ParallelRadixSort (
+                Iterator first,
+                Iterator last,
+                std::size_t grainSize = 0,
+                Vectorizer &vectorizer = GlobalVectorizer::Instance ()) {
+            typedef typename std::iterator_traits<Iterator>::value_type T;
+            static_assert (std::is_integral<T>::value,
+                "ParallelRadixSort only sorts integral keys.");
+            typedef typename std::make_unsigned<T>::type U;
+            std::size_t size = last - first;
+            std::size_t width = vectorizer.GetWidth ();
+            grainSize = detail::GetGrainSize (size, width, grainSize);
+            if (width == 1 || size <= grainSize) {
+                std::sort (first, last);
+                return;
+            }
+            const U signBit = std::is_signed<T>::value ?
+                (U)((U)1 << (sizeof (T) * 8 - 1)) : (U)0;
+            auto key = [signBit] (T value) -> U {
+                return (U)value ^ signBit;
+            };
+            std::size_t blockCount = std::min ((size + grainSize - 1) / grainSize, 4 * width);
+            std::size_t blockSize = (size + blockCount - 1) / blockCount;
+            blockCount = (size + blockSize - 1) / blockSize;
+            std::vector<std::size_t> counts (blockCount * 256);
+            std::vector<T> buffer (size);
+            bool inBuffer = false;
+            for (ui32 shift = 0; shift < sizeof (T) * 8; shift += 8) {
+                if (inBuffer ?
+                        detail::RadixPass (buffer.begin (), first, size, blockSize,
+                            blockCount, shift, key, counts, vectorizer) :
+                        detail::RadixPass (first, buffer.begin (), size, blockSize,
+                            blockCount, shift, key, counts, vectorizer)) {
+                    inBuffer = !inBuffer;
+                }
+            }
+            if (inBuffer) {
+                auto copyBack = [&] (
+                        std::size_t startIndex,
+                        std::size_t endIndex,
+                        std::size_t /*rank*/) {
+                    std::copy (buffer.begin () + startIndex,
+                        buffer.begin () + endIndex, first + startIndex);
+                };
+                detail::ForRange (size, grainSize, vectorizer, copyBack);
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_ParallelAlgorithms_h)
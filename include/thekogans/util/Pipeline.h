@@ -47,6 +47,15 @@ namespace thekogans {
         /// job on to the next stage (this is how modern processor
         /// architectures perform scalar, and even super-scalar
         /// execution).
+        ///
+        /// By default jobs move between stages through the stage
+        /// \see{JobQueue} pendingJobs (a mutex and a condition variable
+        /// per hop). Set Stage::handoffCapacity to move them through a
+        /// bounded lock-free ring instead. A full ring blocks the stage
+        /// feeding it, so a slow stage throttles the ones before it
+        /// instead of accumulating an unbounded backlog. With
+        /// Stage::inlineExecution the worker that finished the previous
+        /// stage runs an idle stage itself.
 
         struct _LIB_THEKOGANS_UTIL_DECL Pipeline : public virtual RefCounted {
             /// \brief
@@ -228,6 +237,10 @@ namespace thekogans {
                 /// \brief
                 /// Job execution end time.
                 ui64 end;
+                /// \brief
+                /// When the job was enqueued on the pipeline
+                /// (enqueueTime tracks the current stage).
+                ui64 pipelineEnqueueTime;
 
             public:
                 /// \brief
@@ -357,6 +370,26 @@ namespace thekogans {
                 /// \brief
                 /// Called to initialize/uninitialize the worker thread.
                 RunLoop::WorkerCallback *workerCallback;
+                /// \brief
+                /// If > 0, jobs are handed off to this stage through a lock-free
+                /// ring of this capacity (see \see{JobQueue::HandoffJob}). When the
+                /// ring is full, the upstream stage blocks (backpressure).
+                std::size_t handoffCapacity;
+                /// \brief
+                /// true == if this stage is idle, the worker that finished the
+                /// previous stage executes this one on it's own thread (while
+                /// the job's data is still hot in it's cache). Requires
+                /// handoffCapacity > 0.
+                bool inlineExecution;
+                /// \brief
+                /// Max jobs in this stage (queued and running), 0 == unbounded.
+                /// A job finishing the previous stage waits for room (a credit)
+                /// before entering this one. A full stage therefore stalls the
+                /// one before it, which fills up and stalls the one before it,
+                /// all the way back to the pipeline entry (see \see{AdmitJob}).
+                /// Keep it <= jobExecutionPolicy->maxJobs so that the stage
+                /// never throws from inside the previous stage's worker.
+                std::size_t capacity;
 
                 /// \brief
                 /// ctor.
@@ -364,8 +397,12 @@ namespace thekogans {
                 /// \param[in] jobExecutionPolicy_ Stage \see{JobQueue} \see{RunLoop::JobExecutionPolicy}.
                 /// \param[in] workerCount_ Number of workers servicing this stage.
                 /// \param[in] workerPriority_ Stage worker thread priority.
-                /// \param[in] workerAffinity_ Stage worker thread processor affinity.
+                /// \param[in] workerAffinity_ Stage worker thread processor affinity (a processor
+                /// id, or one of the \see{CPUTopology} placement policies).
                 /// \param[in] workerCallback_ Called to initialize/uninitialize the stage worker thread(s).
+                /// \param[in] handoffCapacity_ Stage handoff ring capacity (0 == no ring).
+                /// \param[in] inlineExecution_ true == execute the stage inline when it's idle.
+                /// \param[in] capacity_ Max jobs in this stage (0 == unbounded).
                 Stage (
                     const std::string &name_ = std::string (),
                     RunLoop::JobExecutionPolicy::SharedPtr jobExecutionPolicy_ =
@@ -373,13 +410,19 @@ namespace thekogans {
                     std::size_t workerCount_ = 1,
                     i32 workerPriority_ = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
                     ui32 workerAffinity_ = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
-                    RunLoop::WorkerCallback *workerCallback_ = 0) :
+                    RunLoop::WorkerCallback *workerCallback_ = 0,
+                    std::size_t handoffCapacity_ = 0,
+                    bool inlineExecution_ = false,
+                    std::size_t capacity_ = 0) :
                     name (name_),
                     jobExecutionPolicy (jobExecutionPolicy_),
                     workerCount (workerCount_),
                     workerPriority (workerPriority_),
                     workerAffinity (workerAffinity_),
-                    workerCallback (workerCallback_) {}
+                    workerCallback (workerCallback_),
+                    handoffCapacity (handoffCapacity_),
+                    inlineExecution (inlineExecution_),
+                    capacity (capacity_) {}
             };
 
             /// \struct RunLoop::State RunLoop.h thekogans/util/RunLoop.h
@@ -421,6 +464,12 @@ namespace thekogans {
                 /// Pipeline stats.
                 RunLoop::Stats stats;
                 /// \brief
+                /// Job wait times. Recorded outside jobsMutex.
+                ConcurrentHistogram waitTimes;
+                /// \brief
+                /// Job run times. Recorded outside jobsMutex.
+                ConcurrentHistogram runTimes;
+                /// \brief
                 /// Synchronization mutex.
                 Mutex jobsMutex;
                 /// \brief
@@ -436,6 +485,9 @@ namespace thekogans {
                 /// Signal waiting workers that the pipeline is not paused.
                 Condition notPaused;
                 /// \brief
+                /// Signaled when a pending job is dequeued (see \see{AdmitJob}).
+                Condition notFull;
+                /// \brief
                 /// Number of workers servicing the pipeline.
                 const std::size_t workerCount;
                 /// \brief
@@ -477,11 +529,18 @@ namespace thekogans {
                     /// ctor.
                     /// \param[in] state_ Pipeline to which this worker belongs.
                     /// \param[in] name Worker thread name.
+                    /// \param[in] index Worker index (used to place the worker
+                    /// if workerAffinity is a \see{CPUTopology} placement policy).
                     Worker (State::SharedPtr state_,
-                            const std::string &name = std::string ()) :
+                            const std::string &name = std::string (),
+                            std::size_t index = 0) :
                             Thread (name),
                             state (state_) {
-                        Create (state->workerPriority, state->workerAffinity);
+                        Create (
+                            state->workerPriority,
+                            state->workerAffinity,
+                            index,
+                            state->workerCount);
                     }
 
                 private:
@@ -497,6 +556,24 @@ namespace thekogans {
                 /// Pipeline stages.
                 std::vector<JobQueue::SharedPtr> stages;
                 /// \brief
+                /// Stage::inlineExecution of every stage.
+                std::vector<bool> inlineStages;
+                /// \brief
+                /// Stage::capacity of every stage.
+                std::vector<std::size_t> stageCapacities;
+                /// \brief
+                /// Count of jobs in every stage (credits in use).
+                std::unique_ptr<std::atomic<std::size_t>[]> stageJobs;
+                /// \brief
+                /// Count of workers waiting for a stage credit.
+                std::atomic<std::size_t> creditWaiters;
+                /// \brief
+                /// Synchronization mutex (creditAvailable).
+                Mutex creditsMutex;
+                /// \brief
+                /// Signaled when a stage credit is released.
+                Condition creditAvailable;
+                /// \brief
                 /// Synchronization mutex.
                 Mutex workersMutex;
 
@@ -540,6 +617,23 @@ namespace thekogans {
                     Job *job,
                     ui64 start,
                     ui64 end);
+                /// \brief
+                /// Used internally to move the job to it's current stage
+                /// (job->stage). Executes the stage inline if the stage
+                /// allows it and is idle, otherwise hands it off to the
+                /// stage workers.
+                /// \param[in] job Job to move.
+                void EnqStageJob (Job *job);
+                /// \brief
+                /// Used internally to reserve room for a job in the given
+                /// stage. Blocks while the stage is full.
+                /// \param[in] stage Stage index.
+                /// \return true == reserved, false == the pipeline was stopped.
+                bool AcquireCredit (std::size_t stage);
+                /// \brief
+                /// Used internally to release the room reserved by AcquireCredit.
+                /// \param[in] stage Stage index.
+                void ReleaseCredit (std::size_t stage);
             };
 
         protected:
@@ -556,7 +650,8 @@ namespace thekogans {
             /// \param[in] jobExecutionPolicy Pipeline \see{JobExecutionPolicy}.
             /// \param[in] workerCount Max workers to service the pipeline.
             /// \param[in] workerPriority Worker thread priority.
-            /// \param[in] workerAffinity Worker thread processor affinity.
+            /// \param[in] workerAffinity Worker thread processor affinity (a processor id,
+            /// or one of the \see{CPUTopology} placement policies).
             /// \param[in] workerCallback Called to initialize/uninitialize
             /// the worker thread.
             Pipeline (
@@ -657,6 +752,20 @@ namespace thekogans {
                 bool wait = false,
                 const TimeSpec &timeSpec = TimeSpec::Infinite);
             /// \brief
+            /// Enqueue a job on the pipeline if it has room for it. Unlike EnqJob,
+            /// which throws when the pipeline \see{JobExecutionPolicy} maxJobs is
+            /// reached, AdmitJob waits for the pipeline to make room. Combined with
+            /// Stage::capacity this bounds the number of jobs in the pipeline.
+            /// \param[in] job Job to enqueue.
+            /// \param[in] timeSpec How long to wait for room. TimeSpec::Zero == don't
+            /// wait, TimeSpec::Infinite == wait until there's room or the pipeline
+            /// is stopped.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == the job was enqueued, false == the pipeline is full.
+            bool AdmitJob (
+                Job::SharedPtr job,
+                const TimeSpec &timeSpec = TimeSpec::Infinite);
+            /// \brief
             /// Enqueue a lambda (function) to be performed by the pipeline stages.
             /// \param[in] begin First lambda in the array.
             /// \param[in] end Just past the last lambda in the array.
@@ -822,6 +931,15 @@ namespace thekogans {
             /// \brief
             /// Reset the pipeline stats.
             void ResetStats ();
+            /// \brief
+            /// Return a snapshot of the job wait and run time histograms
+            /// without taking the pipeline lock (see \see{RunLoop::GetJobTimes}).
+            /// \param[out] waitTime Distribution of the time jobs spent waiting
+            /// to enter the first stage.
+            /// \param[out] runTime Distribution of the time jobs spent in the pipeline.
+            void GetJobTimes (
+                Histogram &waitTime,
+                Histogram &runTime);
 
             /// \brief
             /// Return true if there are no running jobs and the
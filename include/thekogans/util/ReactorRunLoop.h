@@ -0,0 +1,334 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Linux)
+
+#if !defined (__thekogans_util_ReactorRunLoop_h)
+#define __thekogans_util_ReactorRunLoop_h
+
+#include <cstddef>
+#include <string>
+#include <map>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/TimeSpec.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/RunLoop.h"
+#include "thekogans/util/ThreadRunLoop.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct ReactorRunLoop ReactorRunLoop.h thekogans/util/ReactorRunLoop.h
+        ///
+        /// \brief
+        /// ReactorRunLoop is a Linux \see{ThreadRunLoop} that multiplexes job execution
+        /// with handle (file descriptor) readiness and timers on the same thread. Instead
+        /// of waiting on a condition variable, the thread that called Start waits in
+        /// epoll_wait. EnqJob (and Stop, Continue...) wake it up using an eventfd, and
+        /// timers are timerfds registered with the same epoll instance. This way one
+        /// thread can serve pipes, sockets, inotify (\see{Directory::Watcher}) and
+        /// \see{ChildProcess} stdio alongside it's queued jobs without any locking in
+        /// the callbacks (they are always called on the run loop thread).
+        ///
+        /// Use it exactly like a \see{ThreadRunLoop}, and call AddHandle/AddTimer to
+        /// register handles and timers:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// struct PipeReader : public util::ReactorRunLoop::HandleCallback {
+        ///     virtual void OnHandleEvents (
+        ///             util::ReactorRunLoop &runLoop,
+        ///             THEKOGANS_UTIL_HANDLE handle,
+        ///             util::ui32 events) throw () override {
+        ///         if (util::Flags32 (events).Test (util::ReactorRunLoop::EVENT_READ)) {
+        ///             // read from handle.
+        ///         }
+        ///     }
+        /// };
+        ///
+        /// util::ReactorRunLoop runLoop ("Reactor");
+        /// runLoop.AddHandle (
+        ///     pipe[0],
+        ///     util::ReactorRunLoop::EVENT_READ,
+        ///     util::ReactorRunLoop::HandleCallback::SharedPtr (new PipeReader));
+        /// runLoop.Start ();
+        /// \endcode
+        ///
+        /// NOTE: io_uring completions integrate the same way. Register an eventfd with
+        /// the ring (io_uring_register_eventfd) and add it with AddHandle. The callback
+        /// will be called on the run loop thread whenever there are completions to reap.
+
+        struct _LIB_THEKOGANS_UTIL_DECL ReactorRunLoop : public ThreadRunLoop {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (ReactorRunLoop)
+
+            enum {
+                /// \brief
+                /// Handle is readable.
+                EVENT_READ = 1,
+                /// \brief
+                /// Handle is writable.
+                EVENT_WRITE = 2,
+                /// \brief
+                /// Error condition on handle (always reported).
+                EVENT_ERROR = 4,
+                /// \brief
+                /// Peer hung up (always reported).
+                EVENT_HANGUP = 8
+            };
+
+            /// \struct ReactorRunLoop::HandleCallback ReactorRunLoop.h thekogans/util/ReactorRunLoop.h
+            ///
+            /// \brief
+            /// Implement this interface to receive handle readiness notifications.
+            struct _LIB_THEKOGANS_UTIL_DECL HandleCallback : public virtual RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (HandleCallback)
+
+                /// \brief
+                /// dtor.
+                virtual ~HandleCallback () {}
+
+                /// \brief
+                /// Called on the run loop thread when the handle is ready.
+                /// \param[in] runLoop ReactorRunLoop that detected the events.
+                /// \param[in] handle Handle that's ready.
+                /// \param[in] events A combination of EVENT_* flags.
+                virtual void OnHandleEvents (
+                    ReactorRunLoop & /*runLoop*/,
+                    THEKOGANS_UTIL_HANDLE /*handle*/,
+                    ui32 /*events*/) throw () = 0;
+            };
+
+            /// \struct ReactorRunLoop::TimerCallback ReactorRunLoop.h thekogans/util/ReactorRunLoop.h
+            ///
+            /// \brief
+            /// Implement this interface to receive timer notifications.
+            struct _LIB_THEKOGANS_UTIL_DECL TimerCallback : public virtual RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (TimerCallback)
+
+                /// \brief
+                /// dtor.
+                virtual ~TimerCallback () {}
+
+                /// \brief
+                /// Called on the run loop thread when the timer fires.
+                /// \param[in] runLoop ReactorRunLoop that owns the timer.
+                /// \param[in] timer Timer that fired (as returned by AddTimer).
+                /// \param[in] expirations Number of expirations since the last
+                /// call (> 1 if the run loop thread fell behind a periodic timer).
+                virtual void OnTimer (
+                    ReactorRunLoop & /*runLoop*/,
+                    THEKOGANS_UTIL_HANDLE /*timer*/,
+                    ui64 /*expirations*/) throw () = 0;
+            };
+
+        private:
+            /// \brief
+            /// epoll instance.
+            THEKOGANS_UTIL_HANDLE epollHandle;
+            /// \brief
+            /// eventfd used to wake up epoll_wait.
+            THEKOGANS_UTIL_HANDLE eventHandle;
+            /// \brief
+            /// Max events to retrieve per epoll_wait.
+            const std::size_t maxEventsPerWait;
+            /// \brief
+            /// Max jobs to execute before checking on the handles.
+            const std::size_t maxJobsPerWait;
+            /// \brief
+            /// Convenient typedef for std::map<THEKOGANS_UTIL_HANDLE, HandleCallback::SharedPtr>.
+            typedef std::map<THEKOGANS_UTIL_HANDLE, HandleCallback::SharedPtr> HandleMap;
+            /// \brief
+            /// Registered handles.
+            HandleMap handles;
+            /// \struct ReactorRunLoop::TimerInfo ReactorRunLoop.h thekogans/util/ReactorRunLoop.h
+            ///
+            /// \brief
+            /// Registered timer.
+            struct TimerInfo {
+                /// \brief
+                /// Timer callback.
+                TimerCallback::SharedPtr callback;
+                /// \brief
+                /// true == periodic, false == one shot.
+                bool periodic;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] callback_ Timer callback.
+                /// \param[in] periodic_ true == periodic, false == one shot.
+                TimerInfo (
+                    TimerCallback::SharedPtr callback_ = TimerCallback::SharedPtr (),
+                    bool periodic_ = false) :
+                    callback (callback_),
+                    periodic (periodic_) {}
+            };
+            /// \brief
+            /// Convenient typedef for std::map<THEKOGANS_UTIL_HANDLE, TimerInfo>.
+            typedef std::map<THEKOGANS_UTIL_HANDLE, TimerInfo> TimerMap;
+            /// \brief
+            /// Registered timers (timerfd).
+            TimerMap timers;
+            /// \brief
+            /// Synchronization lock for handles and timers.
+            SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] name RunLoop name.
+            /// \param[in] jobExecutionPolicy RunLoop \see{JobExecutionPolicy}.
+            /// \param[in] maxEventsPerWait_ Max events to retrieve per epoll_wait.
+            /// \param[in] maxJobsPerWait_ Max jobs to execute before checking on
+            /// the handles (keeps a busy job queue from starving I/O).
+            ReactorRunLoop (
+                const std::string &name = std::string (),
+                JobExecutionPolicy::SharedPtr jobExecutionPolicy =
+                    JobExecutionPolicy::SharedPtr (new FIFOJobExecutionPolicy),
+                std::size_t maxEventsPerWait_ = 256,
+                std::size_t maxJobsPerWait_ = 64);
+            /// \brief
+            /// dtor.
+            virtual ~ReactorRunLoop ();
+
+            /// \brief
+            /// Start watching the given handle. The handle must be non-blocking.
+            /// \param[in] handle Handle to watch.
+            /// \param[in] events A combination of EVENT_READ and EVENT_WRITE.
+            /// \param[in] callback Callback to call when the handle is ready.
+            /// \param[in] edgeTriggered true == report readiness only when it
+            /// changes (EPOLLET), false == report it for as long as it lasts.
+            void AddHandle (
+                THEKOGANS_UTIL_HANDLE handle,
+                ui32 events,
+                HandleCallback::SharedPtr callback,
+                bool edgeTriggered = false);
+            /// \brief
+            /// Change the events watched for the given handle.
+            /// \param[in] handle Handle previously passed to AddHandle.
+            /// \param[in] events A combination of EVENT_READ and EVENT_WRITE.
+            /// \param[in] edgeTriggered true == report readiness only when it
+            /// changes (EPOLLET), false == report it for as long as it lasts.
+            void ModifyHandle (
+                THEKOGANS_UTIL_HANDLE handle,
+                ui32 events,
+                bool edgeTriggered = false);
+            /// \brief
+            /// Stop watching the given handle.
+            /// NOTE: If called from a thread other than the run loop thread,
+            /// the callback might still be called once (with events gathered
+            /// before the call).
+            /// \param[in] handle Handle previously passed to AddHandle.
+            void DeleteHandle (THEKOGANS_UTIL_HANDLE handle);
+
+            /// \brief
+            /// Create a timer.
+            /// \param[in] timeSpec When (and, if periodic, how often) to fire.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \param[in] callback Callback to call when the timer fires.
+            /// \param[in] periodic true == periodic, false == one shot.
+            /// \return Timer handle to pass to DeleteTimer.
+            THEKOGANS_UTIL_HANDLE AddTimer (
+                const TimeSpec &timeSpec,
+                TimerCallback::SharedPtr callback,
+                bool periodic = false);
+            /// \brief
+            /// Cancel and destroy the given timer. One shot timers are
+            /// destroyed automatically after they fire.
+            /// \param[in] timer Timer handle returned by AddTimer.
+            void DeleteTimer (THEKOGANS_UTIL_HANDLE timer);
+
+            // RunLoop
+            /// \brief
+            /// Start the run loop. This is a blocking call and will
+            /// only complete when Stop is called.
+            virtual void Start () override;
+            /// \brief
+            /// Stop the run loop. Calling this function will cause the Start call
+            /// to return.
+            /// \param[in] cancelRunningJobs true = Cancel all running jobs.
+            /// \param[in] cancelPendingJobs true = Cancel all pending jobs.
+            virtual void Stop (
+                bool cancelRunningJobs = true,
+                bool cancelPendingJobs = true) override;
+            /// \brief
+            /// Continue the paused run loop.
+            virtual void Continue () override;
+
+            /// \brief
+            /// Enqueue a job to be performed on the run loop thread.
+            /// \param[in] job Job to enqueue.
+            /// \param[in] wait Wait for job to finish. Used for synchronous job execution.
+            /// \param[in] timeSpec How long to wait for the job to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == !wait || WaitForJob (...)
+            virtual bool EnqJob (
+                Job::SharedPtr job,
+                bool wait = false,
+                const TimeSpec &timeSpec = TimeSpec::Infinite) override;
+            /// \brief
+            /// Enqueue a job to be performed next on the run loop thread.
+            /// \param[in] job Job to enqueue.
+            /// \param[in] wait Wait for job to finish. Used for synchronous job execution.
+            /// \param[in] timeSpec How long to wait for the job to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == !wait || WaitForJob (...)
+            virtual bool EnqJobFront (
+                Job::SharedPtr job,
+                bool wait = false,
+                const TimeSpec &timeSpec = TimeSpec::Infinite) override;
+
+        private:
+            /// \brief
+            /// Wake up the thread waiting in epoll_wait.
+            void Wake ();
+            /// \brief
+            /// Execute up to maxJobsPerWait pending jobs.
+            /// \return true == there are more pending jobs.
+            bool ExecuteJobs ();
+            /// \brief
+            /// Dispatch a timer expiration.
+            /// \param[in] timer Timer that fired.
+            /// \return true == it was a timer.
+            bool DispatchTimer (THEKOGANS_UTIL_HANDLE timer);
+            /// \brief
+            /// Dispatch handle events.
+            /// \param[in] handle Handle that's ready.
+            /// \param[in] events epoll events.
+            void DispatchHandle (
+                THEKOGANS_UTIL_HANDLE handle,
+                ui32 events);
+
+            /// \brief
+            /// ReactorRunLoop is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (ReactorRunLoop)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_ReactorRunLoop_h)
+
+#endif // defined (TOOLCHAIN_OS_Linux)
@@ -0,0 +1,340 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_Reclaimer_h)
+#define __thekogans_util_Reclaimer_h
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Allocator.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct Reclaimer Reclaimer.h thekogans/util/Reclaimer.h
+        ///
+        /// \brief
+        /// Reclaimer is the base for the safe memory reclamation domains
+        /// (\see{HazardPointerReclaimer} and \see{EpochReclaimer}). Lock-free
+        /// structures can't free a node the moment they unlink it, as readers
+        /// that loaded a pointer to it before the unlink might still be looking
+        /// at it. Instead of paying for an atomic reference count on every read
+        /// (\see{RefCounted}), the writer Retire(s) the node, and the domain
+        /// frees it once no reader can possibly hold it. How the domain knows
+        /// that is what the derived classes implement.
+        ///
+        /// Every thread that uses a domain gets a ThreadRecord (allocated on first
+        /// use and recycled when the thread exits) holding the thread's reader
+        /// state and it's own list of retired objects. Retire appends to the calling
+        /// thread's list without synchronization, and once the list grows past
+        /// the domain's threshold the thread scans it, freeing whatever is safe.
+        /// Objects left over when a thread exits are handed to the next scan.
+        ///
+        /// Retired objects are freed with a caller supplied deleter. The Retire
+        /// overloads cover the two common cases: objects created with new (which
+        /// includes the \see{Heap} backed ones, as THEKOGANS_UTIL_DECLARE_HEAP
+        /// routes their operator delete to the heap) and raw blocks that came
+        /// from an \see{Allocator}.
+        ///
+        /// IMPORTANT: A domain must outlive every reader and writer using it.
+        /// Use the Global* singletons unless you need a private domain.
+
+        struct _LIB_THEKOGANS_UTIL_DECL Reclaimer {
+            /// \brief
+            /// Frees a retired object.
+            /// \param[in] object Object to free.
+            /// \param[in] size Object size (as passed to Retire).
+            /// \param[in] context Deleter context (as passed to Retire).
+            typedef void (*Deleter) (
+                void *object,
+                std::size_t size,
+                void *context);
+
+            /// \struct Reclaimer::Stats Reclaimer.h thekogans/util/Reclaimer.h
+            ///
+            /// \brief
+            /// Domain stats.
+            struct _LIB_THEKOGANS_UTIL_DECL Stats {
+                /// \brief
+                /// Objects retired.
+                ui64 retiredCount;
+                /// \brief
+                /// Objects freed.
+                ui64 reclaimedCount;
+                /// \brief
+                /// Scans performed.
+                ui64 scanCount;
+                /// \brief
+                /// Thread records (most threads ever using the domain at once).
+                ui64 threadCount;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    retiredCount (0),
+                    reclaimedCount (0),
+                    scanCount (0),
+                    threadCount (0) {}
+
+                /// \brief
+                /// Return the number of objects retired, but not yet freed.
+                /// \return Number of objects waiting to be freed.
+                inline ui64 GetPendingCount () const {
+                    return retiredCount - reclaimedCount;
+                }
+            };
+
+        protected:
+            /// \struct Reclaimer::RetiredObject Reclaimer.h thekogans/util/Reclaimer.h
+            ///
+            /// \brief
+            /// An object waiting to be freed.
+            struct RetiredObject {
+                /// \brief
+                /// Object to free.
+                void *object;
+                /// \brief
+                /// Object size.
+                std::size_t size;
+                /// \brief
+                /// Frees the object.
+                Deleter deleter;
+                /// \brief
+                /// Deleter context.
+                void *context;
+                /// \brief
+                /// Domain specific stamp (\see{EpochReclaimer} keeps
+                /// the epoch the object was retired in here).
+                ui64 stamp;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] object_ Object to free.
+                /// \param[in] size_ Object size.
+                /// \param[in] deleter_ Frees the object.
+                /// \param[in] context_ Deleter context.
+                RetiredObject (
+                    void *object_,
+                    std::size_t size_,
+                    Deleter deleter_,
+                    void *context_) :
+                    object (object_),
+                    size (size_),
+                    deleter (deleter_),
+                    context (context_),
+                    stamp (0) {}
+
+                /// \brief
+                /// Free the object.
+                inline void Reclaim () const {
+                    deleter (object, size, context);
+                }
+            };
+            /// \brief
+            /// Convenient typedef for std::vector<RetiredObject>.
+            typedef std::vector<RetiredObject> RetiredObjects;
+
+            /// \struct Reclaimer::ThreadRecord Reclaimer.h thekogans/util/Reclaimer.h
+            ///
+            /// \brief
+            /// Per thread domain state. Derived domains extend it with their
+            /// reader state. Records are never freed while the domain is alive,
+            /// so scanning threads can walk the list without synchronization.
+            struct ThreadRecord {
+                /// \brief
+                /// Next record in the domain's list.
+                ThreadRecord *next;
+                /// \brief
+                /// true == a thread owns this record.
+                std::atomic<bool> active;
+                /// \brief
+                /// Objects retired by the owning thread.
+                RetiredObjects retired;
+
+                /// \brief
+                /// ctor.
+                ThreadRecord () :
+                    next (0),
+                    active (true) {}
+                /// \brief
+                /// dtor.
+                virtual ~ThreadRecord () {}
+
+                /// \brief
+                /// Called when the owning thread exits to reset the
+                /// reader state before the record is recycled.
+                virtual void Clear () = 0;
+            };
+
+            /// \brief
+            /// Unique (for the life of the process) domain serial number.
+            /// Used by the per thread record cache to tell domains apart.
+            const ui64 serialNumber;
+            /// \brief
+            /// Thread record list (push only).
+            std::atomic<ThreadRecord *> threadRecords;
+            /// \brief
+            /// Number of records in threadRecords.
+            std::atomic<std::size_t> threadRecordCount;
+            /// \brief
+            /// Scan the thread's retired list once it's this long.
+            const std::size_t retireThreshold;
+            /// \brief
+            /// Objects left over by exited threads.
+            RetiredObjects orphans;
+            /// \brief
+            /// Number of objects in orphans (checked without the lock).
+            std::atomic<std::size_t> orphanCount;
+            /// \brief
+            /// Protects orphans.
+            SpinLock orphansLock;
+            /// \brief
+            /// Objects retired.
+            std::atomic<ui64> retiredCount;
+            /// \brief
+            /// Objects freed.
+            std::atomic<ui64> reclaimedCount;
+            /// \brief
+            /// Scans performed.
+            std::atomic<ui64> scanCount;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] retireThreshold_ Scan the thread's retired
+            /// list once it's this long.
+            explicit Reclaimer (std::size_t retireThreshold_);
+            /// \brief
+            /// dtor. Free all retired objects. There must be no readers left.
+            virtual ~Reclaimer ();
+
+            /// \brief
+            /// Retire an object. It will be freed (by calling deleter) once
+            /// no reader can hold a pointer to it. The object must already be
+            /// unreachable for new readers (unlinked from the structure).
+            /// \param[in] object Object to retire.
+            /// \param[in] size Object size (passed to deleter).
+            /// \param[in] deleter Frees the object.
+            /// \param[in] context Passed to deleter.
+            void Retire (
+                void *object,
+                std::size_t size,
+                Deleter deleter,
+                void *context = 0);
+            /// \brief
+            /// Retire an object created with new (including objects with
+            /// a \see{Heap}). It will be deleted once no reader can hold it.
+            /// \param[in] object Object to retire.
+            template<typename T>
+            void Retire (T *object) {
+                Retire (object, sizeof (T), DeleteObject<T>, 0);
+            }
+            /// \brief
+            /// Retire a block allocated with the given \see{Allocator}. It will
+            /// be returned to the allocator once no reader can hold it.
+            /// \param[in] block Block to retire.
+            /// \param[in] size Block size (as passed to Allocator::Alloc).
+            /// \param[in] allocator Allocator the block came from.
+            void Retire (
+                void *block,
+                std::size_t size,
+                Allocator &allocator);
+
+            /// \brief
+            /// Scan the calling thread's retired list (and whatever exited
+            /// threads left over) now, instead of waiting for the threshold.
+            /// \return Number of objects freed.
+            std::size_t Reclaim ();
+
+            /// \brief
+            /// Return a snapshot of the domain stats.
+            /// \return Domain stats.
+            Stats GetStats () const;
+
+        protected:
+            /// \brief
+            /// Return the calling thread's record (acquiring one on first use).
+            /// \return The calling thread's record.
+            ThreadRecord &GetThreadRecord ();
+
+            /// \brief
+            /// Create a new thread record.
+            /// \return New thread record.
+            virtual ThreadRecord *NewThreadRecord () = 0;
+            /// \brief
+            /// Called by Retire before adding the object to the thread's
+            /// list. Lets the domain stamp the object.
+            /// \param[in] object Object being retired.
+            virtual void OnRetire (RetiredObject & /*object*/) {}
+            /// \brief
+            /// Free the objects on the given list that no reader can hold.
+            /// \param[in, out] retired List of retired objects to scan.
+            /// Objects still in use are left on the list.
+            /// \return Number of objects freed.
+            virtual std::size_t Scan (RetiredObjects &retired) = 0;
+            /// \brief
+            /// Return the length the thread's retired list has to reach to trigger
+            /// a scan. By default it's retireThreshold. Derived domains whose scan
+            /// cost grows with the number of threads can scale it.
+            /// \return Scan threshold.
+            virtual std::size_t GetScanThreshold () const {
+                return retireThreshold;
+            }
+
+        private:
+            /// \struct Reclaimer::ThreadRecordCache Reclaimer.h thekogans/util/Reclaimer.h
+            ///
+            /// \brief
+            /// Forward declaration of the per thread record cache. It maps
+            /// domains to the calling thread's records, and releases the
+            /// records when the thread exits.
+            struct ThreadRecordCache;
+
+            /// \brief
+            /// Adopt the orphans (if any) and Scan the given list.
+            /// \param[in, out] retired List to scan.
+            /// \return Number of objects freed.
+            std::size_t ScanRetired (RetiredObjects &retired);
+            /// \brief
+            /// Called when a thread that used the domain exits.
+            /// \param[in] record Thread's record.
+            void ReleaseThreadRecord (ThreadRecord &record);
+
+            /// \brief
+            /// Deleter used by Retire (T *).
+            /// \param[in] object Object to delete.
+            template<typename T>
+            static void DeleteObject (
+                    void *object,
+                    std::size_t /*size*/,
+                    void * /*context*/) {
+                delete static_cast<T *> (object);
+            }
+
+            /// \brief
+            /// Reclaimer is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Reclaimer)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_Reclaimer_h)
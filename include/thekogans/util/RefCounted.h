@@ -18,7 +18,11 @@
 #if !defined (__thekogans_util_RefCounted_h)
 #define __thekogans_util_RefCounted_h
 
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
 #include <typeinfo>
 #include <atomic>
 #include "thekogans/util/Config.h"
@@ -61,6 +65,11 @@ namespace thekogans {
         /// inherited from, than your classes' inheritance must be virtual
         /// to ward off the dreaded diamond pattern that can result from
         /// multiple inheritance.
+        ///
+        /// Objects created with RefCounted::Make live in the same allocation as
+        /// their control block (References) instead of paying for a second one.
+        /// The object is destroyed when the last SharedPtr lets go, and the memory
+        /// is returned when the last WeakPtr does.
 
         struct _LIB_THEKOGANS_UTIL_DECL RefCounted {
         private:
@@ -80,19 +89,35 @@ namespace thekogans {
                 /// \brief
                 /// Count of shared references.
                 std::atomic<ui32> shared;
+                /// \brief
+                /// true == References lives in the same block
+                /// as the object (see RefCounted::Make).
+                const bool coAllocated;
 
             public:
                 /// \brief
                 /// ctor.
-                References () :
+                /// \param[in] coAllocated_ true == References lives in
+                /// the same block as the object (see RefCounted::Make).
+                explicit References (bool coAllocated_ = false) :
                     weak (1),
-                    shared (0) {}
+                    shared (0),
+                    coAllocated (coAllocated_) {}
+
+                /// \brief
+                /// Return true if References lives in the same block as the object.
+                /// \return true == References lives in the same block as the object.
+                inline bool IsCoAllocated () const {
+                    return coAllocated;
+                }
 
                 /// \brief
                 /// Increment the weak reference count.
+                /// NOTE: A new reference is always taken out through an existing
+                /// one, so there's nothing to synchronize with (relaxed).
                 /// \return Incremented weak reference count.
                 inline ui32 AddWeakRef () {
-                    return ++weak;
+                    return weak.fetch_add (1, std::memory_order_relaxed) + 1;
                 }
                 /// \brief
                 /// Decrement the weak reference count, and if 0, call delete.
@@ -102,24 +127,27 @@ namespace thekogans {
                 /// Return the count of weak references held.
                 /// \return Count of weak references held.
                 inline ui32 GetWeakCount () const {
-                    return weak;
+                    return weak.load (std::memory_order_relaxed);
                 }
 
                 /// \brief
                 /// Increment the shared reference count.
+                /// NOTE: Same as AddWeakRef, relaxed is enough.
                 /// \return Incremented shared reference count.
                 inline ui32 AddSharedRef () {
-                    return ++shared;
+                    return shared.fetch_add (1, std::memory_order_relaxed) + 1;
                 }
                 /// \brief
                 /// Decrement the shared reference count, and if 0, call object->Harakiri ().
+                /// NOTE: The decrement is acq_rel so that all writes made to the object
+                /// through other references are visible to whoever ends up destroying it.
                 /// \return Decremented shared reference count.
                 ui32 ReleaseSharedRef (RefCounted *object);
                 /// \brief
                 /// Return the count of shared references held.
                 /// \return Count of shared references held.
                 inline ui32 GetSharedCount () const {
-                    return shared;
+                    return shared.load (std::memory_order_relaxed);
                 }
                 /// \brief
                 /// Used by \see{WeakPtr<T>::GetSharedPtr} below to atomically
@@ -133,11 +161,55 @@ namespace thekogans {
                 THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (References)
             } *references;
 
+            /// \struct RefCounted::CoAllocation RefCounted.h thekogans/util/RefCounted.h
+            ///
+            /// \brief
+            /// Used by Make to hand the RefCounted ctor the References it
+            /// placed in front of the object. CoAllocations are kept in a
+            /// per thread stack so that objects created with Make from
+            /// inside another Make'd object's ctor don't get confused.
+            struct _LIB_THEKOGANS_UTIL_DECL CoAllocation {
+                /// \brief
+                /// Start of the object.
+                const ui8 *begin;
+                /// \brief
+                /// End of the object.
+                const ui8 *end;
+                /// \brief
+                /// References waiting to be claimed by the object's RefCounted ctor.
+                References *references;
+                /// \brief
+                /// Previous (outer) CoAllocation on this thread.
+                CoAllocation *prev;
+
+                /// \brief
+                /// ctor. Construct References at the head of the block,
+                /// and push this CoAllocation on the thread's stack.
+                /// \param[in] block Block allocated by Make.
+                /// \param[in] offset Offset of the object in the block.
+                /// \param[in] size Size of the object.
+                CoAllocation (
+                    void *block,
+                    std::size_t offset,
+                    std::size_t size);
+                /// \brief
+                /// dtor. Pop this CoAllocation off the thread's stack.
+                ~CoAllocation ();
+
+                /// \brief
+                /// CoAllocation is neither copy constructable, nor assignable.
+                THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (CoAllocation)
+            };
+
+            /// \brief
+            /// Return the block allocated by Make for the given References.
+            /// \param[in] references References at the head of the block.
+            static void FreeBlock (References *references);
+
         public:
             /// \brief
             /// ctor.
-            RefCounted () :
-                references (new References) {}
+            RefCounted ();
             /// \brief
             /// dtor.
             virtual ~RefCounted ();
@@ -533,6 +605,25 @@ namespace thekogans {
                 }
             };
 
+            /// \brief
+            /// Create a T whose control block (References) shares it's allocation
+            /// (one allocation instead of two). Use it like std::make_shared:
+            ///
+            /// \code{.cpp}
+            /// foo::SharedPtr foo = thekogans::util::RefCounted::Make<foo> (arg1, arg2);
+            /// \endcode
+            ///
+            /// NOTE: The object is bound to it's block; it must be managed with
+            /// SharedPtr/WeakPtr. Make bypasses T's class specific operator new (if any).
+            /// Derived classes that override Harakiri should call RefCounted::Harakiri
+            /// instead of delete this.
+            /// \param[in] args Arguments to pass to T's ctor.
+            /// \return SharedPtr<T> to the new object.
+            template<
+                typename T,
+                typename... Args>
+            static SharedPtr<T> Make (Args &&... args);
+
         protected:
             /// \brief
             /// Default method of suicide. Derived classes can
@@ -543,11 +634,36 @@ namespace thekogans {
             /// compulsory, as they were never 'allocated' to
             /// begin with. In that case consider using \see{Singleton}
             /// with \see{RefCountedInstanceCreator} and \see{RefCountedInstanceDestroyer}.
-            virtual void Harakiri () {
-                delete this;
-            }
+            /// NOTE: Objects created with Make are destroyed in place (their
+            /// memory goes back when the last WeakPtr lets go of it).
+            virtual void Harakiri ();
         };
 
+        template<
+            typename T,
+            typename... Args>
+        RefCounted::SharedPtr<T> RefCounted::Make (Args &&... args) {
+            static_assert (std::is_base_of<RefCounted, T>::value,
+                "T must derive from RefCounted.");
+            static_assert (alignof (T) <= alignof (std::max_align_t),
+                "Over aligned types are not supported.");
+            const std::size_t offset =
+                (sizeof (References) + alignof (T) - 1) / alignof (T) * alignof (T);
+            void *block = ::operator new (offset + sizeof (T));
+            T *object;
+            {
+                CoAllocation coAllocation (block, offset, sizeof (T));
+                try {
+                    object = ::new ((ui8 *)block + offset) T (std::forward<Args> (args)...);
+                }
+                catch (...) {
+                    FreeBlock ((References *)block);
+                    throw;
+                }
+            }
+            return SharedPtr<T> (object);
+        }
+
         /// \def THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS(type)
         /// Use this macro inside a \see{RefCounted} derived class to declare the pointers.
         #define THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS(type)\
@@ -40,6 +40,7 @@
 #include "thekogans/util/Types.h"
 #include "thekogans/util/SizeT.h"
 #include "thekogans/util/Serializable.h"
+#include "thekogans/util/Histogram.h"
 #include "thekogans/util/RefCounted.h"
 #include "thekogans/util/IntrusiveList.h"
 #include "thekogans/util/GUID.h"
@@ -158,6 +159,14 @@ namespace thekogans {
                 /// \brief
                 /// Set when job completes execution.
                 Event completed;
+                /// \brief
+                /// When the job was last enqueued (\see{HRTimer::Click}).
+                /// Used to compute the time the job spent waiting to run.
+                ui64 enqueueTime;
+                /// \brief
+                /// When the job should be done by (absolute, see \see{GetCurrentTime}).
+                /// Used by \see{EDFJobExecutionPolicy} and \see{Scheduler}.
+                TimeSpec deadline;
 
             public:
                 /// \brief
@@ -167,7 +176,9 @@ namespace thekogans {
                     id (id_),
                     state (Completed),
                     disposition (Unknown),
-                    sleeping (false) {}
+                    sleeping (false),
+                    enqueueTime (0),
+                    deadline (TimeSpec::Infinite) {}
                 /// \brief
                 /// dtor.
                 virtual ~Job () {}
@@ -234,11 +245,25 @@ namespace thekogans {
                     return disposition == Succeeded;
                 }
 
+                /// \brief
+                /// Return the job deadline.
+                /// \return Job deadline (TimeSpec::Infinite == no deadline).
+                inline const TimeSpec &GetDeadline () const {
+                    return deadline;
+                }
+                /// \brief
+                /// Set the job deadline. Call this before enqueueing the job.
+                /// \param[in] deadline_ When the job should be done by
+                /// (absolute, TimeSpec::Infinite == no deadline).
+                inline void SetDeadline (const TimeSpec &deadline_) {
+                    deadline = deadline_;
+                }
+
                 /// \brief
                 /// Call this method on a running job to cancel execution.
                 /// Monitor disposition (ShouldStop () below) in Execute ()
                 /// to respond to cancellation requests.
-                void Cancel ();
+                virtual void Cancel ();
 
                 /// \brief
                 /// Wait for the job to complete.
@@ -252,7 +277,7 @@ namespace thekogans {
             protected:
                 /// \brief
                 /// Used internally by RunLoop to set the RunLoop id and reset
-                /// state, disposition and completed.
+                /// state, disposition, completed and enqueueTime.
                 /// \param[in] runLoopId_ RunLoop id to which this job belongs.
                 virtual void Reset (const RunLoop::Id &runLoopId_);
                 /// \brief
@@ -270,7 +295,7 @@ namespace thekogans {
                 /// job as succeeded execution.
                 /// \param[in] done false == job completed successfully, otherwise
                 /// job was forced to exit Execute because the run loop was stopped.
-                void Succeed (const std::atomic<bool> &done);
+                virtual void Succeed (const std::atomic<bool> &done);
 
                 /// \brief
                 /// Return true if the job should stop what it's doing and exit.
@@ -322,6 +347,9 @@ namespace thekogans {
                 /// SystemRunLoop needs acces to protected members.
                 friend struct SystemRunLoop;
                 /// \brief
+                /// ReactorRunLoop needs acces to protected members.
+                friend struct ReactorRunLoop;
+                /// \brief
                 /// JobQueue needs acces to protected members.
                 friend struct JobQueue;
                 /// \brief
@@ -501,6 +529,46 @@ namespace thekogans {
                 virtual Job *DeqJob (State &state) override;
             };
 
+            /// \struct RunLoop::EDFJobExecutionPolicy RunLoop.h thekogans/util/RunLoop.h
+            ///
+            /// \brief
+            /// Earliest Deadline First execution policy. Pending jobs are kept
+            /// sorted by \see{Job::GetDeadline}. Jobs with equal deadlines (and
+            /// jobs without one, which go last) execute in FIFO order. Inserting
+            /// scans pendingJobs from the back, so it's O(1) when the deadlines
+            /// arrive (more or less) in order.
+            struct _LIB_THEKOGANS_UTIL_DECL EDFJobExecutionPolicy : public JobExecutionPolicy {
+                /// \brief
+                /// ctor.
+                /// \param[in] maxJobs Max pending run loop jobs.
+                EDFJobExecutionPolicy (std::size_t maxJobs = SIZE_T_MAX) :
+                    JobExecutionPolicy (maxJobs) {}
+
+                /// \brief
+                /// Enqueue a job on the given RunLoops pendingJobs to be performed
+                /// on the run loop thread (after all jobs with the same or earlier
+                /// deadline).
+                /// \param[in] runLoop RunLoop on which to enqueue the given job.
+                /// \param[in] job Job to enqueue.
+                virtual void EnqJob (
+                    State &state,
+                    Job *job) override;
+                /// \brief
+                /// Enqueue a job on the given RunLoops pendingJobs to be performed
+                /// on the run loop thread (before all jobs with the same or later
+                /// deadline).
+                /// \param[in] runLoop RunLoop on which to enqueue the given job.
+                /// \param[in] job Job to enqueue.
+                virtual void EnqJobFront (
+                    State &state,
+                    Job *job) override;
+                /// \brief
+                /// Dequeue the next job to be executed on the run loop thread.
+                /// \param[in] runLoop RunLoop from which to dequeue the next job.
+                /// \return The next job to execute (0 if no more pending jobs).
+                virtual Job *DeqJob (State &state) override;
+            };
+
             /// \brief
             /// Convenient typedef for std::list<Job::SharedPtr>.
             typedef std::list<Job::SharedPtr> UserJobList;
@@ -511,6 +579,8 @@ namespace thekogans {
             /// RunLoop statistics.\n
             /// totalJobs - Number of retired (completed) jobs.\n
             /// totalJobTime - Amount of time spent executing jobs.\n
+            /// queueDepth - Number of jobs waiting to execute.\n
+            /// maxQueueDepth - Queue depth high-water mark.\n
             /// last - Last job.\n
             /// min - Fastest job.\n
             /// max - Slowest job.\n
@@ -531,6 +601,27 @@ namespace thekogans {
                 /// \brief
                 /// Total time taken to process totalJobs.
                 ui64 totalJobTime;
+                /// \brief
+                /// Number of jobs waiting to execute when the snapshot was taken.
+                SizeT queueDepth;
+                /// \brief
+                /// Most jobs ever waiting to execute (since the last Reset).
+                SizeT maxQueueDepth;
+                /// \brief
+                /// Number of workers servicing the run loop when the
+                /// snapshot was taken (see \see{JobQueue}).
+                SizeT workerCount;
+                /// \brief
+                /// Most workers ever servicing the run loop (since the last Reset).
+                SizeT maxWorkerCount;
+                /// \brief
+                /// Number of workers an elastic \see{JobQueue} added
+                /// to drain a backlog (since the last Reset).
+                SizeT spawnedWorkers;
+                /// \brief
+                /// Number of idle workers an elastic \see{JobQueue}
+                /// retired (since the last Reset).
+                SizeT retiredWorkers;
                 /// \struct RunLoop::Stats::Job RunLoop.h thekogans/util/RunLoop.h
                 ///
                 /// \brief
@@ -662,6 +753,14 @@ namespace thekogans {
                 /// \brief
                 /// Maximum job stats.
                 Job maxJob;
+                /// \brief
+                /// Distribution of the time succeeded jobs spent
+                /// waiting to run (from enqueue to start).
+                Histogram waitTime;
+                /// \brief
+                /// Distribution of the time succeeded jobs spent
+                /// executing (from start to end).
+                Histogram runTime;
 
                 /// \brief
                 /// ctor.
@@ -673,7 +772,13 @@ namespace thekogans {
                     id (id_),
                     name (name_),
                     totalJobs (0),
-                    totalJobTime (0) {}
+                    totalJobTime (0),
+                    queueDepth (0),
+                    maxQueueDepth (0),
+                    workerCount (0),
+                    maxWorkerCount (0),
+                    spawnedWorkers (0),
+                    retiredWorkers (0) {}
                 /// brief
                 /// ctor.
                 /// \parma[in] stats Stats to copy.
@@ -682,9 +787,17 @@ namespace thekogans {
                     name (stats.name),
                     totalJobs (stats.totalJobs),
                     totalJobTime (stats.totalJobTime),
+                    queueDepth (stats.queueDepth),
+                    maxQueueDepth (stats.maxQueueDepth),
+                    workerCount (stats.workerCount),
+                    maxWorkerCount (stats.maxWorkerCount),
+                    spawnedWorkers (stats.spawnedWorkers),
+                    retiredWorkers (stats.retiredWorkers),
                     lastJob (stats.lastJob),
                     minJob (stats.minJob),
-                    maxJob (stats.maxJob) {}
+                    maxJob (stats.maxJob),
+                    waitTime (stats.waitTime),
+                    runTime (stats.runTime) {}
 
                 /// \brief
                 /// Assignment operator.
@@ -731,6 +844,24 @@ namespace thekogans {
                 /// "TotalJobTime"
                 static const char * const ATTR_TOTAL_JOB_TIME;
                 /// \brief
+                /// "QueueDepth"
+                static const char * const ATTR_QUEUE_DEPTH;
+                /// \brief
+                /// "MaxQueueDepth"
+                static const char * const ATTR_MAX_QUEUE_DEPTH;
+                /// \brief
+                /// "WorkerCount"
+                static const char * const ATTR_WORKER_COUNT;
+                /// \brief
+                /// "MaxWorkerCount"
+                static const char * const ATTR_MAX_WORKER_COUNT;
+                /// \brief
+                /// "SpawnedWorkers"
+                static const char * const ATTR_SPAWNED_WORKERS;
+                /// \brief
+                /// "RetiredWorkers"
+                static const char * const ATTR_RETIRED_WORKERS;
+                /// \brief
                 /// "LastJob"
                 static const char * const TAG_LAST_JOB;
                 /// \brief
@@ -739,6 +870,12 @@ namespace thekogans {
                 /// \brief
                 /// "MaxJob"
                 static const char * const TAG_MAX_JOB;
+                /// \brief
+                /// "WaitTime"
+                static const char * const TAG_WAIT_TIME;
+                /// \brief
+                /// "RunTime"
+                static const char * const TAG_RUN_TIME;
 
                 /// \brief
                 /// Read the Serializable from an XML DOM.
@@ -773,11 +910,22 @@ namespace thekogans {
                     RunLoop::Job *job,
                     ui64 start,
                     ui64 end);
+                /// \brief
+                /// After enqueueing each job, used to update the high-water mark.
+                /// \param[in] depth Current queue depth.
+                inline void UpdateQueueDepth (std::size_t depth) {
+                    if (maxQueueDepth < depth) {
+                        maxQueueDepth = depth;
+                    }
+                }
 
                 /// \brief
                 /// RunLoop needs access to Update.
                 friend struct RunLoop;
                 /// \brief
+                /// JobQueue needs access to Update (handed off jobs).
+                friend struct JobQueue;
+                /// \brief
                 /// Pipeline needs access to Update.
                 friend struct Pipeline;
             };
@@ -910,6 +1058,12 @@ namespace thekogans {
                 /// RunLoop stats.
                 Stats stats;
                 /// \brief
+                /// Job wait times. Recorded outside jobsMutex.
+                ConcurrentHistogram waitTimes;
+                /// \brief
+                /// Job run times. Recorded outside jobsMutex.
+                ConcurrentHistogram runTimes;
+                /// \brief
                 /// Synchronization mutex.
                 Mutex jobsMutex;
                 /// \brief
@@ -940,8 +1094,12 @@ namespace thekogans {
                 /// \brief
                 /// Used internally by worker(s) to get the next job.
                 /// \param[in] wait true == Wait until a job becomes available.
-                /// \return The next job to execute.
-                Job *DeqJob (bool wait = true);
+                /// \param[in] timeSpec How long to wait for a job to become available.
+                /// IMPORTANT: timeSpec is a relative value.
+                /// \return The next job to execute (0 == done or timed out).
+                Job *DeqJob (
+                    bool wait = true,
+                    const TimeSpec &timeSpec = TimeSpec::Infinite);
                 /// \brief
                 /// Called by worker(s) after each job is completed.
                 /// Used to update state and \see{RunLoop::Stats}.
@@ -952,6 +1110,16 @@ namespace thekogans {
                     Job *job,
                     ui64 start,
                     ui64 end);
+                /// \brief
+                /// Record the wait and run times of a succeeded job.
+                /// Lock free, called by FinishedJob before it takes jobsMutex.
+                /// \param[in] job Completed job.
+                /// \param[in] start Completed job start time.
+                /// \param[in] end Completed job end time.
+                void RecordJobTimes (
+                    Job *job,
+                    ui64 start,
+                    ui64 end);
             };
 
         protected:
@@ -1234,6 +1402,15 @@ namespace thekogans {
             /// \brief
             /// Reset the run loop stats.
             virtual void ResetStats ();
+            /// \brief
+            /// Return a snapshot of the job wait and run time histograms.
+            /// Unlike GetStats, this method does not take the run loop lock
+            /// and is therefore suitable for frequent polling of busy run loops.
+            /// \param[out] waitTime Distribution of the time jobs spent waiting to run.
+            /// \param[out] runTime Distribution of the time jobs spent executing.
+            void GetJobTimes (
+                Histogram &waitTime,
+                Histogram &runTime);
 
             /// \brief
             /// Return true if there are no running or pending jobs.
@@ -29,6 +29,8 @@
 #include "thekogans/util/SpinLock.h"
 #include "thekogans/util/IntrusiveList.h"
 #include "thekogans/util/JobQueuePool.h"
+#include "thekogans/util/Histogram.h"
+#include "thekogans/util/TimeSpec.h"
 #include "thekogans/util/SystemInfo.h"
 
 namespace thekogans {
@@ -42,6 +44,16 @@ namespace thekogans {
         /// in parallel (prioritized round-robin), but need to make
         /// sequential progress. Scheduler is designed to execute in
         /// O(1) time no mater the number of active queues.
+        ///
+        /// By default, a queue executes one job per turn. Give a priority a time
+        /// slice (\see{SetTimeSlice}) and it's queues will execute jobs back to
+        /// back until they use it up, run out of jobs, or a higher priority queue
+        /// becomes ready (the worker is preempted at the next job boundary). Queues
+        /// whose next job has a deadline (\see{RunLoop::Job::SetDeadline}) are
+        /// scheduled ahead of their peers in Earliest Deadline First order (use
+        /// \see{RunLoop::EDFJobExecutionPolicy} to order the jobs within a queue
+        /// the same way). Each priority has it's own lock, and keeps it's own
+        /// \see{Stats} (queue latency and run quantum accounting).
 
         struct _LIB_THEKOGANS_UTIL_DECL Scheduler {
             /// \brief
@@ -113,6 +125,14 @@ namespace thekogans {
                 /// \brief
                 /// true == a job from this JobQueue is being executed.
                 std::atomic<bool> inFlight;
+                /// \brief
+                /// When the queue was added to it's priority list
+                /// (\see{HRTimer::Click}). Used to compute queue latency.
+                ui64 readyTime;
+                /// \brief
+                /// Deadline of the queue's next job when it was added
+                /// to it's priority list (used for EDF ordering).
+                TimeSpec deadline;
 
             public:
                 /// \brief
@@ -130,7 +150,9 @@ namespace thekogans {
                         RunLoop (name, jobExecutionPolicy),
                         scheduler (scheduler_),
                         priority (priority_),
-                        inFlight (false) {
+                        inFlight (false),
+                        readyTime (0),
+                        deadline (TimeSpec::Infinite) {
                     Start ();
                 }
                 /// \brief
@@ -188,6 +210,13 @@ namespace thekogans {
                     bool wait = false,
                     const TimeSpec &timeSpec = TimeSpec::Infinite) override;
 
+            private:
+                /// \brief
+                /// Return the deadline of the next job to execute.
+                /// \return Deadline of the next job to execute
+                /// (TimeSpec::Infinite == none).
+                TimeSpec GetNextJobDeadline ();
+
                 /// \brief
                 /// Scheduler needs access to protected members.
                 friend struct Scheduler;
@@ -235,19 +264,118 @@ namespace thekogans {
             /// dtor.
             virtual ~Scheduler ();
 
-        private:
+            /// \struct Scheduler::Stats Scheduler.h thekogans/util/Scheduler.h
+            ///
+            /// \brief
+            /// Per priority scheduler statistics.
+            struct Stats {
+                /// \brief
+                /// Distribution of the time queues spent waiting for a
+                /// worker (from becoming ready to being scheduled, in
+                /// \see{HRTimer} ticks).
+                Histogram latency;
+                /// \brief
+                /// Number of turns (time slices) queues were given.
+                ui64 slices;
+                /// \brief
+                /// Number of turns cut short by a higher priority queue.
+                ui64 preemptions;
+                /// \brief
+                /// Number of jobs executed.
+                ui64 jobs;
+                /// \brief
+                /// Time spent executing jobs (in \see{HRTimer} ticks).
+                ui64 runTime;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    slices (0),
+                    preemptions (0),
+                    jobs (0),
+                    runTime (0) {}
+            };
+
+            /// \brief
+            /// Set the time slice given to the queues of the given priority.
+            /// \param[in] priority Priority whose time slice to set.
+            /// \param[in] timeSlice How long a queue can execute jobs back
+            /// to back (TimeSpec::Zero == one job per turn).
+            void SetTimeSlice (
+                JobQueue::Priority priority,
+                const TimeSpec &timeSlice);
+            /// \brief
+            /// Return the time slice given to the queues of the given priority.
+            /// \param[in] priority Priority whose time slice to return.
+            /// \return Time slice given to the queues of the given priority.
+            TimeSpec GetTimeSlice (JobQueue::Priority priority) const;
+
             /// \brief
-            /// Low priority JobQueue list.
-            JobQueueList low;
+            /// Return a snapshot of the given priority stats.
+            /// \param[in] priority Priority whose stats to return.
+            /// \param[out] stats Where to put the snapshot.
+            void GetStats (
+                JobQueue::Priority priority,
+                Stats &stats) const;
             /// \brief
-            /// Normal priority JobQueue list.
-            JobQueueList normal;
+            /// Reset all priority stats.
+            void ResetStats ();
+
+        private:
+            enum {
+                /// \brief
+                /// Number of priorities.
+                PRIORITY_COUNT = JobQueue::PRIORITY_HIGH + 1
+            };
+            /// \struct Scheduler::PriorityList Scheduler.h thekogans/util/Scheduler.h
+            ///
             /// \brief
-            /// High priority JobQueue list.
-            JobQueueList high;
+            /// Ready JobQueues of a given priority, and their stats.
+            /// Every priority has it's own lock so that queues of one
+            /// priority don't contend with the others.
+            struct PriorityList {
+                /// \brief
+                /// Ready JobQueue list.
+                JobQueueList jobQueues;
+                /// \brief
+                /// Number of JobQueues in the list (read without the lock
+                /// to check for higher priority work).
+                std::atomic<std::size_t> readyCount;
+                /// \brief
+                /// Synchronization \see{SpinLock} for the list.
+                SpinLock spinLock;
+                /// \brief
+                /// Time slice (in \see{HRTimer} ticks, 0 == one job per turn).
+                std::atomic<ui64> timeSlice;
+                /// \brief
+                /// Queue latency.
+                ConcurrentHistogram latency;
+                /// \brief
+                /// Turns given.
+                std::atomic<ui64> slices;
+                /// \brief
+                /// Turns cut short by higher priority queues.
+                std::atomic<ui64> preemptions;
+                /// \brief
+                /// Jobs executed.
+                std::atomic<ui64> jobs;
+                /// \brief
+                /// Time spent executing jobs.
+                std::atomic<ui64> runTime;
+
+                /// \brief
+                /// ctor.
+                PriorityList () :
+                    readyCount (0),
+                    timeSlice (0),
+                    slices (0),
+                    preemptions (0),
+                    jobs (0),
+                    runTime (0) {}
+            };
             /// \brief
-            /// Synchronization \see{SpinLock} for above lists.
-            SpinLock spinLock;
+            /// Ready JobQueue lists (indexed by \see{JobQueue::Priority}).
+            PriorityList priorityLists[PRIORITY_COUNT];
             /// \brief
             /// \see{JobQueuePool} executing the jobs.
             JobQueuePool jobQueuePool;
@@ -270,6 +398,19 @@ namespace thekogans {
             /// JobQueue (based on priority).
             /// \return Highest priority JobQueue with a job ready to execute.
             JobQueue *GetNextJobQueue ();
+            /// \brief
+            /// Return true if a queue with priority higher than the given
+            /// one is waiting for a worker.
+            /// \param[in] priority Priority to check against.
+            /// \return true == a higher priority queue is ready.
+            bool IsHigherPriorityReady (JobQueue::Priority priority) const;
+            /// \brief
+            /// Execute the jobs of the given (in flight) queue for one turn.
+            /// \param[in] jobQueue JobQueue to execute.
+            /// \param[in] done Set when the worker should stop.
+            void ExecuteJobQueue (
+                JobQueue *jobQueue,
+                const std::atomic<bool> &done);
         };
 
         /// \struct GlobalScheduler Scheduler.h thekogans/util/Scheduler.h
@@ -20,6 +20,8 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <ostream>
 #include "pugixml/pugixml.hpp"
 #include "thekogans/util/Config.h"
@@ -30,6 +32,7 @@
 #include "thekogans/util/Serializer.h"
 #include "thekogans/util/JSON.h"
 #include "thekogans/util/Buffer.h"
+#include "thekogans/util/ConcurrentHashMap.h"
 #include "thekogans/util/SpinLock.h"
 #include "thekogans/util/LockGuard.h"
 #include "thekogans/util/StringUtils.h"
@@ -56,14 +59,38 @@ namespace thekogans {
             ///
             /// \brief
             /// Binary header containing enough info to deserialize the serializable instance.
+            /// BinHeader comes in three flavors distinguished by it's magic:
+            /// MAGIC32 - The classic header. Carries the full type name.
+            /// COMPACT_MAGIC32 - Carries a stable, registered type id
+            /// (\see{Serializable::RegisterTypeId}) instead of the type name.
+            /// DICTIONARY_MAGIC32 - Carries an index in to a per stream
+            /// \see{Serializable::TypeDictionary}. The type name is only
+            /// sent the first time the type appears in the stream.
+            /// The classic header is the default and is what all writers
+            /// produce unless asked otherwise. All readers understand classic
+            /// and compact headers. Dictionary headers can only be read by a
+            /// \see{Serializable::TypeDictionary}.
             struct _LIB_THEKOGANS_UTIL_DECL BinHeader {
                 /// \brief
-                /// MAGIC32
+                /// Compact header magic.
+                static const ui32 COMPACT_MAGIC32 = 0x46415243; // "FARC"
+                /// \brief
+                /// Dictionary header magic.
+                static const ui32 DICTIONARY_MAGIC32 = 0x46415244; // "FARD"
+
+                /// \brief
+                /// MAGIC32, COMPACT_MAGIC32 or DICTIONARY_MAGIC32.
                 ui32 magic;
                 /// \brief
-                /// Serializable type (it's class name).
+                /// Serializable type (it's class name). Always
+                /// filled in, regardless of header flavor.
                 std::string type;
                 /// \brief
+                /// COMPACT_MAGIC32: registered type id.
+                /// DICTIONARY_MAGIC32: index in to the stream dictionary.
+                /// MAGIC32: 0.
+                ui32 typeId;
+                /// \brief
                 /// Serializable version.
                 ui16 version;
                 /// \brief
@@ -74,6 +101,7 @@ namespace thekogans {
                 /// ctor.
                 BinHeader () :
                     magic (0),
+                    typeId (0),
                     version (0),
                     size (0) {}
                 /// \brief
@@ -87,16 +115,44 @@ namespace thekogans {
                     std::size_t size_) :
                     magic (MAGIC32),
                     type (type_),
+                    typeId (0),
+                    version (version_),
+                    size (size_) {}
+                /// \brief
+                /// ctor. Create a compact header.
+                /// \param[in] typeId_ Registered type id (\see{Serializable::RegisterTypeId}).
+                /// \param[in] type_ Serializable type (it's class name).
+                /// \param[in] version_ Serializable version.
+                /// \param[in] size_ Serializable size in bytes (not including the header).
+                BinHeader (
+                    ui32 typeId_,
+                    const char *type_,
+                    ui16 version_,
+                    std::size_t size_) :
+                    magic (COMPACT_MAGIC32),
+                    type (type_),
+                    typeId (typeId_),
                     version (version_),
                     size (size_) {}
 
                 /// \brief
-                /// Return the header size.
+                /// Return true if the header magic is MAGIC32 or COMPACT_MAGIC32.
+                /// \return true == header can be read without a \see{Serializable::TypeDictionary}.
+                inline bool IsValid () const {
+                    return magic == MAGIC32 || magic == COMPACT_MAGIC32;
+                }
+
+                /// \brief
+                /// Return the header size. NOTE: The size of the dictionary
+                /// header depends on the state of the stream. Use
+                /// \see{Serializable::TypeDictionary::Size} for those.
                 /// \return BinHeader size.
                 inline std::size_t Size () const {
                     return
                         Serializer::Size (magic) +
-                        Serializer::Size (type) +
+                        (magic == COMPACT_MAGIC32 ?
+                            SizeT (typeId).Size () :
+                            Serializer::Size (type)) +
                         Serializer::Size (version) +
                         Serializer::Size (size);
                 }
@@ -111,6 +167,9 @@ namespace thekogans {
                 /// "Type"
                 static const char * const ATTR_TYPE;
                 /// \brief
+                /// "TypeId"
+                static const char * const ATTR_TYPE_ID;
+                /// \brief
                 /// "Version"
                 static const char * const ATTR_VERSION;
                 /// \brief
@@ -121,6 +180,7 @@ namespace thekogans {
                 /// Parse the header from an xml dom that looks like this;
                 /// <Header Magic = "FARS"
                 ///         Type = ""
+                ///         TypeId = ""
                 ///         Version = ""
                 ///         Size = ""
                 ///         ...>
@@ -198,8 +258,11 @@ namespace thekogans {
             /// typedef for Serializable factories.
             typedef std::tuple<BinFactory, XMLFactory, JSONFactory> Factories;
             /// \brief
-            /// typedef for the Serializable map.
-            typedef std::map<std::string, Factories> Map;
+            /// typedef for the Serializable map. It's consulted on every
+            /// extraction (and registered in to lazily in static builds),
+            /// so lookups are lock free. Types are never unregistered, so
+            /// the Factories addresses it hands out are stable.
+            typedef ConcurrentHashMap<std::string, Factories> Map;
             /// \brief
             /// Controls Map's lifetime.
             /// \return Serializable map.
@@ -225,6 +288,160 @@ namespace thekogans {
                     Factories factories);
             };
 
+            /// \brief
+            /// Register a stable type id for the given type. Once registered,
+            /// the type can be written with a compact \see{BinHeader} that
+            /// carries the id instead of the type name (\see{WriteCompact},
+            /// \see{TypeDictionary}). The mapping is part of the wire format;
+            /// both ends of the stream must agree on it. Ids must be registered
+            /// at startup, before any streams are read or written (the lookups
+            /// are lock free).
+            /// \param[in] type Serializable type (it's class name).
+            /// \param[in] typeId Stable type id (1 - UI32_MAX, 0 is reserved).
+            static void RegisterTypeId (
+                const std::string &type,
+                ui32 typeId);
+            /// \brief
+            /// Return the type id registered for the given type.
+            /// \param[in] type Serializable type (it's class name).
+            /// \return Registered type id (0 if none).
+            static ui32 TypeToTypeId (const std::string &type);
+            /// \brief
+            /// Return the type registered for the given type id.
+            /// \param[in] typeId Registered type id.
+            /// \return Registered type (0 if none).
+            static const std::string *TypeIdToType (ui32 typeId);
+            /// \struct Serializable::TypeIdInitializer Serializable.h thekogans/util/Serializable.h
+            ///
+            /// \brief
+            /// TypeIdInitializer is used to register type ids at static
+            /// initialization time. It should not be used directly, and
+            /// instead is included in THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_TYPE_ID.
+            struct _LIB_THEKOGANS_UTIL_DECL TypeIdInitializer {
+                /// \brief
+                /// ctor. Register the type id.
+                /// \param[in] type Serializable type (it's class name).
+                /// \param[in] typeId Stable type id.
+                TypeIdInitializer (
+                        const std::string &type,
+                        ui32 typeId) {
+                    RegisterTypeId (type, typeId);
+                }
+            };
+
+            /// \brief
+            /// Return the binary factory for the type described by the given
+            /// header. For compact headers this is an O(1) lookup.
+            /// \param[in] header \see{BinHeader} describing the type.
+            /// \return Binary factory (0 if the type is not registered).
+            static BinFactory GetBinFactory (const BinHeader &header);
+
+            /// \struct Serializable::TypeDictionary Serializable.h thekogans/util/Serializable.h
+            ///
+            /// \brief
+            /// TypeDictionary encodes the headers of a stream of serializables
+            /// so that each type name goes on the wire only once. Types with a
+            /// registered id (\see{RegisterTypeId}) are written with a compact
+            /// header. All others get a per stream index the first time they
+            /// are seen (the name is sent along with it) and are referenced by
+            /// that index from then on. The reading side must use it's own
+            /// TypeDictionary and read the stream in the order it was written.
+            /// The reader understands classic and compact headers as well, so a
+            /// TypeDictionary can be used to read any binary serializable stream.
+            ///
+            /// NOTE: TypeDictionary is not thread safe. Use one per stream
+            /// direction, and Reset it when the stream is (re)established.
+            struct _LIB_THEKOGANS_UTIL_DECL TypeDictionary {
+            private:
+                /// \struct Serializable::TypeDictionary::WriteEntry Serializable.h thekogans/util/Serializable.h
+                ///
+                /// \brief
+                /// How a type is encoded on the writing side.
+                struct WriteEntry {
+                    /// \brief
+                    /// COMPACT_MAGIC32 or DICTIONARY_MAGIC32.
+                    ui32 magic;
+                    /// \brief
+                    /// Type id or dictionary index.
+                    ui32 typeId;
+                    /// \brief
+                    /// true == type name has been written.
+                    bool written;
+
+                    /// \brief
+                    /// ctor.
+                    /// \param[in] magic_ COMPACT_MAGIC32 or DICTIONARY_MAGIC32.
+                    /// \param[in] typeId_ Type id or dictionary index.
+                    WriteEntry (
+                        ui32 magic_ = 0,
+                        ui32 typeId_ = 0) :
+                        magic (magic_),
+                        typeId (typeId_),
+                        written (false) {}
+                };
+                /// \brief
+                /// Writing side entries (keyed on the address returned by Type ()).
+                std::unordered_map<const char *, WriteEntry> writeEntries;
+                /// \brief
+                /// Next writing side dictionary index.
+                ui32 nextIndex;
+                /// \brief
+                /// Reading side dictionary.
+                std::vector<std::pair<std::string, const Factories *>> readEntries;
+
+            public:
+                /// \brief
+                /// ctor.
+                TypeDictionary () :
+                    nextIndex (0) {}
+
+                /// \brief
+                /// Forget all types (both sides).
+                void Reset ();
+
+                /// \brief
+                /// Return the size of the given serializable, including the
+                /// header it will be written with by the next call to Write.
+                /// \param[in] serializable Serializable whose size to return.
+                /// \return Size of the serializable including the header.
+                std::size_t Size (const Serializable &serializable) const;
+
+                /// \brief
+                /// Write a serializable using the most compact header possible.
+                /// \param[out] serializer Serializer to write the serializable to.
+                /// \param[in] serializable Serializable to write.
+                void Write (
+                    Serializer &serializer,
+                    const Serializable &serializable);
+
+                /// \brief
+                /// Read a header written by Write (or a classic or compact header).
+                /// \param[in] serializer Serializer to read the header from.
+                /// \param[out] header Where to put the header.
+                void ReadHeader (
+                    Serializer &serializer,
+                    BinHeader &header);
+                /// \brief
+                /// Read a serializable written by Write (or with a classic or compact header).
+                /// \param[in] serializer Serializer to read the serializable from.
+                /// \return Serializable.
+                SharedPtr Read (Serializer &serializer);
+
+            private:
+                /// \brief
+                /// Read a header and return the factories for it's type.
+                /// \param[in] serializer Serializer to read the header from.
+                /// \param[out] header Where to put the header.
+                /// \return Binary factory for the type.
+                BinFactory ReadHeaderAndFactory (
+                    Serializer &serializer,
+                    BinHeader &header);
+
+                /// \brief
+                /// TypeDictionary is neither copy constructable, nor assignable.
+                THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (TypeDictionary)
+            };
+
             /// \brief
             /// dtor.
             virtual ~Serializable () {}
@@ -234,6 +451,21 @@ namespace thekogans {
             /// \return true == The given type is in the map.
             static bool ValidateType (const std::string &type);
 
+            /// \brief
+            /// Write a serializable with a compact header if it's type has a
+            /// registered id (\see{RegisterTypeId}), or a classic one if not.
+            /// Unlike \see{TypeDictionary}, this is stateless.
+            /// \param[out] serializer Serializer to write the serializable to.
+            /// \param[in] serializable Serializable to write.
+            static void WriteCompact (
+                Serializer &serializer,
+                const Serializable &serializable);
+            /// \brief
+            /// Return the size of the serializable including the
+            /// header that \see{WriteCompact} would write.
+            /// \return Size of the serializable including the header.
+            static std::size_t CompactSize (const Serializable &serializable);
+
             /// \brief
             /// Return the size of the serializable including the header.
             /// Use of this API is mendatory as virtual std::size_t Size ()
@@ -298,6 +530,10 @@ namespace thekogans {
             /// \param[out] node Parent node.
             virtual void Write (JSON::Object & /*object*/) const = 0;
 
+            /// \brief
+            /// Needs access to Type and Read.
+            friend struct SerializableView;
+
             /// \brief
             /// Needs access to BinHeader.
             friend Serializer & _LIB_THEKOGANS_UTIL_API operator << (
@@ -448,15 +684,12 @@ namespace thekogans {
                 if (!registered) {\
                     thekogans::util::LockGuard<thekogans::util::SpinLock> guard (spinLock);\
                     if (!registered) {\
-                        std::pair<Map::iterator, bool> result =\
-                            GetMap ().insert (\
-                                Map::value_type (\
-                                    #type,\
-                                    thekogans::util::Serializable::Factories (\
-                                        type::BinCreate,\
-                                        type::XMLCreate,\
-                                        type::JSONCreate)));\
-                        if (!result.second) {\
+                        if (!GetMap ().Insert (\
+                                #type,\
+                                thekogans::util::Serializable::Factories (\
+                                    type::BinCreate,\
+                                    type::XMLCreate,\
+                                    type::JSONCreate))) {\
                             THEKOGANS_UTIL_THROW_STRING_EXCEPTION (\
                                 "'%s' is already registered.", #type);\
                         }\
@@ -504,37 +737,39 @@ namespace thekogans {
                     type::JSONCreate));
     #endif // defined (THEKOGANS_UTIL_TYPE_Static)
 
+        /// \def THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_TYPE_ID(type, typeId)
+        /// Register a stable type id for a serializable (\see{Serializable::RegisterTypeId}).
+        /// Instantiate one of these in the class cpp file (after
+        /// THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE).
+        /// Example:
+        /// \code{.cpp}
+        /// THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_TYPE_ID (SymmetricKey, 100)
+        /// \endcode
+        #define THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_TYPE_ID(type, typeId)\
+            static const thekogans::util::Serializable::TypeIdInitializer\
+                type##TypeIdInitializer (#type, typeId);
+
         /// \brief
-        /// Serializable::BinHeader insertion operator.
+        /// Serializable::BinHeader insertion operator. Writes classic and
+        /// compact headers (dictionary headers are written by
+        /// \see{Serializable::TypeDictionary}).
         /// \param[in] serializer Where to serialize the serializable header.
         /// \param[in] header Serializable::BinHeader to serialize.
         /// \return serializer.
-        inline Serializer & _LIB_THEKOGANS_UTIL_API operator << (
-                Serializer &serializer,
-                const Serializable::BinHeader &header) {
-            serializer <<
-                header.magic <<
-                header.type <<
-                header.version <<
-                header.size;
-            return serializer;
-        }
+        _LIB_THEKOGANS_UTIL_DECL Serializer & _LIB_THEKOGANS_UTIL_API operator << (
+            Serializer &serializer,
+            const Serializable::BinHeader &header);
 
         /// \brief
-        /// Serializable::BinHeader extraction operator.
+        /// Serializable::BinHeader extraction operator. Reads classic and
+        /// compact headers (dictionary headers are read by
+        /// \see{Serializable::TypeDictionary}).
         /// \param[in] serializer Where to deserialize the serializable header.
         /// \param[in] header Serializable::BinHeader to deserialize.
         /// \return serializer.
-        inline Serializer & _LIB_THEKOGANS_UTIL_API operator >> (
-                Serializer &serializer,
-                Serializable::BinHeader &header) {
-            serializer >>
-                header.magic >>
-                header.type >>
-                header.version >>
-                header.size;
-            return serializer;
-        }
+        _LIB_THEKOGANS_UTIL_DECL Serializer & _LIB_THEKOGANS_UTIL_API operator >> (
+            Serializer &serializer,
+            Serializable::BinHeader &header);
 
         /// \brief
         /// Serializable::TextHeader insertion operator.
@@ -659,6 +894,12 @@ namespace thekogans {
             /// Parses \see{Serializable::BinHeader::type}.
             ValueParser<std::string> typeParser;
             /// \brief
+            /// Compact header type id.
+            SizeT typeId;
+            /// \brief
+            /// Parses \see{Serializable::BinHeader::typeId}.
+            ValueParser<SizeT> typeIdParser;
+            /// \brief
             /// Parses \see{Serializable::BinHeader::version}.
             ValueParser<ui16> versionParser;
             /// \brief
@@ -675,6 +916,9 @@ namespace thekogans {
                 /// Next value is \see{Serializable::BinHeader::type}.
                 STATE_TYPE,
                 /// \brief
+                /// Next value is \see{Serializable::BinHeader::typeId}.
+                STATE_TYPE_ID,
+                /// \brief
                 /// Next value is \see{Serializable::BinHeader::version}.
                 STATE_VERSION,
                 /// \brief
@@ -690,6 +934,7 @@ namespace thekogans {
                 value (value_),
                 magicParser (value.magic),
                 typeParser (value.type),
+                typeIdParser (typeId),
                 versionParser (value.version),
                 sizeParser (value.size),
                 state (STATE_MAGIC) {}
@@ -714,7 +959,7 @@ namespace thekogans {
                     _T &serializable) {\
                 thekogans::util::Serializable::BinHeader header;\
                 serializer >> header;\
-                if (header.magic == thekogans::util::MAGIC32 &&\
+                if (header.IsValid () &&\
                         header.type == serializable.GetType ()) {\
                     serializable.Read (header, serializer);\
                     return serializer;\
@@ -767,13 +1012,13 @@ namespace thekogans {
                     _T::SharedPtr &serializable) {\
                 thekogans::util::Serializable::BinHeader header;\
                 serializer >> header;\
-                if (header.magic == thekogans::util::MAGIC32) {\
-                    thekogans::util::Serializable::Map::iterator it =\
-                        thekogans::util::Serializable::GetMap ().find (header.type);\
-                    if (it != thekogans::util::Serializable::GetMap ().end ()) {\
+                if (header.IsValid ()) {\
+                    thekogans::util::Serializable::BinFactory factory =\
+                        thekogans::util::Serializable::GetBinFactory (header);\
+                    if (factory != 0) {\
                         serializable =\
                             thekogans::util::dynamic_refcounted_sharedptr_cast<_T> (\
-                                std::get<0> (it->second) (header, serializer));\
+                                factory (header, serializer));\
                         return serializer;\
                     }\
                     else {\
@@ -793,12 +1038,12 @@ namespace thekogans {
                     _T::SharedPtr &serializable) {\
                 thekogans::util::Serializable::TextHeader header;\
                 node >> header;\
-                thekogans::util::Serializable::Map::iterator it =\
-                    thekogans::util::Serializable::GetMap ().find (header.type);\
-                if (it != thekogans::util::Serializable::GetMap ().end ()) {\
+                const thekogans::util::Serializable::Factories *factories =\
+                    thekogans::util::Serializable::GetMap ().Find (header.type);\
+                if (factories != 0) {\
                     serializable =\
                         thekogans::util::dynamic_refcounted_sharedptr_cast<_T> (\
-                            std::get<1> (it->second) (header, node)); \
+                            std::get<1> (*factories) (header, node)); \
                     return node;\
                 }\
                 else {\
@@ -812,12 +1057,12 @@ namespace thekogans {
                     _T::SharedPtr &serializable) {\
                 thekogans::util::Serializable::TextHeader header;\
                 object >> header;\
-                thekogans::util::Serializable::Map::iterator it =\
-                    thekogans::util::Serializable::GetMap ().find (header.type);\
-                if (it != thekogans::util::Serializable::GetMap ().end ()) {\
+                const thekogans::util::Serializable::Factories *factories =\
+                    thekogans::util::Serializable::GetMap ().Find (header.type);\
+                if (factories != 0) {\
                     serializable =\
                         thekogans::util::dynamic_refcounted_sharedptr_cast<_T> (\
-                            std::get<2> (it->second) (header, object)); \
+                            std::get<2> (*factories) (header, object)); \
                     return object;\
                 }\
                 else {\
@@ -964,13 +1209,13 @@ namespace thekogans {
                                 payload.GetWritePtr (),\
                                 payload.GetDataAvailableForWriting ()));\
                         if (payload.IsFull ()) {\
-                            thekogans::util::Serializable::Map::iterator it =\
-                                thekogans::util::Serializable::GetMap ().find (header.type);\
-                            if (it != thekogans::util::Serializable::GetMap ().end ()) {\
+                            thekogans::util::Serializable::BinFactory factory =\
+                                thekogans::util::Serializable::GetBinFactory (header);\
+                            if (factory != 0) {\
                                 THEKOGANS_UTIL_TRY {\
                                     value =\
                                         thekogans::util::dynamic_refcounted_sharedptr_cast<_T> (\
-                                            std::get<0> (it->second) (header, payload));\
+                                            factory (header, payload));\
                                     Reset ();\
                                     return true;\
                                 }\
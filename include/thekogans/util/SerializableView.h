@@ -0,0 +1,358 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_SerializableView_h)
+#define __thekogans_util_SerializableView_h
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SizeT.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Serializable.h"
+#include "thekogans/util/Exception.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct SerializableView SerializableView.h thekogans/util/SerializableView.h
+        ///
+        /// \brief
+        /// SerializableView is a read only, zero-copy view of a binary serialized
+        /// \see{Serializable} (header + payload) sitting in memory (usually a
+        /// \see{Buffer} that just came off the wire or out of a file). The header
+        /// is parsed and the record is validated (magic, type registered, payload
+        /// in bounds) once, in the ctor. After that, fields are read in place with
+        /// a \see{SerializableView::Cursor}. Strings and byte arrays come back as
+        /// non-owning \see{SerializableView::Slice}s pointing in to the record, and
+        /// fields you don't care about can be skipped without being decoded. The
+        /// real object is only built if/when you call Materialize. Ex:
+        ///
+        /// \code{.cpp}
+        /// // Records are written with: buffer << record;
+        /// while (buffer.GetDataAvailableForReading () > 0) {
+        ///     thekogans::util::SerializableView view (buffer);
+        ///     if (view.GetType () == Record::TYPE) {
+        ///         thekogans::util::SerializableView::Cursor cursor = view.GetCursor ();
+        ///         thekogans::util::ui64 id = cursor.Read<thekogans::util::ui64> ();
+        ///         thekogans::util::SerializableView::Slice name = cursor.ReadString ();
+        ///         if (name == "interesting") {
+        ///             Record::SharedPtr record = view.Materialize<Record> ();
+        ///             ...
+        ///         }
+        ///     }
+        ///     buffer.AdvanceReadOffset (view.GetSize ());
+        /// }
+        /// \endcode
+        ///
+        /// VERY IMPORTANT: SerializableView, it's Cursors and Slices point in
+        /// to the memory they were created on. That memory must outlive them
+        /// and must not change while they are in use. Also, the Cursor needs to
+        /// know the field layout of the record (the order in which it's Write
+        /// wrote the fields). It's the same knowledge Read has, just applied lazily.
+
+        struct _LIB_THEKOGANS_UTIL_DECL SerializableView {
+            /// \struct SerializableView::Slice SerializableView.h thekogans/util/SerializableView.h
+            ///
+            /// \brief
+            /// Non-owning view of a serialized string or byte array.
+            struct _LIB_THEKOGANS_UTIL_DECL Slice {
+                /// \brief
+                /// Pointer to the first byte (in to the record).
+                const ui8 *data;
+                /// \brief
+                /// Slice length in bytes.
+                std::size_t length;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] data_ Pointer to the first byte.
+                /// \param[in] length_ Slice length in bytes.
+                Slice (
+                    const ui8 *data_ = 0,
+                    std::size_t length_ = 0) :
+                    data (data_),
+                    length (length_) {}
+
+                /// \brief
+                /// Return true if the slice is empty.
+                /// \return true == the slice is empty.
+                inline bool IsEmpty () const {
+                    return length == 0;
+                }
+                /// \brief
+                /// Return the slice as characters (NOT null terminated).
+                /// \return Slice as characters.
+                inline const char *GetChars () const {
+                    return (const char *)data;
+                }
+                /// \brief
+                /// Copy the slice in to a std::string.
+                /// \return std::string copy of the slice.
+                inline std::string ToString () const {
+                    return std::string (GetChars (), length);
+                }
+
+                /// \brief
+                /// Compare the slice to the given string.
+                /// \param[in] value String to compare to.
+                /// \return true == equal.
+                inline bool operator == (const std::string &value) const {
+                    return length == value.size () &&
+                        (length == 0 || memcmp (data, value.data (), length) == 0);
+                }
+                /// \brief
+                /// Compare the slice to the given null terminated string.
+                /// \param[in] value String to compare to.
+                /// \return true == equal.
+                inline bool operator == (const char *value) const {
+                    return length == strlen (value) &&
+                        (length == 0 || memcmp (data, value, length) == 0);
+                }
+                /// \brief
+                /// Compare the slice to the given slice.
+                /// \param[in] other Slice to compare to.
+                /// \return true == equal.
+                inline bool operator == (const Slice &other) const {
+                    return length == other.length &&
+                        (length == 0 || memcmp (data, other.data, length) == 0);
+                }
+                /// \brief
+                /// Compare the slice to the given string.
+                /// \param[in] value String to compare to.
+                /// \return true == not equal.
+                template<typename T>
+                inline bool operator != (const T &value) const {
+                    return !(*this == value);
+                }
+            };
+
+            /// \struct SerializableView::Cursor SerializableView.h thekogans/util/SerializableView.h
+            ///
+            /// \brief
+            /// Cursor reads the fields of a record sequentially, in place. Every
+            /// read is bounds checked against the record, so a Cursor will never
+            /// wander outside of it (it throws instead). Cursors are cheap to copy.
+            /// Copy one to remember a position you want to come back to.
+            struct _LIB_THEKOGANS_UTIL_DECL Cursor {
+            private:
+                /// \brief
+                /// How multi-byte values are stored.
+                Endianness endianness;
+                /// \brief
+                /// Start of the fields.
+                const ui8 *data;
+                /// \brief
+                /// Length of the fields.
+                std::size_t length;
+                /// \brief
+                /// Current offset.
+                std::size_t offset;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] endianness_ How multi-byte values are stored.
+                /// \param[in] data_ Start of the fields.
+                /// \param[in] length_ Length of the fields.
+                Cursor (
+                    Endianness endianness_,
+                    const ui8 *data_,
+                    std::size_t length_) :
+                    endianness (endianness_),
+                    data (data_),
+                    length (length_),
+                    offset (0) {}
+
+                /// \brief
+                /// Return the current offset (from the start of the payload).
+                /// \return Current offset.
+                inline std::size_t GetOffset () const {
+                    return offset;
+                }
+                /// \brief
+                /// Return the number of bytes left to read.
+                /// \return Number of bytes left to read.
+                inline std::size_t GetRemaining () const {
+                    return length - offset;
+                }
+
+                /// \brief
+                /// Extract any value that has a \see{Serializer} extraction operator
+                /// (integral types, \see{SizeT}, \see{GUID}...). The value is decoded
+                /// straight out of the record.
+                /// \param[out] value Where to place the extracted value.
+                /// \return *this.
+                template<typename T>
+                Cursor &operator >> (T &value) {
+                    TenantReadBuffer buffer (endianness, data + offset, length - offset);
+                    buffer >> value;
+                    offset += buffer.readOffset;
+                    return *this;
+                }
+                /// \brief
+                /// Extract and return a value.
+                /// \return Extracted value.
+                template<typename T>
+                T Read () {
+                    T value;
+                    *this >> value;
+                    return value;
+                }
+                /// \brief
+                /// Skip a value of the given type.
+                template<typename T>
+                void Skip () {
+                    Read<T> ();
+                }
+
+                /// \brief
+                /// Return a slice of the next count raw bytes.
+                /// \param[in] count Number of bytes.
+                /// \return Slice of the next count bytes.
+                Slice ReadRaw (std::size_t count);
+                /// \brief
+                /// Return a slice of a serialized std::string (no copy).
+                /// \return Slice of the string's characters.
+                Slice ReadString ();
+                /// \brief
+                /// Return a slice of a serialized std::vector<i8/ui8> (no copy).
+                /// \return Slice of the vector's bytes.
+                inline Slice ReadBytes () {
+                    // Same wire format (SizeT count + bytes).
+                    return ReadString ();
+                }
+                /// \brief
+                /// Return a view of a nested serialized \see{Serializable}
+                /// and advance past it.
+                /// \return View of the nested serializable.
+                SerializableView ReadSerializable ();
+
+                /// \brief
+                /// Skip count raw bytes.
+                /// \param[in] count Number of bytes to skip.
+                inline void Skip (std::size_t count) {
+                    ReadRaw (count);
+                }
+                /// \brief
+                /// Skip a serialized std::string (or std::vector<i8/ui8>).
+                inline void SkipString () {
+                    ReadString ();
+                }
+                /// \brief
+                /// Skip a nested serialized \see{Serializable}.
+                void SkipSerializable ();
+            };
+
+        private:
+            /// \brief
+            /// How multi-byte values are stored.
+            Endianness endianness;
+            /// \brief
+            /// Start of the record (header).
+            const ui8 *record;
+            /// \brief
+            /// Parsed record header.
+            Serializable::BinHeader header;
+            /// \brief
+            /// Serialized header size.
+            std::size_t headerSize;
+            /// \brief
+            /// Factory used to materialize the record.
+            Serializable::BinFactory factory;
+
+        public:
+            /// \brief
+            /// ctor. Parse and validate the record header.
+            /// \param[in] endianness_ How multi-byte values are stored.
+            /// \param[in] data Start of the record.
+            /// \param[in] length Number of bytes available at data
+            /// (can be more than the record).
+            SerializableView (
+                Endianness endianness_,
+                const void *data,
+                std::size_t length);
+            /// \brief
+            /// ctor. View the record at the buffer's read position.
+            /// NOTE: The buffer's read position is not changed.
+            /// Use buffer.AdvanceReadOffset (view.GetSize ()) to
+            /// skip over the record.
+            /// \param[in] buffer Buffer containing the record.
+            explicit SerializableView (const Buffer &buffer);
+
+            /// \brief
+            /// Return the record header.
+            /// \return Record header.
+            inline const Serializable::BinHeader &GetHeader () const {
+                return header;
+            }
+            /// \brief
+            /// Return the record type.
+            /// \return Record type.
+            inline const std::string &GetType () const {
+                return header.type;
+            }
+            /// \brief
+            /// Return the record version.
+            /// \return Record version.
+            inline ui16 GetVersion () const {
+                return header.version;
+            }
+            /// \brief
+            /// Return the record size (header + payload). Use it to step
+            /// over the record.
+            /// \return Record size.
+            inline std::size_t GetSize () const {
+                return headerSize + (std::size_t)header.size;
+            }
+            /// \brief
+            /// Return the record payload (everything after the header).
+            /// \return Record payload.
+            inline Slice GetPayload () const {
+                return Slice (record + headerSize, (std::size_t)header.size);
+            }
+            /// \brief
+            /// Return a cursor positioned at the first field of the record.
+            /// \return Cursor positioned at the first field of the record.
+            inline Cursor GetCursor () const {
+                return Cursor (endianness, record + headerSize, (std::size_t)header.size);
+            }
+
+            /// \brief
+            /// Materialize the record (call it's registered factory).
+            /// \return The real object.
+            Serializable::SharedPtr Materialize () const;
+            /// \brief
+            /// Materialize the record as the given type.
+            /// \return The real object (null if the record is not a T).
+            template<typename T>
+            typename T::SharedPtr Materialize () const {
+                return dynamic_refcounted_sharedptr_cast<T> (Materialize ());
+            }
+            /// \brief
+            /// Materialize the record in to an existing object.
+            /// \param[out] serializable Object to read the record in to
+            /// (must be of the record's type).
+            void Materialize (Serializable &serializable) const;
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_SerializableView_h)
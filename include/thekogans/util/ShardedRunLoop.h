@@ -0,0 +1,255 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_ShardedRunLoop_h)
+#define __thekogans_util_ShardedRunLoop_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <utility>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Constants.h"
+#include "thekogans/util/RunLoop.h"
+#include "thekogans/util/JobQueue.h"
+#include "thekogans/util/TimeSpec.h"
+#include "thekogans/util/SystemInfo.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct ShardedRunLoop ShardedRunLoop.h thekogans/util/ShardedRunLoop.h
+        ///
+        /// \brief
+        /// ShardedRunLoop is a set of single threaded run loops (shards), one
+        /// per processor, each pinned to it's own processor. Jobs are routed to
+        /// shards by key (a connection id, an account number, a hash of a file
+        /// name...), so all jobs with the same key execute, in order, on the same
+        /// thread and processor. Since a shard is the only thread that touches the
+        /// state belonging to it's keys, that state needs no locking and stays hot
+        /// in that processor's caches. Here's how to use it:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// util::ShardedRunLoop sessions ("sessions");
+        ///
+        /// void OnPacket (util::ui64 sessionId, const Packet &packet) {
+        ///     // Every packet for a given session is processed by the same shard.
+        ///     sessions.EnqJob (sessionId,
+        ///         [sessionId, packet] (util::RunLoop::Job & /*job*/, const std::atomic<bool> &done) {
+        ///             if (!done) {
+        ///                 ...
+        ///             }
+        ///         });
+        /// }
+        /// \endcode
+        ///
+        /// Shards talk to each other by posting jobs (messages) to the shard that owns
+        /// the destination key. \see{HandoffJob} does that through the destination
+        /// shard's bounded, lock-free handoff ring (see \see{JobQueue::HandoffJob}),
+        /// so a shard sending a message to another never contends on the destination's
+        /// mutex. Jobs are plain \see{RunLoop::Job}s, and every shard is a \see{JobQueue}
+        /// that can be used directly (\see{GetShard}) for anything not covered here.
+        ///
+        /// NOTE: Jobs with the same key run in the order they were posted as long as
+        /// they were posted the same way (all through EnqJob, or all through HandoffJob).
+        /// The handoff ring and the shard's pending job list are drained independently.
+
+        struct _LIB_THEKOGANS_UTIL_DECL ShardedRunLoop {
+            /// \brief
+            /// Returned by \see{GetCurrentShardIndex} when the calling
+            /// thread is not one of this ShardedRunLoop's shards.
+            static const std::size_t NO_SHARD = SIZE_T_MAX;
+            /// \brief
+            /// Default handoff ring capacity (per shard).
+            static const std::size_t DEFAULT_HANDOFF_CAPACITY = 1024;
+
+        private:
+            /// \brief
+            /// ShardedRunLoop id.
+            const RunLoop::Id id;
+            /// \brief
+            /// ShardedRunLoop name.
+            const std::string name;
+            /// \brief
+            /// The shards.
+            std::vector<JobQueue::SharedPtr> shards;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] name_ ShardedRunLoop name. If set, the shards
+            /// (and their threads) will be named name-%d.
+            /// \param[in] shardCount Number of shards.
+            /// \param[in] jobExecutionPolicy Shard \see{RunLoop::JobExecutionPolicy}.
+            /// \param[in] handoffCapacity Capacity of each shard's lock-free
+            /// handoff ring (0 == no ring, \see{HandoffJob} is the same as EnqJob).
+            /// \param[in] workerPriority Shard thread priority.
+            /// \param[in] workerAffinity Shard placement. One of the \see{CPUTopology}
+            /// placement policies (resolved to a single processor per shard), or
+            /// THEKOGANS_UTIL_MAX_THREAD_AFFINITY to leave the shards unpinned.
+            /// \param[in] workerCallback Called to initialize/uninitialize the shard threads.
+            ShardedRunLoop (
+                const std::string &name_ = std::string (),
+                std::size_t shardCount = SystemInfo::Instance ().GetCPUCount (),
+                RunLoop::JobExecutionPolicy::SharedPtr jobExecutionPolicy =
+                    RunLoop::JobExecutionPolicy::SharedPtr (new RunLoop::FIFOJobExecutionPolicy),
+                std::size_t handoffCapacity = DEFAULT_HANDOFF_CAPACITY,
+                i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+                ui32 workerAffinity = THEKOGANS_UTIL_SCATTER_THREAD_AFFINITY,
+                RunLoop::WorkerCallback *workerCallback = 0);
+            /// \brief
+            /// dtor. Stop the shards.
+            virtual ~ShardedRunLoop ();
+
+            /// \brief
+            /// Return the ShardedRunLoop id.
+            /// \return ShardedRunLoop id.
+            inline const RunLoop::Id &GetId () const {
+                return id;
+            }
+            /// \brief
+            /// Return the ShardedRunLoop name.
+            /// \return ShardedRunLoop name.
+            inline const std::string &GetName () const {
+                return name;
+            }
+
+            /// \brief
+            /// Return the number of shards.
+            /// \return Number of shards.
+            inline std::size_t GetShardCount () const {
+                return shards.size ();
+            }
+            /// \brief
+            /// Return the index of the shard that owns the given key.
+            /// The key is mixed before being reduced modulo the shard
+            /// count so that sequential keys spread evenly.
+            /// \param[in] key Key to map.
+            /// \return Index of the shard that owns the given key.
+            std::size_t GetShardIndex (ui64 key) const;
+            /// \brief
+            /// Return the shard at the given index.
+            /// \param[in] index Shard index [0, GetShardCount ()).
+            /// \return The shard at the given index.
+            JobQueue &GetShard (std::size_t index);
+            /// \brief
+            /// If called from a job running on one of the shards, return
+            /// that shard's index. Use it to tell local work (that can be
+            /// done in place) from remote work (that needs to be posted).
+            /// \return Index of the shard running the calling thread
+            /// (NO_SHARD if the calling thread is not one of our shards).
+            std::size_t GetCurrentShardIndex () const;
+
+            /// \brief
+            /// Start the shards (the ctor calls this member).
+            void Start ();
+            /// \brief
+            /// Stop the shards.
+            /// \param[in] cancelRunningJobs true = Cancel all running jobs.
+            /// \param[in] cancelPendingJobs true = Cancel all pending jobs.
+            void Stop (
+                bool cancelRunningJobs = true,
+                bool cancelPendingJobs = true);
+            /// \brief
+            /// Wait until all shards are idle.
+            /// \param[in] timeSpec How long to wait for the shards to become idle.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == all shards are idle, false == timed out.
+            bool WaitForIdle (const TimeSpec &timeSpec = TimeSpec::Infinite);
+            /// \brief
+            /// Return true if all shards are idle.
+            /// \return true if all shards are idle.
+            bool IsIdle ();
+
+            /// \brief
+            /// Enqueue a job on the shard that owns the given key.
+            /// \param[in] key Routing key.
+            /// \param[in] job Job to enqueue.
+            /// \param[in] wait Wait for job to finish. Used for synchronous job execution.
+            /// \param[in] timeSpec How long to wait for the job to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// NOTE: Don't wait on a job routed to the calling shard (it will deadlock).
+            /// \return true == !wait || WaitForJob (...)
+            bool EnqJob (
+                ui64 key,
+                RunLoop::Job::SharedPtr job,
+                bool wait = false,
+                const TimeSpec &timeSpec = TimeSpec::Infinite);
+            /// \brief
+            /// Enqueue a lambda (function) on the shard that owns the given key.
+            /// \param[in] key Routing key.
+            /// \param[in] function Lambda to enqueue.
+            /// \param[in] wait Wait for job to finish. Used for synchronous job execution.
+            /// \param[in] timeSpec How long to wait for the job to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return std::pair<RunLoop::Job::SharedPtr, bool> containing the
+            /// LambdaJob and the EnqJob return.
+            std::pair<RunLoop::Job::SharedPtr, bool> EnqJob (
+                ui64 key,
+                const RunLoop::LambdaJob::Function &function,
+                bool wait = false,
+                const TimeSpec &timeSpec = TimeSpec::Infinite);
+            /// \brief
+            /// Post a job (message) to the shard that owns the given key through
+            /// it's lock-free handoff ring. This is the preferred way for shards to
+            /// talk to each other. If the ring is full, block until the destination
+            /// shard takes a job off it.
+            /// \param[in] key Routing key.
+            /// \param[in] job Job to post.
+            void HandoffJob (
+                ui64 key,
+                RunLoop::Job::SharedPtr job);
+            /// \brief
+            /// Post a lambda (message) to the shard that owns the given key through
+            /// it's lock-free handoff ring.
+            /// \param[in] key Routing key.
+            /// \param[in] function Lambda to post.
+            /// \return The LambdaJob that was posted.
+            RunLoop::Job::SharedPtr HandoffJob (
+                ui64 key,
+                const RunLoop::LambdaJob::Function &function);
+
+            /// \brief
+            /// Return the shard stats rolled up in to one \see{RunLoop::Stats}.
+            /// Counts (jobs, times, queue depths and workers) are summed, the
+            /// job time and wait time histograms are merged, minJob/maxJob are
+            /// the fastest/slowest job on any shard and lastJob is the job that
+            /// finished last. maxQueueDepth is the sum of the shards' maxima
+            /// (an upper bound on the most jobs ever pending at once).
+            /// \return Aggregate stats.
+            RunLoop::Stats GetStats ();
+            /// \brief
+            /// Return the given shard's stats. Use it to spot hot (overloaded) keys.
+            /// \param[in] index Shard index [0, GetShardCount ()).
+            /// \return The given shard's stats.
+            RunLoop::Stats GetShardStats (std::size_t index);
+            /// \brief
+            /// Reset all shards' stats.
+            void ResetStats ();
+
+            /// \brief
+            /// ShardedRunLoop is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (ShardedRunLoop)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_ShardedRunLoop_h)
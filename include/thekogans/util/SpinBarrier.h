@@ -0,0 +1,102 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_SpinBarrier_h)
+#define __thekogans_util_SpinBarrier_h
+
+#include <cstddef>
+#include <atomic>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct SpinBarrier SpinBarrier.h thekogans/util/SpinBarrier.h
+        ///
+        /// \brief
+        /// SpinBarrier is a sense-reversing barrier designed for low latency.
+        /// Unlike \see{Barrier} (which always goes through the kernel), arriving
+        /// threads first spin (for up to spinCount pauses, yielding the time
+        /// slice every now and then) waiting for the last thread to flip the
+        /// sense. Only if the wait is longer than that do they park on a
+        /// \see{Condition}. The last thread to arrive pays for a
+        /// SignalAll only if someone actually parked. This makes back to back
+        /// rounds (see \see{Vectorizer}) cost a few cache misses instead of a
+        /// couple of context switches, while idle threads still get out of
+        /// the way.
+
+        struct _LIB_THEKOGANS_UTIL_DECL SpinBarrier {
+            /// \brief
+            /// Default number of pauses before parking.
+            static const ui32 DEFAULT_SPIN_COUNT = 4096;
+
+        private:
+            /// \brief
+            /// Number of threads to synchronize.
+            const std::size_t count;
+            /// \brief
+            /// Number of pauses before parking.
+            const ui32 spinCount;
+            /// \brief
+            /// Number of threads yet to arrive in the current round.
+            std::atomic<std::size_t> remaining;
+            /// \brief
+            /// Flipped (incremented) by the last thread to arrive.
+            std::atomic<ui32> sense;
+            /// \brief
+            /// Number of threads parked on condition.
+            std::atomic<std::size_t> parked;
+            /// \brief
+            /// Lock protecting condition.
+            Mutex mutex;
+            /// \brief
+            /// Parked threads wait on this condition.
+            Condition condition;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] count_ Number of threads to synchronize.
+            /// \param[in] spinCount_ Number of pauses before parking.
+            explicit SpinBarrier (
+                std::size_t count_,
+                ui32 spinCount_ = DEFAULT_SPIN_COUNT);
+
+            /// \brief
+            /// Return the number of threads this barrier synchronizes.
+            /// \return Number of threads this barrier synchronizes.
+            inline std::size_t GetCount () const {
+                return count;
+            }
+
+            /// \brief
+            /// Wait for all threads to enter the barrier.
+            /// \return true = last (signaling) thread, false = waiting thread.
+            bool Wait ();
+
+            /// \brief
+            /// SpinBarrier is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (SpinBarrier)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_SpinBarrier_h)
@@ -0,0 +1,373 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_util_TaskGraph_h)
+#define __thekogans_util_TaskGraph_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "thekogans/util/Config.h"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/RunLoop.h"
+#include "thekogans/util/JobQueue.h"
+#include "thekogans/util/JobQueuePool.h"
+#include "thekogans/util/HRTimerMgr.h"
+#include "thekogans/util/TimeSpec.h"
+#include "thekogans/util/Event.h"
+
+namespace thekogans {
+    namespace util {
+
+        /// \struct TaskGraph TaskGraph.h thekogans/util/TaskGraph.h
+        ///
+        /// \brief
+        /// TaskGraph is a fork-join directed acyclic graph of jobs. Declare the
+        /// nodes and the edges between them (to runs after from), and submit the
+        /// graph to a \see{RunLoop} (\see{JobQueue}) or a \see{JobQueuePool}.
+        /// Nodes without predecessors are enqueued right away. Every other node
+        /// is enqueued by the last of it's predecessors to complete (each node
+        /// keeps an atomic count of outstanding predecessors), so no worker ever
+        /// blocks waiting for a dependency. Here's how to use it:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// util::TaskGraph::SharedPtr graph (new util::TaskGraph ("build"));
+        /// util::TaskGraph::Node::SharedPtr parse = graph->AddNode ("parse",
+        ///     [] (util::RunLoop::Job &job, const std::atomic<bool> &done) {...});
+        /// util::TaskGraph::Node::SharedPtr optimize = graph->AddNode ("optimize", ...);
+        /// util::TaskGraph::Node::SharedPtr lint = graph->AddNode ("lint", ...);
+        /// util::TaskGraph::Node::SharedPtr emit = graph->AddNode ("emit", ...);
+        /// graph->AddEdge (parse, optimize);
+        /// graph->AddEdge (parse, lint);
+        /// graph->AddEdge (optimize, emit);
+        /// graph->AddEdge (lint, emit);
+        /// graph->Submit (util::GlobalJobQueuePool::Instance ());
+        /// graph->Wait ();
+        /// util::HRTimerMgr timerMgr ("build");
+        /// graph->GetTimings (*timerMgr.GetRootScope ());
+        /// std::cout << timerMgr.ToXMLString () << std::endl;
+        /// \endcode
+        ///
+        /// A node only runs if all it's predecessors succeeded. If a node fails
+        /// (it's function threw) or is cancelled, or if the graph is cancelled,
+        /// the nodes that have not started yet are skipped (their disposition is
+        /// Cancelled) and the graph completes as soon as the running ones do.
+        ///
+        /// IMPORTANT: TaskGraph must be created on the heap (it holds a reference
+        /// to itself while running). Nodes and edges can't be added while the
+        /// graph is running. A completed graph can be submitted again. The run
+        /// loop (or pool) must outlive the run. Nodes are enqueued by the graph,
+        /// don't enqueue them yourself.
+
+        struct _LIB_THEKOGANS_UTIL_DECL TaskGraph : public virtual RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (TaskGraph)
+
+            /// \struct TaskGraph::Node TaskGraph.h thekogans/util/TaskGraph.h
+            ///
+            /// \brief
+            /// Node is a \see{RunLoop::Job} that executes a lambda and, when it
+            /// completes, enqueues the successors for which it was the last
+            /// outstanding predecessor.
+            struct _LIB_THEKOGANS_UTIL_DECL Node : public RunLoop::Job {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Node)
+
+                /// \brief
+                /// Convenient typedef for RunLoop::LambdaJob::Function.
+                typedef RunLoop::LambdaJob::Function Function;
+
+            private:
+                /// \brief
+                /// Graph to which this node belongs.
+                TaskGraph &graph;
+                /// \brief
+                /// Node index in graph.nodes.
+                const std::size_t index;
+                /// \brief
+                /// Node name (used for timing).
+                const std::string name;
+                /// \brief
+                /// Lambda to execute.
+                Function function;
+                /// \brief
+                /// Nodes that must complete before this one can run.
+                std::vector<Node *> predecessors;
+                /// \brief
+                /// Nodes that depend on this one.
+                std::vector<Node *> successors;
+                /// \brief
+                /// Number of predecessors yet to complete in the current run.
+                std::atomic<std::size_t> pendingPredecessors;
+                /// \brief
+                /// \see{JobQueue} borrowed from a \see{JobQueuePool}
+                /// (held until the node completes).
+                JobQueue::SharedPtr jobQueue;
+                /// \brief
+                /// When the node started running (0 if it didn't run).
+                ui64 start;
+                /// \brief
+                /// When the node completed.
+                ui64 end;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] graph_ Graph to which this node belongs.
+                /// \param[in] index_ Node index in graph.nodes.
+                /// \param[in] name_ Node name.
+                /// \param[in] function_ Lambda to execute.
+                Node (
+                    TaskGraph &graph_,
+                    std::size_t index_,
+                    const std::string &name_,
+                    const Function &function_);
+
+                /// \brief
+                /// Return the node name.
+                /// \return Node name.
+                inline const std::string &GetName () const {
+                    return name;
+                }
+                /// \brief
+                /// Return when the node started running in the last run.
+                /// \return \see{HRTimer::Click} when the node started running (0 if it didn't).
+                inline ui64 GetStartTime () const {
+                    return start;
+                }
+                /// \brief
+                /// Return when the node completed in the last run.
+                /// \return \see{HRTimer::Click} when the node completed (0 if it didn't run).
+                inline ui64 GetEndTime () const {
+                    return end;
+                }
+
+            protected:
+                // RunLoop::Job
+                /// \brief
+                /// Record the start and end times, and when we complete,
+                /// let the graph know so that it can release our successors.
+                /// \param[in] state_ New job state.
+                virtual void SetState (State state_) override;
+                /// \brief
+                /// If the graph is not being cancelled, execute the lambda.
+                /// \param[in] done true == The run loop is done and nothing can be executed on it.
+                virtual void Execute (const std::atomic<bool> &done) throw () override;
+
+                /// \brief
+                /// TaskGraph needs access to private members.
+                friend struct TaskGraph;
+
+                /// \brief
+                /// Node is neither copy constructable, nor assignable.
+                THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (Node)
+            };
+
+        private:
+            /// \brief
+            /// Graph name (used for timing).
+            const std::string name;
+            /// \brief
+            /// Graph nodes (in the order they were added).
+            std::vector<Node::SharedPtr> nodes;
+            /// \brief
+            /// If submitted to a RunLoop, this is it.
+            RunLoop *runLoop;
+            /// \brief
+            /// If submitted to a JobQueuePool, this is it.
+            JobQueuePool *jobQueuePool;
+            /// \brief
+            /// true == the graph is running.
+            std::atomic<bool> running;
+            /// \brief
+            /// true == skip the nodes that have not started yet.
+            std::atomic<bool> stopping;
+            /// \brief
+            /// true == Cancel was called.
+            std::atomic<bool> cancelled;
+            /// \brief
+            /// true == a node failed.
+            std::atomic<bool> failed;
+            /// \brief
+            /// Number of nodes yet to complete in the current run.
+            std::atomic<std::size_t> remainingNodes;
+            /// \brief
+            /// Disposition of the last run.
+            volatile RunLoop::Job::Disposition disposition;
+            /// \brief
+            /// When the last run started.
+            ui64 start;
+            /// \brief
+            /// When the last run completed.
+            ui64 end;
+            /// \brief
+            /// Signaled when the run completes.
+            Event completed;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] name_ Graph name.
+            explicit TaskGraph (const std::string &name_ = std::string ());
+            /// \brief
+            /// dtor.
+            virtual ~TaskGraph () {}
+
+            /// \brief
+            /// Return the graph name.
+            /// \return Graph name.
+            inline const std::string &GetName () const {
+                return name;
+            }
+
+            /// \brief
+            /// Add a new node to the graph.
+            /// \param[in] nodeName Node name.
+            /// \param[in] function Lambda to execute.
+            /// \return The new node.
+            Node::SharedPtr AddNode (
+                const std::string &nodeName,
+                const Node::Function &function);
+            /// \brief
+            /// Add a dependency edge. to will not run until from completes.
+            /// \param[in] from Predecessor.
+            /// \param[in] to Successor.
+            void AddEdge (
+                Node::SharedPtr from,
+                Node::SharedPtr to);
+
+            /// \brief
+            /// Return the graph nodes.
+            /// \return Graph nodes (in the order they were added).
+            inline const std::vector<Node::SharedPtr> &GetNodes () const {
+                return nodes;
+            }
+
+            /// \brief
+            /// Run the graph on the given run loop.
+            /// \param[in] runLoop_ \see{RunLoop} (\see{JobQueue}) to run the nodes on.
+            void Submit (RunLoop &runLoop_);
+            /// \brief
+            /// Run the graph on the given pool. Every ready node
+            /// borrows a \see{JobQueue} for the duration of it's run. If the
+            /// pool runs dry, the node (and with it the graph) fails.
+            /// \param[in] jobQueuePool_ \see{JobQueuePool} to run the nodes on.
+            void Submit (JobQueuePool &jobQueuePool_);
+
+            /// \brief
+            /// Cancel the graph. Running nodes are cancelled (they should monitor
+            /// job.IsCancelled () and done) and the ones that have not started are skipped.
+            void Cancel ();
+
+            /// \brief
+            /// Wait for the graph to complete.
+            /// \param[in] timeSpec How long to wait for the graph to complete.
+            /// IMPORTANT: timeSpec is a relative value.
+            /// \return true == Wait completed successfully, false == Timed out.
+            inline bool Wait (const TimeSpec &timeSpec = TimeSpec::Infinite) {
+                return completed.Wait (timeSpec);
+            }
+
+            /// \brief
+            /// Return true if the graph is running.
+            /// \return true == the graph is running.
+            inline bool IsRunning () const {
+                return running;
+            }
+            /// \brief
+            /// Return the disposition of the last run (Unknown while running).
+            /// \return Disposition of the last run.
+            inline RunLoop::Job::Disposition GetDisposition () const {
+                return disposition;
+            }
+            /// \brief
+            /// Return true if the last run was cancelled.
+            /// \return true == the last run was cancelled.
+            inline bool IsCancelled () const {
+                return disposition == RunLoop::Job::Cancelled;
+            }
+            /// \brief
+            /// Return true if a node failed in the last run.
+            /// \return true == a node failed in the last run.
+            inline bool IsFailed () const {
+                return disposition == RunLoop::Job::Failed;
+            }
+            /// \brief
+            /// Return true if all nodes succeeded in the last run.
+            /// \return true == all nodes succeeded in the last run.
+            inline bool IsSucceeded () const {
+                return disposition == RunLoop::Job::Succeeded;
+            }
+
+            /// \brief
+            /// Return the wall clock time of the last run (\see{HRTimer} units).
+            /// \return Wall clock time of the last run.
+            ui64 GetElapsedTime () const;
+            /// \brief
+            /// Return the critical path of the last run. That's the chain of
+            /// dependent nodes with the largest sum of execution times. No
+            /// amount of workers can make the graph run faster than that.
+            /// \param[out] criticalPath Nodes on the critical path (in execution order).
+            /// \return Sum of the critical path nodes execution times (\see{HRTimer} units).
+            ui64 GetCriticalPath (std::vector<Node::SharedPtr> &criticalPath) const;
+            /// \brief
+            /// Add the timings of the last run to the given \see{HRTimerMgr} scope.
+            /// A sub-scope (named after the graph) gets a timer for every node that
+            /// ran, and a "CriticalPath" sub-scope with the critical path nodes.
+            /// The wall clock and critical path times (in seconds) are added as
+            /// "Elapsed" and "CriticalPath" attributes.
+            /// \param[in] scope \see{HRTimerMgr::ScopeInfo} to add the timings to.
+            void GetTimings (HRTimerMgr::ScopeInfo &scope) const;
+
+        private:
+            /// \brief
+            /// Validate the graph and get it ready to run.
+            /// \return Nodes without predecessors.
+            std::vector<Node *> Prepare ();
+            /// \brief
+            /// Enqueue the given ready nodes.
+            /// \param[in] readyNodes Nodes to enqueue.
+            void Start (const std::vector<Node *> &readyNodes);
+            /// \brief
+            /// Enqueue a ready node (or skip it if the graph is stopping).
+            /// \param[in] node Node to enqueue.
+            void DispatchNode (Node &node);
+            /// \brief
+            /// Called by Node::SetState (or DispatchNode) when the node completes.
+            /// \param[in] node Node that completed.
+            void FinishedNode (Node &node);
+            /// \brief
+            /// Return the nodes in topological order.
+            /// \param[out] order Nodes in topological order.
+            /// \return false == the graph has a cycle.
+            bool TopologicalSort (std::vector<Node *> &order) const;
+
+            /// \brief
+            /// TaskGraph is neither copy constructable, nor assignable.
+            THEKOGANS_UTIL_DISALLOW_COPY_AND_ASSIGN (TaskGraph)
+        };
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_util_TaskGraph_h)
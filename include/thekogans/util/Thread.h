@@ -40,6 +40,7 @@
 #include "thekogans/util/Constants.h"
 #include "thekogans/util/TimeSpec.h"
 #include "thekogans/util/SpinLock.h"
+#include "thekogans/util/CPUSet.h"
 #include "thekogans/util/ThreadRunLoop.h"
 
 #if defined (TOOLCHAIN_OS_Windows)
@@ -110,6 +111,22 @@
 /// \def THEKOGANS_UTIL_MAX_THREAD_AFFINITY
 /// Thread can run on any core.
 #define THEKOGANS_UTIL_MAX_THREAD_AFFINITY thekogans::util::UI32_MAX
+/// \def THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY
+/// Place workers on neighboring processors (SMT siblings first).
+/// See \see{CPUTopology}.
+#define THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY (thekogans::util::UI32_MAX - 1)
+/// \def THEKOGANS_UTIL_SCATTER_THREAD_AFFINITY
+/// Spread workers across sockets and cores (SMT siblings last).
+/// See \see{CPUTopology}.
+#define THEKOGANS_UTIL_SCATTER_THREAD_AFFINITY (thekogans::util::UI32_MAX - 2)
+/// \def THEKOGANS_UTIL_PHYSICAL_CORE_THREAD_AFFINITY
+/// Bind every worker to it's own physical core.
+/// See \see{CPUTopology}.
+#define THEKOGANS_UTIL_PHYSICAL_CORE_THREAD_AFFINITY (thekogans::util::UI32_MAX - 3)
+/// \def THEKOGANS_UTIL_NUMA_NODE_THREAD_AFFINITY
+/// Divide workers evenly among NUMA nodes.
+/// See \see{CPUTopology}.
+#define THEKOGANS_UTIL_NUMA_NODE_THREAD_AFFINITY (thekogans::util::UI32_MAX - 4)
 
 namespace thekogans {
     namespace util {
@@ -265,10 +282,17 @@ namespace thekogans {
             /// \brief
             /// Create the thread.
             /// \param[in] priority Thread priority.
-            /// \param[in] affinity Thread processor affinity.
+            /// \param[in] affinity Thread processor affinity. Either a processor
+            /// id or one of the THEKOGANS_UTIL_*_THREAD_AFFINITY placement policies.
+            /// \param[in] worker If affinity is a placement policy, the index of
+            /// this thread among it's peers.
+            /// \param[in] workerCount If affinity is a placement policy, the
+            /// number of peers being placed.
             void Create (
                 i32 priority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
-                ui32 affinity = THEKOGANS_UTIL_MAX_THREAD_AFFINITY);
+                ui32 affinity = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
+                std::size_t worker = 0,
+                std::size_t workerCount = 1);
 
             /// \brief
             /// Wait for thread to finish.
@@ -357,6 +381,16 @@ namespace thekogans {
             static void SetThreadAffinity (
                 THEKOGANS_UTIL_THREAD_HANDLE thread,
                 ui32 affinity);
+            /// \brief
+            /// Set thread affinity. This will bind the thread
+            /// to a set of processors (see \see{CPUTopology}).
+            /// An empty set leaves the affinity alone. On OS X,
+            /// which has no way to bind threads, the first
+            /// processor id is used as the affinity tag.
+            /// \param[in] affinity Processors to bind the thread to.
+            static void SetThreadAffinity (
+                THEKOGANS_UTIL_THREAD_HANDLE thread,
+                const CPUSet &affinity);
 
             /// \brief
             /// Return current thread handle.
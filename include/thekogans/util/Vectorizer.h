@@ -27,8 +27,7 @@
 #include "thekogans/util/SystemInfo.h"
 #include "thekogans/util/Singleton.h"
 #include "thekogans/util/Thread.h"
-#include "thekogans/util/Mutex.h"
-#include "thekogans/util/Barrier.h"
+#include "thekogans/util/SpinBarrier.h"
 
 namespace thekogans {
     namespace util {
@@ -87,6 +86,15 @@ namespace thekogans {
         /// } job (result, vertices, xform);
         /// GlobalVectorizer::Instance ().Execute (job);
         /// \endcode
+        ///
+        /// Workers are released and joined with a \see{SpinBarrier}, so back to
+        /// back calls with small jobs don't pay for a kernel round trip. Work is
+        /// handed out either statically (equal, contiguous chunks, one per rank),
+        /// or dynamically (ranks keep grabbing chunks off a shared atomic counter
+        /// until the job is done) to keep uneven jobs from leaving cores idle.
+        /// A Vectorizer runs one job at a time. If it's busy (another thread's
+        /// job, or a job calling Execute from inside Job::Execute), the job runs
+        /// on the calling thread instead of waiting.
 
         struct _LIB_THEKOGANS_UTIL_DECL Vectorizer {
             /// \struct Vectorizer::Job Vectorizer.h thekogans/util/Vectorizer.h
@@ -106,6 +114,9 @@ namespace thekogans {
             /// thread calls Job::Execute with the same this pointer).
             /// This design decision requires that Job::Execute be
             /// thread safe (re-entrant).
+            /// NOTE: With ScheduleDynamic and ScheduleGuided, a rank can
+            /// call Execute more than once (with different ranges). If
+            /// you stash partial results by rank, accumulate them.
             struct Job {
                 /// \brief
                 /// Virtual dtor.
@@ -115,7 +126,7 @@ namespace thekogans {
                 /// implements the scatter part of scatter/gather.
                 /// Use it to initialize the space where partial
                 /// results will be stored by each stage.
-                /// \param[in] chunks Number of chunks this job will be broken up in to.
+                /// \param[in] chunks Number of chunks (ranks) this job will be broken up in to.
                 virtual void Prolog (std::size_t /*chunks*/) throw () {}
                 /// \brief
                 /// Called by each worker with appropriate chunk range.
@@ -138,13 +149,39 @@ namespace thekogans {
                 virtual std::size_t Size () const throw () = 0;
             };
 
+            /// \enum
+            /// How Execute hands out work to the ranks.
+            enum Schedule {
+                /// \brief
+                /// One contiguous chunk per rank (chunkSize_ wide if given,
+                /// Size () / ranks otherwise). Lowest overhead, best for
+                /// uniform jobs.
+                ScheduleStatic,
+                /// \brief
+                /// Ranks grab chunkSize_ wide chunks (Size () / (8 * ranks)
+                /// if not given) until the job is done.
+                ScheduleDynamic,
+                /// \brief
+                /// Like dynamic, but chunks start large (remaining / (2 * ranks))
+                /// and shrink to chunkSize_ (1 if not given) as the job winds down.
+                ScheduleGuided
+            };
+
             /// \brief
             /// ctor. Initialize the workers array, and start waiting for jobs.
             /// \param[in] workerCount_ The width of the vector.
             /// \param[in] workerPriority Worker thread priority.
+            /// \param[in] workerAffinity Worker thread processor affinity. Rank 0
+            /// is the thread calling Execute and it's bound when the Vectorizer is
+            /// created. Use one of the \see{CPUTopology} placement policies (or
+            /// THEKOGANS_UTIL_MAX_THREAD_AFFINITY to leave the threads unbound).
+            /// \param[in] spinCount How long (\see{SpinBarrier}) workers spin
+            /// waiting for the next job before parking.
             Vectorizer (
                 std::size_t workerCount_ = SystemInfo::Instance ().GetCPUCount (),
-                i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY);
+                i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+                ui32 workerAffinity = THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY,
+                ui32 spinCount = SpinBarrier::DEFAULT_SPIN_COUNT);
             /// \brief
             /// dtor.
             virtual ~Vectorizer ();
@@ -157,21 +194,30 @@ namespace thekogans {
             /// latency by scheduling fewer workers to do more work.
             /// \param[in] job_ Job to parellalize.
             /// \param[in] chunkSize_ Optional worker chunk size.
+            /// \param[in] schedule_ How to hand out work to the ranks.
             /// NOTE: Vectorizer::Execute is synchronous.
             void Execute (
                 Job &job_,
-                std::size_t chunkSize_ = SIZE_T_MAX);
+                std::size_t chunkSize_ = SIZE_T_MAX,
+                Schedule schedule_ = ScheduleStatic);
+
+            /// \brief
+            /// Return the vector width (worker threads + the calling thread).
+            /// \return Vector width.
+            inline std::size_t GetWidth () const {
+                return workers.size () + 1;
+            }
 
         private:
             /// \brief
             /// Flag to signal the worker thread.
             std::atomic<bool> done;
             /// \brief
-            /// Synchronization lock.
-            Mutex mutex;
+            /// true == a job is being vectorized.
+            std::atomic<bool> busy;
             /// \brief
-            /// Used to synchronize vectorizer workers.
-            Barrier barrier;
+            /// Used to release and join vectorizer workers.
+            SpinBarrier barrier;
             /// \struct vectorizer::Worker Vectorizer.h thekogans/util/Vectorizer.h
             ///
             /// \brief
@@ -197,14 +243,18 @@ namespace thekogans {
                 /// \param[in] rank_ Worker rank.
                 /// \param[in] name Worker thread name.
                 /// \param[in] priority Worker thread priority.
+                /// \param[in] affinity Worker thread processor affinity.
+                /// \param[in] workerCount Vector width.
                 Worker (Vectorizer &vectorizer_,
                         std::size_t rank_,
                         const std::string &name = std::string (),
-                        i32 priority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY) :
+                        i32 priority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+                        ui32 affinity = THEKOGANS_UTIL_MAX_THREAD_AFFINITY,
+                        std::size_t workerCount = 1) :
                         Thread (name),
                         vectorizer (vectorizer_),
                         rank (rank_) {
-                    Create (priority, (ui32)rank);
+                    Create (priority, affinity, rank, workerCount);
                 }
 
             protected:
@@ -226,6 +276,24 @@ namespace thekogans {
             /// \brief
             /// Chunk size each worker should execute.
             std::size_t chunkSize;
+            /// \brief
+            /// Cached job->Size ().
+            std::size_t size;
+            /// \brief
+            /// How work is handed out.
+            Schedule schedule;
+            /// \brief
+            /// Next unclaimed index (ScheduleDynamic and ScheduleGuided).
+            std::atomic<std::size_t> next;
+
+            /// \brief
+            /// Execute the current job's chunk(s) for the given rank.
+            /// \param[in] rank Rank (0 = calling thread).
+            void ExecuteChunks (std::size_t rank);
+            /// \brief
+            /// Run the job on the calling thread.
+            /// \param[in] job_ Job to run.
+            static void ExecuteInline (Job &job_);
         };
 
         /// \struct GlobalVectorizer Vectorizer.h thekogans/util/Vectorizer.h
@@ -246,10 +314,14 @@ namespace thekogans {
             /// Create a global vectorizer with custom ctor arguments.
             /// \param[in] workerCount The width of the vector.
             /// \param[in] workerPriority Worker thread priority.
+            /// \param[in] workerAffinity Worker thread processor affinity.
+            /// \param[in] spinCount How long workers spin waiting for the next job.
             GlobalVectorizer (
                 std::size_t workerCount = SystemInfo::Instance ().GetCPUCount (),
-                i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY) :
-                Vectorizer (workerCount, workerPriority) {}
+                i32 workerPriority = THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY,
+                ui32 workerAffinity = THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY,
+                ui32 spinCount = SpinBarrier::DEFAULT_SPIN_COUNT) :
+                Vectorizer (workerCount, workerPriority, workerAffinity, spinCount) {}
         };
 
     } // namespace util
@@ -0,0 +1,102 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/AlignedBufferPool.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            inline std::size_t AlignUp (
+                    std::size_t value,
+                    std::size_t alignment) {
+                return (value + alignment - 1) & ~(alignment - 1);
+            }
+        }
+
+        AlignedBufferPool::AlignedBufferPool (
+                std::size_t bufferSize_,
+                std::size_t alignment_,
+                std::size_t maxFreeBuffers_,
+                std::size_t initialBuffers) :
+                bufferSize (AlignUp (bufferSize_, alignment_)),
+                alignment (alignment_),
+                maxFreeBuffers (maxFreeBuffers_),
+                allocator (DefaultAllocator::Instance (), alignment_) {
+            if (bufferSize_ == 0 || alignment_ == 0 || OneBitCount (alignment_) != 1) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            freeBuffers.reserve (maxFreeBuffers);
+            for (std::size_t i = 0; i < initialBuffers && i < maxFreeBuffers; ++i) {
+                freeBuffers.push_back (allocator.Alloc (bufferSize));
+            }
+        }
+
+        AlignedBufferPool::~AlignedBufferPool () {
+            for (std::size_t i = 0, count = freeBuffers.size (); i < count; ++i) {
+                allocator.Free (freeBuffers[i], bufferSize);
+            }
+        }
+
+        void *AlignedBufferPool::Alloc (std::size_t size) {
+            if (size > bufferSize) {
+                return allocator.Alloc (size);
+            }
+            if (size > 0) {
+                {
+                    LockGuard<SpinLock> guard (spinLock);
+                    if (!freeBuffers.empty ()) {
+                        void *ptr = freeBuffers.back ();
+                        freeBuffers.pop_back ();
+                        return ptr;
+                    }
+                }
+                return allocator.Alloc (bufferSize);
+            }
+            return 0;
+        }
+
+        void AlignedBufferPool::Free (
+                void *ptr,
+                std::size_t size) {
+            if (ptr != 0) {
+                if (size > bufferSize) {
+                    allocator.Free (ptr, size);
+                }
+                else {
+                    {
+                        LockGuard<SpinLock> guard (spinLock);
+                        if (freeBuffers.size () < maxFreeBuffers) {
+                            freeBuffers.push_back (ptr);
+                            return;
+                        }
+                    }
+                    allocator.Free (ptr, bufferSize);
+                }
+            }
+        }
+
+        std::size_t AlignedBufferPool::GetFreeCount () {
+            LockGuard<SpinLock> guard (spinLock);
+            return freeBuffers.size ();
+        }
+
+    } // namespace util
+} // namespace thekogans
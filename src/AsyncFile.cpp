@@ -0,0 +1,845 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (TOOLCHAIN_OS_Windows)
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#if defined (TOOLCHAIN_OS_Linux)
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <linux/io_uring.h>
+#endif // defined (TOOLCHAIN_OS_Linux)
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/JobQueue.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/util/AsyncFile.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Set while a completion callback is running on this thread.
+            // Submit does not block such threads (they are the ones that
+            // would unblock it).
+            thread_local bool inCompletion = false;
+
+            void Execute (
+                    THEKOGANS_UTIL_HANDLE handle,
+                    const AsyncFile::Operation &operation,
+                    std::size_t &count,
+                    THEKOGANS_UTIL_ERROR_CODE &errorCode) {
+                count = 0;
+                errorCode = 0;
+                ssize_t result;
+                do {
+                    switch (operation.type) {
+                        case AsyncFile::Operation::Read:
+                            result = pread (handle, operation.buffer,
+                                operation.length, (off_t)operation.offset);
+                            break;
+                        case AsyncFile::Operation::Write:
+                            result = pwrite (handle, operation.buffer,
+                                operation.length, (off_t)operation.offset);
+                            break;
+                        case AsyncFile::Operation::Sync:
+                            result = fsync (handle);
+                            break;
+                        case AsyncFile::Operation::DataSync:
+                        #if defined (TOOLCHAIN_OS_Linux)
+                            result = fdatasync (handle);
+                        #else // defined (TOOLCHAIN_OS_Linux)
+                            result = fsync (handle);
+                        #endif // defined (TOOLCHAIN_OS_Linux)
+                            break;
+                        default:
+                            errno = EINVAL;
+                            result = -1;
+                            break;
+                    }
+                } while (result < 0 && THEKOGANS_UTIL_OS_ERROR_CODE == EINTR);
+                if (result < 0) {
+                    errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                }
+                else if (operation.type == AsyncFile::Operation::Read ||
+                        operation.type == AsyncFile::Operation::Write) {
+                    count = (std::size_t)result;
+                }
+            }
+        }
+
+        void AsyncFile::RunLoopCallback::OnComplete (
+                AsyncFile &file,
+                Operation &operation) throw () {
+            THEKOGANS_UTIL_TRY {
+                AsyncFile *file_ = &file;
+                Operation::SharedPtr operation_ (&operation);
+                Callback::SharedPtr callback_ = callback;
+                runLoop.EnqJob (
+                    [file_, operation_, callback_] (
+                            RunLoop::Job & /*job*/,
+                            const std::atomic<bool> & /*done*/) {
+                        callback_->OnComplete (*file_, *operation_);
+                    });
+            }
+            THEKOGANS_UTIL_CATCH_AND_LOG_SUBSYSTEM (THEKOGANS_UTIL)
+        }
+
+        struct AsyncFile::Engine {
+            /// \brief
+            /// dtor.
+            virtual ~Engine () {}
+
+            /// \brief
+            /// Return the backend type.
+            /// \return BackendIoUring or BackendThreadPool.
+            virtual Backend GetBackend () const = 0;
+
+            /// \brief
+            /// Register buffers.
+            /// \param[in] buffers Buffers to register.
+            virtual void RegisterBuffers (const std::vector<RegisteredBuffer> & /*buffers*/) {}
+            /// \brief
+            /// Unregister buffers.
+            virtual void UnregisterBuffers () {}
+
+            /// \brief
+            /// Submit operations. Every operation carries a reference
+            /// that's released by AsyncFile::Complete.
+            /// \param[in] operations Operations to submit.
+            /// \param[in] count Number of operations.
+            /// \param[in] linked true == operations form a chain.
+            virtual void Submit (
+                Operation * const *operations,
+                std::size_t count,
+                bool linked) = 0;
+        };
+
+    #if defined (TOOLCHAIN_OS_Linux)
+        namespace {
+            inline int io_uring_setup (
+                    ui32 entries,
+                    io_uring_params *params) {
+                return (int)syscall (__NR_io_uring_setup, entries, params);
+            }
+
+            inline int io_uring_enter (
+                    int ring,
+                    ui32 toSubmit,
+                    ui32 minComplete,
+                    ui32 flags) {
+                return (int)syscall (__NR_io_uring_enter, ring, toSubmit, minComplete, flags, 0, 0);
+            }
+
+            inline int io_uring_register (
+                    int ring,
+                    ui32 opcode,
+                    const void *arg,
+                    ui32 count) {
+                return (int)syscall (__NR_io_uring_register, ring, opcode, arg, count);
+            }
+        }
+
+        struct AsyncFile::IoUringEngine : public AsyncFile::Engine, public Thread {
+            /// \brief
+            /// AsyncFile whose operations we execute.
+            AsyncFile &file;
+            /// \brief
+            /// io_uring handle.
+            int ring;
+            /// \brief
+            /// Submission queue ring mapping.
+            void *sqRing;
+            /// \brief
+            /// Submission queue ring mapping size.
+            std::size_t sqRingSize;
+            /// \brief
+            /// Completion queue ring mapping (can be the same as sqRing).
+            void *cqRing;
+            /// \brief
+            /// Completion queue ring mapping size.
+            std::size_t cqRingSize;
+            /// \brief
+            /// Submission queue entries.
+            io_uring_sqe *sqes;
+            /// \brief
+            /// Submission queue entries mapping size.
+            std::size_t sqesSize;
+            /// \brief
+            /// Submission queue tail (we produce).
+            ui32 *sqTail;
+            /// \brief
+            /// Submission queue index mask.
+            ui32 sqMask;
+            /// \brief
+            /// Submission queue index array.
+            ui32 *sqArray;
+            /// \brief
+            /// Completion queue head (we consume).
+            ui32 *cqHead;
+            /// \brief
+            /// Completion queue tail (kernel produces).
+            ui32 *cqTail;
+            /// \brief
+            /// Completion queue index mask.
+            ui32 cqMask;
+            /// \brief
+            /// Completion queue entries.
+            io_uring_cqe *cqes;
+            /// \brief
+            /// Serializes submissions.
+            SpinLock spinLock;
+
+            /// \brief
+            /// ctor. Setup the ring. Throws if io_uring is not supported.
+            /// \param[in] file_ AsyncFile whose operations we execute.
+            IoUringEngine (AsyncFile &file_) :
+                    Thread ("AsyncFile"),
+                    file (file_),
+                    ring (-1),
+                    sqRing (MAP_FAILED),
+                    sqRingSize (0),
+                    cqRing (MAP_FAILED),
+                    cqRingSize (0),
+                    sqes ((io_uring_sqe *)MAP_FAILED),
+                    sqesSize (0),
+                    sqTail (0),
+                    sqMask (0),
+                    sqArray (0),
+                    cqHead (0),
+                    cqTail (0),
+                    cqMask (0),
+                    cqes (0) {
+                io_uring_params params;
+                memset (&params, 0, sizeof (params));
+                // Completion callbacks can submit past the queue depth.
+                // Give them plenty of room in the completion queue.
+                params.flags = IORING_SETUP_CQSIZE;
+                params.cq_entries = (ui32)file.queueDepth * 4;
+                ring = io_uring_setup ((ui32)file.queueDepth, &params);
+                if (ring < 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                THEKOGANS_UTIL_TRY {
+                    Probe ();
+                    sqRingSize = params.sq_off.array + params.sq_entries * sizeof (ui32);
+                    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+                    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+                        sqRingSize = cqRingSize = std::max (sqRingSize, cqRingSize);
+                    }
+                    sqRing = mmap (0, sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+                    if (sqRing == MAP_FAILED) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+                        cqRing = sqRing;
+                    }
+                    else {
+                        cqRing = mmap (0, cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+                        if (cqRing == MAP_FAILED) {
+                            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                THEKOGANS_UTIL_OS_ERROR_CODE);
+                        }
+                    }
+                    sqesSize = params.sq_entries * sizeof (io_uring_sqe);
+                    sqes = (io_uring_sqe *)mmap (0, sqesSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+                    if (sqes == MAP_FAILED) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    ui8 *sq = (ui8 *)sqRing;
+                    sqTail = (ui32 *)(sq + params.sq_off.tail);
+                    sqMask = *(ui32 *)(sq + params.sq_off.ring_mask);
+                    sqArray = (ui32 *)(sq + params.sq_off.array);
+                    ui8 *cq = (ui8 *)cqRing;
+                    cqHead = (ui32 *)(cq + params.cq_off.head);
+                    cqTail = (ui32 *)(cq + params.cq_off.tail);
+                    cqMask = *(ui32 *)(cq + params.cq_off.ring_mask);
+                    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+                    Create ();
+                }
+                THEKOGANS_UTIL_CATCH (Exception) {
+                    Cleanup ();
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+            }
+            /// \brief
+            /// dtor. Stop the completion thread and tear down the ring.
+            virtual ~IoUringEngine () {
+                // A NOP with 0 user_data tells the completion thread to exit.
+                {
+                    LockGuard<SpinLock> guard (spinLock);
+                    io_uring_sqe &sqe = GetSqe ();
+                    sqe.opcode = IORING_OP_NOP;
+                    __atomic_store_n (sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+                    EnterSubmit (1);
+                }
+                Wait ();
+                Cleanup ();
+            }
+
+            // Engine
+            virtual Backend GetBackend () const override {
+                return BackendIoUring;
+            }
+
+            virtual void RegisterBuffers (
+                    const std::vector<RegisteredBuffer> &buffers) override {
+                UnregisterBuffers ();
+                if (!buffers.empty ()) {
+                    std::vector<iovec> iovecs (buffers.size ());
+                    for (std::size_t i = 0, count = buffers.size (); i < count; ++i) {
+                        iovecs[i].iov_base = buffers[i].first;
+                        iovecs[i].iov_len = buffers[i].second;
+                    }
+                    if (io_uring_register (ring, IORING_REGISTER_BUFFERS,
+                            iovecs.data (), (ui32)iovecs.size ()) < 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                }
+            }
+
+            virtual void UnregisterBuffers () override {
+                // ENXIO == no buffers were registered.
+                if (io_uring_register (ring, IORING_UNREGISTER_BUFFERS, 0, 0) < 0 &&
+                        THEKOGANS_UTIL_OS_ERROR_CODE != ENXIO) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+
+            virtual void Submit (
+                    Operation * const *operations,
+                    std::size_t count,
+                    bool linked) override {
+                LockGuard<SpinLock> guard (spinLock);
+                for (std::size_t i = 0; i < count; ++i) {
+                    Operation &operation = *operations[i];
+                    io_uring_sqe &sqe = GetSqe ();
+                    sqe.fd = file.handle;
+                    sqe.user_data = (ui64)(std::uintptr_t)&operation;
+                    switch (operation.type) {
+                        case Operation::Read:
+                        case Operation::Write:
+                            sqe.off = operation.offset;
+                            sqe.addr = (ui64)(std::uintptr_t)operation.buffer;
+                            sqe.len = (ui32)operation.length;
+                            if (operation.bufferIndex >= 0) {
+                                sqe.opcode = operation.type == Operation::Read ?
+                                    IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                                sqe.buf_index = (ui16)operation.bufferIndex;
+                            }
+                            else {
+                                sqe.opcode = operation.type == Operation::Read ?
+                                    IORING_OP_READ : IORING_OP_WRITE;
+                            }
+                            break;
+                        case Operation::Sync:
+                        case Operation::DataSync:
+                            sqe.opcode = IORING_OP_FSYNC;
+                            if (operation.type == Operation::DataSync) {
+                                sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+                            }
+                            break;
+                    }
+                    if (linked && i < count - 1) {
+                        sqe.flags |= IOSQE_IO_LINK;
+                    }
+                    // Make the entry visible to the kernel.
+                    __atomic_store_n (sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+                }
+                EnterSubmit ((ui32)count);
+            }
+
+            // Thread
+            /// \brief
+            /// Reap completions and hand them to the AsyncFile.
+            virtual void Run () throw () override {
+                for (bool done = false; !done;) {
+                    if (io_uring_enter (ring, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                        THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                        if (errorCode != EINTR && errorCode != EAGAIN && errorCode != EBUSY) {
+                            THEKOGANS_UTIL_LOG_SUBSYSTEM_ERROR (
+                                THEKOGANS_UTIL,
+                                "io_uring_enter: %s\n",
+                                Exception::FromErrorCode (errorCode).c_str ());
+                        }
+                    }
+                    ui32 head = *cqHead;
+                    ui32 tail = __atomic_load_n (cqTail, __ATOMIC_ACQUIRE);
+                    while (head != tail) {
+                        const io_uring_cqe &cqe = cqes[head++ & cqMask];
+                        if (cqe.user_data != 0) {
+                            ui64 userData = cqe.user_data;
+                            i32 result = cqe.res;
+                            // Free the slot before calling out so that
+                            // callbacks that submit have room.
+                            __atomic_store_n (cqHead, head, __ATOMIC_RELEASE);
+                            file.Complete (
+                                (Operation *)(std::uintptr_t)userData,
+                                result < 0 ? 0 : (std::size_t)result,
+                                result < 0 ? -result : 0);
+                        }
+                        else {
+                            done = true;
+                        }
+                    }
+                    __atomic_store_n (cqHead, head, __ATOMIC_RELEASE);
+                }
+            }
+
+        private:
+            /// \brief
+            /// Make sure the kernel supports the ops we use (5.6+).
+            void Probe () {
+                std::vector<ui8> buffer (
+                    sizeof (io_uring_probe) + 256 * sizeof (io_uring_probe_op), 0);
+                io_uring_probe *probe = (io_uring_probe *)buffer.data ();
+                if (io_uring_register (ring, IORING_REGISTER_PROBE, probe, 256) < 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (ENOSYS);
+                }
+                static const ui8 ops[] = {
+                    IORING_OP_NOP,
+                    IORING_OP_READ,
+                    IORING_OP_WRITE,
+                    IORING_OP_READ_FIXED,
+                    IORING_OP_WRITE_FIXED,
+                    IORING_OP_FSYNC
+                };
+                for (std::size_t i = 0; i < sizeof (ops) / sizeof (ops[0]); ++i) {
+                    if (ops[i] > probe->last_op ||
+                            (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) == 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (ENOSYS);
+                    }
+                }
+            }
+
+            /// \brief
+            /// Return the next (zeroed) submission queue entry.
+            /// NOTE: Must be called with spinLock held. Since operations in
+            /// flight never exceed the ring size (and the kernel consumes
+            /// entries during io_uring_enter), there's always room.
+            /// \return Next submission queue entry.
+            io_uring_sqe &GetSqe () {
+                ui32 index = *sqTail & sqMask;
+                io_uring_sqe &sqe = sqes[index];
+                memset (&sqe, 0, sizeof (sqe));
+                sqArray[index] = index;
+                return sqe;
+            }
+
+            /// \brief
+            /// Tell the kernel about count new submission queue entries.
+            /// \param[in] count Number of new entries.
+            void EnterSubmit (ui32 count) {
+                while (count > 0) {
+                    int result = io_uring_enter (ring, count, 0, 0);
+                    if (result < 0) {
+                        THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                        if (errorCode == EAGAIN || errorCode == EBUSY) {
+                            // Kernel is short on resources or the completion
+                            // queue is backed up. Give the completion thread
+                            // a chance to catch up.
+                            Thread::YieldSlice ();
+                        }
+                        else if (errorCode != EINTR) {
+                            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                        }
+                    }
+                    else {
+                        count -= (ui32)result;
+                    }
+                }
+            }
+
+            /// \brief
+            /// Release the ring resources.
+            void Cleanup () {
+                if (sqes != MAP_FAILED) {
+                    munmap (sqes, sqesSize);
+                }
+                if (cqRing != MAP_FAILED && cqRing != sqRing) {
+                    munmap (cqRing, cqRingSize);
+                }
+                if (sqRing != MAP_FAILED) {
+                    munmap (sqRing, sqRingSize);
+                }
+                if (ring >= 0) {
+                    close (ring);
+                }
+            }
+        };
+    #endif // defined (TOOLCHAIN_OS_Linux)
+
+        struct AsyncFile::ThreadPoolEngine : public AsyncFile::Engine {
+            /// \brief
+            /// AsyncFile whose operations we execute.
+            AsyncFile &file;
+            /// \brief
+            /// Workers performing blocking I/O.
+            JobQueue jobQueue;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] file_ AsyncFile whose operations we execute.
+            /// \param[in] workerCount Number of workers.
+            ThreadPoolEngine (
+                AsyncFile &file_,
+                std::size_t workerCount) :
+                file (file_),
+                jobQueue (
+                    "AsyncFile",
+                    RunLoop::JobExecutionPolicy::SharedPtr (
+                        new RunLoop::FIFOJobExecutionPolicy),
+                    workerCount) {}
+            /// \brief
+            /// dtor. AsyncFile waits for outstanding operations so
+            /// the queue is empty by the time we get here.
+            virtual ~ThreadPoolEngine () {
+                jobQueue.Stop ();
+            }
+
+            // Engine
+            virtual Backend GetBackend () const override {
+                return BackendThreadPool;
+            }
+
+            virtual void Submit (
+                    Operation * const *operations,
+                    std::size_t count,
+                    bool linked) override {
+                AsyncFile *file_ = &file;
+                if (linked) {
+                    std::vector<Operation *> chain (operations, operations + count);
+                    jobQueue.EnqJob (
+                        [file_, chain] (
+                                RunLoop::Job & /*job*/,
+                                const std::atomic<bool> & /*done*/) {
+                            bool failed = false;
+                            for (std::size_t i = 0, count = chain.size (); i < count; ++i) {
+                                std::size_t countTransferred = 0;
+                                THEKOGANS_UTIL_ERROR_CODE errorCode = ECANCELED;
+                                if (!failed) {
+                                    Execute (file_->handle, *chain[i], countTransferred, errorCode);
+                                    // Like io_uring, a short read/write breaks the chain.
+                                    failed = errorCode != 0 ||
+                                        ((chain[i]->type == Operation::Read ||
+                                            chain[i]->type == Operation::Write) &&
+                                            countTransferred < chain[i]->length);
+                                }
+                                file_->Complete (chain[i], countTransferred, errorCode);
+                            }
+                        });
+                }
+                else {
+                    for (std::size_t i = 0; i < count; ++i) {
+                        Operation *operation = operations[i];
+                        jobQueue.EnqJob (
+                            [file_, operation] (
+                                    RunLoop::Job & /*job*/,
+                                    const std::atomic<bool> & /*done*/) {
+                                std::size_t countTransferred = 0;
+                                THEKOGANS_UTIL_ERROR_CODE errorCode = 0;
+                                Execute (file_->handle, *operation, countTransferred, errorCode);
+                                file_->Complete (operation, countTransferred, errorCode);
+                            });
+                    }
+                }
+            }
+        };
+
+        AsyncFile::AsyncFile (
+                const std::string &path_,
+                i32 flags,
+                i32 mode,
+                std::size_t queueDepth_,
+                Backend backend,
+                std::size_t workerCount) :
+                path (path_),
+                handle (open (path.c_str (), flags, mode)),
+                queueDepth (queueDepth_),
+                inFlight (0),
+                operationCompleted (mutex) {
+            if (handle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", path.c_str ());
+            }
+            THEKOGANS_UTIL_TRY {
+                if (queueDepth == 0 || queueDepth > 4096 || workerCount == 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                if (backend != BackendThreadPool) {
+                #if defined (TOOLCHAIN_OS_Linux)
+                    THEKOGANS_UTIL_TRY {
+                        engine.reset (new IoUringEngine (*this));
+                    }
+                    THEKOGANS_UTIL_CATCH (Exception) {
+                        if (backend == BackendIoUring) {
+                            THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                        }
+                    }
+                #else // defined (TOOLCHAIN_OS_Linux)
+                    if (backend == BackendIoUring) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (ENOSYS);
+                    }
+                #endif // defined (TOOLCHAIN_OS_Linux)
+                }
+                if (engine.get () == 0) {
+                    engine.reset (new ThreadPoolEngine (*this, workerCount));
+                }
+            }
+            THEKOGANS_UTIL_CATCH (Exception) {
+                close (handle);
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+        }
+
+        AsyncFile::~AsyncFile () {
+            WaitForIdle ();
+            engine.reset ();
+            close (handle);
+        }
+
+        AsyncFile::Backend AsyncFile::GetBackend () const {
+            return engine->GetBackend ();
+        }
+
+        void AsyncFile::RegisterBuffers (
+                const std::vector<std::pair<void *, std::size_t>> &buffers) {
+            LockGuard<Mutex> guard (mutex);
+            if (inFlight == 0) {
+                engine->RegisterBuffers (buffers);
+                registeredBuffers = buffers;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (EBUSY);
+            }
+        }
+
+        void AsyncFile::UnregisterBuffers () {
+            LockGuard<Mutex> guard (mutex);
+            if (inFlight == 0) {
+                engine->UnregisterBuffers ();
+                registeredBuffers.clear ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (EBUSY);
+            }
+        }
+
+        AsyncFile::Operation::SharedPtr AsyncFile::Read (
+                ui64 offset,
+                void *buffer,
+                std::size_t length,
+                Callback::SharedPtr callback,
+                i32 bufferIndex) {
+            std::vector<Operation::SharedPtr> operations (1,
+                Operation::SharedPtr (
+                    new Operation (
+                        Operation::Read, offset, buffer, length, callback, bufferIndex)));
+            Submit (operations);
+            return operations[0];
+        }
+
+        AsyncFile::Operation::SharedPtr AsyncFile::Write (
+                ui64 offset,
+                const void *buffer,
+                std::size_t length,
+                Callback::SharedPtr callback,
+                i32 bufferIndex) {
+            std::vector<Operation::SharedPtr> operations (1,
+                Operation::SharedPtr (
+                    new Operation (
+                        Operation::Write, offset, (void *)buffer, length, callback, bufferIndex)));
+            Submit (operations);
+            return operations[0];
+        }
+
+        AsyncFile::Operation::SharedPtr AsyncFile::Sync (
+                bool dataOnly,
+                Callback::SharedPtr callback) {
+            std::vector<Operation::SharedPtr> operations (1,
+                Operation::SharedPtr (
+                    new Operation (
+                        dataOnly ? Operation::DataSync : Operation::Sync,
+                        0, 0, 0, callback)));
+            Submit (operations);
+            return operations[0];
+        }
+
+        AsyncFile::Operation::SharedPtr AsyncFile::WriteAndSync (
+                ui64 offset,
+                const void *buffer,
+                std::size_t length,
+                Callback::SharedPtr callback,
+                bool dataOnly,
+                i32 bufferIndex) {
+            std::vector<Operation::SharedPtr> operations;
+            operations.push_back (
+                Operation::SharedPtr (
+                    new Operation (
+                        Operation::Write, offset, (void *)buffer, length, callback, bufferIndex)));
+            operations.push_back (
+                Operation::SharedPtr (
+                    new Operation (
+                        dataOnly ? Operation::DataSync : Operation::Sync,
+                        0, 0, 0, callback)));
+            Submit (operations, true);
+            return operations[1];
+        }
+
+        void AsyncFile::Submit (
+                const std::vector<Operation::SharedPtr> &operations,
+                bool linked) {
+            std::size_t count = operations.size ();
+            if (count == 0) {
+                return;
+            }
+            if (count > queueDepth) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            std::vector<Operation *> operations_ (count);
+            {
+                LockGuard<Mutex> guard (mutex);
+                for (std::size_t i = 0; i < count; ++i) {
+                    Operation *operation = operations[i].Get ();
+                    if (operation == 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    if (operation->type == Operation::Read ||
+                            operation->type == Operation::Write) {
+                        if (operation->buffer == 0 || operation->length > UI32_MAX) {
+                            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                        }
+                        if (operation->bufferIndex >= 0) {
+                            // The operation must fall entirely within the registered buffer.
+                            if ((std::size_t)operation->bufferIndex >= registeredBuffers.size ()) {
+                                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                            }
+                            const RegisteredBuffer &registeredBuffer =
+                                registeredBuffers[operation->bufferIndex];
+                            const ui8 *start = (const ui8 *)registeredBuffer.first;
+                            const ui8 *buffer = (const ui8 *)operation->buffer;
+                            if (buffer < start ||
+                                    buffer + operation->length > start + registeredBuffer.second) {
+                                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                            }
+                        }
+                    }
+                    operations_[i] = operation;
+                }
+                if (!inCompletion) {
+                    while (inFlight + count > queueDepth) {
+                        operationCompleted.Wait ();
+                    }
+                }
+                inFlight += count;
+            }
+            for (std::size_t i = 0; i < count; ++i) {
+                operations_[i]->finished.store (false, std::memory_order_relaxed);
+                operations_[i]->completed.Reset ();
+                operations_[i]->count = 0;
+                operations_[i]->errorCode = 0;
+                // Released by Complete.
+                operations_[i]->AddRef ();
+            }
+            THEKOGANS_UTIL_TRY {
+                engine->Submit (operations_.data (), count, linked);
+            }
+            THEKOGANS_UTIL_CATCH (Exception) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    operations_[i]->Release ();
+                }
+                {
+                    LockGuard<Mutex> guard (mutex);
+                    inFlight -= count;
+                    operationCompleted.SignalAll ();
+                }
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+        }
+
+        std::size_t AsyncFile::GetInFlightCount () {
+            LockGuard<Mutex> guard (mutex);
+            return inFlight;
+        }
+
+        bool AsyncFile::WaitForIdle (const TimeSpec &timeSpec) {
+            LockGuard<Mutex> guard (mutex);
+            if (timeSpec == TimeSpec::Infinite) {
+                while (inFlight > 0) {
+                    operationCompleted.Wait ();
+                }
+            }
+            else {
+                TimeSpec now = GetCurrentTime ();
+                TimeSpec deadline = now + timeSpec;
+                while (inFlight > 0 && deadline > now) {
+                    operationCompleted.Wait (deadline - now);
+                    now = GetCurrentTime ();
+                }
+            }
+            return inFlight == 0;
+        }
+
+        void AsyncFile::Complete (
+                Operation *operation,
+                std::size_t count,
+                THEKOGANS_UTIL_ERROR_CODE errorCode) {
+            // Adopt the reference taken by Submit.
+            Operation::SharedPtr operation_ (operation, false);
+            operation->count = count;
+            operation->errorCode = errorCode;
+            if (operation->callback.Get () != 0) {
+                inCompletion = true;
+                operation->callback->OnComplete (*this, *operation);
+                inCompletion = false;
+            }
+            // Don't touch this AsyncFile after this point. Once inFlight
+            // drops WaitForIdle (and the dtor) are free to return.
+            {
+                LockGuard<Mutex> guard (mutex);
+                --inFlight;
+                operationCompleted.SignalAll ();
+            }
+            operation->finished.store (true, std::memory_order_release);
+            operation->completed.Signal ();
+        }
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (TOOLCHAIN_OS_Windows)
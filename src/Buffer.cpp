@@ -18,16 +18,15 @@
 #include <cassert>
 #include <cstring>
 #include <algorithm>
-#if defined (THEKOGANS_UTIL_HAVE_ZLIB)
-    #include <vector>
-    #include <zlib.h>
-#endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
 #if defined (TOOLCHAIN_OS_Windows)
     #include "thekogans/util/WindowsUtils.h"
 #endif // defined (TOOLCHAIN_OS_Windows)
 #include "thekogans/util/XMLUtils.h"
 #include "thekogans/util/Base64.h"
 #include "thekogans/util/Buffer.h"
+#if defined (THEKOGANS_UTIL_HAVE_ZLIB)
+    #include "thekogans/util/Deflate.h"
+#endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
 
 namespace thekogans {
     namespace util {
@@ -219,107 +218,99 @@ namespace thekogans {
 
     #if defined (THEKOGANS_UTIL_HAVE_ZLIB)
         namespace {
-            struct OutBuffer {
+            struct OutBuffer : public Serializer {
                 Allocator *allocator;
                 ui8 *data;
                 std::size_t length;
+                std::size_t capacity;
 
                 explicit OutBuffer (Allocator *allocator_) :
                     allocator (allocator_),
                     data (0),
-                    length (0) {}
+                    length (0),
+                    capacity (0) {}
+                virtual ~OutBuffer () {
+                    if (data != 0) {
+                        allocator->Free (data, capacity);
+                    }
+                }
+
+                virtual std::size_t Read (
+                        void * /*data_*/,
+                        std::size_t /*length_*/) override {
+                    return 0;
+                }
 
-                void Write (
-                        const ui8 *data_,
-                        std::size_t length_) {
+                virtual std::size_t Write (
+                        const void *data_,
+                        std::size_t length_) override {
                     if (data_ != 0 && length_ > 0) {
-                        ui8 *newData = (ui8 *)allocator->Alloc (length + length_);
+                        if (length + length_ > capacity) {
+                            // Grow geometrically to keep appends amortized O(1).
+                            std::size_t newCapacity =
+                                std::max (capacity * 2, length + length_);
+                            ui8 *newData = (ui8 *)allocator->Alloc (newCapacity);
+                            if (length > 0) {
+                                memcpy (newData, data, length);
+                            }
+                            if (data != 0) {
+                                allocator->Free (data, capacity);
+                            }
+                            data = newData;
+                            capacity = newCapacity;
+                        }
+                        memcpy (data + length, data_, length_);
+                        length += length_;
+                    }
+                    return length_;
+                }
+
+                // Trim the allocation to length and hand it over to the caller.
+                ui8 *Release () {
+                    if (length < capacity) {
+                        ui8 *newData = (ui8 *)allocator->Alloc (length);
                         memcpy (newData, data, length);
-                        memcpy (newData + length, data_, length_);
-                        allocator->Free (data, length);
+                        allocator->Free (data, capacity);
                         data = newData;
-                        length += length_;
+                        capacity = length;
                     }
+                    ui8 *result = data;
+                    data = 0;
+                    capacity = 0;
+                    return result;
                 }
             };
 
+            // Below this size the cost of farming the blocks out to
+            // the GlobalVectorizer outweighs the gain.
+            const std::size_t PARALLEL_DEFLATE_THRESHOLD =
+                8 * DEFAULT_PARALLEL_DEFLATE_BLOCK_SIZE;
+
             void DeflateHelper (
                     const ui8 *data,
                     std::size_t length,
                     OutBuffer &outBuffer) {
-                std::vector<ui8> tmpOutBuffer (length);
-                z_stream zStream;
-                zStream.zalloc = 0;
-                zStream.zfree = 0;
-                zStream.opaque = 0;
-                zStream.next_in = (Bytef *)data;
-                zStream.avail_in = (uInt)length;
-                zStream.next_out = tmpOutBuffer.data ();
-                zStream.avail_out = (uInt)length;
-                deflateInit (&zStream, Z_BEST_COMPRESSION);
-                while (zStream.avail_in != 0) {
-                    int result = deflate (&zStream, Z_NO_FLUSH);
-                    if (result != Z_OK) {
-                        if (zStream.msg != 0) {
-                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                                "%s", zStream.msg);
-                        }
-                        else {
-                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                                "%d", result);
-                        }
-                    }
-                    if (zStream.avail_out == 0) {
-                        outBuffer.Write (tmpOutBuffer.data (), length);
-                        zStream.next_out = tmpOutBuffer.data ();
-                        zStream.avail_out = (uInt)length;
-                    }
+                if (length >= PARALLEL_DEFLATE_THRESHOLD) {
+                    ParallelDeflate (data, length, outBuffer,
+                        Deflater::FORMAT_ZLIB, Deflater::BEST_LEVEL);
                 }
-                int result = Z_OK;
-                while (result == Z_OK) {
-                    if (zStream.avail_out == 0) {
-                        outBuffer.Write (tmpOutBuffer.data (), length);
-                        zStream.next_out = tmpOutBuffer.data ();
-                        zStream.avail_out = (uInt)length;
-                    }
-                    result = deflate (&zStream, Z_FINISH);
+                else {
+                    Deflater deflater (outBuffer,
+                        Deflater::FORMAT_ZLIB, Deflater::BEST_LEVEL);
+                    deflater.Write (data, length);
+                    deflater.Finish ();
                 }
-                assert (result == Z_STREAM_END);
-                outBuffer.Write (tmpOutBuffer.data (), length - zStream.avail_out);
-                deflateEnd (&zStream);
             }
 
             void InflateHelper (
                     const ui8 *data,
                     std::size_t length,
                     OutBuffer &outBuffer) {
-                std::vector<ui8> tmpOutBuffer (length * 2);
-                z_stream zStream;
-                zStream.zalloc = 0;
-                zStream.zfree = 0;
-                zStream.opaque = 0;
-                zStream.next_in = (Bytef *)data;
-                zStream.avail_in = (uInt)tmpOutBuffer.size ();
-                int result = inflateInit (&zStream);
-                if (result != Z_OK) {
-                    if (zStream.msg != 0) {
-                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                            "%s", zStream.msg);
-                    }
-                    else {
-                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                            "%d", result);
-                    }
+                Inflater inflater (outBuffer);
+                if (!inflater.Write (data, length)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Truncated compressed stream.");
                 }
-                do {
-                    zStream.next_out = tmpOutBuffer.data ();
-                    zStream.avail_out = (uInt)tmpOutBuffer.size ();
-                    result = inflate (&zStream, Z_NO_FLUSH);
-                    assert (result != Z_STREAM_ERROR);
-                    outBuffer.Write (tmpOutBuffer.data (), tmpOutBuffer.size () - zStream.avail_out);
-                } while (zStream.avail_out == 0);
-                result = inflateEnd (&zStream);
-                assert (result == Z_OK);
             }
         }
 
@@ -328,13 +319,8 @@ namespace thekogans {
                 if (GetDataAvailableForReading () != 0) {
                     OutBuffer outBuffer (allocator);
                     DeflateHelper (GetReadPtr (), GetDataAvailableForReading (), outBuffer);
-                    return Buffer (
-                        endianness,
-                        outBuffer.data,
-                        outBuffer.length,
-                        0,
-                        outBuffer.length,
-                        allocator);
+                    std::size_t outLength = outBuffer.length;
+                    return Buffer (endianness, outBuffer.Release (), outLength, 0, outLength, allocator);
                 }
                 return Buffer ();
             }
@@ -349,13 +335,8 @@ namespace thekogans {
                 if (GetDataAvailableForReading () != 0) {
                     OutBuffer outBuffer (allocator);
                     InflateHelper (GetReadPtr (), GetDataAvailableForReading (), outBuffer);
-                    return Buffer (
-                        endianness,
-                        outBuffer.data,
-                        outBuffer.length,
-                        0,
-                        outBuffer.length,
-                        allocator);
+                    std::size_t outLength = outBuffer.length;
+                    return Buffer (endianness, outBuffer.Release (), outLength, 0, outLength, allocator);
                 }
                 return Buffer ();
             }
@@ -437,12 +418,8 @@ namespace thekogans {
             if (GetDataAvailableForReading () != 0) {
                 OutBuffer outBuffer (&SecureAllocator::Instance ());
                 DeflateHelper (GetReadPtr (), GetDataAvailableForReading (), outBuffer);
-                return SecureBuffer (
-                    endianness,
-                    outBuffer.data,
-                    outBuffer.length,
-                    0,
-                    outBuffer.length);
+                std::size_t outLength = outBuffer.length;
+                return SecureBuffer (endianness, outBuffer.Release (), outLength, 0, outLength);
             }
             return SecureBuffer ();
         }
@@ -451,12 +428,8 @@ namespace thekogans {
             if (GetDataAvailableForReading () != 0) {
                 OutBuffer outBuffer (&SecureAllocator::Instance ());
                 InflateHelper (GetReadPtr (), GetDataAvailableForReading (), outBuffer);
-                return SecureBuffer (
-                    endianness,
-                    outBuffer.data,
-                    outBuffer.length,
-                    0,
-                    outBuffer.length);
+                std::size_t outLength = outBuffer.length;
+                return SecureBuffer (endianness, outBuffer.Release (), outLength, 0, outLength);
             }
             return SecureBuffer ();
         }
@@ -0,0 +1,95 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cctype>
+#include <algorithm>
+#include <iterator>
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/CPUSet.h"
+
+namespace thekogans {
+    namespace util {
+
+        void CPUSet::Add (ui32 cpu) {
+            std::vector<ui32>::iterator it =
+                std::lower_bound (cpus.begin (), cpus.end (), cpu);
+            if (it == cpus.end () || *it != cpu) {
+                cpus.insert (it, cpu);
+            }
+        }
+
+        void CPUSet::Add (const CPUSet &cpuSet) {
+            std::vector<ui32> result;
+            result.reserve (cpus.size () + cpuSet.cpus.size ());
+            std::set_union (
+                cpus.begin (), cpus.end (),
+                cpuSet.cpus.begin (), cpuSet.cpus.end (),
+                std::back_inserter (result));
+            cpus.swap (result);
+        }
+
+        bool CPUSet::Contains (ui32 cpu) const {
+            return std::binary_search (cpus.begin (), cpus.end (), cpu);
+        }
+
+        CPUSet CPUSet::FromString (const std::string &list) {
+            CPUSet cpuSet;
+            const char *str = list.c_str ();
+            while (*str != '\0') {
+                if (isdigit (*str)) {
+                    char *end;
+                    ui32 first = stringToui32 (str, &end);
+                    ui32 last = first;
+                    str = end;
+                    if (*str == '-') {
+                        last = stringToui32 (str + 1, &end);
+                        str = end;
+                    }
+                    for (ui64 cpu = first; cpu <= last; ++cpu) {
+                        cpuSet.Add ((ui32)cpu);
+                    }
+                }
+                else {
+                    // Skip ',' and any white space (sysfs lists end in '\n').
+                    ++str;
+                }
+            }
+            return cpuSet;
+        }
+
+        std::string CPUSet::ToString () const {
+            std::string list;
+            for (std::size_t i = 0, count = cpus.size (); i < count;) {
+                // Collapse consecutive ids in to a range.
+                std::size_t j = i + 1;
+                while (j < count && cpus[j] == cpus[j - 1] + 1) {
+                    ++j;
+                }
+                if (!list.empty ()) {
+                    list += ",";
+                }
+                list += ui32Tostring (cpus[i]);
+                if (j - i > 1) {
+                    list += "-" + ui32Tostring (cpus[j - 1]);
+                }
+                i = j;
+            }
+            return list;
+        }
+
+    } // namespace util
+} // namespace thekogans
@@ -0,0 +1,481 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Windows)
+    #if !defined (_WINDOWS_)
+        #if !defined (WIN32_LEAN_AND_MEAN)
+            #define WIN32_LEAN_AND_MEAN
+        #endif // !defined (WIN32_LEAN_AND_MEAN)
+        #if !defined (NOMINMAX)
+            #define NOMINMAX
+        #endif // !defined (NOMINMAX)
+        #include <windows.h>
+    #endif // !defined (_WINDOWS_)
+#elif defined (TOOLCHAIN_OS_Linux)
+    #include <fstream>
+#elif defined (TOOLCHAIN_OS_OSX)
+    #include <sys/types.h>
+    #include <sys/sysctl.h>
+#endif // defined (TOOLCHAIN_OS_Windows)
+#include <cctype>
+#include <map>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/CPUTopology.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Until Build renumbers them, LogicalCPU::socket, core and
+            // node hold the raw (platform) ids. Cores are only unique
+            // within a socket.
+            typedef std::map<ui32, CPUTopology::LogicalCPU> LogicalCPUMap;
+
+            void AddCache (
+                    std::vector<CPUTopology::Cache> &caches,
+                    const CPUTopology::Cache &cache) {
+                // Shared caches are reported by every processor sharing them.
+                for (std::size_t i = 0, count = caches.size (); i < count; ++i) {
+                    if (caches[i].level == cache.level &&
+                            caches[i].type == cache.type &&
+                            caches[i].cpus == cache.cpus) {
+                        return;
+                    }
+                }
+                caches.push_back (cache);
+            }
+
+        #if defined (TOOLCHAIN_OS_Windows)
+            void AddGroupMask (
+                    const GROUP_AFFINITY &groupAffinity,
+                    CPUSet &cpuSet) {
+                // Affinity apis (SetThreadAffinityMask) only
+                // address the first processor group.
+                if (groupAffinity.Group == 0) {
+                    for (ui32 i = 0; i < sizeof (KAFFINITY) * 8; ++i) {
+                        if ((groupAffinity.Mask & ((KAFFINITY)1 << i)) != 0) {
+                            cpuSet.Add (i);
+                        }
+                    }
+                }
+            }
+
+            void GetTopology (
+                    LogicalCPUMap &cpus,
+                    std::vector<CPUTopology::Cache> &caches) {
+                DWORD length = 0;
+                GetLogicalProcessorInformationEx (RelationAll, 0, &length);
+                std::vector<ui8> buffer (length);
+                if (!GetLogicalProcessorInformationEx (
+                        RelationAll,
+                        (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data (),
+                        &length)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                ui32 coreCount = 0;
+                ui32 packageCount = 0;
+                for (const ui8 *ptr = buffer.data (), *end = ptr + length; ptr < end;) {
+                    const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *info =
+                        (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)ptr;
+                    CPUSet cpuSet;
+                    switch (info->Relationship) {
+                        case RelationProcessorCore:
+                        case RelationProcessorPackage: {
+                            for (WORD i = 0; i < info->Processor.GroupCount; ++i) {
+                                AddGroupMask (info->Processor.GroupMask[i], cpuSet);
+                            }
+                            ui32 id = info->Relationship == RelationProcessorCore ?
+                                coreCount++ : packageCount++;
+                            for (std::size_t i = 0, count = cpuSet.GetCount (); i < count; ++i) {
+                                CPUTopology::LogicalCPU &cpu = cpus[cpuSet.cpus[i]];
+                                cpu.id = cpuSet.cpus[i];
+                                if (info->Relationship == RelationProcessorCore) {
+                                    cpu.core = id;
+                                }
+                                else {
+                                    cpu.socket = id;
+                                }
+                            }
+                            break;
+                        }
+                        case RelationNumaNode: {
+                            AddGroupMask (info->NumaNode.GroupMask, cpuSet);
+                            for (std::size_t i = 0, count = cpuSet.GetCount (); i < count; ++i) {
+                                CPUTopology::LogicalCPU &cpu = cpus[cpuSet.cpus[i]];
+                                cpu.id = cpuSet.cpus[i];
+                                cpu.node = info->NumaNode.NodeNumber;
+                            }
+                            break;
+                        }
+                        case RelationCache: {
+                            if (info->Cache.Type != CacheTrace) {
+                                CPUTopology::Cache cache;
+                                cache.level = info->Cache.Level;
+                                cache.type =
+                                    info->Cache.Type == CacheData ? CPUTopology::Cache::Data :
+                                    info->Cache.Type == CacheInstruction ?
+                                        CPUTopology::Cache::Instruction : CPUTopology::Cache::Unified;
+                                cache.size = info->Cache.CacheSize;
+                                cache.lineSize = info->Cache.LineSize;
+                                AddGroupMask (info->Cache.GroupMask, cache.cpus);
+                                if (!cache.cpus.IsEmpty ()) {
+                                    AddCache (caches, cache);
+                                }
+                            }
+                            break;
+                        }
+                        default:
+                            break;
+                    }
+                    ptr += info->Size;
+                }
+            }
+        #elif defined (TOOLCHAIN_OS_Linux)
+            std::string ReadSysFile (const std::string &path) {
+                std::string value;
+                std::ifstream file (path.c_str ());
+                if (file.is_open ()) {
+                    std::getline (file, value);
+                }
+                return TrimSpaces (value.c_str ());
+            }
+
+            bool ReadSysui32 (
+                    const std::string &path,
+                    ui32 &value) {
+                std::string str = ReadSysFile (path);
+                if (!str.empty () && isdigit (str[0])) {
+                    value = stringToui32 (str.c_str ());
+                    return true;
+                }
+                return false;
+            }
+
+            const char * const SYS_CPU = "/sys/devices/system/cpu";
+            const char * const SYS_NODE = "/sys/devices/system/node";
+
+            void GetTopology (
+                    LogicalCPUMap &cpus,
+                    std::vector<CPUTopology::Cache> &caches) {
+                CPUSet online = CPUSet::FromString (
+                    ReadSysFile (FormatString ("%s/online", SYS_CPU)));
+                for (std::size_t i = 0, count = online.GetCount (); i < count; ++i) {
+                    CPUTopology::LogicalCPU &cpu = cpus[online.cpus[i]];
+                    cpu.id = online.cpus[i];
+                    // Without topology information every
+                    // processor is it's own core.
+                    if (!ReadSysui32 (
+                            FormatString ("%s/cpu%u/topology/physical_package_id", SYS_CPU, cpu.id),
+                            cpu.socket)) {
+                        cpu.socket = 0;
+                    }
+                    if (!ReadSysui32 (
+                            FormatString ("%s/cpu%u/topology/core_id", SYS_CPU, cpu.id),
+                            cpu.core)) {
+                        cpu.core = cpu.id;
+                    }
+                    for (ui32 index = 0;; ++index) {
+                        std::string cachePath =
+                            FormatString ("%s/cpu%u/cache/index%u", SYS_CPU, cpu.id, index);
+                        CPUTopology::Cache cache;
+                        if (!ReadSysui32 (FormatString ("%s/level", cachePath.c_str ()), cache.level)) {
+                            break;
+                        }
+                        std::string type = ReadSysFile (FormatString ("%s/type", cachePath.c_str ()));
+                        cache.type =
+                            type == "Data" ? CPUTopology::Cache::Data :
+                            type == "Instruction" ? CPUTopology::Cache::Instruction :
+                            CPUTopology::Cache::Unified;
+                        // Sizes are reported as 32K, 8192K...
+                        std::string size = ReadSysFile (FormatString ("%s/size", cachePath.c_str ()));
+                        if (!size.empty () && isdigit (size[0])) {
+                            char *end;
+                            cache.size = stringToui64 (size.c_str (), &end);
+                            cache.size <<= *end == 'K' ? 10 : *end == 'M' ? 20 : *end == 'G' ? 30 : 0;
+                        }
+                        ReadSysui32 (
+                            FormatString ("%s/coherency_line_size", cachePath.c_str ()),
+                            cache.lineSize);
+                        cache.cpus = CPUSet::FromString (
+                            ReadSysFile (FormatString ("%s/shared_cpu_list", cachePath.c_str ())));
+                        if (cache.cpus.IsEmpty ()) {
+                            cache.cpus.Add (cpu.id);
+                        }
+                        AddCache (caches, cache);
+                    }
+                }
+                CPUSet nodes = CPUSet::FromString (
+                    ReadSysFile (FormatString ("%s/online", SYS_NODE)));
+                for (std::size_t i = 0, count = nodes.GetCount (); i < count; ++i) {
+                    CPUSet nodeCPUs = CPUSet::FromString (
+                        ReadSysFile (FormatString ("%s/node%u/cpulist", SYS_NODE, nodes.cpus[i])));
+                    for (std::size_t j = 0, nodeCPUCount = nodeCPUs.GetCount (); j < nodeCPUCount; ++j) {
+                        LogicalCPUMap::iterator it = cpus.find (nodeCPUs.cpus[j]);
+                        if (it != cpus.end ()) {
+                            it->second.node = nodes.cpus[i];
+                        }
+                    }
+                }
+            }
+        #elif defined (TOOLCHAIN_OS_OSX)
+            template<typename T>
+            bool GetSysctl (
+                    const char *name,
+                    T &value) {
+                size_t length = sizeof (value);
+                return sysctlbyname (name, &value, &length, 0, 0) == 0;
+            }
+
+            void GetTopology (
+                    LogicalCPUMap &cpus,
+                    std::vector<CPUTopology::Cache> &caches) {
+                // sysctl only gives us counts. Assume SMT siblings,
+                // and cores of the same package are numbered
+                // consecutively (which is how xnu numbers them).
+                ui32 logicalCount = (ui32)SystemInfo::Instance ().GetCPUCount ();
+                int32_t physicalCount = 0;
+                if (!GetSysctl ("hw.physicalcpu", physicalCount) || physicalCount <= 0) {
+                    physicalCount = logicalCount;
+                }
+                int32_t packageCount = 0;
+                if (!GetSysctl ("hw.packages", packageCount) || packageCount <= 0) {
+                    packageCount = 1;
+                }
+                ui32 threadsPerCore = std::max (logicalCount / (ui32)physicalCount, (ui32)1);
+                ui32 coresPerPackage = std::max ((ui32)physicalCount / (ui32)packageCount, (ui32)1);
+                for (ui32 i = 0; i < logicalCount; ++i) {
+                    CPUTopology::LogicalCPU &cpu = cpus[i];
+                    cpu.id = i;
+                    cpu.core = i / threadsPerCore;
+                    cpu.socket = cpu.core / coresPerPackage;
+                }
+                // hw.cacheconfig[level] is the number of logical
+                // processors sharing each cache of that level.
+                ui64 cacheConfig[10] = {0};
+                ui64 cacheSize[10] = {0};
+                ui64 lineSize = 0;
+                if (GetSysctl ("hw.cacheconfig", cacheConfig) &&
+                        GetSysctl ("hw.cachesize", cacheSize)) {
+                    GetSysctl ("hw.cachelinesize", lineSize);
+                    for (ui32 level = 1; level < 10 && cacheConfig[level] > 0 && cacheSize[level] > 0; ++level) {
+                        for (ui32 first = 0; first < logicalCount; first += (ui32)cacheConfig[level]) {
+                            CPUTopology::Cache cache;
+                            cache.level = level;
+                            cache.type = level == 1 ? CPUTopology::Cache::Data : CPUTopology::Cache::Unified;
+                            cache.size = cacheSize[level];
+                            cache.lineSize = (ui32)lineSize;
+                            for (ui32 i = first; i < first + cacheConfig[level] && i < logicalCount; ++i) {
+                                cache.cpus.Add (i);
+                            }
+                            caches.push_back (cache);
+                        }
+                    }
+                }
+            }
+        #endif // defined (TOOLCHAIN_OS_Windows)
+
+            struct CompareCompact {
+                const std::vector<CPUTopology::LogicalCPU> &cpus;
+
+                explicit CompareCompact (const std::vector<CPUTopology::LogicalCPU> &cpus_) :
+                    cpus (cpus_) {}
+
+                bool operator () (
+                        std::size_t index1,
+                        std::size_t index2) const {
+                    const CPUTopology::LogicalCPU &cpu1 = cpus[index1];
+                    const CPUTopology::LogicalCPU &cpu2 = cpus[index2];
+                    return
+                        cpu1.node != cpu2.node ? cpu1.node < cpu2.node :
+                        cpu1.socket != cpu2.socket ? cpu1.socket < cpu2.socket :
+                        cpu1.core != cpu2.core ? cpu1.core < cpu2.core :
+                        cpu1.thread < cpu2.thread;
+                }
+            };
+        }
+
+        CPUTopology::CPUTopology () {
+            LogicalCPUMap cpuMap;
+            THEKOGANS_UTIL_TRY {
+                GetTopology (cpuMap, caches);
+            }
+            THEKOGANS_UTIL_CATCH_ANY {
+                cpuMap.clear ();
+                caches.clear ();
+            }
+            if (cpuMap.empty ()) {
+                // No topology information. Fall back to a single socket
+                // with single threaded cores.
+                for (ui32 i = 0, count = (ui32)SystemInfo::Instance ().GetCPUCount (); i < count; ++i) {
+                    LogicalCPU &cpu = cpuMap[i];
+                    cpu.id = i;
+                    cpu.core = i;
+                }
+            }
+            for (LogicalCPUMap::const_iterator it = cpuMap.begin (), end = cpuMap.end (); it != end; ++it) {
+                cpus.push_back (it->second);
+            }
+            Build ();
+        }
+
+        CPUSet CPUTopology::GetCacheSiblings (
+                ui32 cpu,
+                ui32 level) const {
+            for (std::size_t i = 0, count = caches.size (); i < count; ++i) {
+                if (caches[i].level == level &&
+                        caches[i].type != Cache::Instruction &&
+                        caches[i].cpus.Contains (cpu)) {
+                    return caches[i].cpus;
+                }
+            }
+            return CPUSet ();
+        }
+
+        CPUSet CPUTopology::GetWorkerAffinity (
+                ui32 affinity,
+                std::size_t worker,
+                std::size_t workerCount) const {
+            switch (affinity) {
+                case THEKOGANS_UTIL_MAX_THREAD_AFFINITY:
+                    return CPUSet ();
+                case THEKOGANS_UTIL_COMPACT_THREAD_AFFINITY:
+                    return CPUSet (compactOrder[worker % compactOrder.size ()]);
+                case THEKOGANS_UTIL_SCATTER_THREAD_AFFINITY:
+                    return CPUSet (scatterOrder[worker % scatterOrder.size ()]);
+                case THEKOGANS_UTIL_PHYSICAL_CORE_THREAD_AFFINITY:
+                    return cores[coreOrder[worker % coreOrder.size ()]];
+                case THEKOGANS_UTIL_NUMA_NODE_THREAD_AFFINITY:
+                    // Keep neighboring workers on the same node.
+                    workerCount = std::max (workerCount, (std::size_t)1);
+                    return nodes[(worker % workerCount) * nodes.size () / workerCount];
+            }
+            return CPUSet (affinity);
+        }
+
+        void CPUTopology::Dump (std::ostream &stream) const {
+            stream << "Sockets: " << sockets.size () << std::endl;
+            for (std::size_t i = 0, count = sockets.size (); i < count; ++i) {
+                stream << "  " << i << ": " << sockets[i].ToString () << std::endl;
+            }
+            stream << "Cores: " << cores.size () << std::endl;
+            for (std::size_t i = 0, count = cores.size (); i < count; ++i) {
+                stream << "  " << i << ": " << cores[i].ToString () << std::endl;
+            }
+            stream << "NUMA nodes: " << nodes.size () << std::endl;
+            for (std::size_t i = 0, count = nodes.size (); i < count; ++i) {
+                stream << "  " << i << ": " << nodes[i].ToString () << std::endl;
+            }
+            stream << "Caches: " << caches.size () << std::endl;
+            for (std::size_t i = 0, count = caches.size (); i < count; ++i) {
+                stream << "  L" << caches[i].level << " " <<
+                    (caches[i].type == Cache::Data ? "data" :
+                        caches[i].type == Cache::Instruction ? "instruction" : "unified") <<
+                    " " << caches[i].size << " bytes (" << caches[i].lineSize << " byte lines): " <<
+                    caches[i].cpus.ToString () << std::endl;
+            }
+        }
+
+        void CPUTopology::Build () {
+            // Renumber raw socket, core and node ids in to dense indices.
+            std::map<ui32, ui32> socketIndices;
+            std::map<std::pair<ui32, ui32>, ui32> coreIndices;
+            std::map<ui32, ui32> nodeIndices;
+            for (std::size_t i = 0, count = cpus.size (); i < count; ++i) {
+                socketIndices[cpus[i].socket] = 0;
+                coreIndices[std::make_pair (cpus[i].socket, cpus[i].core)] = 0;
+                nodeIndices[cpus[i].node] = 0;
+            }
+            ui32 index = 0;
+            for (std::map<ui32, ui32>::iterator
+                    it = socketIndices.begin (),
+                    end = socketIndices.end (); it != end; ++it) {
+                it->second = index++;
+            }
+            index = 0;
+            for (std::map<std::pair<ui32, ui32>, ui32>::iterator
+                    it = coreIndices.begin (),
+                    end = coreIndices.end (); it != end; ++it) {
+                it->second = index++;
+            }
+            index = 0;
+            for (std::map<ui32, ui32>::iterator
+                    it = nodeIndices.begin (),
+                    end = nodeIndices.end (); it != end; ++it) {
+                it->second = index++;
+            }
+            sockets.resize (socketIndices.size ());
+            cores.resize (coreIndices.size ());
+            nodes.resize (nodeIndices.size ());
+            for (std::size_t i = 0, count = cpus.size (); i < count; ++i) {
+                LogicalCPU &cpu = cpus[i];
+                cpu.core = coreIndices[std::make_pair (cpu.socket, cpu.core)];
+                cpu.socket = socketIndices[cpu.socket];
+                cpu.node = nodeIndices[cpu.node];
+                // cpus is sorted by id, so siblings are numbered in id order.
+                cpu.thread = (ui32)cores[cpu.core].GetCount ();
+                sockets[cpu.socket].Add (cpu.id);
+                cores[cpu.core].Add (cpu.id);
+                nodes[cpu.node].Add (cpu.id);
+            }
+            // Compact: node, socket, core, SMT sibling.
+            std::vector<std::size_t> indices (cpus.size ());
+            for (std::size_t i = 0, count = cpus.size (); i < count; ++i) {
+                indices[i] = i;
+            }
+            std::sort (indices.begin (), indices.end (), CompareCompact (cpus));
+            for (std::size_t i = 0, count = indices.size (); i < count; ++i) {
+                compactOrder.push_back (cpus[indices[i]].id);
+            }
+            // Scatter cores round-robin across sockets.
+            std::vector<std::vector<ui32>> socketCores (sockets.size ());
+            std::size_t maxThreads = 0;
+            for (std::size_t i = 0, count = indices.size (); i < count; ++i) {
+                const LogicalCPU &cpu = cpus[indices[i]];
+                if (cpu.thread == 0) {
+                    socketCores[cpu.socket].push_back (cpu.core);
+                }
+                maxThreads = std::max (maxThreads, cores[cpu.core].GetCount ());
+            }
+            for (std::size_t i = 0, done = 0; done < cores.size (); ++i) {
+                for (std::size_t j = 0, count = socketCores.size (); j < count; ++j) {
+                    if (i < socketCores[j].size ()) {
+                        coreOrder.push_back (socketCores[j][i]);
+                        ++done;
+                    }
+                }
+            }
+            // Scatter processors: the first SMT sibling of every
+            // core (in core scatter order), then the second...
+            for (std::size_t i = 0; i < maxThreads; ++i) {
+                for (std::size_t j = 0, count = coreOrder.size (); j < count; ++j) {
+                    const CPUSet &core = cores[coreOrder[j]];
+                    if (i < core.GetCount ()) {
+                        scatterOrder.push_back (core.cpus[i]);
+                    }
+                }
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
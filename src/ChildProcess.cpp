@@ -36,6 +36,7 @@
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/File.h"
+#include "thekogans/util/HRTimer.h"
 #include "thekogans/util/JobQueue.h"
 #include "thekogans/util/ChildProcess.h"
 
@@ -694,6 +695,7 @@ namespace thekogans {
                     SetState (Pending);
                     disposition = Unknown;
                     completed.Reset ();
+                    enqueueTime = HRTimer::Click ();
                 }
                 virtual void Execute (const std::atomic<bool> & /*done*/) throw () {
                     exit (exitCode);
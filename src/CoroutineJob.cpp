@@ -0,0 +1,493 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/CoroutineJob.h"
+
+#if defined (THEKOGANS_UTIL_HAVE_COROUTINES)
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include <exception>
+#include <vector>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Singleton.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/RunLoopScheduler.h"
+#include "thekogans/util/LoggerMgr.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Convert whatever Run threw in to something Fail understands.
+            Exception ToException (std::exception_ptr exception_) {
+                THEKOGANS_UTIL_TRY {
+                    std::rethrow_exception (exception_);
+                }
+                THEKOGANS_UTIL_CATCH (Exception) {
+                    return exception;
+                }
+                THEKOGANS_UTIL_CATCH (std::exception) {
+                    return THEKOGANS_UTIL_STRING_EXCEPTION ("%s", exception.what ());
+                }
+                THEKOGANS_UTIL_CATCH_ANY {
+                    return THEKOGANS_UTIL_STRING_EXCEPTION ("%s", "Caught unknown exception!");
+                }
+            }
+        }
+
+        // ResumeJob is the only thing that resumes a suspended coroutine
+        // on it's run loop. Every armed wait creates one (or more, if it
+        // races with Cancel), and the one that manages to disarm the
+        // wait's generation wins. If a ResumeJob never gets to execute
+        // (it was cancelled, it's run loop was stopped, or the scheduler
+        // dropped it), it cancels the coroutine so that nobody waits for
+        // it forever.
+        struct CoroutineJob::ResumeJob : public RunLoop::Job {
+            CoroutineJob::SharedPtr job;
+            const ui64 generation;
+            bool executed;
+
+            ResumeJob (
+                CoroutineJob &job_,
+                ui64 generation_) :
+                job (&job_),
+                generation (generation_),
+                executed (false) {}
+            virtual ~ResumeJob () {
+                if (!executed) {
+                    job->Abandon (generation);
+                }
+            }
+
+        protected:
+            // RunLoop::Job
+            virtual void SetState (State state_) override {
+                RunLoop::Job::SetState (state_);
+                if (state_ == Completed && !executed) {
+                    executed = true;
+                    job->Abandon (generation);
+                }
+            }
+
+            virtual void Execute (const std::atomic<bool> &done) throw () override {
+                executed = true;
+                job->Resume (generation, done);
+            }
+        };
+
+    #if !defined (TOOLCHAIN_OS_Windows)
+        // A single poll thread waits for handle readiness on behalf of
+        // all suspended CoroutineJobs. It's woken up (self-pipe) every
+        // time a handle is added, or a waiting job is resumed some other
+        // way (cancelled), so that it can drop the stale entries.
+        struct CoroutineJob::HandleWaiter :
+                public Thread,
+                public Singleton<CoroutineJob::HandleWaiter, SpinLock> {
+        private:
+            struct Entry {
+                CoroutineJob::SharedPtr job;
+                ui64 generation;
+                THEKOGANS_UTIL_HANDLE handle;
+                short events;
+
+                Entry (
+                    CoroutineJob &job_,
+                    ui64 generation_,
+                    THEKOGANS_UTIL_HANDLE handle_,
+                    short events_) :
+                    job (&job_),
+                    generation (generation_),
+                    handle (handle_),
+                    events (events_) {}
+            };
+            std::vector<Entry> entries;
+            SpinLock spinLock;
+            THEKOGANS_UTIL_HANDLE wakePipe[2];
+
+        public:
+            HandleWaiter () :
+                    Thread ("CoroutineJob::HandleWaiter") {
+                if (pipe (wakePipe) < 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                for (std::size_t i = 0; i < 2; ++i) {
+                    int flags = fcntl (wakePipe[i], F_GETFL, 0);
+                    if (flags < 0 || fcntl (wakePipe[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+                        THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                        close (wakePipe[0]);
+                        close (wakePipe[1]);
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                    }
+                }
+                Create (THEKOGANS_UTIL_NORMAL_THREAD_PRIORITY, THEKOGANS_UTIL_MAX_THREAD_AFFINITY);
+            }
+
+            void Add (
+                    CoroutineJob &job,
+                    ui64 generation,
+                    THEKOGANS_UTIL_HANDLE handle,
+                    short events) {
+                {
+                    LockGuard<SpinLock> guard (spinLock);
+                    entries.push_back (Entry (job, generation, handle, events));
+                }
+                Wake ();
+            }
+
+            void Wake () {
+                // If the pipe is full the poll thread is already awake.
+                char byte = 0;
+                while (write (wakePipe[1], &byte, 1) < 0 &&
+                    THEKOGANS_UTIL_OS_ERROR_CODE == EINTR);
+            }
+
+        private:
+            // Thread
+            virtual void Run () throw () override {
+                std::vector<pollfd> fds;
+                std::vector<Entry> ready;
+                while (1) {
+                    fds.clear ();
+                    pollfd wake = {wakePipe[0], POLLIN, 0};
+                    fds.push_back (wake);
+                    {
+                        LockGuard<SpinLock> guard (spinLock);
+                        // Drop the entries whose jobs were resumed some other way.
+                        for (std::size_t i = entries.size (); i-- > 0;) {
+                            if (entries[i].job->armed != entries[i].generation) {
+                                entries.erase (entries.begin () + i);
+                            }
+                        }
+                        for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                            pollfd fd = {entries[i].handle, entries[i].events, 0};
+                            fds.push_back (fd);
+                        }
+                    }
+                    if (poll (fds.data (), fds.size (), -1) < 0) {
+                        THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                        // EINTR means a signal interrupted our wait.
+                        if (errorCode != EINTR) {
+                            THEKOGANS_UTIL_LOG_ERROR ("%s\n",
+                                THEKOGANS_UTIL_ERROR_CODE_EXCEPTION (errorCode).Report ().c_str ());
+                            util::Sleep (TimeSpec::FromMilliseconds (100));
+                        }
+                        continue;
+                    }
+                    if (fds[0].revents != 0) {
+                        char buffer[256];
+                        while (read (wakePipe[0], buffer, sizeof (buffer)) > 0);
+                    }
+                    {
+                        // Only this thread removes entries, and Add only appends.
+                        // fds[i] (i > 0) therefore still describes entries[i - 1].
+                        LockGuard<SpinLock> guard (spinLock);
+                        for (std::size_t i = fds.size (); i-- > 1;) {
+                            if (fds[i].revents != 0) {
+                                ready.push_back (entries[i - 1]);
+                                entries.erase (entries.begin () + (i - 1));
+                            }
+                        }
+                    }
+                    for (std::size_t i = 0, count = ready.size (); i < count; ++i) {
+                        THEKOGANS_UTIL_TRY {
+                            ready[i].job->EnqResumeJob (ready[i].generation);
+                        }
+                        THEKOGANS_UTIL_CATCH_ANY {
+                            ready[i].job->Abandon (ready[i].generation);
+                        }
+                    }
+                    ready.clear ();
+                }
+            }
+        };
+    #endif // !defined (TOOLCHAIN_OS_Windows)
+
+        bool CoroutineJob::Awaiter::await_ready () const {
+            return job.ShouldStop () ||
+                (job.wait.type == WaitInfo::Job && job.wait.job->IsCompleted ());
+        }
+
+        bool CoroutineJob::Awaiter::await_resume () const {
+            job.wait = WaitInfo ();
+            return !job.ShouldStop ();
+        }
+
+        void CoroutineJob::Cancel () {
+            RunLoop::Job::Cancel ();
+            // Pairs with the fence in Arm. Either we see the armed
+            // generation, or Arm sees the cancellation.
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            ui64 generation_ = armed;
+            if (generation_ != 0) {
+                THEKOGANS_UTIL_TRY {
+                    EnqResumeJob (generation_);
+                }
+                THEKOGANS_UTIL_CATCH_AND_LOG
+            }
+        }
+
+        CoroutineJob::Awaiter CoroutineJob::Yield () {
+            wait.type = WaitInfo::Yield;
+            return Awaiter (*this);
+        }
+
+        CoroutineJob::Awaiter CoroutineJob::SleepFor (const TimeSpec &timeSpec) {
+            if (timeSpec == TimeSpec::Infinite) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            wait.type = WaitInfo::Timer;
+            wait.timeSpec = timeSpec;
+            return Awaiter (*this);
+        }
+
+        CoroutineJob::Awaiter CoroutineJob::Await (RunLoop::Job::SharedPtr job) {
+            if (job.Get () == 0 || job.Get () == this) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            wait.type = WaitInfo::Job;
+            wait.job = job;
+            return Awaiter (*this);
+        }
+
+        CoroutineJob::Awaiter CoroutineJob::WaitReadable (THEKOGANS_UTIL_HANDLE handle) {
+        #if defined (TOOLCHAIN_OS_Windows)
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                "WaitReadable is not supported on Windows.");
+        #else // defined (TOOLCHAIN_OS_Windows)
+            if (handle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            wait.type = WaitInfo::Readable;
+            wait.handle = handle;
+            return Awaiter (*this);
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+        CoroutineJob::Awaiter CoroutineJob::WaitWritable (THEKOGANS_UTIL_HANDLE handle) {
+        #if defined (TOOLCHAIN_OS_Windows)
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                "WaitWritable is not supported on Windows.");
+        #else // defined (TOOLCHAIN_OS_Windows)
+            if (handle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            wait.type = WaitInfo::Writable;
+            wait.handle = handle;
+            return Awaiter (*this);
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+        void CoroutineJob::Execute (const std::atomic<bool> &done_) throw () {
+            if (GetRunLoopId () != runLoop.GetId ()) {
+                Fail (THEKOGANS_UTIL_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL));
+            }
+            else if (!RunLoop::Job::ShouldStop (done_)) {
+                THEKOGANS_UTIL_TRY {
+                    task = Run ();
+                    Step (done_);
+                }
+                THEKOGANS_UTIL_CATCH_ANY {
+                    Fail (ToException (std::current_exception ()));
+                }
+            }
+        }
+
+        void CoroutineJob::Succeed (const std::atomic<bool> &done_) {
+            if (!task.IsSuspended ()) {
+                RunLoop::Job::Succeed (done_);
+            }
+        }
+
+        void CoroutineJob::SetState (State state_) {
+            if (state_ == Completed) {
+                // The run loop is done with us. If the coroutine is
+                // suspended, stay Running and arm it's wait.
+                if (task.IsSuspended ()) {
+                    Arm ();
+                }
+                else {
+                    Complete ();
+                }
+            }
+            else {
+                RunLoop::Job::SetState (state_);
+            }
+        }
+
+        void CoroutineJob::Step (const std::atomic<bool> &done_) {
+            done = &done_;
+            task.handle.resume ();
+            done = 0;
+            if (task.handle.done () && task.handle.promise ().exception) {
+                Fail (ToException (task.handle.promise ().exception));
+            }
+        }
+
+        void CoroutineJob::Arm () {
+            Arm (++generation);
+        }
+
+        void CoroutineJob::Arm (ui64 generation_) {
+            armed = generation_;
+            // Pairs with the fence in Cancel.
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            THEKOGANS_UTIL_TRY {
+                switch (wait.type) {
+                    case WaitInfo::Yield:
+                        EnqResumeJob (generation_);
+                        break;
+                    case WaitInfo::Timer:
+                        GlobalRunLoopScheduler::Instance ().ScheduleRunLoopJob (
+                            RunLoop::Job::SharedPtr (new ResumeJob (*this, generation_)),
+                            wait.timeSpec,
+                            runLoop);
+                        break;
+                    case WaitInfo::Job: {
+                        CoroutineJob *job = dynamic_cast<CoroutineJob *> (wait.job.Get ());
+                        if (job != 0) {
+                            if (!job->AddContinuation (*this, generation_)) {
+                                EnqResumeJob (generation_);
+                            }
+                        }
+                        else if (wait.job->IsCompleted ()) {
+                            EnqResumeJob (generation_);
+                        }
+                        else {
+                            // Plain jobs don't know about us. Check on them periodically.
+                            GlobalRunLoopScheduler::Instance ().ScheduleRunLoopJob (
+                                RunLoop::Job::SharedPtr (new ResumeJob (*this, generation_)),
+                                pollInterval,
+                                runLoop);
+                        }
+                        break;
+                    }
+                    case WaitInfo::Readable:
+                    case WaitInfo::Writable:
+                    #if !defined (TOOLCHAIN_OS_Windows)
+                        HandleWaiter::Instance ().Add (
+                            *this,
+                            generation_,
+                            wait.handle,
+                            wait.type == WaitInfo::Readable ? POLLIN : POLLOUT);
+                    #endif // !defined (TOOLCHAIN_OS_Windows)
+                        break;
+                }
+                if (IsCancelled ()) {
+                    EnqResumeJob (generation_);
+                }
+            }
+            THEKOGANS_UTIL_CATCH_ANY {
+                if (Disarm (generation_)) {
+                    Fail (ToException (std::current_exception ()));
+                    Complete ();
+                }
+            }
+        }
+
+        bool CoroutineJob::Disarm (ui64 generation_) {
+            return generation_ != 0 && armed.compare_exchange_strong (generation_, 0);
+        }
+
+        void CoroutineJob::Resume (
+                ui64 generation_,
+                const std::atomic<bool> &done_) {
+            if (Disarm (generation_)) {
+            #if !defined (TOOLCHAIN_OS_Windows)
+                if ((wait.type == WaitInfo::Readable || wait.type == WaitInfo::Writable) &&
+                        RunLoop::Job::ShouldStop (done_)) {
+                    // We were not resumed by the poll thread. Let it drop our entry.
+                    HandleWaiter::Instance ().Wake ();
+                }
+            #endif // !defined (TOOLCHAIN_OS_Windows)
+                if (wait.type == WaitInfo::Job &&
+                        !wait.job->IsCompleted () &&
+                        !RunLoop::Job::ShouldStop (done_)) {
+                    // Poll interval expired. Keep waiting.
+                    Arm ();
+                }
+                else {
+                    Step (done_);
+                    if (task.IsSuspended ()) {
+                        Arm ();
+                    }
+                    else {
+                        RunLoop::Job::Succeed (done_);
+                        Complete ();
+                    }
+                }
+            }
+        }
+
+        void CoroutineJob::Abandon (ui64 generation_) {
+            if (Disarm (generation_)) {
+                RunLoop::Job::Cancel ();
+                Complete ();
+            }
+        }
+
+        void CoroutineJob::EnqResumeJob (ui64 generation_) {
+            runLoop.EnqJob (RunLoop::Job::SharedPtr (new ResumeJob (*this, generation_)));
+        }
+
+        bool CoroutineJob::AddContinuation (
+                CoroutineJob &job,
+                ui64 generation_) {
+            LockGuard<SpinLock> guard (spinLock);
+            if (IsCompleted ()) {
+                return false;
+            }
+            continuations.push_back (Continuation (SharedPtr (&job), generation_));
+            return true;
+        }
+
+        void CoroutineJob::Complete () {
+            // Destroying the frame releases whatever the coroutine was holding on to.
+            task = Task ();
+            wait = WaitInfo ();
+            std::vector<Continuation> continuations_;
+            {
+                // Completed must be set under the lock so that
+                // AddContinuation can't miss it.
+                LockGuard<SpinLock> guard (spinLock);
+                RunLoop::Job::SetState (Completed);
+                continuations_.swap (continuations);
+            }
+            for (std::size_t i = 0, count = continuations_.size (); i < count; ++i) {
+                THEKOGANS_UTIL_TRY {
+                    continuations_[i].job->EnqResumeJob (continuations_[i].generation);
+                }
+                THEKOGANS_UTIL_CATCH_ANY {
+                    continuations_[i].job->Abandon (continuations_[i].generation);
+                }
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_UTIL_HAVE_COROUTINES)
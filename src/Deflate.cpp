@@ -0,0 +1,498 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (THEKOGANS_UTIL_HAVE_ZLIB)
+
+#include <cstring>
+#include <climits>
+#include <vector>
+#include <string>
+#include <exception>
+#include <algorithm>
+#include <zlib.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Deflate.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // deflate's window (max distance a match can reach back).
+            const std::size_t WINDOW_SIZE = 32 * 1024;
+            // Number of ParallelDeflate blocks compressed per Vectorizer::Execute.
+            const std::size_t BLOCKS_PER_BATCH = 256;
+            // Max bytes zlib can be handed at once.
+            const std::size_t MAX_ZLIB_CHUNK = UINT_MAX;
+
+            void ThrowZlibError (
+                    const z_stream &zStream,
+                    int result) {
+                if (zStream.msg != 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s (%d)", zStream.msg, result);
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "zlib error: %d", result);
+                }
+            }
+
+            void WriteAll (
+                    Serializer &out,
+                    const void *data,
+                    std::size_t length) {
+                if (length > 0 && out.Write (data, length) != length) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " compressed bytes.",
+                        length);
+                }
+            }
+
+            int GetWindowBits (Deflater::Format format) {
+                return
+                    format == Deflater::FORMAT_ZLIB ? MAX_WBITS :
+                    format == Deflater::FORMAT_GZIP ? MAX_WBITS + 16 : -MAX_WBITS;
+            }
+        }
+
+        struct Deflater::Stream {
+            z_stream zStream;
+            std::vector<ui8> buffer;
+            ui64 totalIn;
+            ui64 totalOut;
+            bool finished;
+
+            Stream (
+                    Format format,
+                    i32 level,
+                    std::size_t chunkSize) :
+                    buffer (std::max<std::size_t> (chunkSize, 1024)),
+                    totalIn (0),
+                    totalOut (0),
+                    finished (false) {
+                memset (&zStream, 0, sizeof (zStream));
+                int result = deflateInit2 (&zStream, level, Z_DEFLATED,
+                    GetWindowBits (format), 8, Z_DEFAULT_STRATEGY);
+                if (result != Z_OK) {
+                    ThrowZlibError (zStream, result);
+                }
+            }
+            ~Stream () {
+                deflateEnd (&zStream);
+            }
+        };
+
+        Deflater::Deflater (
+                Serializer &out_,
+                Format format,
+                i32 level,
+                std::size_t chunkSize) :
+                out (out_),
+                stream (new Stream (format, level, chunkSize)) {}
+
+        Deflater::~Deflater () {}
+
+        void Deflater::Write (
+                const void *data,
+                std::size_t length) {
+            if (stream->finished) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "Deflater stream is finished.");
+            }
+            const ui8 *ptr = (const ui8 *)data;
+            while (length > 0) {
+                std::size_t count = std::min (length, MAX_ZLIB_CHUNK);
+                stream->zStream.next_in = (Bytef *)ptr;
+                stream->zStream.avail_in = (uInt)count;
+                Pump (Z_NO_FLUSH);
+                stream->totalIn += count;
+                ptr += count;
+                length -= count;
+            }
+        }
+
+        ui64 Deflater::Write (Serializer &in) {
+            std::vector<ui8> chunk (stream->buffer.size ());
+            ui64 total = 0;
+            for (std::size_t count = in.Read (chunk.data (), chunk.size ());
+                    count > 0; count = in.Read (chunk.data (), chunk.size ())) {
+                Write (chunk.data (), count);
+                total += count;
+            }
+            return total;
+        }
+
+        void Deflater::Flush () {
+            if (!stream->finished) {
+                stream->zStream.next_in = 0;
+                stream->zStream.avail_in = 0;
+                Pump (Z_SYNC_FLUSH);
+            }
+        }
+
+        void Deflater::Finish () {
+            if (!stream->finished) {
+                stream->zStream.next_in = 0;
+                stream->zStream.avail_in = 0;
+                Pump (Z_FINISH);
+                stream->finished = true;
+            }
+        }
+
+        ui64 Deflater::GetTotalIn () const {
+            return stream->totalIn;
+        }
+
+        ui64 Deflater::GetTotalOut () const {
+            return stream->totalOut;
+        }
+
+        void Deflater::Pump (int flush) {
+            int result;
+            do {
+                stream->zStream.next_out = stream->buffer.data ();
+                stream->zStream.avail_out = (uInt)stream->buffer.size ();
+                result = deflate (&stream->zStream, flush);
+                if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                    ThrowZlibError (stream->zStream, result);
+                }
+                std::size_t count = stream->buffer.size () - stream->zStream.avail_out;
+                WriteAll (out, stream->buffer.data (), count);
+                stream->totalOut += count;
+            } while (stream->zStream.avail_out == 0 ||
+                (flush == Z_FINISH && result != Z_STREAM_END));
+        }
+
+        struct Inflater::Stream {
+            z_stream zStream;
+            std::vector<ui8> buffer;
+            bool raw;
+            ui64 totalIn;
+            ui64 totalOut;
+            bool finished;
+
+            Stream (
+                    bool raw_,
+                    std::size_t chunkSize) :
+                    buffer (std::max<std::size_t> (chunkSize, 1024)),
+                    raw (raw_),
+                    totalIn (0),
+                    totalOut (0),
+                    finished (false) {
+                memset (&zStream, 0, sizeof (zStream));
+                // + 32 = auto detect zlib or gzip.
+                int result = inflateInit2 (&zStream, raw ? -MAX_WBITS : MAX_WBITS + 32);
+                if (result != Z_OK) {
+                    ThrowZlibError (zStream, result);
+                }
+            }
+            ~Stream () {
+                inflateEnd (&zStream);
+            }
+        };
+
+        Inflater::Inflater (
+                Serializer &out_,
+                bool raw,
+                std::size_t chunkSize) :
+                out (out_),
+                stream (new Stream (raw, chunkSize)) {}
+
+        Inflater::~Inflater () {}
+
+        bool Inflater::Write (
+                const void *data,
+                std::size_t length) {
+            const ui8 *ptr = (const ui8 *)data;
+            while (length > 0) {
+                if (stream->finished) {
+                    // Concatenated gzip members are one stream (RFC 1952).
+                    // Anything else after the end of the stream is ignored.
+                    if (!stream->raw && ptr[0] == 0x1f) {
+                        inflateReset (&stream->zStream);
+                        stream->finished = false;
+                    }
+                    else {
+                        break;
+                    }
+                }
+                std::size_t count = std::min (length, MAX_ZLIB_CHUNK);
+                stream->zStream.next_in = (Bytef *)ptr;
+                stream->zStream.avail_in = (uInt)count;
+                do {
+                    stream->zStream.next_out = stream->buffer.data ();
+                    stream->zStream.avail_out = (uInt)stream->buffer.size ();
+                    int result = inflate (&stream->zStream, Z_NO_FLUSH);
+                    if (result == Z_NEED_DICT) {
+                        result = Z_DATA_ERROR;
+                    }
+                    if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                        ThrowZlibError (stream->zStream, result);
+                    }
+                    std::size_t produced = stream->buffer.size () - stream->zStream.avail_out;
+                    WriteAll (out, stream->buffer.data (), produced);
+                    stream->totalOut += produced;
+                    if (result == Z_STREAM_END) {
+                        stream->finished = true;
+                        break;
+                    }
+                    if (result == Z_BUF_ERROR) {
+                        // No progress possible, need more input.
+                        break;
+                    }
+                } while (stream->zStream.avail_out == 0 || stream->zStream.avail_in > 0);
+                std::size_t consumed = count - stream->zStream.avail_in;
+                stream->totalIn += consumed;
+                ptr += consumed;
+                length -= consumed;
+                if (!stream->finished && consumed < count) {
+                    break;
+                }
+            }
+            return stream->finished;
+        }
+
+        ui64 Inflater::Write (Serializer &in) {
+            std::vector<ui8> chunk (stream->buffer.size ());
+            ui64 total = 0;
+            for (std::size_t count = in.Read (chunk.data (), chunk.size ());
+                    count > 0; count = in.Read (chunk.data (), chunk.size ())) {
+                total += count;
+                if (Write (chunk.data (), count)) {
+                    break;
+                }
+            }
+            return total;
+        }
+
+        bool Inflater::IsFinished () const {
+            return stream->finished;
+        }
+
+        ui64 Inflater::GetTotalIn () const {
+            return stream->totalIn;
+        }
+
+        ui64 Inflater::GetTotalOut () const {
+            return stream->totalOut;
+        }
+
+        namespace {
+            struct ParallelDeflateJob : public Vectorizer::Job {
+                const ui8 *data;
+                std::size_t length;
+                std::size_t blockSize;
+                i32 level;
+                bool gzip;
+                std::size_t firstBlock;
+                std::size_t blockCount;
+                struct Block {
+                    std::vector<ui8> compressed;
+                    std::size_t length;
+                    uLong check;
+                    std::string error;
+                };
+                std::vector<Block> blocks;
+
+                ParallelDeflateJob (
+                    const ui8 *data_,
+                    std::size_t length_,
+                    std::size_t blockSize_,
+                    i32 level_,
+                    bool gzip_) :
+                    data (data_),
+                    length (length_),
+                    blockSize (blockSize_),
+                    level (level_),
+                    gzip (gzip_),
+                    firstBlock (0),
+                    blockCount (0) {}
+
+                void SetBatch (
+                        std::size_t firstBlock_,
+                        std::size_t blockCount_) {
+                    firstBlock = firstBlock_;
+                    blockCount = blockCount_;
+                    blocks.resize (blockCount);
+                    for (std::size_t i = 0; i < blockCount; ++i) {
+                        blocks[i].length = 0;
+                        blocks[i].error.clear ();
+                    }
+                }
+
+                virtual void Execute (
+                        std::size_t startIndex,
+                        std::size_t endIndex,
+                        std::size_t /*rank*/) throw () override {
+                    for (; startIndex < endIndex; ++startIndex) {
+                        Block &block = blocks[startIndex];
+                        try {
+                            CompressBlock (firstBlock + startIndex, block);
+                        }
+                        catch (const std::exception &exception) {
+                            block.error = exception.what ();
+                        }
+                    }
+                }
+
+                virtual std::size_t Size () const throw () override {
+                    return blockCount;
+                }
+
+                void CompressBlock (
+                        std::size_t index,
+                        Block &block) {
+                    std::size_t offset = index * blockSize;
+                    block.length = std::min (blockSize, length - offset);
+                    bool last = offset + block.length == length;
+                    z_stream zStream;
+                    memset (&zStream, 0, sizeof (zStream));
+                    int result = deflateInit2 (&zStream, level, Z_DEFLATED,
+                        -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+                    if (result != Z_OK) {
+                        block.error = zStream.msg != 0 ? zStream.msg : "deflateInit2 failed";
+                        return;
+                    }
+                    if (offset > 0) {
+                        // Prime the block with the window preceding it so that
+                        // matches can reach back in to the previous block.
+                        std::size_t dictionaryLength = std::min (offset, WINDOW_SIZE);
+                        deflateSetDictionary (&zStream,
+                            data + offset - dictionaryLength, (uInt)dictionaryLength);
+                    }
+                    // Sync flush adds an empty stored block (5 bytes) and
+                    // might need a byte or two to get to a byte boundary.
+                    block.compressed.resize (deflateBound (&zStream, (uLong)block.length) + 16);
+                    zStream.next_in = (Bytef *)(data + offset);
+                    zStream.avail_in = (uInt)block.length;
+                    zStream.next_out = block.compressed.data ();
+                    zStream.avail_out = (uInt)block.compressed.size ();
+                    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+                    for (;;) {
+                        result = deflate (&zStream, flush);
+                        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                            block.error = zStream.msg != 0 ? zStream.msg : "deflate failed";
+                            break;
+                        }
+                        if (zStream.avail_out != 0 && (!last || result == Z_STREAM_END)) {
+                            break;
+                        }
+                        // Out of space (shouldn't happen, but just in case).
+                        std::size_t used = block.compressed.size () - zStream.avail_out;
+                        block.compressed.resize (block.compressed.size () * 2);
+                        zStream.next_out = block.compressed.data () + used;
+                        zStream.avail_out = (uInt)(block.compressed.size () - used);
+                    }
+                    block.compressed.resize (zStream.total_out);
+                    deflateEnd (&zStream);
+                    block.check = gzip ?
+                        crc32 (0, data + offset, (uInt)block.length) :
+                        adler32 (1, data + offset, (uInt)block.length);
+                }
+            };
+        }
+
+        _LIB_THEKOGANS_UTIL_DECL ui64 _LIB_THEKOGANS_UTIL_API ParallelDeflate (
+                const void *data,
+                std::size_t length,
+                Serializer &out,
+                Deflater::Format format,
+                i32 level,
+                std::size_t blockSize,
+                Vectorizer &vectorizer) {
+            if ((data == 0 && length > 0) || blockSize < WINDOW_SIZE ||
+                    blockSize > MAX_ZLIB_CHUNK / 2 || level < Z_DEFAULT_COMPRESSION ||
+                    level > Z_BEST_COMPRESSION) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            ui64 totalOut = 0;
+            // Header.
+            if (format == Deflater::FORMAT_ZLIB) {
+                ui8 header[2];
+                header[0] = 0x78; // deflate, 32K window.
+                ui8 flevel =
+                    level == Z_DEFAULT_COMPRESSION ? 2 :
+                    level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+                header[1] = (ui8)(flevel << 6);
+                header[1] += (ui8)(31 - (header[0] * 256 + header[1]) % 31);
+                WriteAll (out, header, sizeof (header));
+                totalOut += sizeof (header);
+            }
+            else if (format == Deflater::FORMAT_GZIP) {
+                ui8 header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+                header[8] = level == Z_BEST_COMPRESSION ? 2 : level == Z_BEST_SPEED ? 4 : 0;
+                WriteAll (out, header, sizeof (header));
+                totalOut += sizeof (header);
+            }
+            // Blocks.
+            const ui8 *input = (const ui8 *)data;
+            uLong check = format == Deflater::FORMAT_GZIP ?
+                crc32 (0, Z_NULL, 0) : adler32 (0, Z_NULL, 0);
+            if (length == 0) {
+                // Empty final block.
+                static const ui8 empty[] = {0x03, 0x00};
+                WriteAll (out, empty, sizeof (empty));
+                totalOut += sizeof (empty);
+            }
+            else {
+                ParallelDeflateJob job (input, length, blockSize, level,
+                    format == Deflater::FORMAT_GZIP);
+                std::size_t blockCount = (length + blockSize - 1) / blockSize;
+                for (std::size_t firstBlock = 0; firstBlock < blockCount;
+                        firstBlock += BLOCKS_PER_BATCH) {
+                    job.SetBatch (firstBlock,
+                        std::min (BLOCKS_PER_BATCH, blockCount - firstBlock));
+                    vectorizer.Execute (job, 1);
+                    for (std::size_t i = 0; i < job.blockCount; ++i) {
+                        const ParallelDeflateJob::Block &block = job.blocks[i];
+                        if (!block.error.empty ()) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s", block.error.c_str ());
+                        }
+                        WriteAll (out, block.compressed.data (), block.compressed.size ());
+                        totalOut += block.compressed.size ();
+                        check = format == Deflater::FORMAT_GZIP ?
+                            crc32_combine (check, block.check, (z_off_t)block.length) :
+                            adler32_combine (check, block.check, (z_off_t)block.length);
+                    }
+                }
+            }
+            // Trailer.
+            if (format == Deflater::FORMAT_ZLIB) {
+                ui8 trailer[4] = {
+                    (ui8)(check >> 24), (ui8)(check >> 16), (ui8)(check >> 8), (ui8)check
+                };
+                WriteAll (out, trailer, sizeof (trailer));
+                totalOut += sizeof (trailer);
+            }
+            else if (format == Deflater::FORMAT_GZIP) {
+                ui32 size = (ui32)length;
+                ui8 trailer[8] = {
+                    (ui8)check, (ui8)(check >> 8), (ui8)(check >> 16), (ui8)(check >> 24),
+                    (ui8)size, (ui8)(size >> 8), (ui8)(size >> 16), (ui8)(size >> 24)
+                };
+                WriteAll (out, trailer, sizeof (trailer));
+                totalOut += sizeof (trailer);
+            }
+            return totalOut;
+        }
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
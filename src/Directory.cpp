@@ -26,6 +26,7 @@
     #include <sys/types.h>
     #include <sys/ioctl.h>
     #include <sys/epoll.h>
+    #include <sys/syscall.h>
     #include <fcntl.h>
     #include <unistd.h>
 #elif defined (TOOLCHAIN_OS_OSX)
@@ -37,6 +38,9 @@
 #endif // defined (TOOLCHAIN_OS_Windows)
 #include <cstdlib>
 #include <cassert>
+#if defined (TOOLCHAIN_OS_Linux)
+    #include <atomic>
+#endif // defined (TOOLCHAIN_OS_Linux)
 #include <list>
 #include <set>
 #if defined (TOOLCHAIN_OS_Windows)
@@ -58,6 +62,33 @@
 namespace thekogans {
     namespace util {
 
+        void Directory::Watcher::EventSink::HandleEvents (
+                WatchId watchId,
+                const std::list<Event> &events) {
+            for (std::list<Event>::const_iterator
+                    it = events.begin (),
+                    end = events.end (); it != end; ++it) {
+                switch ((*it).type) {
+                    case Event::Add:
+                        HandleAdd (watchId, (*it).directory, (*it).entry);
+                        break;
+                    case Event::Delete:
+                        HandleDelete (watchId, (*it).directory, (*it).entry);
+                        break;
+                    case Event::Modified:
+                        HandleModified (watchId, (*it).directory, (*it).entry);
+                        break;
+                }
+            }
+        }
+
+    #if defined (TOOLCHAIN_OS_Linux)
+        namespace {
+            const ui32 INOTIFY_MASK =
+                IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE;
+        }
+    #endif // defined (TOOLCHAIN_OS_Linux)
+
         struct Directory::Watcher::Watch {
             THEKOGANS_UTIL_DECLARE_HEAP_WITH_LOCK (Watch, SpinLock)
 
@@ -65,6 +96,7 @@ namespace thekogans {
 
             std::string directory;
             Directory::Watcher::EventSink &eventSink;
+            bool recursive;
             THEKOGANS_UTIL_HANDLE handle;
         #if defined (TOOLCHAIN_OS_Windows)
             OVERLAPPED overlapped;
@@ -111,12 +143,25 @@ namespace thekogans {
             };
             typedef OwnerMap<std::string, Entry> Entries;
             Entries entries;
+        #elif defined (TOOLCHAIN_OS_Linux)
+            TimeSpec coalescingWindow;
+            // Sub-directory watch descriptors (recursive watches only).
+            typedef std::map<THEKOGANS_UTIL_HANDLE, std::string> Subdirectories;
+            Subdirectories subdirectories;
+            // Coalesced events waiting for the window to close.
+            std::list<Event> events;
+            typedef std::map<std::string, std::list<Event>::iterator> EventIndex;
+            EventIndex eventIndex;
+            TimeSpec deadline;
         #endif // defined (TOOLCHAIN_OS_Windows)
 
             Watch (const std::string &directory_,
-                    Directory::Watcher::EventSink &eventSink_) :
+                    Directory::Watcher::EventSink &eventSink_,
+                    bool recursive_,
+                    const TimeSpec &coalescingWindow_) :
                     directory (directory_),
                     eventSink (eventSink_),
+                    recursive (recursive_),
                 #if defined (TOOLCHAIN_OS_Windows)
                     handle (CreateFileW (UTF8ToUTF16 (directory).c_str (),
                         FILE_LIST_DIRECTORY,
@@ -128,7 +173,9 @@ namespace thekogans {
                 #elif defined (TOOLCHAIN_OS_Linux)
                     handle (inotify_add_watch (
                         Directory::Watcher::Instance ().handle, directory.c_str (),
-                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE)) {
+                        INOTIFY_MASK)),
+                    coalescingWindow (coalescingWindow_),
+                    deadline (TimeSpec::Infinite) {
                 #elif defined (TOOLCHAIN_OS_OSX)
                     handle (open (directory.c_str (), O_RDONLY)) {
                 #endif // defined (TOOLCHAIN_OS_Windows)
@@ -153,6 +200,17 @@ namespace thekogans {
                         THEKOGANS_UTIL_OS_ERROR_CODE);
                 }
                 Scan (entries, true);
+            #elif defined (TOOLCHAIN_OS_Linux)
+                if (recursive) {
+                    THEKOGANS_UTIL_TRY {
+                        AddSubdirectories (directory);
+                    }
+                    THEKOGANS_UTIL_CATCH_ANY {
+                        RemoveSubdirectories ();
+                        inotify_rm_watch (Directory::Watcher::Instance ().handle, handle);
+                        throw;
+                    }
+                }
             #endif // defined (TOOLCHAIN_OS_OSX)
             }
 
@@ -161,6 +219,7 @@ namespace thekogans {
                 CloseHandle (handle);
             #elif defined (TOOLCHAIN_OS_Linux)
                 inotify_rm_watch (Directory::Watcher::Instance ().handle, handle);
+                RemoveSubdirectories ();
             #elif defined (TOOLCHAIN_OS_OSX)
                 close (handle);
             #endif // defined (TOOLCHAIN_OS_Windows)
@@ -170,7 +229,7 @@ namespace thekogans {
             void ReadDirectoryChanges () {
                 memset (&overlapped, 0, sizeof (overlapped));
                 if (!ReadDirectoryChangesW (
-                        handle, buffer, sizeof (buffer), FALSE,
+                        handle, buffer, sizeof (buffer), recursive ? TRUE : FALSE,
                         FILE_NOTIFY_CHANGE_CREATION |
                         FILE_NOTIFY_CHANGE_SIZE |
                         FILE_NOTIFY_CHANGE_FILE_NAME |
@@ -244,6 +303,147 @@ namespace thekogans {
                     added.push_back (currentIt->second->entry);
                 }
             }
+        #elif defined (TOOLCHAIN_OS_Linux)
+            // Add watches for all sub-directories of the given directory.
+            // If added != 0, the entries found are reported as added (used
+            // for directories that were created after the watch was set up,
+            // which could have been populated before we got to them).
+            void AddSubdirectories (
+                    const std::string &path,
+                    std::list<Event> *added = 0) {
+                Directory scanDirectory (path, Directory::ENTRY_TYPE);
+                Directory::Entry entry;
+                for (bool gotEntry = scanDirectory.GetFirstEntry (entry);
+                        gotEntry; gotEntry = scanDirectory.GetNextEntry (entry)) {
+                    if (!IsDotOrDotDot (entry.name.c_str ())) {
+                        if (added != 0) {
+                            added->push_back (Event (Event::Add, path, entry));
+                        }
+                        if (entry.type == Directory::Entry::Folder) {
+                            AddSubdirectory (MakePath (path, entry.name), added);
+                        }
+                    }
+                }
+            }
+
+            void AddSubdirectory (
+                    const std::string &path,
+                    std::list<Event> *added = 0) {
+                Directory::Watcher &watcher = Directory::Watcher::Instance ();
+                THEKOGANS_UTIL_HANDLE subdirectory =
+                    inotify_add_watch (watcher.handle, path.c_str (), INOTIFY_MASK);
+                if (subdirectory != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                    // inotify returns the existing descriptor if the
+                    // directory is already watched. Don't steal it from
+                    // another watch.
+                    if (watcher.watches.find (subdirectory) == watcher.watches.end ()) {
+                        Directory::Watcher::SubWatches::iterator it =
+                            watcher.subWatches.find (subdirectory);
+                        if (it == watcher.subWatches.end ()) {
+                            watcher.subWatches.insert (
+                                Directory::Watcher::SubWatches::value_type (subdirectory, this));
+                        }
+                        else if (it->second != this) {
+                            return;
+                        }
+                        subdirectories[subdirectory] = path;
+                        AddSubdirectories (path, added);
+                    }
+                }
+                else {
+                    // The directory might already be gone.
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    if (errorCode != ENOENT && errorCode != ENOTDIR) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                            errorCode, " (%s)", path.c_str ());
+                    }
+                }
+            }
+
+            void RemoveSubdirectories () {
+                Directory::Watcher &watcher = Directory::Watcher::Instance ();
+                for (Subdirectories::const_iterator
+                        it = subdirectories.begin (),
+                        end = subdirectories.end (); it != end; ++it) {
+                    inotify_rm_watch (watcher.handle, it->first);
+                    watcher.subWatches.erase (it->first);
+                }
+                subdirectories.clear ();
+            }
+
+            // Remove the given sub-directory and all it's descendants.
+            void RemoveSubdirectory (
+                    THEKOGANS_UTIL_HANDLE subdirectory,
+                    bool removeWatch) {
+                Subdirectories::iterator it = subdirectories.find (subdirectory);
+                if (it != subdirectories.end ()) {
+                    Directory::Watcher &watcher = Directory::Watcher::Instance ();
+                    std::string prefix = it->second + "/";
+                    for (Subdirectories::iterator
+                            jt = subdirectories.begin (); jt != subdirectories.end ();) {
+                        if (jt->second.compare (0, prefix.size (), prefix) == 0) {
+                            inotify_rm_watch (watcher.handle, jt->first);
+                            watcher.subWatches.erase (jt->first);
+                            subdirectories.erase (jt++);
+                        }
+                        else {
+                            ++jt;
+                        }
+                    }
+                    if (removeWatch) {
+                        inotify_rm_watch (watcher.handle, subdirectory);
+                    }
+                    watcher.subWatches.erase (subdirectory);
+                    subdirectories.erase (subdirectory);
+                }
+            }
+
+            void RemoveSubdirectory (const std::string &path) {
+                for (Subdirectories::const_iterator
+                        it = subdirectories.begin (),
+                        end = subdirectories.end (); it != end; ++it) {
+                    if (it->second == path) {
+                        RemoveSubdirectory (it->first, true);
+                        break;
+                    }
+                }
+            }
+
+            // Merge the given event with the one already pending for
+            // the same entry (if any). The rules are:
+            // Add + Delete = nothing, Delete + Add = Modified,
+            // Add + Modified = Add, anything else = latest.
+            void Coalesce (
+                    ui8 type,
+                    const std::string &path,
+                    const std::string &name) {
+                std::string key = MakePath (path, name);
+                EventIndex::iterator it = eventIndex.find (key);
+                if (it == eventIndex.end ()) {
+                    if (events.empty ()) {
+                        deadline = GetCurrentTime () + coalescingWindow;
+                    }
+                    Directory::Entry entry;
+                    entry.name = name;
+                    events.push_back (Event (type, path, entry));
+                    eventIndex.insert (EventIndex::value_type (key, --events.end ()));
+                }
+                else {
+                    Event &event = *it->second;
+                    if (event.type == Event::Add) {
+                        if (type == Event::Delete) {
+                            events.erase (it->second);
+                            eventIndex.erase (it);
+                        }
+                    }
+                    else if (event.type == Event::Delete && type == Event::Add) {
+                        event.type = Event::Modified;
+                    }
+                    else {
+                        event.type = type;
+                    }
+                }
+            }
         #endif // defined (TOOLCHAIN_OS_Windows)
         };
 
@@ -297,9 +497,12 @@ namespace thekogans {
 
         Directory::Watcher::WatchId Directory::Watcher::AddWatch (
                 const std::string &directory,
-                EventSink &evenSink) {
+                EventSink &evenSink,
+                bool recursive,
+                const TimeSpec &coalescingWindow) {
             LockGuard<SpinLock> guard (spinLock);
-            Watch::UniquePtr watch (new Watch (directory, evenSink));
+            Watch::UniquePtr watch (
+                new Watch (directory, evenSink, recursive, coalescingWindow));
             assert (watch.get () != 0);
             if (watch.get () == 0) {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -391,7 +594,7 @@ namespace thekogans {
                     }
                 #elif defined (TOOLCHAIN_OS_Linux)
                     epoll_event epollEvent = {0};
-                    int count = epoll_wait (epollHandle, &epollEvent, 1, -1);
+                    int count = epoll_wait (epollHandle, &epollEvent, 1, FlushEvents ());
                     if (count < 0) {
                         THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
                         if (errorCode != EINTR) {
@@ -407,38 +610,98 @@ namespace thekogans {
                                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                                     THEKOGANS_UTIL_OS_ERROR_CODE);
                             }
+                            bool overflow = false;
                             for (ui32 i = 0; i < length;) {
                                 inotify_event *event = (inotify_event *)&buffer[i];
+                                i += sizeof (inotify_event) + event->len;
+                                if (Flags32 (event->mask).Test (IN_Q_OVERFLOW)) {
+                                    overflow = true;
+                                    continue;
+                                }
                                 std::string directory;
                                 EventSink *eventSink = 0;
                                 WatchId watchId = THEKOGANS_UTIL_INVALID_HANDLE_VALUE;
+                                std::list<Event> added;
                                 {
                                     LockGuard<SpinLock> guard (spinLock);
+                                    Watch *watch = 0;
                                     Watches::iterator it = watches.find (event->wd);
                                     if (it != watches.end ()) {
-                                        directory = it->second->directory;
-                                        eventSink = &it->second->eventSink;
-                                        watchId = it->second->handle;
+                                        watch = it->second;
+                                        directory = watch->directory;
                                     }
-                                }
-                                if (eventSink != 0) {
-                                    if (Flags32 (event->mask).Test (IN_MOVED_TO) ||
-                                            Flags32 (event->mask).Test (IN_CREATE)) {
-                                        eventSink->HandleAdd (watchId, directory,
-                                            Directory::Entry (MakePath (directory, event->name)));
+                                    else {
+                                        SubWatches::iterator jt = subWatches.find (event->wd);
+                                        if (jt != subWatches.end ()) {
+                                            watch = jt->second;
+                                            directory = watch->subdirectories[event->wd];
+                                        }
                                     }
-                                    if (Flags32 (event->mask).Test (IN_MOVED_FROM) ||
-                                            Flags32 (event->mask).Test (IN_DELETE)) {
-                                        Directory::Entry entry;
-                                        entry.name = event->name;
-                                        eventSink->HandleDelete (watchId, directory, entry);
+                                    if (watch == 0) {
+                                        continue;
                                     }
-                                    if (Flags32 (event->mask).Test (IN_CLOSE_WRITE)) {
-                                        eventSink->HandleModified (watchId, directory,
-                                            Directory::Entry (MakePath (directory, event->name)));
+                                    if (Flags32 (event->mask).Test (IN_IGNORED)) {
+                                        // Kernel removed the watch (directory deleted).
+                                        watch->RemoveSubdirectory (event->wd, false);
+                                        continue;
                                     }
+                                    if (watch->recursive && Flags32 (event->mask).Test (IN_ISDIR)) {
+                                        std::string path = MakePath (directory, event->name);
+                                        if (Flags32 (event->mask).Test (IN_MOVED_TO) ||
+                                                Flags32 (event->mask).Test (IN_CREATE)) {
+                                            watch->AddSubdirectory (path, &added);
+                                        }
+                                        if (Flags32 (event->mask).Test (IN_MOVED_FROM)) {
+                                            watch->RemoveSubdirectory (path);
+                                        }
+                                    }
+                                    if (watch->coalescingWindow != TimeSpec::Zero) {
+                                        if (Flags32 (event->mask).Test (IN_MOVED_TO) ||
+                                                Flags32 (event->mask).Test (IN_CREATE)) {
+                                            watch->Coalesce (Event::Add, directory, event->name);
+                                        }
+                                        if (Flags32 (event->mask).Test (IN_MOVED_FROM) ||
+                                                Flags32 (event->mask).Test (IN_DELETE)) {
+                                            watch->Coalesce (Event::Delete, directory, event->name);
+                                        }
+                                        if (Flags32 (event->mask).Test (IN_CLOSE_WRITE)) {
+                                            watch->Coalesce (Event::Modified, directory, event->name);
+                                        }
+                                        for (std::list<Event>::const_iterator
+                                                it = added.begin (),
+                                                end = added.end (); it != end; ++it) {
+                                            watch->Coalesce (Event::Add,
+                                                (*it).directory, (*it).entry.name);
+                                        }
+                                        continue;
+                                    }
+                                    eventSink = &watch->eventSink;
+                                    watchId = watch->handle;
                                 }
-                                i += sizeof (inotify_event) + event->len;
+                                if (Flags32 (event->mask).Test (IN_MOVED_TO) ||
+                                        Flags32 (event->mask).Test (IN_CREATE)) {
+                                    eventSink->HandleAdd (watchId, directory,
+                                        Directory::Entry (MakePath (directory, event->name)));
+                                }
+                                if (Flags32 (event->mask).Test (IN_MOVED_FROM) ||
+                                        Flags32 (event->mask).Test (IN_DELETE)) {
+                                    Directory::Entry entry;
+                                    entry.name = event->name;
+                                    eventSink->HandleDelete (watchId, directory, entry);
+                                }
+                                if (Flags32 (event->mask).Test (IN_CLOSE_WRITE)) {
+                                    eventSink->HandleModified (watchId, directory,
+                                        Directory::Entry (MakePath (directory, event->name)));
+                                }
+                                for (std::list<Event>::const_iterator
+                                        it = added.begin (),
+                                        end = added.end (); it != end; ++it) {
+                                    eventSink->HandleAdd (watchId, (*it).directory,
+                                        Directory::Entry (MakePath ((*it).directory, (*it).entry.name)));
+                                }
+                            }
+                            if (overflow) {
+                                HandleOverflow ();
                             }
                         }
                     }
@@ -523,6 +786,103 @@ namespace thekogans {
             }
         }
 
+    #if defined (TOOLCHAIN_OS_Linux)
+        int Directory::Watcher::FlushEvents () {
+            struct Batch {
+                WatchId watchId;
+                EventSink *eventSink;
+                std::list<Event> events;
+            };
+            std::list<Batch> batches;
+            int timeout = -1;
+            {
+                TimeSpec now = GetCurrentTime ();
+                LockGuard<SpinLock> guard (spinLock);
+                for (Watches::iterator
+                        it = watches.begin (),
+                        end = watches.end (); it != end; ++it) {
+                    Watch &watch = *it->second;
+                    if (!watch.events.empty ()) {
+                        if (watch.deadline <= now) {
+                            batches.push_back (Batch ());
+                            batches.back ().watchId = watch.handle;
+                            batches.back ().eventSink = &watch.eventSink;
+                            batches.back ().events.swap (watch.events);
+                            watch.eventIndex.clear ();
+                            watch.deadline = TimeSpec::Infinite;
+                        }
+                        else {
+                            int milliseconds = (int)(watch.deadline - now).ToMilliseconds () + 1;
+                            if (timeout == -1 || timeout > milliseconds) {
+                                timeout = milliseconds;
+                            }
+                        }
+                    }
+                }
+            }
+            for (std::list<Batch>::iterator
+                    it = batches.begin (),
+                    end = batches.end (); it != end; ++it) {
+                // Entries are read now (and not when the event occurred)
+                // to reflect their final state. Those that are already
+                // gone will be followed by a delete.
+                for (std::list<Event>::iterator
+                        jt = (*it).events.begin (); jt != (*it).events.end ();) {
+                    if ((*jt).type != Event::Delete) {
+                        THEKOGANS_UTIL_TRY {
+                            (*jt).entry = Directory::Entry (
+                                MakePath ((*jt).directory, (*jt).entry.name));
+                        }
+                        THEKOGANS_UTIL_CATCH (Exception) {
+                            jt = (*it).events.erase (jt);
+                            continue;
+                        }
+                    }
+                    ++jt;
+                }
+                if (!(*it).events.empty ()) {
+                    (*it).eventSink->HandleEvents ((*it).watchId, (*it).events);
+                }
+            }
+            return timeout;
+        }
+
+        void Directory::Watcher::HandleOverflow () {
+            struct Overflow {
+                WatchId watchId;
+                EventSink *eventSink;
+                std::string directory;
+            };
+            std::list<Overflow> overflows;
+            {
+                LockGuard<SpinLock> guard (spinLock);
+                for (Watches::iterator
+                        it = watches.begin (),
+                        end = watches.end (); it != end; ++it) {
+                    Watch &watch = *it->second;
+                    if (watch.recursive) {
+                        // Events about new sub-directories might have been
+                        // lost. Pick them up, and forget the ones that are gone.
+                        watch.RemoveSubdirectories ();
+                        THEKOGANS_UTIL_TRY {
+                            watch.AddSubdirectories (watch.directory);
+                        }
+                        THEKOGANS_UTIL_CATCH_AND_LOG_SUBSYSTEM (THEKOGANS_UTIL)
+                    }
+                    overflows.push_back (Overflow ());
+                    overflows.back ().watchId = watch.handle;
+                    overflows.back ().eventSink = &watch.eventSink;
+                    overflows.back ().directory = watch.directory;
+                }
+            }
+            for (std::list<Overflow>::const_iterator
+                    it = overflows.begin (),
+                    end = overflows.end (); it != end; ++it) {
+                (*it).eventSink->HandleOverflow ((*it).watchId, (*it).directory);
+            }
+        }
+    #endif // defined (TOOLCHAIN_OS_Linux)
+
         #if !defined (THEKOGANS_UTIL_MIN_DIRECORY_ENTRY_IN_PAGE)
             #define THEKOGANS_UTIL_MIN_DIRECORY_ENTRY_IN_PAGE 64
         #endif // !defined (THEKOGANS_UTIL_MIN_DIRECORY_ENTRY_IN_PAGE)
@@ -811,8 +1171,11 @@ namespace thekogans {
         }
 
     #if defined (TOOLCHAIN_OS_Windows)
-        Directory::Directory (const std::string &path_) :
+        Directory::Directory (
+                const std::string &path_,
+                ui32 entryFields_) :
                 path (path_),
+                entryFields (entryFields_),
                 handle (THEKOGANS_UTIL_INVALID_HANDLE_VALUE),
                 attributes (0),
                 creationDate (-1),
@@ -949,9 +1312,18 @@ namespace thekogans {
             }
         }
     #else // defined (TOOLCHAIN_OS_Windows)
-        Directory::Directory (const std::string &path_) :
+        Directory::Directory (
+                const std::string &path_,
+                ui32 entryFields_) :
                 path (path_),
+                entryFields (entryFields_),
+            #if defined (TOOLCHAIN_OS_Linux)
+                handle (THEKOGANS_UTIL_INVALID_HANDLE_VALUE),
+                bufferOffset (0),
+                bufferLength (0),
+            #else // defined (TOOLCHAIN_OS_Linux)
                 dir (0),
+            #endif // defined (TOOLCHAIN_OS_Linux)
                 mode (0),
                 lastStatusDate (-1),
                 lastAccessedDate (-1),
@@ -977,6 +1349,62 @@ namespace thekogans {
             THEKOGANS_UTIL_CATCH_AND_LOG_SUBSYSTEM (THEKOGANS_UTIL)
         }
 
+    #if defined (TOOLCHAIN_OS_Linux)
+        bool Directory::GetFirstEntry (Entry &entry) {
+            Close ();
+            handle = open (path.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (handle != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                if (buffer.empty ()) {
+                    buffer.resize (DEFAULT_BUFFER_SIZE);
+                }
+                bufferOffset = bufferLength = 0;
+                return GetNextEntry (entry);
+            }
+            else {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                if (errorCode != ENOENT && errorCode != ENOTDIR) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+            }
+            return false;
+        }
+
+        namespace {
+            // glibc does not expose the raw getdents64 record.
+            struct linux_dirent64 {
+                ui64 d_ino;
+                i64 d_off;
+                ui16 d_reclen;
+                ui8 d_type;
+                char d_name[1];
+            };
+        }
+
+        bool Directory::GetNextEntry (Entry &entry) {
+            if (handle != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                if (bufferOffset >= bufferLength) {
+                    long result;
+                    do {
+                        result = syscall (SYS_getdents64, handle, &buffer[0], buffer.size ());
+                    } while (result < 0 && THEKOGANS_UTIL_OS_ERROR_CODE == EINTR);
+                    if (result < 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", path.c_str ());
+                    }
+                    bufferOffset = 0;
+                    bufferLength = (std::size_t)result;
+                }
+                if (bufferOffset < bufferLength) {
+                    const linux_dirent64 *dirEnt =
+                        (const linux_dirent64 *)&buffer[bufferOffset];
+                    bufferOffset += dirEnt->d_reclen;
+                    GetEntry (dirEnt->d_name, dirEnt->d_type, entry);
+                    return true;
+                }
+            }
+            return false;
+        }
+    #else // defined (TOOLCHAIN_OS_Linux)
         bool Directory::GetFirstEntry (Entry &entry) {
             Close ();
             dir = opendir (path.c_str ());
@@ -1020,6 +1448,7 @@ namespace thekogans {
             }
             return false;
         }
+    #endif // defined (TOOLCHAIN_OS_Linux)
 
         void Directory::Create (
                 const std::string &path,
@@ -1069,6 +1498,102 @@ namespace thekogans {
             }
         }
 
+    #if defined (TOOLCHAIN_OS_Linux)
+        void Directory::Close () {
+            if (handle != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                // NOTE: On Linux the descriptor is released even
+                // if close is interrupted, so don't retry.
+                int result = close (handle);
+                handle = THEKOGANS_UTIL_INVALID_HANDLE_VALUE;
+                bufferOffset = bufferLength = 0;
+                if (result < 0 && THEKOGANS_UTIL_OS_ERROR_CODE != EINTR) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+        }
+
+        namespace {
+            ui8 d_typeTotype (ui8 d_type) {
+                return d_type == DT_DIR ? Directory::Entry::Folder :
+                    d_type == DT_REG ? Directory::Entry::File :
+                    d_type == DT_LNK ? Directory::Entry::Link : Directory::Entry::Invalid;
+            }
+
+        #if defined (STATX_BASIC_STATS)
+            // Cleared the first time statx reports ENOSYS
+            // (kernels older than 4.11).
+            std::atomic<bool> haveStatx (true);
+
+            ui32 entryFieldsTostatxMask (ui32 entryFields) {
+                ui32 mask = STATX_TYPE;
+                if ((entryFields & Directory::ENTRY_MODE) != 0) {
+                    mask |= STATX_MODE;
+                }
+                if ((entryFields & Directory::ENTRY_DATES) != 0) {
+                    mask |= STATX_CTIME | STATX_ATIME | STATX_MTIME;
+                }
+                if ((entryFields & Directory::ENTRY_SIZE) != 0) {
+                    mask |= STATX_SIZE;
+                }
+                return mask;
+            }
+        #endif // defined (STATX_BASIC_STATS)
+        }
+
+        void Directory::GetEntry (
+                const char *name,
+                ui8 d_type,
+                Entry &entry) const {
+            entry.fileSystem = Entry::POSIX;
+            entry.type = d_typeTotype (d_type);
+            entry.name = name;
+            entry.mode = 0;
+            entry.lastStatusDate = -1;
+            entry.lastAccessedDate = -1;
+            entry.lastModifiedDate = -1;
+            entry.size = 0;
+            // If all the caller wants is the type, and the
+            // file system gave it to us, we're done.
+            if ((entryFields & ~ENTRY_TYPE) == 0 && d_type != DT_UNKNOWN) {
+                return;
+            }
+        #if defined (STATX_BASIC_STATS)
+            if (haveStatx.load (std::memory_order_relaxed)) {
+                struct statx buf;
+                if (statx (handle, name, AT_SYMLINK_NOFOLLOW,
+                        entryFieldsTostatxMask (entryFields), &buf) == 0) {
+                    entry.type = systemTotype (buf.stx_mode);
+                    entry.mode = buf.stx_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+                    entry.lastStatusDate = buf.stx_ctime.tv_sec;
+                    entry.lastAccessedDate = buf.stx_atime.tv_sec;
+                    entry.lastModifiedDate = buf.stx_mtime.tv_sec;
+                    entry.size = buf.stx_size;
+                    return;
+                }
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                if (errorCode != ENOSYS) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                        errorCode, " (%s)", MakePath (path, name).c_str ());
+                }
+                haveStatx.store (false, std::memory_order_relaxed);
+            }
+        #endif // defined (STATX_BASIC_STATS)
+            STAT_STRUCT buf;
+            if (FSTATAT_FUNC (handle, name, &buf, AT_SYMLINK_NOFOLLOW) == 0) {
+                entry.type = systemTotype (buf.st_mode);
+                entry.mode = buf.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+                entry.lastStatusDate = buf.st_ctime;
+                entry.lastAccessedDate = buf.st_atime;
+                entry.lastModifiedDate = buf.st_mtime;
+                entry.size = buf.st_size;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", MakePath (path, name).c_str ());
+            }
+        }
+    #else // defined (TOOLCHAIN_OS_Linux)
         void Directory::Close () {
             if (dir != 0) {
                 int result;
@@ -1103,13 +1628,16 @@ namespace thekogans {
                     THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", pathName.c_str ());
             }
         }
+    #endif // defined (TOOLCHAIN_OS_Linux)
     #endif // defined (TOOLCHAIN_OS_Windows)
 
         void Directory::Delete (
                 const std::string &path,
                 bool recursive) {
             if (recursive) {
-                Directory directory (path);
+                // Only the entry type is needed to decide how to
+                // delete it, which (on Linux) saves a stat per entry.
+                Directory directory (path, ENTRY_TYPE);
                 Directory::Entry entry;
                 for (bool gotEntry = directory.GetFirstEntry (entry);
                         gotEntry; gotEntry = directory.GetNextEntry (entry)) {
@@ -0,0 +1,340 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <vector>
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Event.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Path.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/DirectoryWalker.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // A directory whose walk is in progress. pending counts the
+            // directory's own scan plus every sub-directory still being
+            // walked. When it drops to 0 the directory is left and the
+            // parent's count is decremented in turn.
+            struct Folder : public RefCounted {
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Folder)
+
+                const std::string path;
+                const SharedPtr parent;
+                std::atomic<std::size_t> pending;
+
+                Folder (
+                    const std::string &path_,
+                    SharedPtr parent_ = SharedPtr ()) :
+                    path (path_),
+                    parent (parent_),
+                    pending (1) {}
+            };
+
+            struct Walker : public RefCounted {
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Walker)
+
+                DirectoryWalker::Visitor &visitor;
+                const ui32 entryFields;
+                const std::size_t maxInFlight;
+                // Run loops to scan sub-directories on. They are
+                // either owned by the caller, or held by jobQueues.
+                std::vector<RunLoop *> runLoops;
+                std::vector<JobQueue::SharedPtr> jobQueues;
+                std::atomic<std::size_t> nextRunLoop;
+                std::atomic<std::size_t> inFlight;
+                std::atomic<bool> cancelled;
+                Event done;
+
+                Walker (
+                    DirectoryWalker::Visitor &visitor_,
+                    ui32 entryFields_,
+                    std::size_t maxInFlight_) :
+                    visitor (visitor_),
+                    entryFields (entryFields_ | Directory::ENTRY_TYPE),
+                    maxInFlight (maxInFlight_),
+                    nextRunLoop (0),
+                    inFlight (0),
+                    cancelled (false) {}
+
+                bool Walk (const std::string &path) {
+                    Scan (Folder::SharedPtr (new Folder (path)));
+                    done.Wait ();
+                    // Return borrowed queues to their pool here, and not
+                    // from the last job to release us (on their worker).
+                    jobQueues.clear ();
+                    return !cancelled;
+                }
+
+                void Scan (Folder::SharedPtr folder) {
+                    if (!cancelled) {
+                        THEKOGANS_UTIL_TRY {
+                            Directory directory (folder->path, entryFields);
+                            Directory::Entry entry;
+                            for (bool gotEntry = directory.GetFirstEntry (entry);
+                                    gotEntry && !cancelled;
+                                    gotEntry = directory.GetNextEntry (entry)) {
+                                if (!IsDotOrDotDot (entry.name.c_str ()) &&
+                                        visitor.Filter (folder->path, entry)) {
+                                    visitor.VisitEntry (folder->path, entry);
+                                    if (entry.type == Directory::Entry::Folder) {
+                                        ++folder->pending;
+                                        Schedule (
+                                            Folder::SharedPtr (
+                                                new Folder (
+                                                    MakePath (folder->path, entry.name),
+                                                    folder)));
+                                    }
+                                }
+                            }
+                        }
+                        THEKOGANS_UTIL_CATCH (Exception) {
+                            visitor.HandleError (folder->path, exception);
+                        }
+                        THEKOGANS_UTIL_CATCH (std::exception) {
+                            visitor.HandleError (folder->path,
+                                THEKOGANS_UTIL_STRING_EXCEPTION ("%s", exception.what ()));
+                        }
+                    }
+                    Leave (folder);
+                }
+
+                void Leave (Folder::SharedPtr folder) {
+                    while (--folder->pending == 0) {
+                        if (!cancelled) {
+                            THEKOGANS_UTIL_TRY {
+                                visitor.LeaveDirectory (folder->path);
+                            }
+                            THEKOGANS_UTIL_CATCH (Exception) {
+                                visitor.HandleError (folder->path, exception);
+                            }
+                            THEKOGANS_UTIL_CATCH (std::exception) {
+                                visitor.HandleError (folder->path,
+                                    THEKOGANS_UTIL_STRING_EXCEPTION ("%s", exception.what ()));
+                            }
+                        }
+                        if (folder->parent.Get () == 0) {
+                            done.Signal ();
+                            break;
+                        }
+                        folder = folder->parent;
+                    }
+                }
+
+                void Schedule (Folder::SharedPtr folder);
+            };
+
+            struct ScanJob : public RunLoop::Job {
+                Walker::SharedPtr walker;
+                Folder::SharedPtr folder;
+                bool scanned;
+
+                ScanJob (
+                    Walker::SharedPtr walker_,
+                    Folder::SharedPtr folder_) :
+                    walker (walker_),
+                    folder (folder_),
+                    scanned (false) {}
+                // If the job was cancelled before it had a chance to
+                // run, we still need to account for the folder or
+                // Walk will never return.
+                virtual ~ScanJob () {
+                    if (!scanned) {
+                        walker->cancelled = true;
+                        --walker->inFlight;
+                        walker->Leave (folder);
+                    }
+                }
+
+                virtual void Execute (const std::atomic<bool> &done) throw () override {
+                    scanned = true;
+                    --walker->inFlight;
+                    if (ShouldStop (done)) {
+                        walker->cancelled = true;
+                    }
+                    walker->Scan (folder);
+                }
+            };
+
+            void Walker::Schedule (Folder::SharedPtr folder) {
+                if (!runLoops.empty ()) {
+                    if (inFlight++ < maxInFlight) {
+                        ScanJob *scanJob = new ScanJob (Walker::SharedPtr (this), folder);
+                        RunLoop::Job::SharedPtr job (scanJob);
+                        THEKOGANS_UTIL_TRY {
+                            runLoops[nextRunLoop++ % runLoops.size ()]->EnqJob (job);
+                            return;
+                        }
+                        THEKOGANS_UTIL_CATCH_ANY {
+                            // Most likely the run loop's pending job limit
+                            // was reached. Scan in-line instead.
+                            scanJob->scanned = true;
+                        }
+                    }
+                    --inFlight;
+                }
+                Scan (folder);
+            }
+        }
+
+        bool DirectoryWalker::Walk (
+                const std::string &path,
+                Visitor &visitor,
+                RunLoop &runLoop,
+                ui32 entryFields,
+                std::size_t maxInFlight) {
+            Walker::SharedPtr walker (new Walker (visitor, entryFields, maxInFlight));
+            walker->runLoops.push_back (&runLoop);
+            return walker->Walk (path);
+        }
+
+        bool DirectoryWalker::Walk (
+                const std::string &path,
+                Visitor &visitor,
+                JobQueuePool &jobQueuePool,
+                std::size_t jobQueueCount,
+                ui32 entryFields,
+                std::size_t maxInFlight) {
+            Walker::SharedPtr walker (new Walker (visitor, entryFields, maxInFlight));
+            while (walker->jobQueues.size () < jobQueueCount) {
+                JobQueue::SharedPtr jobQueue = jobQueuePool.GetJobQueue ();
+                if (jobQueue.Get () == 0) {
+                    break;
+                }
+                walker->jobQueues.push_back (jobQueue);
+                walker->runLoops.push_back (jobQueue.Get ());
+            }
+            return walker->Walk (path);
+        }
+
+        namespace {
+            struct SummaryVisitor : public DirectoryWalker::Visitor {
+                std::atomic<ui64> files;
+                std::atomic<ui64> folders;
+                std::atomic<ui64> links;
+                std::atomic<ui64> other;
+                std::atomic<ui64> errors;
+                std::atomic<ui64> size;
+
+                SummaryVisitor () :
+                    files (0),
+                    folders (0),
+                    links (0),
+                    other (0),
+                    errors (0),
+                    size (0) {}
+
+                virtual void VisitEntry (
+                        const std::string & /*directory*/,
+                        const Directory::Entry &entry) override {
+                    switch (entry.type) {
+                        case Directory::Entry::File:
+                            ++files;
+                            size += entry.size;
+                            break;
+                        case Directory::Entry::Folder:
+                            ++folders;
+                            break;
+                        case Directory::Entry::Link:
+                            ++links;
+                            break;
+                        default:
+                            ++other;
+                            break;
+                    }
+                }
+                virtual void HandleError (
+                        const std::string & /*directory*/,
+                        const Exception & /*exception*/) override {
+                    ++errors;
+                }
+            };
+        }
+
+        DirectoryWalker::Summary DirectoryWalker::GetSummary (
+                const std::string &path,
+                RunLoop &runLoop,
+                std::size_t maxInFlight) {
+            SummaryVisitor visitor;
+            Walk (path, visitor, runLoop,
+                Directory::ENTRY_TYPE | Directory::ENTRY_SIZE, maxInFlight);
+            Summary summary;
+            summary.files = visitor.files;
+            summary.folders = visitor.folders;
+            summary.links = visitor.links;
+            summary.other = visitor.other;
+            summary.errors = visitor.errors;
+            summary.size = visitor.size;
+            return summary;
+        }
+
+        namespace {
+            struct DeleteVisitor : public DirectoryWalker::Visitor {
+                Mutex mutex;
+                bool failed;
+                Exception exception;
+
+                DeleteVisitor () :
+                    failed (false) {}
+
+                virtual void VisitEntry (
+                        const std::string &directory,
+                        const Directory::Entry &entry) override {
+                    if (entry.type != Directory::Entry::Folder) {
+                        THEKOGANS_UTIL_TRY {
+                            File::Delete (MakePath (directory, entry.name));
+                        }
+                        THEKOGANS_UTIL_CATCH (Exception) {
+                            HandleError (directory, exception);
+                        }
+                    }
+                }
+                virtual void LeaveDirectory (const std::string &directory) override {
+                    Directory::Delete (directory, false);
+                }
+                virtual void HandleError (
+                        const std::string & /*directory*/,
+                        const Exception &exception_) override {
+                    LockGuard<Mutex> guard (mutex);
+                    if (!failed) {
+                        failed = true;
+                        exception = exception_;
+                    }
+                }
+            };
+        }
+
+        void DirectoryWalker::Delete (
+                const std::string &path,
+                RunLoop &runLoop,
+                std::size_t maxInFlight) {
+            DeleteVisitor visitor;
+            if (!Walk (path, visitor, runLoop, Directory::ENTRY_TYPE, maxInFlight)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Delete of %s was cancelled.", path.c_str ());
+            }
+            if (visitor.failed) {
+                THEKOGANS_UTIL_EXCEPTION_NOTE_LOCATION (visitor.exception);
+                throw visitor.exception;
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
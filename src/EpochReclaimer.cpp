@@ -0,0 +1,96 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/EpochReclaimer.h"
+
+namespace thekogans {
+    namespace util {
+
+        EpochReclaimer::Guard::Guard (EpochReclaimer &reclaimer) :
+                record (static_cast<ThreadRecord &> (reclaimer.GetThreadRecord ())) {
+            if (record.nestingLevel++ == 0) {
+                record.readerEpoch.store (
+                    (reclaimer.epoch.load (std::memory_order_relaxed) << 1) | 1,
+                    std::memory_order_relaxed);
+                // Announce the epoch before reading any shared pointers.
+                // Pairs with the fence in TryAdvanceEpoch.
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+            }
+        }
+
+        EpochReclaimer::Guard::~Guard () {
+            if (--record.nestingLevel == 0) {
+                record.readerEpoch.store (0, std::memory_order_release);
+            }
+        }
+
+        void EpochReclaimer::ThreadRecord::Clear () {
+            readerEpoch.store (0, std::memory_order_release);
+            nestingLevel = 0;
+        }
+
+        Reclaimer::ThreadRecord *EpochReclaimer::NewThreadRecord () {
+            return new ThreadRecord;
+        }
+
+        void EpochReclaimer::OnRetire (RetiredObject &object) {
+            // The object is already unlinked. Readers that
+            // can still see it entered in this epoch (or before).
+            object.stamp = epoch.load (std::memory_order_acquire);
+        }
+
+        std::size_t EpochReclaimer::Scan (RetiredObjects &retired) {
+            TryAdvanceEpoch ();
+            ui64 currentEpoch = epoch.load (std::memory_order_acquire);
+            std::size_t reclaimed = 0;
+            std::size_t kept = 0;
+            for (std::size_t i = 0, count = retired.size (); i < count; ++i) {
+                if (retired[i].stamp + 2 <= currentEpoch) {
+                    retired[i].Reclaim ();
+                    ++reclaimed;
+                }
+                else {
+                    retired[kept++] = retired[i];
+                }
+            }
+            retired.resize (kept, RetiredObject (0, 0, 0, 0));
+            return reclaimed;
+        }
+
+        void EpochReclaimer::TryAdvanceEpoch () {
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            ui64 currentEpoch = epoch.load (std::memory_order_relaxed);
+            for (Reclaimer::ThreadRecord *record = threadRecords.load (std::memory_order_acquire);
+                    record != 0; record = record->next) {
+                ui64 readerEpoch = static_cast<ThreadRecord *> (record)->readerEpoch.load (
+                    std::memory_order_acquire);
+                if ((readerEpoch & 1) != 0 && (readerEpoch >> 1) != currentEpoch) {
+                    // A reader is still in a critical section
+                    // that started in an earlier epoch.
+                    return;
+                }
+            }
+            epoch.compare_exchange_strong (
+                currentEpoch, currentEpoch + 1, std::memory_order_acq_rel);
+        }
+
+        EpochReclaimer &EpochReclaimer::GetGlobalEpochReclaimer () {
+            return GlobalEpochReclaimer::Instance ();
+        }
+
+    } // namespace util
+} // namespace thekogans
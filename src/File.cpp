@@ -22,8 +22,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <cstring>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 #include "thekogans/util/Buffer.h"
+#include "thekogans/util/DefaultAllocator.h"
 #include "thekogans/util/Path.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/LoggerMgr.h"
@@ -474,5 +478,383 @@ namespace thekogans {
         #endif // defined (TOOLCHAIN_OS_Windows)
         }
 
+        namespace {
+            inline ui64 AlignDown (
+                    ui64 value,
+                    ui64 alignment) {
+                return value & ~(alignment - 1);
+            }
+
+            inline ui64 AlignUp (
+                    ui64 value,
+                    ui64 alignment) {
+                return (value + alignment - 1) & ~(alignment - 1);
+            }
+
+            inline bool IsAligned (
+                    const void *ptr,
+                    std::size_t alignment) {
+                return ((std::uintptr_t)ptr & (alignment - 1)) == 0;
+            }
+
+            inline bool IsPowerOf2 (ui64 value) {
+                return value != 0 && (value & (value - 1)) == 0;
+            }
+
+            const std::size_t DEFAULT_DIRECT_BLOCK_SIZE = 4096;
+        }
+
+        DirectFile::DirectFile (
+                Endianness endianness,
+                const std::string &path,
+                i32 flags,
+                std::size_t stageSize_) :
+                SimpleFile (endianness),
+                blockSize (DEFAULT_DIRECT_BLOCK_SIZE),
+                requestedStageSize (stageSize_),
+                stageSize (0),
+                stage (0),
+                stageOffset (0),
+                stageLength (0),
+                position (0),
+                size (0),
+                diskSize (0) {
+            Open (path, flags);
+        }
+
+        DirectFile::~DirectFile () {
+            THEKOGANS_UTIL_TRY {
+                Close ();
+            }
+            THEKOGANS_UTIL_CATCH_AND_LOG_SUBSYSTEM (THEKOGANS_UTIL)
+        }
+
+        void DirectFile::Open (
+                const std::string &path,
+                i32 flags,
+                i32 /*mode*/) {
+            Close ();
+            Flags<i32> flags_ (flags);
+            bool append = flags_.Test (Append);
+            // DirectFile uses positional I/O so O_APPEND is out. And
+            // since unaligned writes need to read-modify-write the
+            // blocks they touch, a writable file must also be readable.
+            flags_.Set (Append, false);
+            if (flags_.Test (WriteOnly)) {
+                flags_.Set (ReadOnly, true);
+            }
+            SimpleFile::Open (path, flags_);
+        #if defined (TOOLCHAIN_OS_Windows)
+            DWORD dwDesiredAccess = GENERIC_READ;
+            DWORD dwShareMode = FILE_SHARE_READ;
+            if (flags_.Test (WriteOnly)) {
+                dwDesiredAccess |= GENERIC_WRITE;
+                dwShareMode |= FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+            }
+            THEKOGANS_UTIL_HANDLE directHandle = ReOpenFile (handle,
+                dwDesiredAccess, dwShareMode, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH);
+            if (directHandle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                File::Close ();
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    errorCode, " (%s)", path.c_str ());
+            }
+            CloseHandle (handle);
+            handle = directHandle;
+            // Covers both 512 byte and 4K (advanced format) sector devices.
+            blockSize = DEFAULT_DIRECT_BLOCK_SIZE;
+        #else // defined (TOOLCHAIN_OS_Windows)
+        #if defined (TOOLCHAIN_OS_Linux)
+            i32 fileFlags = fcntl (handle, F_GETFL);
+            if (fileFlags < 0 || fcntl (handle, F_SETFL, fileFlags | O_DIRECT) < 0) {
+        #else // defined (TOOLCHAIN_OS_Linux)
+            if (fcntl (handle, F_NOCACHE, 1) < 0) {
+        #endif // defined (TOOLCHAIN_OS_Linux)
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                File::Close ();
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    errorCode, " (%s)", path.c_str ());
+            }
+            blockSize = 0;
+        #if defined (TOOLCHAIN_OS_Linux) && defined (STATX_DIOALIGN)
+            // Linux 6.1+ reports the exact direct I/O alignment requirements.
+            struct statx stx;
+            if (statx (handle, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+                    (stx.stx_mask & STATX_DIOALIGN) != 0) {
+                blockSize = std::max (stx.stx_dio_mem_align, stx.stx_dio_offset_align);
+            }
+        #endif // defined (TOOLCHAIN_OS_Linux) && defined (STATX_DIOALIGN)
+            if (!IsPowerOf2 (blockSize)) {
+                STAT_STRUCT buf;
+                blockSize = FSTAT_FUNC (handle, &buf) == 0 &&
+                    IsPowerOf2 (buf.st_blksize) ?
+                    buf.st_blksize : DEFAULT_DIRECT_BLOCK_SIZE;
+            }
+        #endif // defined (TOOLCHAIN_OS_Windows)
+            stageSize = (std::size_t)AlignUp (
+                std::max (requestedStageSize, blockSize), blockSize);
+            allocator.reset (new AlignedAllocator (DefaultAllocator::Instance (), blockSize));
+            stage = (ui8 *)allocator->Alloc (stageSize);
+            stageOffset = 0;
+            stageLength = 0;
+            size = diskSize = File::GetSize ();
+            position = append ? size : 0;
+        }
+
+        void DirectFile::Close () {
+            if (IsOpen ()) {
+                Flush ();
+                allocator->Free (stage, stageSize);
+                stage = 0;
+                allocator.reset ();
+                File::Close ();
+            }
+        }
+
+        void DirectFile::Flush () {
+            FlushStage ();
+            if (diskSize != size) {
+                File::SetSize (size);
+                diskSize = size;
+            }
+            File::Flush ();
+        }
+
+        std::size_t DirectFile::Read (
+                void *buffer,
+                std::size_t count) {
+            FlushStage ();
+            if (position >= size) {
+                return 0;
+            }
+            if (count > size - position) {
+                count = (std::size_t)(size - position);
+            }
+            ui8 *ptr = (ui8 *)buffer;
+            std::size_t countRead = 0;
+            while (countRead < count) {
+                std::size_t remaining = count - countRead;
+                if ((position & (blockSize - 1)) == 0 &&
+                        IsAligned (ptr, blockSize) && remaining >= blockSize) {
+                    // Aligned, read straight in to the caller's buffer.
+                    std::size_t length = (std::size_t)AlignDown (remaining, blockSize);
+                    std::size_t read = PRead (ptr, length, position);
+                    ptr += read;
+                    position += read;
+                    countRead += read;
+                    if (read < length) {
+                        break;
+                    }
+                }
+                else {
+                    // Bounce the unaligned head/tail through the stage.
+                    ui64 blockOffset = AlignDown (position, blockSize);
+                    std::size_t head = (std::size_t)(position - blockOffset);
+                    std::size_t length = (std::size_t)std::min<ui64> (
+                        AlignUp (head + remaining, blockSize), stageSize);
+                    std::size_t read = PRead (stage, length, blockOffset);
+                    if (read <= head) {
+                        break;
+                    }
+                    std::size_t copy = std::min (remaining, read - head);
+                    memcpy (ptr, stage + head, copy);
+                    ptr += copy;
+                    position += copy;
+                    countRead += copy;
+                }
+            }
+            return countRead;
+        }
+
+        std::size_t DirectFile::Write (
+                const void *buffer,
+                std::size_t count) {
+            const ui8 *ptr = (const ui8 *)buffer;
+            std::size_t remaining = count;
+            while (remaining > 0) {
+                if (stageLength == 0 && (position & (blockSize - 1)) == 0 &&
+                        IsAligned (ptr, blockSize) && remaining >= blockSize) {
+                    // Aligned, write straight from the caller's buffer.
+                    std::size_t length = (std::size_t)AlignDown (remaining, blockSize);
+                    PWrite (ptr, length, position);
+                    ptr += length;
+                    remaining -= length;
+                    position += length;
+                    if (diskSize < position) {
+                        diskSize = position;
+                    }
+                    if (size < position) {
+                        size = position;
+                    }
+                    continue;
+                }
+                if (stageLength > 0 && position != stageOffset + stageLength) {
+                    // Not contiguous with what's staged.
+                    FlushStage ();
+                }
+                if (stageLength == 0) {
+                    stageOffset = AlignDown (position, blockSize);
+                    stageLength = (std::size_t)(position - stageOffset);
+                    if (stageLength > 0) {
+                        // Unaligned head, read-modify-write the first block.
+                        std::size_t read = stageOffset < diskSize ?
+                            PRead (stage, blockSize, stageOffset) : 0;
+                        if (read < stageLength) {
+                            memset (stage + read, 0, stageLength - read);
+                        }
+                    }
+                }
+                std::size_t length = std::min (remaining, stageSize - stageLength);
+                memcpy (stage + stageLength, ptr, length);
+                stageLength += length;
+                ptr += length;
+                remaining -= length;
+                position += length;
+                if (size < position) {
+                    size = position;
+                }
+                if (stageLength == stageSize) {
+                    FlushStage ();
+                }
+            }
+            return count;
+        }
+
+        i64 DirectFile::Tell () const {
+            return (i64)position;
+        }
+
+        i64 DirectFile::Seek (
+                i64 offset,
+                i32 fromWhere) {
+            i64 newPosition =
+                fromWhere == SEEK_SET ? offset :
+                fromWhere == SEEK_CUR ? (i64)position + offset :
+                fromWhere == SEEK_END ? (i64)size + offset : -1;
+            if (newPosition < 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL, " (%s)", path.c_str ());
+            }
+            position = (ui64)newPosition;
+            return newPosition;
+        }
+
+        ui64 DirectFile::GetSize () const {
+            return size;
+        }
+
+        void DirectFile::SetSize (ui64 newSize) {
+            FlushStage ();
+            File::SetSize (newSize);
+            size = diskSize = newSize;
+        }
+
+        void DirectFile::FlushStage () {
+            if (stageLength > 0) {
+                std::size_t length = (std::size_t)AlignUp (stageLength, blockSize);
+                if (length > stageLength) {
+                    // Unaligned tail. Pad it out to a block boundary with
+                    // whatever is on disk past it (or zeros if nothing is).
+                    std::size_t tailBlock = length - blockSize;
+                    std::size_t tailLength = stageLength - tailBlock;
+                    std::size_t read = 0;
+                    if (stageOffset + stageLength < diskSize) {
+                        std::vector<ui8> tail (stage + tailBlock, stage + stageLength);
+                        read = PRead (stage + tailBlock, blockSize, stageOffset + tailBlock);
+                        memcpy (stage + tailBlock, tail.data (), tailLength);
+                    }
+                    if (read < blockSize) {
+                        std::size_t padded = std::max (read, tailLength);
+                        memset (stage + tailBlock + padded, 0, blockSize - padded);
+                    }
+                }
+                PWrite (stage, length, stageOffset);
+                if (diskSize < stageOffset + length) {
+                    diskSize = stageOffset + length;
+                }
+                stageLength = 0;
+            }
+        }
+
+        std::size_t DirectFile::PRead (
+                void *buffer,
+                std::size_t count,
+                ui64 offset) {
+            std::size_t countRead = 0;
+            while (countRead < count) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                OVERLAPPED overlapped;
+                memset (&overlapped, 0, sizeof (OVERLAPPED));
+                ULARGE_INTEGER uli;
+                uli.QuadPart = offset + countRead;
+                overlapped.Offset = uli.LowPart;
+                overlapped.OffsetHigh = uli.HighPart;
+                DWORD read = 0;
+                if (!ReadFile (handle, (ui8 *)buffer + countRead,
+                        (DWORD)(count - countRead), &read, &overlapped)) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    if (errorCode == ERROR_HANDLE_EOF) {
+                        break;
+                    }
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                        errorCode, " (%s)", path.c_str ());
+                }
+            #else // defined (TOOLCHAIN_OS_Windows)
+                ssize_t read = pread (handle, (ui8 *)buffer + countRead,
+                    count - countRead, offset + countRead);
+                if (read < 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    if (errorCode == EINTR) {
+                        continue;
+                    }
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                        errorCode, " (%s)", path.c_str ());
+                }
+            #endif // defined (TOOLCHAIN_OS_Windows)
+                countRead += (std::size_t)read;
+                // Short read means end of file (and the next
+                // offset is probably no longer aligned).
+                if (read == 0 || ((std::size_t)read & (blockSize - 1)) != 0) {
+                    break;
+                }
+            }
+            return countRead;
+        }
+
+        void DirectFile::PWrite (
+                const void *buffer,
+                std::size_t count,
+                ui64 offset) {
+            std::size_t countWritten = 0;
+            while (countWritten < count) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                OVERLAPPED overlapped;
+                memset (&overlapped, 0, sizeof (OVERLAPPED));
+                ULARGE_INTEGER uli;
+                uli.QuadPart = offset + countWritten;
+                overlapped.Offset = uli.LowPart;
+                overlapped.OffsetHigh = uli.HighPart;
+                DWORD written = 0;
+                if (!WriteFile (handle, (const ui8 *)buffer + countWritten,
+                        (DWORD)(count - countWritten), &written, &overlapped)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", path.c_str ());
+                }
+            #else // defined (TOOLCHAIN_OS_Windows)
+                ssize_t written = pwrite (handle, (const ui8 *)buffer + countWritten,
+                    count - countWritten, offset + countWritten);
+                if (written < 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    if (errorCode == EINTR) {
+                        continue;
+                    }
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                        errorCode, " (%s)", path.c_str ());
+                }
+            #endif // defined (TOOLCHAIN_OS_Windows)
+                countWritten += (std::size_t)written;
+            }
+        }
+
     } // namespace util
 } // namespace thekogans
@@ -26,11 +26,156 @@
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/Console.h"
 #include "thekogans/util/StringUtils.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/GUID.h"
 #include "thekogans/util/FileLogger.h"
 
 namespace thekogans {
     namespace util {
 
+        namespace {
+            std::string GetArchivePath (
+                    const std::string &path,
+                    std::size_t archiveNumber,
+                    bool compressArchives) {
+                return FormatString (
+                    "%s." THEKOGANS_UTIL_SIZE_T_FORMAT "%s",
+                    path.c_str (),
+                    archiveNumber,
+                    compressArchives ? ".z" : "");
+            }
+
+            void RenameFile (
+                    const std::string &from,
+                    const std::string &to) {
+                if (rename (from.c_str (), to.c_str ()) < 0) {
+                    THEKOGANS_UTIL_THROW_POSIX_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_POSIX_OS_ERROR_CODE);
+                }
+            }
+
+            // Shift the existing archives (dropping the oldest) and
+            // move the freshly rotated log in to the *.1 slot.
+            struct ArchiveJob : public RunLoop::Job {
+                const std::string path;
+                const std::size_t archiveCount;
+                const bool compressArchives;
+                const std::string rotatedPath;
+
+                ArchiveJob (
+                    const std::string &path_,
+                    std::size_t archiveCount_,
+                    bool compressArchives_,
+                    const std::string &rotatedPath_) :
+                    path (path_),
+                    archiveCount (archiveCount_),
+                    compressArchives (compressArchives_),
+                    rotatedPath (rotatedPath_) {}
+
+                virtual void Execute (const std::atomic<bool> & /*done*/) throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        std::size_t archiveNumber = archiveCount;
+                        std::string archivePath =
+                            GetArchivePath (path, archiveNumber--, compressArchives);
+                        if (Path (archivePath).Exists ()) {
+                            File::Delete (archivePath);
+                        }
+                        while (archiveNumber > 0) {
+                            std::string archivePath =
+                                GetArchivePath (path, archiveNumber, compressArchives);
+                            if (Path (archivePath).Exists ()) {
+                                RenameFile (
+                                    archivePath,
+                                    GetArchivePath (path, archiveNumber + 1, compressArchives));
+                            }
+                            --archiveNumber;
+                        }
+                    #if defined (THEKOGANS_UTIL_HAVE_ZLIB)
+                        if (compressArchives) {
+                            Buffer buffer;
+                            {
+                                ReadOnlyFile rotatedFile (HostEndian, rotatedPath);
+                                buffer.Resize ((std::size_t)rotatedFile.GetSize ());
+                                if (buffer.GetLength () > 0) {
+                                    buffer.AdvanceWriteOffset (
+                                        rotatedFile.Read (buffer.GetWritePtr (), buffer.GetLength ()));
+                                }
+                            }
+                            Buffer deflated = buffer.Deflate ();
+                            SimpleFile archiveFile (
+                                HostEndian,
+                                GetArchivePath (path, 1, compressArchives),
+                                SimpleFile::WriteOnly | SimpleFile::Create | SimpleFile::Truncate);
+                            if (deflated.GetDataAvailableForReading () > 0) {
+                                archiveFile.Write (
+                                    deflated.GetReadPtr (),
+                                    deflated.GetDataAvailableForReading ());
+                            }
+                            File::Delete (rotatedPath);
+                        }
+                        else
+                    #endif // defined (THEKOGANS_UTIL_HAVE_ZLIB)
+                        {
+                            RenameFile (rotatedPath, GetArchivePath (path, 1, false));
+                        }
+                    }
+                    THEKOGANS_UTIL_CATCH (std::exception) {
+                        // There is very little we can do here.
+                    #if defined (THEKOGANS_UTIL_CONFIG_Debug)
+                        Console::Instance ().PrintString (
+                            FormatString (
+                                "FileLogger::ArchiveJob::Execute: %s\n",
+                                exception.what ()),
+                            Console::StdErr,
+                            Console::TEXT_COLOR_RED);
+                    #else // defined (THEKOGANS_UTIL_CONFIG_Debug)
+                        (void)exception;
+                    #endif // defined (THEKOGANS_UTIL_CONFIG_Debug)
+                    }
+                }
+            };
+        }
+
+        FileLogger::FileLogger (
+                const std::string &path_,
+                bool archive_,
+                std::size_t archiveCount_,
+                std::size_t maxLogFileSize_,
+                ui32 level,
+                bool compressArchives_,
+                std::size_t maxBufferSize,
+                const TimeSpec &flushInterval) :
+                Logger (level),
+                path (path_),
+                archive (archive_),
+                archiveCount (archiveCount_),
+                maxLogFileSize (maxLogFileSize_),
+                compressArchives (compressArchives_),
+                buffer (HostEndian, maxBufferSize),
+                fileSize (0),
+                timer (*this, "FileLogger", false) {
+            if (maxBufferSize > 0 && flushInterval != TimeSpec::Zero) {
+                timer.Start (flushInterval, true);
+            }
+        }
+
+        FileLogger::~FileLogger () {
+            timer.Stop ();
+            timer.WaitForCallbacks ();
+            THEKOGANS_UTIL_TRY {
+                {
+                    LockGuard<Mutex> guard (mutex);
+                    FlushBuffer ();
+                }
+                if (archiveQueue.Get () != 0) {
+                    archiveQueue->WaitForIdle ();
+                }
+            }
+            THEKOGANS_UTIL_CATCH_ANY {
+                // Can't let exceptions escape the dtor.
+            }
+        }
+
         void FileLogger::Log (
                 const std::string & /*subsystem*/,
                 ui32 level,
@@ -38,14 +183,32 @@ namespace thekogans {
                 const std::string &message) throw () {
             if (level <= this->level && (!header.empty () || !message.empty ())) {
                 THEKOGANS_UTIL_TRY {
-                    ArchiveLog ();
-                    OpenFile ();
-                    file.Seek (0, SEEK_END);
-                    if (!header.empty ()) {
-                        file.Write (header.c_str (), header.size ());
+                    LockGuard<Mutex> guard (mutex);
+                    std::size_t entrySize = header.size () + message.size ();
+                    if (entrySize > buffer.GetDataAvailableForWriting ()) {
+                        FlushBuffer ();
+                    }
+                    if (entrySize <= buffer.GetDataAvailableForWriting ()) {
+                        if (!header.empty ()) {
+                            buffer.Write (header.c_str (), header.size ());
+                        }
+                        if (!message.empty ()) {
+                            buffer.Write (message.c_str (), message.size ());
+                        }
+                        if (buffer.IsFull ()) {
+                            FlushBuffer ();
+                        }
                     }
-                    if (!message.empty ()) {
-                        file.Write (message.c_str (), message.size ());
+                    else {
+                        // Entry is bigger than the buffer. Write it out directly.
+                        OpenFile ();
+                        if (!header.empty ()) {
+                            fileSize += file.Write (header.c_str (), header.size ());
+                        }
+                        if (!message.empty ()) {
+                            fileSize += file.Write (message.c_str (), message.size ());
+                        }
+                        ArchiveLog ();
                     }
                 }
                 THEKOGANS_UTIL_CATCH (std::exception) {
@@ -64,45 +227,75 @@ namespace thekogans {
             }
         }
 
+        void FileLogger::Flush (const TimeSpec &timeSpec) {
+            {
+                LockGuard<Mutex> guard (mutex);
+                FlushBuffer ();
+                if (file.IsOpen ()) {
+                    file.Flush ();
+                }
+            }
+            if (archiveQueue.Get () != 0) {
+                archiveQueue->WaitForIdle (timeSpec);
+            }
+        }
+
+        void FileLogger::Alarm (Timer & /*timer*/) throw () {
+            THEKOGANS_UTIL_TRY {
+                LockGuard<Mutex> guard (mutex);
+                FlushBuffer ();
+            }
+            THEKOGANS_UTIL_CATCH (std::exception) {
+                // There is very little we can do here.
+            #if defined (THEKOGANS_UTIL_CONFIG_Debug)
+                Console::Instance ().PrintString (
+                    FormatString (
+                        "FileLogger::Alarm: %s\n",
+                        exception.what ()),
+                    Console::StdErr,
+                    Console::TEXT_COLOR_RED);
+            #else // defined (THEKOGANS_UTIL_CONFIG_Debug)
+                (void)exception;
+            #endif // defined (THEKOGANS_UTIL_CONFIG_Debug)
+            }
+        }
+
+        void FileLogger::FlushBuffer () {
+            if (!buffer.IsEmpty ()) {
+                OpenFile ();
+                fileSize += file.Write (
+                    buffer.GetReadPtr (),
+                    buffer.GetDataAvailableForReading ());
+                buffer.Rewind ();
+                ArchiveLog ();
+            }
+        }
+
         void FileLogger::ArchiveLog () {
-            if (archive && archiveCount > 0 && Path (path).Exists ()) {
-                Directory::Entry entry (path);
-                if (entry.size > maxLogFileSize) {
-                    file.Close ();
-                    std::size_t archiveNumber = archiveCount;
-                    std::string archivePath =
-                        FormatString (
-                            "%s." THEKOGANS_UTIL_SIZE_T_FORMAT,
-                            path.c_str (),
-                            archiveNumber--);
-                    if (Path (archivePath).Exists ()) {
-                        File::Delete (archivePath);
-                    }
-                    while (archiveNumber > 0) {
-                        std::string archivePath =
-                            FormatString (
-                                "%s." THEKOGANS_UTIL_SIZE_T_FORMAT,
-                                path.c_str (),
-                                archiveNumber);
-                        if (Path (archivePath).Exists ()) {
-                            std::string nextArchivePath =
-                                FormatString (
-                                    "%s." THEKOGANS_UTIL_SIZE_T_FORMAT,
-                                    path.c_str (),
-                                    archiveNumber + 1);
-                            if (rename (archivePath.c_str (), nextArchivePath.c_str ()) < 0) {
-                                THEKOGANS_UTIL_THROW_POSIX_ERROR_CODE_EXCEPTION (
-                                    THEKOGANS_UTIL_POSIX_OS_ERROR_CODE);
-                            }
-                        }
-                        --archiveNumber;
-                    }
-                    if (rename (path.c_str (), std::string (path + ".1").c_str ()) < 0) {
-                        THEKOGANS_UTIL_THROW_POSIX_ERROR_CODE_EXCEPTION (
-                            THEKOGANS_UTIL_POSIX_OS_ERROR_CODE);
-                    }
-                    file.Open (path, SimpleFile::ReadWrite | SimpleFile::Create);
+            if (archive && archiveCount > 0 && fileSize > maxLogFileSize) {
+                file.Close ();
+                fileSize = 0;
+                // Renaming the log out of the way is cheap. The rest
+                // (shifting the archives and compression) is done on
+                // archiveQueue so as not to block the logger.
+                std::string rotatedPath =
+                    FormatString (
+                        "%s.%s",
+                        path.c_str (),
+                        GUID::FromRandom ().ToString ().c_str ());
+                RenameFile (path, rotatedPath);
+                if (archiveQueue.Get () == 0) {
+                    archiveQueue.Reset (
+                        new JobQueue (
+                            "FileLogger",
+                            RunLoop::JobExecutionPolicy::SharedPtr (
+                                new RunLoop::FIFOJobExecutionPolicy),
+                            1,
+                            THEKOGANS_UTIL_LOW_THREAD_PRIORITY));
                 }
+                archiveQueue->EnqJob (
+                    RunLoop::Job::SharedPtr (
+                        new ArchiveJob (path, archiveCount, compressArchives, rotatedPath)));
             }
         }
 
@@ -114,7 +307,9 @@ namespace thekogans {
             }
             if (!file.IsOpen ()) {
                 file.Open (path, SimpleFile::ReadWrite | SimpleFile::Create | SimpleFile::Append);
+                fileSize = file.GetSize ();
             }
+            file.Seek (0, SEEK_END);
         }
 
     } // namespace util
@@ -18,7 +18,7 @@
 #include <cassert>
 #include "thekogans/util/SpinLock.h"
 #include "thekogans/util/LockGuard.h"
-#include "thekogans/util/File.h"
+#include "thekogans/util/MappedFile.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/StringUtils.h"
 #include "thekogans/util/Hash.h"
@@ -106,13 +106,16 @@ namespace thekogans {
                 const std::string &path,
                 std::size_t digestSize,
                 Digest &digest) {
-            ReadOnlyFile file (HostEndian, path);
+            MappedFile file (path);
             if (file.GetSize () > 0) {
                 Init (digestSize);
-                ui8 buffer[4096];
-                for (std::size_t size = file.Read (buffer, 4096);
-                        size != 0; size = file.Read (buffer, 4096)) {
-                    Update (buffer, size);
+                // Hash straight from the page cache. The file is mapped
+                // in windows to keep address space usage bounded.
+                const std::size_t WINDOW_SIZE = 64 * 1024 * 1024;
+                for (ui64 offset = 0; offset < file.GetSize (); offset += WINDOW_SIZE) {
+                    MappedRegion::SharedPtr region = file.Map (offset, WINDOW_SIZE);
+                    region->Advise (MappedRegion::AdviceSequential);
+                    Update (region->GetData (), region->GetLength ());
                 }
                 Final (digest);
             }
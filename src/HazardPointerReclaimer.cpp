@@ -0,0 +1,113 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <vector>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HazardPointerReclaimer.h"
+
+namespace thekogans {
+    namespace util {
+
+        HazardPointerReclaimer::Guard::Guard (HazardPointerReclaimer &reclaimer) :
+                record (static_cast<ThreadRecord &> (reclaimer.GetThreadRecord ())),
+                index (0),
+                hazardPointer (0) {
+            for (; index < HAZARD_POINTER_COUNT; ++index) {
+                if ((record.usedHazardPointers & (1 << index)) == 0) {
+                    record.usedHazardPointers |= 1 << index;
+                    hazardPointer = &record.hazardPointers[index];
+                    return;
+                }
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Out of hazard pointers (%u per thread).",
+                HAZARD_POINTER_COUNT);
+        }
+
+        HazardPointerReclaimer::Guard::~Guard () {
+            hazardPointer->store (0, std::memory_order_release);
+            record.usedHazardPointers &= ~(1 << index);
+        }
+
+        HazardPointerReclaimer::ThreadRecord::ThreadRecord () :
+                usedHazardPointers (0) {
+            for (std::size_t i = 0; i < HAZARD_POINTER_COUNT; ++i) {
+                hazardPointers[i].store (0, std::memory_order_relaxed);
+            }
+        }
+
+        void HazardPointerReclaimer::ThreadRecord::Clear () {
+            for (std::size_t i = 0; i < HAZARD_POINTER_COUNT; ++i) {
+                hazardPointers[i].store (0, std::memory_order_relaxed);
+            }
+            usedHazardPointers = 0;
+        }
+
+        Reclaimer::ThreadRecord *HazardPointerReclaimer::NewThreadRecord () {
+            return new ThreadRecord;
+        }
+
+        std::size_t HazardPointerReclaimer::Scan (RetiredObjects &retired) {
+            // Pairs with the seq_cst store/load in Guard::Protect. Either the
+            // reader sees the object unlinked (and moves on), or we see it's
+            // hazard pointer.
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            std::vector<void *> hazardPointers;
+            hazardPointers.reserve (threadRecordCount.load (std::memory_order_relaxed) * HAZARD_POINTER_COUNT);
+            for (Reclaimer::ThreadRecord *record = threadRecords.load (std::memory_order_acquire);
+                    record != 0; record = record->next) {
+                ThreadRecord *threadRecord = static_cast<ThreadRecord *> (record);
+                for (std::size_t i = 0; i < HAZARD_POINTER_COUNT; ++i) {
+                    void *hazardPointer =
+                        threadRecord->hazardPointers[i].load (std::memory_order_acquire);
+                    if (hazardPointer != 0) {
+                        hazardPointers.push_back (hazardPointer);
+                    }
+                }
+            }
+            std::sort (hazardPointers.begin (), hazardPointers.end ());
+            std::size_t reclaimed = 0;
+            std::size_t kept = 0;
+            for (std::size_t i = 0, count = retired.size (); i < count; ++i) {
+                if (std::binary_search (
+                        hazardPointers.begin (),
+                        hazardPointers.end (),
+                        retired[i].object)) {
+                    retired[kept++] = retired[i];
+                }
+                else {
+                    retired[i].Reclaim ();
+                    ++reclaimed;
+                }
+            }
+            retired.resize (kept, RetiredObject (0, 0, 0, 0));
+            return reclaimed;
+        }
+
+        std::size_t HazardPointerReclaimer::GetScanThreshold () const {
+            std::size_t threshold =
+                2 * threadRecordCount.load (std::memory_order_relaxed) * HAZARD_POINTER_COUNT;
+            return threshold > retireThreshold ? threshold : retireThreshold;
+        }
+
+        HazardPointerReclaimer &HazardPointerReclaimer::GetGlobalHazardPointerReclaimer () {
+            return GlobalHazardPointerReclaimer::Instance ();
+        }
+
+    } // namespace util
+} // namespace thekogans
@@ -0,0 +1,447 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include "thekogans/util/Constants.h"
+#include "thekogans/util/SizeT.h"
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Histogram.h"
+
+namespace thekogans {
+    namespace util {
+
+        #if !defined (THEKOGANS_UTIL_MIN_HISTOGRAMS_IN_PAGE)
+            #define THEKOGANS_UTIL_MIN_HISTOGRAMS_IN_PAGE 16
+        #endif // !defined (THEKOGANS_UTIL_MIN_HISTOGRAMS_IN_PAGE)
+
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE (
+            Histogram,
+            1,
+            SpinLock,
+            THEKOGANS_UTIL_MIN_HISTOGRAMS_IN_PAGE,
+            DefaultAllocator::Instance ())
+
+        namespace {
+            // Index of the most significant set bit (value > 0).
+            inline std::size_t GetMostSignificantBit (ui64 value) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                std::size_t bit = 0;
+                for (std::size_t shift = 32; shift > 0; shift >>= 1) {
+                    if (value >= (THEKOGANS_UTIL_UI64_LITERAL (1) << shift)) {
+                        value >>= shift;
+                        bit += shift;
+                    }
+                }
+                return bit;
+            #else // defined (TOOLCHAIN_OS_Windows)
+                return 63 - __builtin_clzll (value);
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+        }
+
+        Histogram &Histogram::operator = (const Histogram &histogram) {
+            if (&histogram != this) {
+                count = histogram.count;
+                total = histogram.total;
+                min = histogram.min;
+                max = histogram.max;
+                buckets = histogram.buckets;
+            }
+            return *this;
+        }
+
+        std::size_t Histogram::GetBucketIndex (ui64 value) {
+            if (value < SUB_BUCKET_COUNT) {
+                return (std::size_t)value;
+            }
+            // value >> shift is in [SUB_BUCKET_COUNT, 2 * SUB_BUCKET_COUNT).
+            std::size_t shift = GetMostSignificantBit (value) - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKET_COUNT +
+                (std::size_t)(value >> shift) - SUB_BUCKET_COUNT;
+        }
+
+        ui64 Histogram::GetBucketLowerBound (std::size_t index) {
+            if (index < SUB_BUCKET_COUNT) {
+                return index;
+            }
+            std::size_t shift = index / SUB_BUCKET_COUNT - 1;
+            return (ui64)(SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+        }
+
+        ui64 Histogram::GetBucketUpperBound (std::size_t index) {
+            if (index < SUB_BUCKET_COUNT) {
+                return index;
+            }
+            std::size_t shift = index / SUB_BUCKET_COUNT - 1;
+            return GetBucketLowerBound (index) +
+                ((THEKOGANS_UTIL_UI64_LITERAL (1) << shift) - 1);
+        }
+
+        void Histogram::Record (ui64 value) {
+            if (count == 0 || min > value) {
+                min = value;
+            }
+            if (count == 0 || max < value) {
+                max = value;
+            }
+            ++count;
+            total += value;
+            AddToBucket (GetBucketIndex (value), 1);
+        }
+
+        void Histogram::Merge (const Histogram &histogram) {
+            if (histogram.count > 0) {
+                if (count == 0 || min > histogram.min) {
+                    min = histogram.min;
+                }
+                if (count == 0 || max < histogram.max) {
+                    max = histogram.max;
+                }
+                count += histogram.count;
+                total += histogram.total;
+                for (std::size_t i = 0, bucketsSize = histogram.buckets.size (); i < bucketsSize; ++i) {
+                    if (histogram.buckets[i] > 0) {
+                        AddToBucket (i, histogram.buckets[i]);
+                    }
+                }
+            }
+        }
+
+        ui64 Histogram::GetPercentile (f64 percentile) const {
+            if (count == 0) {
+                return 0;
+            }
+            if (percentile <= 0.0) {
+                return min;
+            }
+            if (percentile >= 100.0) {
+                return max;
+            }
+            // Rank of the value we're after (1 based).
+            ui64 rank = (ui64)std::ceil (percentile / 100.0 * count);
+            if (rank == 0) {
+                rank = 1;
+            }
+            ui64 seen = 0;
+            for (std::size_t i = 0, bucketsSize = buckets.size (); i < bucketsSize; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    ui64 value = GetBucketUpperBound (i);
+                    return value < min ? min : value > max ? max : value;
+                }
+            }
+            return max;
+        }
+
+        void Histogram::Reset () {
+            count = 0;
+            total = 0;
+            min = 0;
+            max = 0;
+            buckets.clear ();
+        }
+
+        std::size_t Histogram::Size () const {
+            std::size_t size =
+                Serializer::Size (count) +
+                Serializer::Size (total) +
+                Serializer::Size (min) +
+                Serializer::Size (max);
+            // Only the non-empty buckets are serialized.
+            SizeT bucketCount = 0;
+            for (std::size_t i = 0, bucketsSize = buckets.size (); i < bucketsSize; ++i) {
+                if (buckets[i] > 0) {
+                    ++bucketCount;
+                }
+            }
+            return size + Serializer::Size (bucketCount) +
+                bucketCount * (Serializer::Size (ui32 ()) + Serializer::Size (ui64 ()));
+        }
+
+        void Histogram::Read (
+                const BinHeader & /*header*/,
+                Serializer &serializer) {
+            buckets.clear ();
+            SizeT bucketCount;
+            serializer >> count >> total >> min >> max >> bucketCount;
+            for (std::size_t i = 0; i < bucketCount; ++i) {
+                ui32 index;
+                ui64 bucket;
+                serializer >> index >> bucket;
+                AddToBucket (index, bucket);
+            }
+        }
+
+        void Histogram::Write (Serializer &serializer) const {
+            SizeT bucketCount = 0;
+            for (std::size_t i = 0, bucketsSize = buckets.size (); i < bucketsSize; ++i) {
+                if (buckets[i] > 0) {
+                    ++bucketCount;
+                }
+            }
+            serializer << count << total << min << max << bucketCount;
+            for (std::size_t i = 0, bucketsSize = buckets.size (); i < bucketsSize; ++i) {
+                if (buckets[i] > 0) {
+                    serializer << (ui32)i << buckets[i];
+                }
+            }
+        }
+
+        const char * const Histogram::TAG_HISTOGRAM = "Histogram";
+        const char * const Histogram::ATTR_COUNT = "Count";
+        const char * const Histogram::ATTR_TOTAL = "Total";
+        const char * const Histogram::ATTR_MIN = "Min";
+        const char * const Histogram::ATTR_MAX = "Max";
+        const char * const Histogram::ATTR_MEAN = "Mean";
+        const char * const Histogram::ATTR_P50 = "P50";
+        const char * const Histogram::ATTR_P90 = "P90";
+        const char * const Histogram::ATTR_P99 = "P99";
+        const char * const Histogram::ATTR_P999 = "P999";
+        const char * const Histogram::TAG_BUCKETS = "Buckets";
+        const char * const Histogram::TAG_BUCKET = "Bucket";
+        const char * const Histogram::ATTR_INDEX = "Index";
+
+        // NOTE: Mean and the percentiles are derived from the buckets.
+        // They are written for the benefit of the consumer and ignored
+        // on read.
+
+        void Histogram::Read (
+                const TextHeader & /*header*/,
+                const pugi::xml_node &node) {
+            buckets.clear ();
+            count = stringToui64 (node.attribute (ATTR_COUNT).value ());
+            total = stringToui64 (node.attribute (ATTR_TOTAL).value ());
+            min = stringToui64 (node.attribute (ATTR_MIN).value ());
+            max = stringToui64 (node.attribute (ATTR_MAX).value ());
+            pugi::xml_node bucketsNode = node.child (TAG_BUCKETS);
+            for (pugi::xml_node child = bucketsNode.first_child ();
+                    !child.empty (); child = child.next_sibling ()) {
+                if (child.type () == pugi::node_element && std::string (child.name ()) == TAG_BUCKET) {
+                    AddToBucket (
+                        stringTosize_t (child.attribute (ATTR_INDEX).value ()),
+                        stringToui64 (child.attribute (ATTR_COUNT).value ()));
+                }
+            }
+        }
+
+        void Histogram::Write (pugi::xml_node &node) const {
+            node.append_attribute (ATTR_COUNT).set_value (ui64Tostring (count).c_str ());
+            node.append_attribute (ATTR_TOTAL).set_value (ui64Tostring (total).c_str ());
+            node.append_attribute (ATTR_MIN).set_value (ui64Tostring (min).c_str ());
+            node.append_attribute (ATTR_MAX).set_value (ui64Tostring (max).c_str ());
+            node.append_attribute (ATTR_MEAN).set_value (ui64Tostring (GetMean ()).c_str ());
+            node.append_attribute (ATTR_P50).set_value (ui64Tostring (GetPercentile (50.0)).c_str ());
+            node.append_attribute (ATTR_P90).set_value (ui64Tostring (GetPercentile (90.0)).c_str ());
+            node.append_attribute (ATTR_P99).set_value (ui64Tostring (GetPercentile (99.0)).c_str ());
+            node.append_attribute (ATTR_P999).set_value (ui64Tostring (GetPercentile (99.9)).c_str ());
+            pugi::xml_node bucketsNode = node.append_child (TAG_BUCKETS);
+            for (std::size_t i = 0, bucketsSize = buckets.size (); i < bucketsSize; ++i) {
+                if (buckets[i] > 0) {
+                    pugi::xml_node bucketNode = bucketsNode.append_child (TAG_BUCKET);
+                    bucketNode.append_attribute (ATTR_INDEX).set_value (size_tTostring (i).c_str ());
+                    bucketNode.append_attribute (ATTR_COUNT).set_value (ui64Tostring (buckets[i]).c_str ());
+                }
+            }
+        }
+
+        void Histogram::Read (
+                const TextHeader & /*header*/,
+                const JSON::Object &object) {
+            buckets.clear ();
+            count = object.Get<JSON::Number> (ATTR_COUNT)->To<ui64> ();
+            total = object.Get<JSON::Number> (ATTR_TOTAL)->To<ui64> ();
+            min = object.Get<JSON::Number> (ATTR_MIN)->To<ui64> ();
+            max = object.Get<JSON::Number> (ATTR_MAX)->To<ui64> ();
+            JSON::Array::SharedPtr bucketsArray = object.Get<JSON::Array> (TAG_BUCKETS);
+            if (bucketsArray.Get () != 0) {
+                for (std::size_t i = 0, valueCount = bucketsArray->GetValueCount (); i < valueCount; ++i) {
+                    JSON::Object::SharedPtr bucketObject = bucketsArray->Get<JSON::Object> (i);
+                    AddToBucket (
+                        (std::size_t)bucketObject->Get<JSON::Number> (ATTR_INDEX)->To<ui64> (),
+                        bucketObject->Get<JSON::Number> (ATTR_COUNT)->To<ui64> ());
+                }
+            }
+        }
+
+        void Histogram::Write (JSON::Object &object) const {
+            object.Add (ATTR_COUNT, count);
+            object.Add (ATTR_TOTAL, total);
+            object.Add (ATTR_MIN, min);
+            object.Add (ATTR_MAX, max);
+            object.Add (ATTR_MEAN, GetMean ());
+            object.Add (ATTR_P50, GetPercentile (50.0));
+            object.Add (ATTR_P90, GetPercentile (90.0));
+            object.Add (ATTR_P99, GetPercentile (99.0));
+            object.Add (ATTR_P999, GetPercentile (99.9));
+            JSON::Array::SharedPtr bucketsArray (new JSON::Array);
+            for (std::size_t i = 0, bucketsSize = buckets.size (); i < bucketsSize; ++i) {
+                if (buckets[i] > 0) {
+                    JSON::Object::SharedPtr bucketObject (new JSON::Object);
+                    bucketObject->Add (ATTR_INDEX, (ui64)i);
+                    bucketObject->Add (ATTR_COUNT, buckets[i]);
+                    bucketsArray->Add (bucketObject);
+                }
+            }
+            object.Add (TAG_BUCKETS, bucketsArray);
+        }
+
+        void Histogram::AddToBucket (
+                std::size_t index,
+                ui64 count_) {
+            if (index >= BUCKET_COUNT) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            if (buckets.empty ()) {
+                buckets.resize (BUCKET_COUNT);
+            }
+            buckets[index] += count_;
+        }
+
+        struct ConcurrentHistogram::Shard {
+            // Keep the shards from sharing cache lines.
+            ui8 pad1[THEKOGANS_UTIL_CACHE_LINE_SIZE];
+            std::atomic<ui64> count;
+            std::atomic<ui64> total;
+            std::atomic<ui64> min;
+            std::atomic<ui64> max;
+            std::atomic<ui64> buckets[Histogram::BUCKET_COUNT];
+            ui8 pad2[THEKOGANS_UTIL_CACHE_LINE_SIZE];
+
+            Shard () {
+                Reset ();
+            }
+
+            void Record (ui64 value) {
+                // Shards are shared only when there are more recording
+                // threads than shards. Most of the time these loops will
+                // either not execute or succeed on the first try.
+                ui64 min_ = min.load (std::memory_order_relaxed);
+                while (min_ > value &&
+                    !min.compare_exchange_weak (min_, value, std::memory_order_relaxed)) {}
+                ui64 max_ = max.load (std::memory_order_relaxed);
+                while (max_ < value &&
+                    !max.compare_exchange_weak (max_, value, std::memory_order_relaxed)) {}
+                buckets[Histogram::GetBucketIndex (value)].fetch_add (1, std::memory_order_relaxed);
+                total.fetch_add (value, std::memory_order_relaxed);
+                count.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            void Snapshot (Histogram &histogram) const {
+                if (count.load (std::memory_order_relaxed) > 0) {
+                    // Count what's in the buckets (and not the count member)
+                    // so that the percentiles are consistent even if values
+                    // are being recorded while we read.
+                    ui64 count_ = 0;
+                    for (std::size_t i = 0; i < Histogram::BUCKET_COUNT; ++i) {
+                        ui64 bucket = buckets[i].load (std::memory_order_relaxed);
+                        if (bucket > 0) {
+                            histogram.AddToBucket (i, bucket);
+                            count_ += bucket;
+                        }
+                    }
+                    if (count_ > 0) {
+                        ui64 min_ = min.load (std::memory_order_relaxed);
+                        ui64 max_ = max.load (std::memory_order_relaxed);
+                        if (histogram.count == 0 || histogram.min > min_) {
+                            histogram.min = min_;
+                        }
+                        if (histogram.count == 0 || histogram.max < max_) {
+                            histogram.max = max_;
+                        }
+                        histogram.count += count_;
+                        histogram.total += total.load (std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            void Reset () {
+                count.store (0, std::memory_order_relaxed);
+                total.store (0, std::memory_order_relaxed);
+                min.store (UI64_MAX, std::memory_order_relaxed);
+                max.store (0, std::memory_order_relaxed);
+                for (std::size_t i = 0; i < Histogram::BUCKET_COUNT; ++i) {
+                    buckets[i].store (0, std::memory_order_relaxed);
+                }
+            }
+        };
+
+        namespace {
+            // Threads are assigned shards round robin on first use.
+            std::atomic<std::size_t> nextShardIndex (0);
+            thread_local std::size_t shardIndex = nextShardIndex++;
+        }
+
+        ConcurrentHistogram::ConcurrentHistogram (std::size_t shardCount_) :
+                shardCount (shardCount_),
+                shards (0) {
+            if (shardCount == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            shards = new std::atomic<Shard *>[shardCount];
+            for (std::size_t i = 0; i < shardCount; ++i) {
+                shards[i] = 0;
+            }
+        }
+
+        ConcurrentHistogram::~ConcurrentHistogram () {
+            for (std::size_t i = 0; i < shardCount; ++i) {
+                delete shards[i].load ();
+            }
+            delete [] shards;
+        }
+
+        void ConcurrentHistogram::Record (ui64 value) {
+            std::atomic<Shard *> &slot = shards[shardIndex % shardCount];
+            Shard *shard = slot.load (std::memory_order_acquire);
+            if (shard == 0) {
+                Shard *newShard = new Shard;
+                if (slot.compare_exchange_strong (shard, newShard, std::memory_order_acq_rel)) {
+                    shard = newShard;
+                }
+                else {
+                    // Another thread sharing this slot beat us to it.
+                    delete newShard;
+                }
+            }
+            shard->Record (value);
+        }
+
+        void ConcurrentHistogram::Snapshot (Histogram &histogram) const {
+            histogram.Reset ();
+            for (std::size_t i = 0; i < shardCount; ++i) {
+                Shard *shard = shards[i].load (std::memory_order_acquire);
+                if (shard != 0) {
+                    shard->Snapshot (histogram);
+                }
+            }
+        }
+
+        void ConcurrentHistogram::Reset () {
+            for (std::size_t i = 0; i < shardCount; ++i) {
+                Shard *shard = shards[i].load (std::memory_order_acquire);
+                if (shard != 0) {
+                    shard->Reset ();
+                }
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cassert>
+#include <atomic>
 #include "thekogans/util/LockGuard.h"
 #include "thekogans/util/HRTimer.h"
 #include "thekogans/util/Exception.h"
@@ -27,25 +29,215 @@ namespace thekogans {
 
         void JobQueue::State::Worker::Run () throw () {
             RunLoop::WorkerInitializer workerInitializer (state->workerCallback);
+            // Only elastic queue workers time out waiting for jobs.
+            const TimeSpec &timeSpec =
+                state->IsElastic () ? state->idleTimeout : TimeSpec::Infinite;
+            ui64 lastJobTime = HRTimer::Click ();
             while (!state->done) {
-                Job *job = state->DeqJob ();
+                bool handoff = false;
+                ++state->idleWorkers;
+                Job *job = state->handoffJobs.get () != 0 ?
+                    state->DeqHandoffJob (handoff, timeSpec) : state->DeqJob (true, timeSpec);
+                --state->idleWorkers;
                 if (job != 0) {
+                    // If we were the last idle worker, whatever
+                    // is left in the queue might need a hand.
+                    state->GrowWorkers ();
+                    state->ExecuteJob (job, handoff);
+                    lastJobTime = HRTimer::Click ();
+                }
+                else if (timeSpec != TimeSpec::Infinite &&
+                        HRTimer::ToTimeSpec (
+                            HRTimer::ComputeElapsedTime (
+                                lastJobTime, HRTimer::Click ())) >= state->idleTimeout &&
+                        state->RetireWorker (this)) {
+                    break;
+                }
+            }
+            ThreadReaper::Instance ().ReapThread (this);
+        }
+
+        RunLoop::Job *JobQueue::State::DeqHandoffJob (
+                bool &handoff,
+                const TimeSpec &timeSpec) {
+            while (!done) {
+                // Acquire the slot before looking for a job so that a
+                // job found on the ring can't be overtaken by RunJobInline.
+                if (AcquireSlot ()) {
+                    Job *job = 0;
+                    if (handoffJobs->Pop (job)) {
+                        std::atomic_thread_fence (std::memory_order_seq_cst);
+                        if (waitingProducers > 0) {
+                            LockGuard<Mutex> guard (jobsMutex);
+                            handoffNotFull.SignalAll ();
+                        }
+                        handoff = true;
+                        return job;
+                    }
+                    {
+                        LockGuard<Mutex> guard (jobsMutex);
+                        if (!done && !paused && !pendingJobs.empty ()) {
+                            job = jobExecutionPolicy->DeqJob (*this);
+                            runningJobs.push_back (job);
+                            handoff = false;
+                            return job;
+                        }
+                    }
+                    ReleaseSlot ();
+                }
+                LockGuard<Mutex> guard (jobsMutex);
+                ++sleepingWorkers;
+                // Producers bump the ring position and then check sleepingWorkers,
+                // we bump sleepingWorkers and then check the ring. The fences
+                // guarantee at least one of us sees the other.
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+                if (!done && (busyWorkers >= workerCount ||
+                        (handoffJobs->IsEmpty () && (paused || pendingJobs.empty ()))) &&
+                        !jobsNotEmpty.Wait (timeSpec)) {
+                    --sleepingWorkers;
+                    break;
+                }
+                --sleepingWorkers;
+            }
+            return 0;
+        }
+
+        void JobQueue::State::ExecuteJob (
+                Job *job,
+                bool handoff) {
+            ui64 start = 0;
+            ui64 end = 0;
+            // Short circuit cancelled pending jobs.
+            if (!job->ShouldStop (done)) {
+                start = HRTimer::Click ();
+                job->SetState (Job::Running);
+                job->Prologue (done);
+                job->Execute (done);
+                job->Epilogue (done);
+                job->Succeed (done);
+                end = HRTimer::Click ();
+            }
+            if (handoffJobs.get () != 0) {
+                // Release the slot before reporting back. Completing
+                // a job can start another one (see Pipeline).
+                ReleaseSlot ();
+            }
+            if (handoff) {
+                FinishedHandoffJob (job, start, end);
+            }
+            else {
+                FinishedJob (job, start, end);
+            }
+        }
+
+        void JobQueue::State::FinishedHandoffJob (
+                Job *job,
+                ui64 start,
+                ui64 end) {
+            assert (job != 0);
+            RecordJobTimes (job, start, end);
+            {
+                LockGuard<Mutex> guard (jobsMutex);
+                stats.Update (job, start, end);
+                --handoffJobCount;
+                if (IsEmpty ()) {
+                    idle.SignalAll ();
+                }
+            }
+            job->SetState (RunLoop::Job::Completed);
+            job->Release ();
+        }
+
+        bool JobQueue::State::AcquireSlot () {
+            std::size_t busy = busyWorkers.load (std::memory_order_relaxed);
+            while (busy < workerCount) {
+                if (busyWorkers.compare_exchange_weak (busy, busy + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void JobQueue::State::ReleaseSlot () {
+            --busyWorkers;
+            // A worker that failed to acquire a slot (because RunJobInline
+            // had it) might have gone to sleep with work waiting for it.
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            if (sleepingWorkers > 0) {
+                LockGuard<Mutex> guard (jobsMutex);
+                if (!handoffJobs->IsEmpty () || (!paused && !pendingJobs.empty ())) {
+                    jobsNotEmpty.Signal ();
+                }
+            }
+        }
+
+        bool JobQueue::State::IsEmpty () const {
+            return pendingJobs.empty () && runningJobs.empty () && handoffJobCount == 0;
+        }
+
+        void JobQueue::State::AddWorker () {
+            std::size_t index = workers.size ();
+            std::string workerName;
+            if (!name.empty ()) {
+                if (workerCount > 1) {
+                    workerName = FormatString ("%s-" THEKOGANS_UTIL_SIZE_T_FORMAT, name.c_str (), index);
+                }
+                else {
+                    workerName = name;
+                }
+            }
+            workers.push_back (new Worker (SharedPtr (this), workerName, index));
+            if (maxWorkers < workers.size ()) {
+                maxWorkers = workers.size ();
+            }
+        }
+
+        void JobQueue::State::GrowWorkers () {
+            if (IsElastic () && !done) {
+                std::size_t backlog = handoffJobs.get () != 0 ? handoffJobs->GetSize () : 0;
+                {
+                    LockGuard<Mutex> guard (jobsMutex);
+                    if (!paused) {
+                        backlog += pendingJobs.size ();
+                    }
+                }
+                if (backlog <= idleWorkers) {
+                    backlogStart = 0;
+                }
+                else {
+                    ui64 now = HRTimer::Click ();
                     ui64 start = 0;
-                    ui64 end = 0;
-                    // Short circuit cancelled pending jobs.
-                    if (!job->ShouldStop (state->done)) {
-                        start = HRTimer::Click ();
-                        job->SetState (Job::Running);
-                        job->Prologue (state->done);
-                        job->Execute (state->done);
-                        job->Epilogue (state->done);
-                        job->Succeed (state->done);
-                        end = HRTimer::Click ();
+                    if (backlogStart.compare_exchange_strong (start, now)) {
+                        // First sighting, start the clock.
+                        start = now;
+                    }
+                    if (HRTimer::ToTimeSpec (HRTimer::ComputeElapsedTime (start, now)) >= spawnDelay) {
+                        LockGuard<Mutex> guard (workersMutex);
+                        // Restarting the clock makes sure we add at most one
+                        // worker per spawnDelay (even if we race other threads).
+                        if (!done && workers.size () < workerCount &&
+                                backlogStart.compare_exchange_strong (start, now)) {
+                            THEKOGANS_UTIL_TRY {
+                                AddWorker ();
+                                ++spawnedWorkers;
+                            }
+                            THEKOGANS_UTIL_CATCH_AND_LOG_SUBSYSTEM (THEKOGANS_UTIL)
+                        }
                     }
-                    state->FinishedJob (job, start, end);
                 }
             }
-            ThreadReaper::Instance ().ReapThread (this);
+        }
+
+        bool JobQueue::State::RetireWorker (Worker *worker) {
+            LockGuard<Mutex> guard (workersMutex);
+            // Stop clears the list, and Start might have replaced it
+            // with new workers. Only retire a worker that's on it.
+            if (!done && workers.contains (worker) && workers.size () > minWorkerCount) {
+                workers.erase (worker);
+                ++retiredWorkers;
+                return true;
+            }
+            return false;
         }
 
         THEKOGANS_UTIL_IMPLEMENT_HEAP_WITH_LOCK (JobQueue::State, SpinLock)
@@ -56,7 +248,11 @@ namespace thekogans {
                 std::size_t workerCount,
                 i32 workerPriority,
                 ui32 workerAffinity,
-                WorkerCallback *workerCallback) :
+                WorkerCallback *workerCallback,
+                std::size_t handoffCapacity,
+                std::size_t minWorkerCount,
+                const TimeSpec &idleTimeout,
+                const TimeSpec &spawnDelay) :
                 RunLoop (
                     RunLoop::State::SharedPtr (
                         new State (
@@ -65,7 +261,11 @@ namespace thekogans {
                             workerCount,
                             workerPriority,
                             workerAffinity,
-                            workerCallback))),
+                            workerCallback,
+                            handoffCapacity,
+                            minWorkerCount,
+                            idleTimeout,
+                            spawnDelay))),
                 state (dynamic_refcounted_sharedptr_cast<State> (RunLoop::state)) {
             if (workerCount > 0) {
                 Start ();
@@ -83,17 +283,10 @@ namespace thekogans {
         void JobQueue::Start () {
             LockGuard<Mutex> guard (state->workersMutex);
             state->done = false;
-            for (std::size_t i = state->workers.size (); i < state->workerCount; ++i) {
-                std::string workerName;
-                if (!state->name.empty ()) {
-                    if (state->workerCount > 1) {
-                        workerName = FormatString ("%s-" THEKOGANS_UTIL_SIZE_T_FORMAT, state->name.c_str (), i);
-                    }
-                    else {
-                        workerName = state->name;
-                    }
-                }
-                state->workers.push_back (new State::Worker (state, workerName));
+            state->backlogStart = 0;
+            // Elastic queues start small, and grow with the load.
+            while (state->workers.size () < state->minWorkerCount) {
+                state->AddWorker ();
             }
         }
 
@@ -111,6 +304,15 @@ namespace thekogans {
             state->done = true;
             // Wake up sleeping workers to allow them to exit.
             state->jobsNotEmpty.SignalAll ();
+            if (state->handoffJobs.get () != 0) {
+                // Handoff workers and producers check done with
+                // jobsMutex locked. Signal them under the lock so
+                // that the wakeup can't fall between the check and
+                // the wait.
+                LockGuard<Mutex> guard (state->jobsMutex);
+                state->jobsNotEmpty.SignalAll ();
+                state->handoffNotFull.SignalAll ();
+            }
             //  Cancel all running jobs.
             if (cancelRunningJobs) {
                 CancelRunningJobs ();
@@ -126,6 +328,12 @@ namespace thekogans {
                     state->runningJobs.push_back (job);
                     state->FinishedJob (job, 0, 0);
                 }
+                if (state->handoffJobs.get () != 0) {
+                    while (state->handoffJobs->Pop (job)) {
+                        job->Cancel ();
+                        state->FinishedHandoffJob (job, 0, 0);
+                    }
+                }
             }
             // Let everyone know the queue is idle.
             state->idle.SignalAll ();
@@ -136,6 +344,170 @@ namespace thekogans {
             return !state->workers.empty ();
         }
 
+        void JobQueue::Continue () {
+            RunLoop::Continue ();
+            if (state->handoffJobs.get () != 0) {
+                // Handoff workers wait on jobsNotEmpty, even when paused
+                // (see State::DeqHandoffJob).
+                LockGuard<Mutex> guard (state->jobsMutex);
+                state->jobsNotEmpty.SignalAll ();
+            }
+        }
+
+        bool JobQueue::WaitForIdle (const TimeSpec &timeSpec) {
+            LockGuard<Mutex> guard (state->jobsMutex);
+            if (timeSpec == TimeSpec::Infinite) {
+                while (IsRunning () && !state->IsEmpty ()) {
+                    state->idle.Wait ();
+                }
+            }
+            else {
+                TimeSpec now = GetCurrentTime ();
+                TimeSpec deadline = now + timeSpec;
+                while (IsRunning () && !state->IsEmpty () && deadline > now) {
+                    if (!state->idle.Wait (deadline - now)) {
+                        return false;
+                    }
+                    now = GetCurrentTime ();
+                }
+            }
+            return state->IsEmpty ();
+        }
+
+        bool JobQueue::IsIdle () {
+            LockGuard<Mutex> guard (state->jobsMutex);
+            return !IsRunning () || state->IsEmpty ();
+        }
+
+        bool JobQueue::EnqJob (
+                Job::SharedPtr job,
+                bool wait,
+                const TimeSpec &timeSpec) {
+            bool result = RunLoop::EnqJob (job);
+            if (result) {
+                state->GrowWorkers ();
+                result = !wait || WaitForJob (job, timeSpec);
+            }
+            return result;
+        }
+
+        bool JobQueue::EnqJobFront (
+                Job::SharedPtr job,
+                bool wait,
+                const TimeSpec &timeSpec) {
+            bool result = RunLoop::EnqJobFront (job);
+            if (result) {
+                state->GrowWorkers ();
+                result = !wait || WaitForJob (job, timeSpec);
+            }
+            return result;
+        }
+
+        RunLoop::Stats JobQueue::GetStats () {
+            Stats stats = RunLoop::GetStats ();
+            if (state->handoffJobs.get () != 0) {
+                stats.queueDepth += state->handoffJobs->GetSize ();
+                stats.UpdateQueueDepth (state->maxHandoffDepth);
+            }
+            {
+                LockGuard<Mutex> guard (state->workersMutex);
+                stats.workerCount = state->workers.size ();
+            }
+            stats.maxWorkerCount = state->maxWorkers;
+            stats.spawnedWorkers = state->spawnedWorkers;
+            stats.retiredWorkers = state->retiredWorkers;
+            return stats;
+        }
+
+        void JobQueue::ResetStats () {
+            RunLoop::ResetStats ();
+            state->maxHandoffDepth = 0;
+            {
+                LockGuard<Mutex> guard (state->workersMutex);
+                state->maxWorkers = state->workers.size ();
+            }
+            state->spawnedWorkers = 0;
+            state->retiredWorkers = 0;
+        }
+
+        void JobQueue::HandoffJob (Job::SharedPtr job) {
+            if (state->handoffJobs.get () == 0) {
+                EnqJob (job);
+            }
+            else if (job.Get () != 0 && job->IsCompleted ()) {
+                job->Reset (state->id);
+                job->AddRef ();
+                ++state->handoffJobCount;
+                while (state->done || !state->handoffJobs->Push (job.Get ())) {
+                    // The queue is stopped, or the ring is full. Wait
+                    // for a worker to make room.
+                    LockGuard<Mutex> guard (state->jobsMutex);
+                    if (state->done) {
+                        // Nobody is going to make room. Park the
+                        // job with the pending jobs (the same
+                        // thing EnqJob does to a stopped queue).
+                        THEKOGANS_UTIL_TRY {
+                            state->jobExecutionPolicy->EnqJob (*state, job.Get ());
+                        }
+                        THEKOGANS_UTIL_CATCH (Exception) {
+                            --state->handoffJobCount;
+                            job->Release ();
+                            THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                        }
+                        --state->handoffJobCount;
+                        state->jobsNotEmpty.Signal ();
+                        return;
+                    }
+                    ++state->waitingProducers;
+                    // See State::DeqHandoffJob.
+                    std::atomic_thread_fence (std::memory_order_seq_cst);
+                    if (state->handoffJobs->GetSize () >= state->handoffJobs->GetCapacity ()) {
+                        state->handoffNotFull.Wait ();
+                    }
+                    --state->waitingProducers;
+                }
+                std::size_t depth = state->handoffJobs->GetSize ();
+                std::size_t maxDepth = state->maxHandoffDepth.load (std::memory_order_relaxed);
+                while (maxDepth < depth &&
+                        !state->maxHandoffDepth.compare_exchange_weak (
+                            maxDepth, depth, std::memory_order_relaxed)) {}
+                // Only pay for the lock if there's a worker to wake up.
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+                if (state->sleepingWorkers > 0) {
+                    LockGuard<Mutex> guard (state->jobsMutex);
+                    state->jobsNotEmpty.Signal ();
+                }
+                state->GrowWorkers ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool JobQueue::RunJobInline (Job::SharedPtr job) {
+            if (job.Get () != 0 && job->IsCompleted ()) {
+                if (state->handoffJobs.get () != 0 && !state->done &&
+                        state->handoffJobs->IsEmpty () && state->AcquireSlot ()) {
+                    // Workers acquire their slot before popping the ring. If it's
+                    // still empty, there's no queued job this one would overtake.
+                    if (state->handoffJobs->IsEmpty ()) {
+                        job->Reset (state->id);
+                        job->AddRef ();
+                        ++state->handoffJobCount;
+                        state->ExecuteJob (job.Get (), true);
+                        return true;
+                    }
+                    state->ReleaseSlot ();
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         JobQueue::JobQueue (State::SharedPtr state_) :
                 RunLoop (dynamic_refcounted_sharedptr_cast<RunLoop::State> (state_)),
                 state (state_) {
@@ -35,17 +35,29 @@ namespace thekogans {
                 std::size_t workerCount_,
                 i32 workerPriority_,
                 ui32 workerAffinity_,
-                RunLoop::WorkerCallback *workerCallback_) :
+                RunLoop::WorkerCallback *workerCallback_,
+                std::size_t minWorkerCount_,
+                const TimeSpec &idleTimeout_,
+                const TimeSpec &spawnDelay_) :
                 minJobQueues (minJobQueues_),
                 maxJobQueues (maxJobQueues_),
                 name (name_),
                 jobExecutionPolicy (jobExecutionPolicy_),
                 workerCount (workerCount_),
+                minWorkerCount (minWorkerCount_),
+                idleTimeout (idleTimeout_),
+                spawnDelay (spawnDelay_),
                 workerPriority (workerPriority_),
                 workerAffinity (workerAffinity_),
                 workerCallback (workerCallback_),
                 idPool (0),
-                idle (mutex) {
+                idle (mutex),
+                jobQueueAvailable (mutex),
+                createdJobQueues (0),
+                deletedJobQueues (0),
+                maxJobQueueCount (minJobQueues_),
+                exhaustedCount (0),
+                timedOutCount (0) {
             // By requiring at least one JobQueue in reserve coupled
             // with the logic in ReleaseJobQueue below, we guarantee
             // that we avoid the deadlock associated with trying to
@@ -67,6 +79,9 @@ namespace thekogans {
                             workerPriority,
                             workerAffinity,
                             workerCallback,
+                            minWorkerCount,
+                            idleTimeout,
+                            spawnDelay,
                             *this));
                 }
             }
@@ -93,10 +108,22 @@ namespace thekogans {
         JobQueue::SharedPtr JobQueuePool::GetJobQueue (
                 std::size_t retries,
                 const TimeSpec &timeSpec) {
-            JobQueue *jobQueue = AcquireJobQueue ();
-            while (jobQueue == 0 && retries-- > 0) {
-                Sleep (timeSpec);
+            JobQueue *jobQueue = 0;
+            {
+                LockGuard<Mutex> guard (mutex);
                 jobQueue = AcquireJobQueue ();
+                if (jobQueue == 0) {
+                    ++exhaustedCount;
+                    // The pool is at maxJobQueues. Instead of polling,
+                    // wait for ReleaseJobQueue to return one.
+                    while (jobQueue == 0 && retries-- > 0) {
+                        jobQueueAvailable.Wait (timeSpec);
+                        jobQueue = AcquireJobQueue ();
+                    }
+                    if (jobQueue == 0) {
+                        ++timedOutCount;
+                    }
+                }
             }
             return util::JobQueue::SharedPtr (jobQueue);
         }
@@ -170,38 +197,64 @@ namespace thekogans {
             return borrowedJobQueues.empty ();
         }
 
+        JobQueuePool::Stats JobQueuePool::GetStats () {
+            Stats stats;
+            LockGuard<Mutex> guard (mutex);
+            stats.availableJobQueues = availableJobQueues.size ();
+            stats.borrowedJobQueues = borrowedJobQueues.size ();
+            stats.createdJobQueues = createdJobQueues;
+            stats.deletedJobQueues = deletedJobQueues;
+            stats.maxJobQueueCount = maxJobQueueCount;
+            stats.exhaustedCount = exhaustedCount;
+            stats.timedOutCount = timedOutCount;
+            return stats;
+        }
+
+        void JobQueuePool::ResetStats () {
+            LockGuard<Mutex> guard (mutex);
+            createdJobQueues = 0;
+            deletedJobQueues = 0;
+            maxJobQueueCount = availableJobQueues.size () + borrowedJobQueues.size ();
+            exhaustedCount = 0;
+            timedOutCount = 0;
+        }
+
         JobQueuePool::JobQueue *JobQueuePool::AcquireJobQueue () {
             JobQueue *jobQueue = 0;
-            {
-                LockGuard<Mutex> guard (mutex);
-                if (!availableJobQueues.empty ()) {
-                    // Borrow a job queue from the front of the pool.
-                    // This combined with ReleaseJobQueue putting
-                    // returned job queue at the front should
-                    // guarantee the best cache utilization.
-                    jobQueue = availableJobQueues.pop_front ();
-                }
-                else if (availableJobQueues.size () + borrowedJobQueues.size () < maxJobQueues) {
-                    std::string jobQueueName;
-                    if (!name.empty ()) {
-                        jobQueueName = FormatString (
-                            "%s-" THEKOGANS_UTIL_SIZE_T_FORMAT,
-                            name.c_str (),
-                            ++idPool);
-                    }
-                    jobQueue = new JobQueue (
-                        jobQueueName,
-                        jobExecutionPolicy,
-                        workerCount,
-                        workerPriority,
-                        workerAffinity,
-                        workerCallback,
-                        *this);
+            if (!availableJobQueues.empty ()) {
+                // Borrow a job queue from the front of the pool.
+                // This combined with ReleaseJobQueue putting
+                // returned job queue at the front should
+                // guarantee the best cache utilization.
+                jobQueue = availableJobQueues.pop_front ();
+            }
+            else if (availableJobQueues.size () + borrowedJobQueues.size () < maxJobQueues) {
+                std::string jobQueueName;
+                if (!name.empty ()) {
+                    jobQueueName = FormatString (
+                        "%s-" THEKOGANS_UTIL_SIZE_T_FORMAT,
+                        name.c_str (),
+                        ++idPool);
                 }
-                if (jobQueue != 0) {
-                    borrowedJobQueues.push_back (jobQueue);
+                jobQueue = new JobQueue (
+                    jobQueueName,
+                    jobExecutionPolicy,
+                    workerCount,
+                    workerPriority,
+                    workerAffinity,
+                    workerCallback,
+                    minWorkerCount,
+                    idleTimeout,
+                    spawnDelay,
+                    *this);
+                ++createdJobQueues;
+                if (maxJobQueueCount < borrowedJobQueues.size () + 1) {
+                    maxJobQueueCount = borrowedJobQueues.size () + 1;
                 }
             }
+            if (jobQueue != 0) {
+                borrowedJobQueues.push_back (jobQueue);
+            }
             return jobQueue;
         }
 
@@ -214,6 +267,8 @@ namespace thekogans {
                 // is borrowed from this pool, it will be the last
                 // one used, and it's cache will be nice and warm.
                 availableJobQueues.push_front (jobQueue);
+                // Hand it to the next GetJobQueue waiting on an exhausted pool.
+                jobQueueAvailable.Signal ();
                 // If the pool is idle, see if we need to remove excess job queues.
                 if (borrowedJobQueues.empty ()) {
                     while (availableJobQueues.size () > minJobQueues) {
@@ -221,6 +276,7 @@ namespace thekogans {
                         // guarantees that we avoid the deadlock associated
                         // with deleating the passed in jobQueue.
                         delete availableJobQueues.pop_back ();
+                        ++deletedJobQueues;
                     }
                     idle.SignalAll ();
                 }
@@ -564,6 +564,11 @@ namespace thekogans {
                     (*jt)->Flush (timeSpec);
                 }
             }
+            for (LoggerList::iterator
+                    it = defaultLoggers.begin (),
+                    end = defaultLoggers.end (); it != end; ++it) {
+                (*it)->Flush (timeSpec);
+            }
         }
 
         bool LoggerMgr::FilterEntry (Entry &entry) {
@@ -0,0 +1,295 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include "thekogans/util/Exception.h"
+#if defined (TOOLCHAIN_OS_Windows)
+    #include "thekogans/util/WindowsUtils.h"
+#elif defined (TOOLCHAIN_OS_Linux)
+    #include "thekogans/util/LinuxUtils.h"
+#elif defined (TOOLCHAIN_OS_OSX)
+    #include "thekogans/util/OSXUtils.h"
+#endif // defined (TOOLCHAIN_OS_Windows)
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/MappedFile.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Mapping offsets need to be aligned on this boundary.
+            std::size_t GetAllocationGranularity () {
+            #if defined (TOOLCHAIN_OS_Windows)
+                SYSTEM_INFO systemInfo;
+                GetSystemInfo (&systemInfo);
+                return systemInfo.dwAllocationGranularity;
+            #else // defined (TOOLCHAIN_OS_Windows)
+                return SystemInfo::Instance ().GetPageSize ();
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+        }
+
+        MappedRegion::~MappedRegion () {
+        #if defined (TOOLCHAIN_OS_Windows)
+            UnmapViewOfFile (base);
+        #else // defined (TOOLCHAIN_OS_Windows)
+            munmap (base, baseLength);
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+        void MappedRegion::Advise (
+                Advice advice,
+                std::size_t offset_,
+                std::size_t length_) {
+            ui8 *start;
+            std::size_t size;
+            GetRange (offset_, length_, start, size);
+        #if defined (TOOLCHAIN_OS_Windows)
+            if (advice == AdviceWillNeed) {
+            #if _WIN32_WINNT >= 0x0602
+                WIN32_MEMORY_RANGE_ENTRY range;
+                range.VirtualAddress = start;
+                range.NumberOfBytes = size;
+                if (!PrefetchVirtualMemory (GetCurrentProcess (), 1, &range, 0)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            #endif // _WIN32_WINNT >= 0x0602
+            }
+        #else // defined (TOOLCHAIN_OS_Windows)
+            int posixAdvice;
+            switch (advice) {
+                case AdviceSequential:
+                    posixAdvice = MADV_SEQUENTIAL;
+                    break;
+                case AdviceRandom:
+                    posixAdvice = MADV_RANDOM;
+                    break;
+                case AdviceWillNeed:
+                    posixAdvice = MADV_WILLNEED;
+                    break;
+                case AdviceDontNeed:
+                    posixAdvice = MADV_DONTNEED;
+                    break;
+                case AdviceHugePage:
+                #if defined (MADV_HUGEPAGE)
+                    posixAdvice = MADV_HUGEPAGE;
+                    break;
+                #else // defined (MADV_HUGEPAGE)
+                    // Not supported on this platform. It's only a hint.
+                    return;
+                #endif // defined (MADV_HUGEPAGE)
+                default:
+                    posixAdvice = MADV_NORMAL;
+                    break;
+            }
+            if (madvise (start, size, posixAdvice) != 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+        void MappedRegion::Sync (
+                bool wait,
+                std::size_t offset_,
+                std::size_t length_) {
+            if (!readOnly) {
+                ui8 *start;
+                std::size_t size;
+                GetRange (offset_, length_, start, size);
+            #if defined (TOOLCHAIN_OS_Windows)
+                if (!FlushViewOfFile (start, size)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                // FlushViewOfFile only schedules the writes.
+                // There's no way to wait for a range on Windows.
+                (void)wait;
+            #else // defined (TOOLCHAIN_OS_Windows)
+                if (msync (start, size, wait ? MS_SYNC : MS_ASYNC) != 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+        }
+
+        void MappedRegion::GetRange (
+                std::size_t offset_,
+                std::size_t length_,
+                ui8 *&start,
+                std::size_t &size) const {
+            if (offset_ > length) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            if (length_ == 0 || length_ > length - offset_) {
+                length_ = length - offset_;
+            }
+            // madvise/msync want page aligned addresses. Since the
+            // mapping starts on a page boundary, round down to it.
+            std::size_t pageSize = SystemInfo::Instance ().GetPageSize ();
+            std::size_t baseOffset = (std::size_t)(data + offset_ - (ui8 *)base);
+            std::size_t alignedOffset = baseOffset - baseOffset % pageSize;
+            start = (ui8 *)base + alignedOffset;
+            size = baseOffset - alignedOffset + length_;
+        }
+
+        MappedFile::MappedFile (
+                const std::string &path_,
+                bool readOnly_,
+                ui64 size_) :
+                path (path_),
+                handle (THEKOGANS_UTIL_INVALID_HANDLE_VALUE),
+            #if defined (TOOLCHAIN_OS_Windows)
+                mapping (0),
+            #endif // defined (TOOLCHAIN_OS_Windows)
+                size (0),
+                readOnly (readOnly_) {
+        #if defined (TOOLCHAIN_OS_Windows)
+            handle = CreateFileW (
+                UTF8ToUTF16 (path).c_str (),
+                readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                0,
+                readOnly || size_ == 0 ? OPEN_EXISTING : OPEN_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL,
+                0);
+            if (handle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", path.c_str ());
+            }
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx (handle, &fileSize)) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                CloseHandle (handle);
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+            }
+            size = fileSize.QuadPart;
+            if (!readOnly && size_ > size) {
+                size = size_;
+            }
+            // A zero length file can't be mapped.
+            if (size > 0) {
+                mapping = CreateFileMappingW (
+                    handle,
+                    0,
+                    readOnly ? PAGE_READONLY : PAGE_READWRITE,
+                    (DWORD)(size >> 32),
+                    (DWORD)size,
+                    0);
+                if (mapping == 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    CloseHandle (handle);
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+            }
+        #else // defined (TOOLCHAIN_OS_Windows)
+            handle = open (
+                path.c_str (),
+                readOnly ? O_RDONLY : O_RDWR | (size_ > 0 ? O_CREAT : 0),
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            if (handle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_AND_MESSAGE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE, " (%s)", path.c_str ());
+            }
+            STAT_STRUCT buf;
+            if (FSTAT_FUNC (handle, &buf) != 0) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                close (handle);
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+            }
+            size = buf.st_size;
+            if (!readOnly && size_ > size) {
+                if (FTRUNCATE_FUNC (handle, size_) != 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    close (handle);
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+                size = size_;
+            }
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+        MappedFile::~MappedFile () {
+        #if defined (TOOLCHAIN_OS_Windows)
+            if (mapping != 0) {
+                CloseHandle (mapping);
+            }
+            CloseHandle (handle);
+        #else // defined (TOOLCHAIN_OS_Windows)
+            close (handle);
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+        MappedRegion::SharedPtr MappedFile::Map (
+                ui64 offset,
+                std::size_t length,
+                bool readOnly_) {
+            if (offset >= size || (!readOnly_ && readOnly)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            if (length == 0 || length > size - offset) {
+                length = (std::size_t)(size - offset);
+            }
+            std::size_t granularity = GetAllocationGranularity ();
+            ui64 baseOffset = offset - offset % granularity;
+            std::size_t baseLength = (std::size_t)(offset - baseOffset) + length;
+        #if defined (TOOLCHAIN_OS_Windows)
+            void *base = MapViewOfFile (
+                mapping,
+                readOnly_ ? FILE_MAP_READ : FILE_MAP_READ | FILE_MAP_WRITE,
+                (DWORD)(baseOffset >> 32),
+                (DWORD)baseOffset,
+                baseLength);
+            if (base == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+        #else // defined (TOOLCHAIN_OS_Windows)
+            void *base = mmap (
+                0,
+                baseLength,
+                readOnly_ ? PROT_READ : PROT_READ | PROT_WRITE,
+                MAP_SHARED,
+                handle,
+                baseOffset);
+            if (base == MAP_FAILED) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+        #endif // defined (TOOLCHAIN_OS_Windows)
+            return MappedRegion::SharedPtr (
+                new MappedRegion (
+                    base,
+                    baseLength,
+                    (ui8 *)base + (offset - baseOffset),
+                    length,
+                    offset,
+                    readOnly_));
+        }
+
+    } // namespace util
+} // namespace thekogans
@@ -93,7 +93,8 @@ namespace thekogans {
             pipeline (pipeline_.state),
             stage (GetFirstStage ()),
             start (0),
-            end (0) {}
+            end (0),
+            pipelineEnqueueTime (0) {}
 
         const RunLoop::Id &Pipeline::Job::GetPipelineId () const {
             return pipeline->id;
@@ -106,6 +107,7 @@ namespace thekogans {
                 stage = GetFirstStage ();
                 start = 0;
                 end = 0;
+                pipelineEnqueueTime = enqueueTime;
             }
         }
 
@@ -122,16 +124,25 @@ namespace thekogans {
                     completed.Signal ();
                 }
                 else {
+                    // The job holds a credit on the stage it just finished
+                    // until it gets one on the next stage. If the next stage
+                    // is full, this (upstream stage) worker blocks, and the
+                    // backpressure propagates up the pipeline.
+                    std::size_t previous = stage;
                     if (!ShouldStop (pipeline->done) &&
-                            ((stage = GetNextStage ()) < pipeline->stages.size ())) {
+                            ((stage = GetNextStage ()) < pipeline->stages.size ()) &&
+                            pipeline->AcquireCredit (stage)) {
+                        pipeline->ReleaseCredit (previous);
                         THEKOGANS_UTIL_TRY {
-                            pipeline->stages[stage]->EnqJob (RunLoop::Job::SharedPtr (this));
+                            pipeline->EnqStageJob (this);
                             return;
                         }
                         THEKOGANS_UTIL_CATCH (Exception) {
                             Fail (exception);
                         }
+                        previous = stage;
                     }
+                    pipeline->ReleaseCredit (previous);
                     stage = pipeline->stages.size ();
                     End (pipeline->done);
                     end = HRTimer::Click ();
@@ -147,12 +158,14 @@ namespace thekogans {
                 if (job != 0) {
                     // Short circuit cancelled pending jobs.
                     if (!job->ShouldStop (state->done) &&
-                            ((job->stage = job->GetFirstStage ()) < state->stages.size ())) {
+                            ((job->stage = job->GetFirstStage ()) < state->stages.size ()) &&
+                            state->AcquireCredit (job->stage)) {
                         THEKOGANS_UTIL_TRY {
-                            state->stages[job->stage]->EnqJob (RunLoop::Job::SharedPtr (job));
+                            state->EnqStageJob (job);
                             continue;
                         }
                         THEKOGANS_UTIL_CATCH (Exception) {
+                            state->ReleaseCredit (job->stage);
                             job->Fail (exception);
                         }
                     }
@@ -181,12 +194,18 @@ namespace thekogans {
                 idle (jobsMutex),
                 paused (false),
                 notPaused (jobsMutex),
+                notFull (jobsMutex),
                 workerCount (workerCount_),
                 workerPriority (workerPriority_),
                 workerAffinity (workerAffinity_),
-                workerCallback (workerCallback_) {
+                workerCallback (workerCallback_),
+                creditWaiters (0),
+                creditAvailable (creditsMutex) {
             if (begin != 0 && end != 0 && jobExecutionPolicy.Get () != 0 && workerCount > 0) {
+                stageJobs.reset (new std::atomic<std::size_t>[end - begin]);
                 for (; begin != end; ++begin) {
+                    stageJobs[stages.size ()] = 0;
+                    stageCapacities.push_back (begin->capacity);
                     stages.push_back (
                         JobQueue::SharedPtr (
                             new JobQueue (
@@ -195,7 +214,9 @@ namespace thekogans {
                                 begin->workerCount,
                                 begin->workerPriority,
                                 begin->workerAffinity,
-                                begin->workerCallback)));
+                                begin->workerCallback,
+                                begin->handoffCapacity)));
+                    inlineStages.push_back (begin->inlineExecution && begin->handoffCapacity > 0);
                 }
             }
             else {
@@ -229,6 +250,7 @@ namespace thekogans {
             if (!done && !paused && !pendingJobs.empty ()) {
                 job = jobExecutionPolicy->DeqJob (*this);
                 runningJobs.push_back (job);
+                notFull.Signal ();
             }
             return job;
         }
@@ -238,6 +260,12 @@ namespace thekogans {
                 ui64 start,
                 ui64 end) {
             assert (job != 0);
+            if (job->IsSucceeded ()) {
+                if (job->pipelineEnqueueTime != 0) {
+                    waitTimes.Record (HRTimer::ComputeElapsedTime (job->pipelineEnqueueTime, start));
+                }
+                runTimes.Record (HRTimer::ComputeElapsedTime (start, end));
+            }
             {
                 LockGuard<Mutex> guard (jobsMutex);
                 stats.Update (job, start, end);
@@ -246,10 +274,59 @@ namespace thekogans {
                     idle.SignalAll ();
                 }
             }
+            // Jobs cancelled before entering the first stage are still
+            // on it. Move them past the last one, otherwise SetState
+            // would try to finish them again.
+            job->stage = stages.size ();
             job->SetState (RunLoop::Job::Completed);
             job->Release ();
         }
 
+        bool Pipeline::State::AcquireCredit (std::size_t stage) {
+            std::atomic<std::size_t> &jobs = stageJobs[stage];
+            std::size_t capacity = stageCapacities[stage];
+            if (capacity == 0) {
+                ++jobs;
+                return true;
+            }
+            while (!done) {
+                std::size_t count = jobs.load (std::memory_order_relaxed);
+                while (count < capacity) {
+                    if (jobs.compare_exchange_weak (count, count + 1)) {
+                        return true;
+                    }
+                }
+                LockGuard<Mutex> guard (creditsMutex);
+                ++creditWaiters;
+                // ReleaseCredit decrements the count and then checks
+                // creditWaiters. We do the opposite. The fences guarantee
+                // that at least one of us sees the other.
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+                if (!done && jobs >= capacity) {
+                    creditAvailable.Wait ();
+                }
+                --creditWaiters;
+            }
+            return false;
+        }
+
+        void Pipeline::State::ReleaseCredit (std::size_t stage) {
+            --stageJobs[stage];
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            if (creditWaiters > 0) {
+                LockGuard<Mutex> guard (creditsMutex);
+                creditAvailable.SignalAll ();
+            }
+        }
+
+        void Pipeline::State::EnqStageJob (Job *job) {
+            JobQueue::SharedPtr &queue = stages[job->stage];
+            RunLoop::Job::SharedPtr stageJob (job);
+            if (!inlineStages[job->stage] || !queue->RunJobInline (stageJob)) {
+                queue->HandoffJob (stageJob);
+            }
+        }
+
         bool Pipeline::Pause (
                 bool cancelRunningJobs,
                 const TimeSpec &timeSpec) {
@@ -324,7 +401,7 @@ namespace thekogans {
                         workerName = state->name;
                     }
                 }
-                state->workers.push_back (new State::Worker (state, workerName));
+                state->workers.push_back (new State::Worker (state, workerName, i));
             }
         }
 
@@ -332,10 +409,6 @@ namespace thekogans {
                 bool cancelRunningJobs,
                 bool cancelPendingJobs) {
             LockGuard<Mutex> guard (state->workersMutex);
-            // Stop the pipeline stages.
-            for (std::size_t i = 0, count = state->stages.size (); i < count; ++i) {
-                state->stages[i]->Stop (cancelRunningJobs, cancelPendingJobs);
-            }
             // Clear worker list in case Start is called again.
             // The worker threads are responsible for their own
             // lifetimes. Also do it before setting state->done = true
@@ -343,9 +416,26 @@ namespace thekogans {
             // list so as not to have a race leading to a crash.
             state->workers.clear ();
             // Preclude workers from dequeuing any more pending jobs.
+            // Do it before stopping the stages so that jobs completing
+            // a stage stop moving down the pipeline (and don't get
+            // stranded on a stopped stage).
             state->done = true;
             // Wake up sleeping workers to allow them to exit.
             state->jobsNotEmpty.SignalAll ();
+            {
+                // Wake up workers blocked on a full stage.
+                LockGuard<Mutex> guard (state->creditsMutex);
+                state->creditAvailable.SignalAll ();
+            }
+            {
+                // Wake up blocked AdmitJob callers.
+                LockGuard<Mutex> guard (state->jobsMutex);
+                state->notFull.SignalAll ();
+            }
+            // Stop the pipeline stages.
+            for (std::size_t i = 0, count = state->stages.size (); i < count; ++i) {
+                state->stages[i]->Stop (cancelRunningJobs, cancelPendingJobs);
+            }
             //  Cancel all running jobs.
             if (cancelRunningJobs) {
                 CancelRunningJobs ();
@@ -379,6 +469,7 @@ namespace thekogans {
                 {
                     LockGuard<Mutex> guard (state->jobsMutex);
                     state->jobExecutionPolicy->EnqJob (*state, job.Get ());
+                    state->stats.UpdateQueueDepth (state->pendingJobs.size ());
                     job->Reset (state->id);
                     job->AddRef ();
                     state->jobsNotEmpty.Signal ();
@@ -391,6 +482,41 @@ namespace thekogans {
             }
         }
 
+        bool Pipeline::AdmitJob (
+                Job::SharedPtr job,
+                const TimeSpec &timeSpec) {
+            if (job.Get () != 0 && job->IsCompleted () && job->GetPipelineId () == state->id) {
+                LockGuard<Mutex> guard (state->jobsMutex);
+                std::size_t maxJobs = state->jobExecutionPolicy->maxJobs;
+                if (timeSpec == TimeSpec::Infinite) {
+                    while (!state->done && state->pendingJobs.size () >= maxJobs) {
+                        state->notFull.Wait ();
+                    }
+                }
+                else if (timeSpec != TimeSpec::Zero) {
+                    TimeSpec now = GetCurrentTime ();
+                    TimeSpec deadline = now + timeSpec;
+                    while (!state->done && state->pendingJobs.size () >= maxJobs && deadline > now) {
+                        state->notFull.Wait (deadline - now);
+                        now = GetCurrentTime ();
+                    }
+                }
+                if (state->pendingJobs.size () < maxJobs) {
+                    state->jobExecutionPolicy->EnqJob (*state, job.Get ());
+                    state->stats.UpdateQueueDepth (state->pendingJobs.size ());
+                    job->Reset (state->id);
+                    job->AddRef ();
+                    state->jobsNotEmpty.Signal ();
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         std::pair<Pipeline::Job::SharedPtr, bool> Pipeline::EnqJob (
                 const LambdaJob::Function *&begin,
                 const LambdaJob::Function *&end,
@@ -410,6 +536,7 @@ namespace thekogans {
                 {
                     LockGuard<Mutex> guard (state->jobsMutex);
                     state->jobExecutionPolicy->EnqJobFront (*state, job.Get ());
+                    state->stats.UpdateQueueDepth (state->pendingJobs.size ());
                     job->Reset (state->id);
                     job->AddRef ();
                     state->jobsNotEmpty.Signal ();
@@ -741,8 +868,14 @@ namespace thekogans {
         }
 
         RunLoop::Stats Pipeline::GetStats () {
-            LockGuard<Mutex> guard (state->jobsMutex);
-            return state->stats;
+            RunLoop::Stats stats (state->id, state->name);
+            {
+                LockGuard<Mutex> guard (state->jobsMutex);
+                state->stats.queueDepth = state->pendingJobs.size ();
+                stats = state->stats;
+            }
+            GetJobTimes (stats.waitTime, stats.runTime);
+            return stats;
         }
 
         void Pipeline::ResetStats () {
@@ -750,11 +883,20 @@ namespace thekogans {
                 LockGuard<Mutex> guard (state->jobsMutex);
                 state->stats.Reset ();
             }
+            state->waitTimes.Reset ();
+            state->runTimes.Reset ();
             for (std::size_t i = 0, count = state->stages.size (); i < count; ++i) {
                 state->stages[i]->ResetStats ();
             }
         }
 
+        void Pipeline::GetJobTimes (
+                Histogram &waitTime,
+                Histogram &runTime) {
+            state->waitTimes.Snapshot (waitTime);
+            state->runTimes.Snapshot (runTime);
+        }
+
         bool Pipeline::IsIdle () {
             LockGuard<Mutex> guard (state->jobsMutex);
             return !IsRunning () || (state->pendingJobs.empty () && state->runningJobs.empty ());
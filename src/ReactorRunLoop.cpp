@@ -0,0 +1,371 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Linux)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <vector>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/ReactorRunLoop.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            ui32 ToEpollEvents (
+                    ui32 events,
+                    bool edgeTriggered) {
+                ui32 epollEvents = 0;
+                if ((events & ReactorRunLoop::EVENT_READ) != 0) {
+                    epollEvents |= EPOLLIN | EPOLLRDHUP;
+                }
+                if ((events & ReactorRunLoop::EVENT_WRITE) != 0) {
+                    epollEvents |= EPOLLOUT;
+                }
+                if (edgeTriggered) {
+                    epollEvents |= EPOLLET;
+                }
+                return epollEvents;
+            }
+
+            ui32 FromEpollEvents (ui32 epollEvents) {
+                ui32 events = 0;
+                if ((epollEvents & (EPOLLIN | EPOLLPRI)) != 0) {
+                    events |= ReactorRunLoop::EVENT_READ;
+                }
+                if ((epollEvents & EPOLLOUT) != 0) {
+                    events |= ReactorRunLoop::EVENT_WRITE;
+                }
+                if ((epollEvents & EPOLLERR) != 0) {
+                    events |= ReactorRunLoop::EVENT_ERROR;
+                }
+                if ((epollEvents & (EPOLLHUP | EPOLLRDHUP)) != 0) {
+                    events |= ReactorRunLoop::EVENT_HANGUP;
+                }
+                return events;
+            }
+        }
+
+        ReactorRunLoop::ReactorRunLoop (
+                const std::string &name,
+                JobExecutionPolicy::SharedPtr jobExecutionPolicy,
+                std::size_t maxEventsPerWait_,
+                std::size_t maxJobsPerWait_) :
+                ThreadRunLoop (name, jobExecutionPolicy),
+                epollHandle (epoll_create1 (EPOLL_CLOEXEC)),
+                eventHandle (eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                maxEventsPerWait (maxEventsPerWait_),
+                maxJobsPerWait (maxJobsPerWait_) {
+            if (epollHandle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE ||
+                    eventHandle == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                if (epollHandle != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                    close (epollHandle);
+                }
+                if (eventHandle != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                    close (eventHandle);
+                }
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+            }
+            if (maxEventsPerWait == 0 || maxJobsPerWait == 0) {
+                close (epollHandle);
+                close (eventHandle);
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            epoll_event event = {0};
+            event.events = EPOLLIN;
+            event.data.fd = eventHandle;
+            if (epoll_ctl (epollHandle, EPOLL_CTL_ADD, eventHandle, &event) < 0) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                close (epollHandle);
+                close (eventHandle);
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+            }
+        }
+
+        ReactorRunLoop::~ReactorRunLoop () {
+            for (TimerMap::const_iterator
+                    it = timers.begin (),
+                    end = timers.end (); it != end; ++it) {
+                close (it->first);
+            }
+            close (eventHandle);
+            close (epollHandle);
+        }
+
+        void ReactorRunLoop::AddHandle (
+                THEKOGANS_UTIL_HANDLE handle,
+                ui32 events,
+                HandleCallback::SharedPtr callback,
+                bool edgeTriggered) {
+            if (handle != THEKOGANS_UTIL_INVALID_HANDLE_VALUE && callback.Get () != 0) {
+                LockGuard<SpinLock> guard (spinLock);
+                if (handles.find (handle) == handles.end ()) {
+                    epoll_event event = {0};
+                    event.events = ToEpollEvents (events, edgeTriggered);
+                    event.data.fd = handle;
+                    if (epoll_ctl (epollHandle, EPOLL_CTL_ADD, handle, &event) < 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    handles[handle] = callback;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Handle %d is already registered.", handle);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void ReactorRunLoop::ModifyHandle (
+                THEKOGANS_UTIL_HANDLE handle,
+                ui32 events,
+                bool edgeTriggered) {
+            LockGuard<SpinLock> guard (spinLock);
+            if (handles.find (handle) != handles.end ()) {
+                epoll_event event = {0};
+                event.events = ToEpollEvents (events, edgeTriggered);
+                event.data.fd = handle;
+                if (epoll_ctl (epollHandle, EPOLL_CTL_MOD, handle, &event) < 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void ReactorRunLoop::DeleteHandle (THEKOGANS_UTIL_HANDLE handle) {
+            HandleCallback::SharedPtr callback;
+            {
+                LockGuard<SpinLock> guard (spinLock);
+                HandleMap::iterator it = handles.find (handle);
+                if (it != handles.end ()) {
+                    // The handle might have been closed already (in
+                    // which case epoll has already forgotten about it).
+                    epoll_ctl (epollHandle, EPOLL_CTL_DEL, handle, 0);
+                    // Release the callback outside the lock.
+                    callback = it->second;
+                    handles.erase (it);
+                }
+            }
+        }
+
+        THEKOGANS_UTIL_HANDLE ReactorRunLoop::AddTimer (
+                const TimeSpec &timeSpec,
+                TimerCallback::SharedPtr callback,
+                bool periodic) {
+            if (timeSpec != TimeSpec::Infinite && callback.Get () != 0) {
+                THEKOGANS_UTIL_HANDLE timer =
+                    timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if (timer == THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                itimerspec value = {{0, 0}, {0, 0}};
+                value.it_value = timeSpec.Totimespec ();
+                // A zero it_value disarms the timer. Fire as soon as possible instead.
+                if (value.it_value.tv_sec == 0 && value.it_value.tv_nsec == 0) {
+                    value.it_value.tv_nsec = 1;
+                }
+                if (periodic) {
+                    value.it_interval = value.it_value;
+                }
+                epoll_event event = {0};
+                event.events = EPOLLIN;
+                event.data.fd = timer;
+                LockGuard<SpinLock> guard (spinLock);
+                if (timerfd_settime (timer, 0, &value, 0) < 0 ||
+                        epoll_ctl (epollHandle, EPOLL_CTL_ADD, timer, &event) < 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    close (timer);
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+                timers[timer] = TimerInfo (callback, periodic);
+                return timer;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void ReactorRunLoop::DeleteTimer (THEKOGANS_UTIL_HANDLE timer) {
+            TimerInfo timerInfo;
+            {
+                LockGuard<SpinLock> guard (spinLock);
+                TimerMap::iterator it = timers.find (timer);
+                if (it != timers.end ()) {
+                    // Closing the timerfd removes it from the epoll set.
+                    close (timer);
+                    // Release the callback outside the lock.
+                    timerInfo = it->second;
+                    timers.erase (it);
+                }
+            }
+        }
+
+        void ReactorRunLoop::Start () {
+            state->done = false;
+            std::vector<epoll_event> events (maxEventsPerWait);
+            while (!state->done) {
+                // Don't block in epoll_wait if there's more work to do.
+                int timeout = ExecuteJobs () ? 0 : -1;
+                if (state->done) {
+                    break;
+                }
+                int count = epoll_wait (epollHandle, events.data (), (int)events.size (), timeout);
+                if (count < 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    // EINTR means a signal interrupted our wait.
+                    if (errorCode != EINTR) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                    }
+                }
+                else {
+                    for (int i = 0; i < count && !state->done; ++i) {
+                        THEKOGANS_UTIL_HANDLE handle = events[i].data.fd;
+                        if (handle == eventHandle) {
+                            eventfd_t value;
+                            eventfd_read (eventHandle, &value);
+                        }
+                        else if (!DispatchTimer (handle)) {
+                            DispatchHandle (handle, events[i].events);
+                        }
+                    }
+                }
+            }
+        }
+
+        void ReactorRunLoop::Stop (
+                bool cancelRunningJobs,
+                bool cancelPendingJobs) {
+            ThreadRunLoop::Stop (cancelRunningJobs, cancelPendingJobs);
+            Wake ();
+        }
+
+        void ReactorRunLoop::Continue () {
+            ThreadRunLoop::Continue ();
+            Wake ();
+        }
+
+        bool ReactorRunLoop::EnqJob (
+                Job::SharedPtr job,
+                bool wait,
+                const TimeSpec &timeSpec) {
+            bool result = RunLoop::EnqJob (job);
+            if (result) {
+                Wake ();
+                result = !wait || WaitForJob (job, timeSpec);
+            }
+            return result;
+        }
+
+        bool ReactorRunLoop::EnqJobFront (
+                Job::SharedPtr job,
+                bool wait,
+                const TimeSpec &timeSpec) {
+            bool result = RunLoop::EnqJobFront (job);
+            if (result) {
+                Wake ();
+                result = !wait || WaitForJob (job, timeSpec);
+            }
+            return result;
+        }
+
+        void ReactorRunLoop::Wake () {
+            // eventfd_write only fails if the counter would overflow,
+            // in which case the run loop thread is awake anyway.
+            eventfd_write (eventHandle, 1);
+        }
+
+        bool ReactorRunLoop::ExecuteJobs () {
+            for (std::size_t i = 0; i < maxJobsPerWait && !state->done; ++i) {
+                Job *job = state->DeqJob (false);
+                if (job == 0) {
+                    return false;
+                }
+                ui64 start = 0;
+                ui64 end = 0;
+                // Short circuit cancelled pending jobs.
+                if (!job->ShouldStop (state->done)) {
+                    start = HRTimer::Click ();
+                    job->SetState (Job::Running);
+                    job->Prologue (state->done);
+                    job->Execute (state->done);
+                    job->Epilogue (state->done);
+                    job->Succeed (state->done);
+                    end = HRTimer::Click ();
+                }
+                state->FinishedJob (job, start, end);
+            }
+            return !state->done && GetPendingJobCount () > 0 && !IsPaused ();
+        }
+
+        bool ReactorRunLoop::DispatchTimer (THEKOGANS_UTIL_HANDLE timer) {
+            TimerInfo timerInfo;
+            {
+                LockGuard<SpinLock> guard (spinLock);
+                TimerMap::iterator it = timers.find (timer);
+                if (it == timers.end ()) {
+                    return false;
+                }
+                timerInfo = it->second;
+            }
+            ui64 expirations = 0;
+            if (read (timer, &expirations, sizeof (expirations)) == sizeof (expirations)) {
+                if (!timerInfo.periodic) {
+                    DeleteTimer (timer);
+                }
+                timerInfo.callback->OnTimer (*this, timer, expirations);
+            }
+            return true;
+        }
+
+        void ReactorRunLoop::DispatchHandle (
+                THEKOGANS_UTIL_HANDLE handle,
+                ui32 events) {
+            HandleCallback::SharedPtr callback;
+            {
+                LockGuard<SpinLock> guard (spinLock);
+                HandleMap::const_iterator it = handles.find (handle);
+                if (it != handles.end ()) {
+                    callback = it->second;
+                }
+            }
+            if (callback.Get () != 0) {
+                callback->OnHandleEvents (*this, handle, FromEpollEvents (events));
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // defined (TOOLCHAIN_OS_Linux)
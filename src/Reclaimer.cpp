@@ -0,0 +1,240 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <set>
+#include <utility>
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Reclaimer.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Serial numbers of the live domains. A thread that exits
+            // after the domain it used is gone must not touch it's record.
+            // Deliberately leaked; threads can exit during static destruction.
+            struct Registry {
+                SpinLock lock;
+                ui64 nextSerialNumber;
+                std::set<ui64> liveSerialNumbers;
+
+                Registry () :
+                    nextSerialNumber (1) {}
+
+                static Registry &Instance () {
+                    static Registry *registry = new Registry;
+                    return *registry;
+                }
+
+                ui64 Register () {
+                    LockGuard<SpinLock> guard (lock);
+                    ui64 serialNumber = nextSerialNumber++;
+                    liveSerialNumbers.insert (serialNumber);
+                    return serialNumber;
+                }
+
+                void Unregister (ui64 serialNumber) {
+                    LockGuard<SpinLock> guard (lock);
+                    liveSerialNumbers.erase (serialNumber);
+                }
+            };
+
+            void DeleteBlock (
+                    void *block,
+                    std::size_t size,
+                    void *context) {
+                static_cast<Allocator *> (context)->Free (block, size);
+            }
+        }
+
+        struct Reclaimer::ThreadRecordCache {
+            struct Entry {
+                ui64 serialNumber;
+                Reclaimer *reclaimer;
+                ThreadRecord *record;
+
+                Entry (
+                    ui64 serialNumber_,
+                    Reclaimer *reclaimer_,
+                    ThreadRecord *record_) :
+                    serialNumber (serialNumber_),
+                    reclaimer (reclaimer_),
+                    record (record_) {}
+            };
+            // A thread uses a handful of domains at most.
+            std::vector<Entry> entries;
+
+            ~ThreadRecordCache () {
+                Registry &registry = Registry::Instance ();
+                LockGuard<SpinLock> guard (registry.lock);
+                for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                    if (registry.liveSerialNumbers.find (entries[i].serialNumber) !=
+                            registry.liveSerialNumbers.end ()) {
+                        entries[i].reclaimer->ReleaseThreadRecord (*entries[i].record);
+                    }
+                }
+            }
+
+            static ThreadRecordCache &Instance () {
+                thread_local ThreadRecordCache threadRecordCache;
+                return threadRecordCache;
+            }
+        };
+
+        Reclaimer::Reclaimer (std::size_t retireThreshold_) :
+                serialNumber (Registry::Instance ().Register ()),
+                threadRecords (0),
+                threadRecordCount (0),
+                retireThreshold (retireThreshold_ > 0 ? retireThreshold_ : 1),
+                orphanCount (0),
+                retiredCount (0),
+                reclaimedCount (0),
+                scanCount (0) {}
+
+        Reclaimer::~Reclaimer () {
+            // After this, exiting threads leave our records alone.
+            Registry::Instance ().Unregister (serialNumber);
+            // There are no readers left, so everything can go.
+            ThreadRecord *record = threadRecords.load (std::memory_order_acquire);
+            while (record != 0) {
+                for (std::size_t i = 0, count = record->retired.size (); i < count; ++i) {
+                    record->retired[i].Reclaim ();
+                }
+                ThreadRecord *next = record->next;
+                delete record;
+                record = next;
+            }
+            for (std::size_t i = 0, count = orphans.size (); i < count; ++i) {
+                orphans[i].Reclaim ();
+            }
+        }
+
+        void Reclaimer::Retire (
+                void *object,
+                std::size_t size,
+                Deleter deleter,
+                void *context) {
+            if (object != 0 && deleter != 0) {
+                RetiredObject retiredObject (object, size, deleter, context);
+                OnRetire (retiredObject);
+                ThreadRecord &record = GetThreadRecord ();
+                record.retired.push_back (retiredObject);
+                retiredCount.fetch_add (1, std::memory_order_relaxed);
+                if (record.retired.size () >= GetScanThreshold ()) {
+                    ScanRetired (record.retired);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Reclaimer::Retire (
+                void *block,
+                std::size_t size,
+                Allocator &allocator) {
+            Retire (block, size, DeleteBlock, &allocator);
+        }
+
+        std::size_t Reclaimer::Reclaim () {
+            return ScanRetired (GetThreadRecord ().retired);
+        }
+
+        Reclaimer::Stats Reclaimer::GetStats () const {
+            Stats stats;
+            stats.retiredCount = retiredCount.load (std::memory_order_relaxed);
+            stats.reclaimedCount = reclaimedCount.load (std::memory_order_relaxed);
+            stats.scanCount = scanCount.load (std::memory_order_relaxed);
+            stats.threadCount = threadRecordCount.load (std::memory_order_relaxed);
+            return stats;
+        }
+
+        Reclaimer::ThreadRecord &Reclaimer::GetThreadRecord () {
+            ThreadRecordCache &threadRecordCache = ThreadRecordCache::Instance ();
+            for (std::size_t i = 0, count = threadRecordCache.entries.size (); i < count; ++i) {
+                if (threadRecordCache.entries[i].serialNumber == serialNumber) {
+                    return *threadRecordCache.entries[i].record;
+                }
+            }
+            // Since a scan has to look at every ThreadRecord in the domain,
+            // recycling the records of exited threads (instead of freeing
+            // them) keeps the list from growing with thread churn.
+            ThreadRecord *record = threadRecords.load (std::memory_order_acquire);
+            for (; record != 0; record = record->next) {
+                bool expected = false;
+                if (!record->active.load (std::memory_order_relaxed) &&
+                        record->active.compare_exchange_strong (
+                            expected, true, std::memory_order_acquire)) {
+                    break;
+                }
+            }
+            if (record == 0) {
+                record = NewThreadRecord ();
+                record->next = threadRecords.load (std::memory_order_relaxed);
+                while (!threadRecords.compare_exchange_weak (
+                        record->next, record,
+                        std::memory_order_release,
+                        std::memory_order_relaxed)) {}
+                threadRecordCount.fetch_add (1, std::memory_order_relaxed);
+            }
+            threadRecordCache.entries.push_back (
+                ThreadRecordCache::Entry (serialNumber, this, record));
+            return *record;
+        }
+
+        std::size_t Reclaimer::ScanRetired (RetiredObjects &retired) {
+            // Deleters are free to Retire (a node taking it's children
+            // with it), so scan a private copy of the list.
+            RetiredObjects objects;
+            objects.swap (retired);
+            if (orphanCount.load (std::memory_order_relaxed) > 0) {
+                LockGuard<SpinLock> guard (orphansLock);
+                objects.insert (objects.end (), orphans.begin (), orphans.end ());
+                orphans.clear ();
+                orphanCount.store (0, std::memory_order_relaxed);
+            }
+            std::size_t reclaimed = objects.empty () ? 0 : Scan (objects);
+            reclaimedCount.fetch_add (reclaimed, std::memory_order_relaxed);
+            scanCount.fetch_add (1, std::memory_order_relaxed);
+            if (retired.empty ()) {
+                retired.swap (objects);
+            }
+            else {
+                retired.insert (retired.end (), objects.begin (), objects.end ());
+            }
+            return reclaimed;
+        }
+
+        void Reclaimer::ReleaseThreadRecord (ThreadRecord &record) {
+            // NOTE: This is called (with the registry lock held) from the
+            // exiting thread's ThreadRecordCache dtor. The derived domain
+            // might be half way through it's dtor, so we don't Scan here
+            // (and only touch the record and the base).
+            record.Clear ();
+            if (!record.retired.empty ()) {
+                LockGuard<SpinLock> guard (orphansLock);
+                orphans.insert (orphans.end (), record.retired.begin (), record.retired.end ());
+                orphanCount.store (orphans.size (), std::memory_order_relaxed);
+                record.retired.clear ();
+            }
+            record.active.store (false, std::memory_order_release);
+        }
+
+    } // namespace util
+} // namespace thekogans
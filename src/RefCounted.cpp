@@ -24,15 +24,20 @@ namespace thekogans {
         THEKOGANS_UTIL_IMPLEMENT_HEAP_WITH_LOCK (RefCounted::References, SpinLock)
 
         ui32 RefCounted::References::ReleaseWeakRef () {
-            ui32 newWeak = --weak;
+            ui32 newWeak = weak.fetch_sub (1, std::memory_order_acq_rel) - 1;
             if (newWeak == 0) {
-                delete this;
+                if (coAllocated) {
+                    FreeBlock (this);
+                }
+                else {
+                    delete this;
+                }
             }
             return newWeak;
         }
 
         ui32 RefCounted::References::ReleaseSharedRef (RefCounted *object) {
-            ui32 newShared = --shared;
+            ui32 newShared = shared.fetch_sub (1, std::memory_order_acq_rel) - 1;
             if (newShared == 0) {
                 object->Harakiri ();
             }
@@ -41,17 +46,61 @@ namespace thekogans {
 
         bool RefCounted::References::LockObject () {
             // This is a classical lock-free algorithm for shared access.
-            for (ui32 count = shared; count != 0; count = shared) {
+            for (ui32 count = shared.load (std::memory_order_relaxed); count != 0;) {
                 // If compare_exchange_weak failed, it's because between the load
                 // above and the exchange below, we were interupted by another thread
-                // that modified the value of shared. Reload and try again.
-                if (shared.compare_exchange_weak (count, count + 1)) {
+                // that modified the value of shared. count now holds the new value,
+                // try again.
+                if (shared.compare_exchange_weak (count, count + 1,
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
                     return true;
                 }
             }
             return false;
         }
 
+        namespace {
+            // Innermost RefCounted::Make in progress on this thread.
+            thread_local void *currentCoAllocation = 0;
+        }
+
+        RefCounted::CoAllocation::CoAllocation (
+                void *block,
+                std::size_t offset,
+                std::size_t size) :
+                begin ((const ui8 *)block + offset),
+                end (begin + size),
+                references (::new (block) References (true)),
+                prev ((CoAllocation *)currentCoAllocation) {
+            currentCoAllocation = this;
+        }
+
+        RefCounted::CoAllocation::~CoAllocation () {
+            currentCoAllocation = prev;
+        }
+
+        void RefCounted::FreeBlock (References *references) {
+            // References is at the head of the block.
+            references->~References ();
+            ::operator delete (references);
+        }
+
+        RefCounted::RefCounted () :
+                references (0) {
+            // If we're being constructed inside a block allocated by
+            // Make, use the References waiting for us at it's head.
+            CoAllocation *coAllocation = (CoAllocation *)currentCoAllocation;
+            if (coAllocation != 0 && coAllocation->references != 0 &&
+                    (const ui8 *)this >= coAllocation->begin &&
+                    (const ui8 *)this < coAllocation->end) {
+                references = coAllocation->references;
+                coAllocation->references = 0;
+            }
+            else {
+                references = new References;
+            }
+        }
+
         RefCounted::~RefCounted () {
             // We're going out of scope. If there are still
             // shared references remaining, we have a problem.
@@ -72,7 +121,22 @@ namespace thekogans {
                     message.c_str ());
                 THEKOGANS_UTIL_ASSERT (references->GetSharedCount () == 0, message);
             }
-            references->ReleaseWeakRef ();
+            // Co-allocated References is released by Harakiri
+            // (after we're gone, as it owns our memory).
+            if (!references->IsCoAllocated ()) {
+                references->ReleaseWeakRef ();
+            }
+        }
+
+        void RefCounted::Harakiri () {
+            if (references->IsCoAllocated ()) {
+                References *references_ = references;
+                this->~RefCounted ();
+                references_->ReleaseWeakRef ();
+            }
+            else {
+                delete this;
+            }
         }
 
     } // namespace util
@@ -39,6 +39,7 @@ namespace thekogans {
             SetState (Pending);
             disposition = Unknown;
             completed.Reset ();
+            enqueueTime = HRTimer::Click ();
         }
 
         void RunLoop::Job::SetState (State state_) {
@@ -166,6 +167,50 @@ namespace thekogans {
             return !state.pendingJobs.empty () ? state.pendingJobs.pop_front () : 0;
         }
 
+        void RunLoop::EDFJobExecutionPolicy::EnqJob (
+                State &state,
+                Job *job) {
+            if (state.pendingJobs.size () < maxJobs) {
+                // Find the first job (from the back) that's due before this one.
+                Job *before = 0;
+                for (Job *prev = state.pendingJobs.back ();
+                        prev != 0 && prev->GetDeadline () > job->GetDeadline ();
+                        prev = state.pendingJobs.prev (prev)) {
+                    before = prev;
+                }
+                state.pendingJobs.insert (job, before);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "RunLoop (%s) max jobs (%u) reached.",
+                    !state.name.empty () ? state.name.c_str () : "no name",
+                    maxJobs);
+            }
+        }
+
+        void RunLoop::EDFJobExecutionPolicy::EnqJobFront (
+                State &state,
+                Job *job) {
+            if (state.pendingJobs.size () < maxJobs) {
+                // Find the first job that's due at the same time or after this one.
+                Job *before = state.pendingJobs.front ();
+                while (before != 0 && before->GetDeadline () < job->GetDeadline ()) {
+                    before = state.pendingJobs.next (before);
+                }
+                state.pendingJobs.insert (job, before);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "RunLoop (%s) max jobs (%u) reached.",
+                    !state.name.empty () ? state.name.c_str () : "no name",
+                    maxJobs);
+            }
+        }
+
+        RunLoop::Job *RunLoop::EDFJobExecutionPolicy::DeqJob (State &state) {
+            return !state.pendingJobs.empty () ? state.pendingJobs.pop_front () : 0;
+        }
+
         #if !defined (THEKOGANS_UTIL_MIN_RUN_LOOP_STATS_JOBS_IN_PAGE)
             #define THEKOGANS_UTIL_MIN_RUN_LOOP_STATS_JOBS_IN_PAGE 64
         #endif // !defined (THEKOGANS_UTIL_MIN_RUN_LOOP_STATS_JOBS_IN_PAGE)
@@ -255,7 +300,7 @@ namespace thekogans {
 
         THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE (
             RunLoop::Stats,
-            1,
+            4,
             SpinLock,
             THEKOGANS_UTIL_MIN_RUN_LOOP_STATS_IN_PAGE,
             DefaultAllocator::Instance ())
@@ -266,9 +311,17 @@ namespace thekogans {
                 name = stats.name;
                 totalJobs = stats.totalJobs;
                 totalJobTime = stats.totalJobTime;
+                queueDepth = stats.queueDepth;
+                maxQueueDepth = stats.maxQueueDepth;
+                workerCount = stats.workerCount;
+                maxWorkerCount = stats.maxWorkerCount;
+                spawnedWorkers = stats.spawnedWorkers;
+                retiredWorkers = stats.retiredWorkers;
                 lastJob = stats.lastJob;
                 minJob = stats.minJob;
                 maxJob = stats.maxJob;
+                waitTime = stats.waitTime;
+                runTime = stats.runTime;
             }
             return *this;
         }
@@ -276,9 +329,17 @@ namespace thekogans {
         void RunLoop::Stats::Reset () {
             totalJobs = 0;
             totalJobTime = 0;
+            queueDepth = 0;
+            maxQueueDepth = 0;
+            workerCount = 0;
+            maxWorkerCount = 0;
+            spawnedWorkers = 0;
+            retiredWorkers = 0;
             lastJob.Reset ();
             minJob.Reset ();
             maxJob.Reset ();
+            waitTime.Reset ();
+            runTime.Reset ();
         }
 
         std::size_t RunLoop::Stats::Size () const {
@@ -286,19 +347,58 @@ namespace thekogans {
                 Serializer::Size (name) +
                 Serializer::Size (totalJobs) +
                 Serializer::Size (totalJobTime) +
+                Serializer::Size (queueDepth) +
+                Serializer::Size (maxQueueDepth) +
+                Serializer::Size (workerCount) +
+                Serializer::Size (maxWorkerCount) +
+                Serializer::Size (spawnedWorkers) +
+                Serializer::Size (retiredWorkers) +
                 Serializable::Size (lastJob) +
                 Serializable::Size (minJob) +
-                Serializable::Size (maxJob);
+                Serializable::Size (maxJob) +
+                Serializable::Size (waitTime) +
+                Serializable::Size (runTime);
         }
 
         void RunLoop::Stats::Read (
-                const BinHeader & /*header*/,
+                const BinHeader &header,
                 Serializer &serializer) {
-            serializer >> id >> name >> totalJobs >> totalJobTime >> lastJob >> minJob >> maxJob;
+            serializer >> id >> name >> totalJobs >> totalJobTime;
+            // Version 2 added the queue depth.
+            if (header.version > 1) {
+                serializer >> queueDepth >> maxQueueDepth;
+            }
+            else {
+                queueDepth = 0;
+                maxQueueDepth = 0;
+            }
+            // Version 4 added the worker counts.
+            if (header.version > 3) {
+                serializer >> workerCount >> maxWorkerCount >>
+                    spawnedWorkers >> retiredWorkers;
+            }
+            else {
+                workerCount = 0;
+                maxWorkerCount = 0;
+                spawnedWorkers = 0;
+                retiredWorkers = 0;
+            }
+            serializer >> lastJob >> minJob >> maxJob;
+            // Version 3 added the wait and run time histograms.
+            if (header.version > 2) {
+                serializer >> waitTime >> runTime;
+            }
+            else {
+                waitTime.Reset ();
+                runTime.Reset ();
+            }
         }
 
         void RunLoop::Stats::Write (Serializer &serializer) const {
-            serializer << id << name << totalJobs << totalJobTime << lastJob << minJob << maxJob;
+            serializer << id << name << totalJobs << totalJobTime <<
+                queueDepth << maxQueueDepth << workerCount << maxWorkerCount <<
+                spawnedWorkers << retiredWorkers << lastJob << minJob << maxJob <<
+                waitTime << runTime;
         }
 
         const char * const RunLoop::Stats::TAG_RUN_LOOP = "RunLoop";
@@ -306,9 +406,17 @@ namespace thekogans {
         const char * const RunLoop::Stats::ATTR_NAME = "Name";
         const char * const RunLoop::Stats::ATTR_TOTAL_JOBS = "TotalJobs";
         const char * const RunLoop::Stats::ATTR_TOTAL_JOB_TIME = "TotalJobTime";
+        const char * const RunLoop::Stats::ATTR_QUEUE_DEPTH = "QueueDepth";
+        const char * const RunLoop::Stats::ATTR_MAX_QUEUE_DEPTH = "MaxQueueDepth";
+        const char * const RunLoop::Stats::ATTR_WORKER_COUNT = "WorkerCount";
+        const char * const RunLoop::Stats::ATTR_MAX_WORKER_COUNT = "MaxWorkerCount";
+        const char * const RunLoop::Stats::ATTR_SPAWNED_WORKERS = "SpawnedWorkers";
+        const char * const RunLoop::Stats::ATTR_RETIRED_WORKERS = "RetiredWorkers";
         const char * const RunLoop::Stats::TAG_LAST_JOB = "LastJob";
         const char * const RunLoop::Stats::TAG_MIN_JOB = "MinJob";
         const char * const RunLoop::Stats::TAG_MAX_JOB = "MaxJob";
+        const char * const RunLoop::Stats::TAG_WAIT_TIME = "WaitTime";
+        const char * const RunLoop::Stats::TAG_RUN_TIME = "RunTime";
 
         void RunLoop::Stats::Read (
                 const TextHeader & /*header*/,
@@ -317,6 +425,12 @@ namespace thekogans {
             name = Decodestring (node.attribute (ATTR_NAME).value ());
             totalJobs = stringTosize_t (node.attribute (ATTR_TOTAL_JOBS).value ());
             totalJobTime = stringToui64 (node.attribute (ATTR_TOTAL_JOB_TIME).value ());
+            queueDepth = stringTosize_t (node.attribute (ATTR_QUEUE_DEPTH).value ());
+            maxQueueDepth = stringTosize_t (node.attribute (ATTR_MAX_QUEUE_DEPTH).value ());
+            workerCount = stringTosize_t (node.attribute (ATTR_WORKER_COUNT).value ());
+            maxWorkerCount = stringTosize_t (node.attribute (ATTR_MAX_WORKER_COUNT).value ());
+            spawnedWorkers = stringTosize_t (node.attribute (ATTR_SPAWNED_WORKERS).value ());
+            retiredWorkers = stringTosize_t (node.attribute (ATTR_RETIRED_WORKERS).value ());
             for (pugi::xml_node child = node.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
                 if (child.type () == pugi::node_element) {
@@ -330,6 +444,12 @@ namespace thekogans {
                     else if (childName == TAG_MAX_JOB) {
                         child >> maxJob;
                     }
+                    else if (childName == TAG_WAIT_TIME) {
+                        child >> waitTime;
+                    }
+                    else if (childName == TAG_RUN_TIME) {
+                        child >> runTime;
+                    }
                 }
             }
         }
@@ -339,6 +459,12 @@ namespace thekogans {
             node.append_attribute (ATTR_NAME).set_value (Encodestring (name).c_str ());
             node.append_attribute (ATTR_TOTAL_JOBS).set_value (size_tTostring (totalJobs).c_str ());
             node.append_attribute (ATTR_TOTAL_JOB_TIME).set_value (ui64Tostring (totalJobTime).c_str ());
+            node.append_attribute (ATTR_QUEUE_DEPTH).set_value (size_tTostring (queueDepth).c_str ());
+            node.append_attribute (ATTR_MAX_QUEUE_DEPTH).set_value (size_tTostring (maxQueueDepth).c_str ());
+            node.append_attribute (ATTR_WORKER_COUNT).set_value (size_tTostring (workerCount).c_str ());
+            node.append_attribute (ATTR_MAX_WORKER_COUNT).set_value (size_tTostring (maxWorkerCount).c_str ());
+            node.append_attribute (ATTR_SPAWNED_WORKERS).set_value (size_tTostring (spawnedWorkers).c_str ());
+            node.append_attribute (ATTR_RETIRED_WORKERS).set_value (size_tTostring (retiredWorkers).c_str ());
             {
                 pugi::xml_node child = node.append_child (TAG_LAST_JOB);
                 child << lastJob;
@@ -351,15 +477,54 @@ namespace thekogans {
                 pugi::xml_node child = node.append_child (TAG_MAX_JOB);
                 child << maxJob;
             }
+            {
+                pugi::xml_node child = node.append_child (TAG_WAIT_TIME);
+                child << waitTime;
+            }
+            {
+                pugi::xml_node child = node.append_child (TAG_RUN_TIME);
+                child << runTime;
+            }
         }
 
         void RunLoop::Stats::Read (
-                const TextHeader & /*header*/,
+                const TextHeader &header,
                 const JSON::Object &object) {
             id = object.Get<JSON::String> (ATTR_ID)->value;
             name = object.Get<JSON::String> (ATTR_NAME)->value;
             totalJobs = object.Get<JSON::Number> (ATTR_TOTAL_JOBS)->To<SizeT> ();
             totalJobTime = object.Get<JSON::Number> (ATTR_TOTAL_JOB_TIME)->To<ui64> ();
+            // Version 2 added the queue depth.
+            if (header.version > 1) {
+                queueDepth = object.Get<JSON::Number> (ATTR_QUEUE_DEPTH)->To<SizeT> ();
+                maxQueueDepth = object.Get<JSON::Number> (ATTR_MAX_QUEUE_DEPTH)->To<SizeT> ();
+            }
+            else {
+                queueDepth = 0;
+                maxQueueDepth = 0;
+            }
+            // Version 4 added the worker counts.
+            if (header.version > 3) {
+                workerCount = object.Get<JSON::Number> (ATTR_WORKER_COUNT)->To<SizeT> ();
+                maxWorkerCount = object.Get<JSON::Number> (ATTR_MAX_WORKER_COUNT)->To<SizeT> ();
+                spawnedWorkers = object.Get<JSON::Number> (ATTR_SPAWNED_WORKERS)->To<SizeT> ();
+                retiredWorkers = object.Get<JSON::Number> (ATTR_RETIRED_WORKERS)->To<SizeT> ();
+            }
+            else {
+                workerCount = 0;
+                maxWorkerCount = 0;
+                spawnedWorkers = 0;
+                retiredWorkers = 0;
+            }
+            // Version 3 added the wait and run time histograms.
+            if (header.version > 2) {
+                *object.Get<JSON::Object> (TAG_WAIT_TIME) >> waitTime;
+                *object.Get<JSON::Object> (TAG_RUN_TIME) >> runTime;
+            }
+            else {
+                waitTime.Reset ();
+                runTime.Reset ();
+            }
         }
 
         void RunLoop::Stats::Write (JSON::Object &object) const {
@@ -367,6 +532,22 @@ namespace thekogans {
             object.Add<const std::string &> (ATTR_NAME, name);
             object.Add<const SizeT &> (ATTR_TOTAL_JOBS, totalJobs);
             object.Add (ATTR_TOTAL_JOB_TIME, totalJobTime);
+            object.Add<const SizeT &> (ATTR_QUEUE_DEPTH, queueDepth);
+            object.Add<const SizeT &> (ATTR_MAX_QUEUE_DEPTH, maxQueueDepth);
+            object.Add<const SizeT &> (ATTR_WORKER_COUNT, workerCount);
+            object.Add<const SizeT &> (ATTR_MAX_WORKER_COUNT, maxWorkerCount);
+            object.Add<const SizeT &> (ATTR_SPAWNED_WORKERS, spawnedWorkers);
+            object.Add<const SizeT &> (ATTR_RETIRED_WORKERS, retiredWorkers);
+            {
+                JSON::Object::SharedPtr child (new JSON::Object);
+                *child << waitTime;
+                object.Add (TAG_WAIT_TIME, child);
+            }
+            {
+                JSON::Object::SharedPtr child (new JSON::Object);
+                *child << runTime;
+                object.Add (TAG_RUN_TIME, child);
+            }
         }
 
         void RunLoop::Stats::Update (
@@ -424,13 +605,17 @@ namespace thekogans {
             }
         }
 
-        RunLoop::Job *RunLoop::State::DeqJob (bool wait) {
+        RunLoop::Job *RunLoop::State::DeqJob (
+                bool wait,
+                const TimeSpec &timeSpec) {
             LockGuard<Mutex> guard (jobsMutex);
             while (!done && paused && wait) {
                 notPaused.Wait ();
             }
             while (!done && pendingJobs.empty () && wait) {
-                jobsNotEmpty.Wait ();
+                if (!jobsNotEmpty.Wait (timeSpec)) {
+                    break;
+                }
             }
             Job *job = 0;
             if (!done && !paused && !pendingJobs.empty ()) {
@@ -445,6 +630,7 @@ namespace thekogans {
                 ui64 start,
                 ui64 end) {
             assert (job != 0);
+            RecordJobTimes (job, start, end);
             {
                 LockGuard<Mutex> guard (jobsMutex);
                 stats.Update (job, start, end);
@@ -457,6 +643,18 @@ namespace thekogans {
             job->Release ();
         }
 
+        void RunLoop::State::RecordJobTimes (
+                Job *job,
+                ui64 start,
+                ui64 end) {
+            if (job->IsSucceeded ()) {
+                if (job->enqueueTime != 0) {
+                    waitTimes.Record (HRTimer::ComputeElapsedTime (job->enqueueTime, start));
+                }
+                runTimes.Record (HRTimer::ComputeElapsedTime (start, end));
+            }
+        }
+
         std::size_t RunLoop::GetPendingJobCount () {
             LockGuard<Mutex> guard (state->jobsMutex);
             return state->pendingJobs.size ();
@@ -517,6 +715,7 @@ namespace thekogans {
                 {
                     LockGuard<Mutex> guard (state->jobsMutex);
                     state->jobExecutionPolicy->EnqJob (*state, job.Get ());
+                    state->stats.UpdateQueueDepth (state->pendingJobs.size ());
                     job->Reset (state->id);
                     job->AddRef ();
                     state->jobsNotEmpty.Signal ();
@@ -547,6 +746,7 @@ namespace thekogans {
                 {
                     LockGuard<Mutex> guard (state->jobsMutex);
                     state->jobExecutionPolicy->EnqJobFront (*state, job.Get ());
+                    state->stats.UpdateQueueDepth (state->pendingJobs.size ());
                     job->Reset (state->id);
                     job->AddRef ();
                     state->jobsNotEmpty.Signal ();
@@ -879,13 +1079,30 @@ namespace thekogans {
         }
 
         RunLoop::Stats RunLoop::GetStats () {
-            LockGuard<Mutex> guard (state->jobsMutex);
-            return state->stats;
+            Stats stats (state->id, state->name);
+            {
+                LockGuard<Mutex> guard (state->jobsMutex);
+                state->stats.queueDepth = state->pendingJobs.size ();
+                stats = state->stats;
+            }
+            GetJobTimes (stats.waitTime, stats.runTime);
+            return stats;
         }
 
         void RunLoop::ResetStats () {
-            LockGuard<Mutex> guard (state->jobsMutex);
-            state->stats.Reset ();
+            {
+                LockGuard<Mutex> guard (state->jobsMutex);
+                state->stats.Reset ();
+            }
+            state->waitTimes.Reset ();
+            state->runTimes.Reset ();
+        }
+
+        void RunLoop::GetJobTimes (
+                Histogram &waitTime,
+                Histogram &runTime) {
+            state->waitTimes.Snapshot (waitTime);
+            state->runTimes.Snapshot (runTime);
         }
 
         bool RunLoop::IsIdle () {
@@ -86,23 +86,82 @@ namespace thekogans {
             return result;
         }
 
+        TimeSpec Scheduler::JobQueue::GetNextJobDeadline () {
+            LockGuard<Mutex> guard (state->jobsMutex);
+            return !state->pendingJobs.empty () ?
+                state->pendingJobs.front ()->GetDeadline () : TimeSpec::Infinite;
+        }
+
         Scheduler::~Scheduler () {
-            {
-                LockGuard<SpinLock> guard (spinLock);
+            for (std::size_t i = 0; i < PRIORITY_COUNT; ++i) {
+                LockGuard<SpinLock> guard (priorityLists[i].spinLock);
                 JobQueueList::DefaultCallback callback;
-                high.clear (callback);
-                normal.clear (callback);
-                low.clear (callback);
+                priorityLists[i].jobQueues.clear (callback);
+                priorityLists[i].readyCount = 0;
             }
             jobQueuePool.WaitForIdle ();
         }
 
+        void Scheduler::SetTimeSlice (
+                JobQueue::Priority priority,
+                const TimeSpec &timeSlice) {
+            if (priority < PRIORITY_COUNT && timeSlice != TimeSpec::Infinite) {
+                priorityLists[priority].timeSlice =
+                    (ui64)(timeSlice.ToNanoseconds () / 1e9 * HRTimer::GetFrequency ());
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        TimeSpec Scheduler::GetTimeSlice (JobQueue::Priority priority) const {
+            if (priority < PRIORITY_COUNT) {
+                return HRTimer::ToTimeSpec (priorityLists[priority].timeSlice);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Scheduler::GetStats (
+                JobQueue::Priority priority,
+                Stats &stats) const {
+            if (priority < PRIORITY_COUNT) {
+                const PriorityList &priorityList = priorityLists[priority];
+                priorityList.latency.Snapshot (stats.latency);
+                stats.slices = priorityList.slices;
+                stats.preemptions = priorityList.preemptions;
+                stats.jobs = priorityList.jobs;
+                stats.runTime = priorityList.runTime;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Scheduler::ResetStats () {
+            for (std::size_t i = 0; i < PRIORITY_COUNT; ++i) {
+                PriorityList &priorityList = priorityLists[i];
+                priorityList.latency.Reset ();
+                priorityList.slices = 0;
+                priorityList.preemptions = 0;
+                priorityList.jobs = 0;
+                priorityList.runTime = 0;
+            }
+        }
+
         void Scheduler::AddJobQueue (
                 JobQueue *jobQueue,
                 bool scheduleJobQueue) {
             if (jobQueue != 0) {
+                // Take the queue's lock before the priority list's.
+                TimeSpec deadline = jobQueue->GetNextJobDeadline ();
                 {
-                    LockGuard<SpinLock> guard (spinLock);
+                    PriorityList &priorityList = priorityLists[jobQueue->priority];
+                    LockGuard<SpinLock> guard (priorityList.spinLock);
                     // In flight job queues are the ones executing
                     // currently executing jobs. They add themselves
                     // to the back of the priority queue after the job
@@ -110,27 +169,33 @@ namespace thekogans {
                     if (jobQueue->inFlight) {
                         return;
                     }
-                    // NOTE: It's okay for push_back to fail. It simply means
-                    // the queue is already in it's proper list and will be
-                    // returned by GetNextJobQueue when it's time to execute
-                    // one of it's jobs.
-                    switch (jobQueue->priority) {
-                        case JobQueue::PRIORITY_LOW:
-                            if (!low.push_back (jobQueue)) {
-                                return;
-                            }
-                            break;
-                        case JobQueue::PRIORITY_NORMAL:
-                            if (!normal.push_back (jobQueue)) {
-                                return;
-                            }
-                            break;
-                        case JobQueue::PRIORITY_HIGH:
-                            if (!high.push_back (jobQueue)) {
-                                return;
-                            }
-                            break;
+                    // NOTE: It's okay for the queue to already be in the
+                    // list. It simply means it will be returned by
+                    // GetNextJobQueue when it's time to execute one of
+                    // it's jobs. Unless it now has a job due earlier,
+                    // in which case it needs to move up.
+                    ui64 readyTime = HRTimer::Click ();
+                    if (priorityList.jobQueues.contains (jobQueue)) {
+                        if (deadline >= jobQueue->deadline) {
+                            return;
+                        }
+                        priorityList.jobQueues.erase (jobQueue);
+                        --priorityList.readyCount;
+                        readyTime = jobQueue->readyTime;
                     }
+                    // Queues with deadlines go ahead of the queues with later
+                    // (or no) deadlines. The rest are scheduled round-robin.
+                    JobQueue *before = 0;
+                    if (deadline != TimeSpec::Infinite) {
+                        before = priorityList.jobQueues.front ();
+                        while (before != 0 && before->deadline <= deadline) {
+                            before = priorityList.jobQueues.next (before);
+                        }
+                    }
+                    priorityList.jobQueues.insert (jobQueue, before);
+                    ++priorityList.readyCount;
+                    jobQueue->deadline = deadline;
+                    jobQueue->readyTime = readyTime;
                 }
                 if (scheduleJobQueue) {
                     struct JobQueueJob : public RunLoop::Job {
@@ -146,28 +211,7 @@ namespace thekogans {
                         virtual void Execute (const std::atomic<bool> &done) throw () {
                             JobQueue *jobQueue;
                             while (!ShouldStop (done) && (jobQueue = scheduler.GetNextJobQueue ()) != 0) {
-                                RunLoop::Job *job;
-                                bool cancelled;
-                                // Skip over cancelled jobs.
-                                do {
-                                    job = jobQueue->state->DeqJob (false);
-                                    if (job != 0) {
-                                        ui64 start = 0;
-                                        ui64 end = 0;
-                                        // Short circuit cancelled pending jobs.
-                                        cancelled = job->ShouldStop (jobQueue->state->done);
-                                        if (!cancelled) {
-                                            start = HRTimer::Click ();
-                                            job->SetState (Job::Running);
-                                            job->Prologue (jobQueue->state->done);
-                                            job->Execute (jobQueue->state->done);
-                                            job->Epilogue (jobQueue->state->done);
-                                            job->Succeed (jobQueue->state->done);
-                                            end = HRTimer::Click ();
-                                        }
-                                        jobQueue->state->FinishedJob (job, start, end);
-                                    }
-                                } while (job != 0 && cancelled);
+                                scheduler.ExecuteJobQueue (jobQueue, done);
                                 jobQueue->inFlight = false;
                                 if (!jobQueue->IsPaused () && jobQueue->GetPendingJobCount () != 0) {
                                     scheduler.AddJobQueue (jobQueue, false);
@@ -190,17 +234,10 @@ namespace thekogans {
 
         void Scheduler::DeleteJobQueue (JobQueue *jobQueue) {
             if (jobQueue != 0) {
-                LockGuard<SpinLock> guard (spinLock);
-                switch (jobQueue->priority) {
-                    case JobQueue::PRIORITY_LOW:
-                        low.erase (jobQueue);
-                        break;
-                    case JobQueue::PRIORITY_NORMAL:
-                        normal.erase (jobQueue);
-                        break;
-                    case JobQueue::PRIORITY_HIGH:
-                        high.erase (jobQueue);
-                        break;
+                PriorityList &priorityList = priorityLists[jobQueue->priority];
+                LockGuard<SpinLock> guard (priorityList.spinLock);
+                if (priorityList.jobQueues.erase (jobQueue)) {
+                    --priorityList.readyCount;
                 }
             }
             else {
@@ -210,22 +247,90 @@ namespace thekogans {
         }
 
         Scheduler::JobQueue *Scheduler::GetNextJobQueue () {
-            JobQueue *jobQueue = 0;
-            LockGuard<SpinLock> guard (spinLock);
             // Priority based, round-robin, O(1) scheduler!
-            if (!high.empty ()) {
-                jobQueue = high.pop_front ();
+            for (std::size_t i = PRIORITY_COUNT; i-- > 0;) {
+                PriorityList &priorityList = priorityLists[i];
+                // Don't bother taking the lock of an empty list.
+                if (priorityList.readyCount > 0) {
+                    JobQueue *jobQueue = 0;
+                    {
+                        LockGuard<SpinLock> guard (priorityList.spinLock);
+                        if (!priorityList.jobQueues.empty ()) {
+                            jobQueue = priorityList.jobQueues.pop_front ();
+                            --priorityList.readyCount;
+                            jobQueue->inFlight = true;
+                        }
+                    }
+                    if (jobQueue != 0) {
+                        priorityList.latency.Record (
+                            HRTimer::ComputeElapsedTime (jobQueue->readyTime, HRTimer::Click ()));
+                        return jobQueue;
+                    }
+                }
             }
-            else if (!normal.empty ()) {
-                jobQueue = normal.pop_front ();
+            return 0;
+        }
+
+        bool Scheduler::IsHigherPriorityReady (JobQueue::Priority priority) const {
+            for (std::size_t i = priority + 1; i < PRIORITY_COUNT; ++i) {
+                if (priorityLists[i].readyCount > 0) {
+                    return true;
+                }
             }
-            else if (!low.empty ()) {
-                jobQueue = low.pop_front ();
+            return false;
+        }
+
+        void Scheduler::ExecuteJobQueue (
+                JobQueue *jobQueue,
+                const std::atomic<bool> &done) {
+            PriorityList &priorityList = priorityLists[jobQueue->priority];
+            ui64 timeSlice = priorityList.timeSlice;
+            ui64 sliceStart = HRTimer::Click ();
+            ui64 runTime = 0;
+            ui64 jobs = 0;
+            bool preempted = false;
+            while (1) {
+                RunLoop::Job *job = jobQueue->state->DeqJob (false);
+                if (job == 0) {
+                    break;
+                }
+                ui64 start = 0;
+                ui64 end = 0;
+                // Short circuit cancelled pending jobs.
+                bool cancelled = job->ShouldStop (jobQueue->state->done);
+                if (!cancelled) {
+                    start = HRTimer::Click ();
+                    job->SetState (RunLoop::Job::Running);
+                    job->Prologue (jobQueue->state->done);
+                    job->Execute (jobQueue->state->done);
+                    job->Epilogue (jobQueue->state->done);
+                    job->Succeed (jobQueue->state->done);
+                    end = HRTimer::Click ();
+                    runTime += HRTimer::ComputeElapsedTime (start, end);
+                    ++jobs;
+                }
+                jobQueue->state->FinishedJob (job, start, end);
+                // Skip over cancelled jobs. Otherwise, without a time
+                // slice, it's one job per turn. With one, keep going
+                // until it's used up, or we're preempted by a higher
+                // priority queue.
+                if (!cancelled) {
+                    if (timeSlice == 0 || done ||
+                            HRTimer::ComputeElapsedTime (sliceStart, end) >= timeSlice) {
+                        break;
+                    }
+                    if (IsHigherPriorityReady (jobQueue->priority)) {
+                        preempted = jobQueue->GetPendingJobCount () != 0;
+                        break;
+                    }
+                }
             }
-            if (jobQueue != 0) {
-                jobQueue->inFlight = true;
+            ++priorityList.slices;
+            if (preempted) {
+                ++priorityList.preemptions;
             }
-            return jobQueue;
+            priorityList.jobs += jobs;
+            priorityList.runTime += runTime;
         }
 
     } // namespace util
@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
 
+#include <memory>
+#include <atomic>
 #include "thekogans/util/XMLUtils.h"
 #include "thekogans/util/Serializable.h"
 
@@ -24,12 +26,14 @@ namespace thekogans {
         const char * const Serializable::BinHeader::TAG_BIN_HEADER = "BinHeader";
         const char * const Serializable::BinHeader::ATTR_MAGIC = "Magic";
         const char * const Serializable::BinHeader::ATTR_TYPE = "Type";
+        const char * const Serializable::BinHeader::ATTR_TYPE_ID = "TypeId";
         const char * const Serializable::BinHeader::ATTR_VERSION = "Version";
         const char * const Serializable::BinHeader::ATTR_SIZE = "Size";
 
         void Serializable::BinHeader::Parse (const pugi::xml_node &node) {
             magic = stringToui32 (node.attribute (ATTR_MAGIC).value ());
             type = Decodestring (node.attribute (ATTR_TYPE).value ());
+            typeId = stringToui32 (node.attribute (ATTR_TYPE_ID).value ());
             version = stringToui16 (node.attribute (ATTR_VERSION).value ());
             size = stringToui64 (node.attribute (ATTR_SIZE).value ());
         }
@@ -40,6 +44,9 @@ namespace thekogans {
             Attributes attributes;
             attributes.push_back (Attribute (ATTR_MAGIC, ui32Tostring (magic)));
             attributes.push_back (Attribute (ATTR_TYPE, Encodestring (type)));
+            if (typeId != 0) {
+                attributes.push_back (Attribute (ATTR_TYPE_ID, ui32Tostring (typeId)));
+            }
             attributes.push_back (Attribute (ATTR_VERSION, ui32Tostring (version)));
             attributes.push_back (Attribute (ATTR_SIZE, ui64Tostring (size)));
             return OpenTag (0, tagName, attributes, true, true);
@@ -56,16 +63,279 @@ namespace thekogans {
         Serializable::MapInitializer::MapInitializer (
                 const std::string &type,
                 Factories factories) {
-            std::pair<Map::iterator, bool> result =
-                GetMap ().insert (Map::value_type (type, factories));
-            if (!result.second) {
+            if (!GetMap ().Insert (type, factories)) {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                     "'%s' is already registered.", type.c_str ());
             }
         }
 
+        namespace {
+            struct TypeIdRegistry {
+                struct Entry {
+                    const std::string type;
+                    // Resolved lazily (the type might register after it's id).
+                    std::atomic<const Serializable::Factories *> factories;
+
+                    explicit Entry (const std::string &type_) :
+                        type (type_),
+                        factories (0) {}
+                };
+                std::unordered_map<ui32, std::unique_ptr<Entry>> typeIds;
+                std::unordered_map<std::string, ui32> types;
+                SpinLock spinLock;
+
+                static TypeIdRegistry &Instance () {
+                    static TypeIdRegistry *instance = new TypeIdRegistry;
+                    return *instance;
+                }
+
+                Entry *GetEntry (ui32 typeId) const {
+                    std::unordered_map<ui32, std::unique_ptr<Entry>>::const_iterator it =
+                        typeIds.find (typeId);
+                    return it != typeIds.end () ? it->second.get () : 0;
+                }
+
+                const Serializable::Factories *GetFactories (ui32 typeId) const {
+                    Entry *entry = GetEntry (typeId);
+                    if (entry != 0) {
+                        const Serializable::Factories *factories =
+                            entry->factories.load (std::memory_order_acquire);
+                        if (factories == 0) {
+                            factories = Serializable::GetMap ().Find (entry->type);
+                            if (factories != 0) {
+                                entry->factories.store (factories, std::memory_order_release);
+                            }
+                        }
+                        return factories;
+                    }
+                    return 0;
+                }
+            };
+
+            void ReadTypeId (
+                    Serializer &serializer,
+                    Serializable::BinHeader &header) {
+                SizeT typeId;
+                serializer >> typeId;
+                const std::string *type = typeId.value <= UI32_MAX ?
+                    Serializable::TypeIdToType ((ui32)typeId.value) : 0;
+                if (type == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unknown serializable type id: " THEKOGANS_UTIL_UI64_FORMAT ".",
+                        typeId.value);
+                }
+                header.typeId = (ui32)typeId.value;
+                header.type = *type;
+            }
+
+            // Everything after the magic for classic and compact headers.
+            void ReadHeaderBody (
+                    Serializer &serializer,
+                    Serializable::BinHeader &header) {
+                if (header.magic == MAGIC32) {
+                    serializer >> header.type;
+                    header.typeId = 0;
+                }
+                else if (header.magic == Serializable::BinHeader::COMPACT_MAGIC32) {
+                    ReadTypeId (serializer, header);
+                }
+                else if (header.magic == Serializable::BinHeader::DICTIONARY_MAGIC32) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                        "Dictionary serializable header requires a Serializable::TypeDictionary.");
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Corrupt serializable header: %u.",
+                        header.magic);
+                }
+                serializer >> header.version >> header.size;
+            }
+        }
+
+        void Serializable::RegisterTypeId (
+                const std::string &type,
+                ui32 typeId) {
+            if (type.empty () || typeId == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            TypeIdRegistry &registry = TypeIdRegistry::Instance ();
+            LockGuard<SpinLock> guard (registry.spinLock);
+            if (registry.typeIds.find (typeId) != registry.typeIds.end ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Type id %u is already registered (%s).",
+                    typeId, registry.typeIds[typeId]->type.c_str ());
+            }
+            if (registry.types.find (type) != registry.types.end ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "'%s' already has a type id.", type.c_str ());
+            }
+            registry.typeIds[typeId].reset (new TypeIdRegistry::Entry (type));
+            registry.types[type] = typeId;
+        }
+
+        ui32 Serializable::TypeToTypeId (const std::string &type) {
+            const TypeIdRegistry &registry = TypeIdRegistry::Instance ();
+            std::unordered_map<std::string, ui32>::const_iterator it =
+                registry.types.find (type);
+            return it != registry.types.end () ? it->second : 0;
+        }
+
+        const std::string *Serializable::TypeIdToType (ui32 typeId) {
+            TypeIdRegistry::Entry *entry = TypeIdRegistry::Instance ().GetEntry (typeId);
+            return entry != 0 ? &entry->type : 0;
+        }
+
+        Serializable::BinFactory Serializable::GetBinFactory (const BinHeader &header) {
+            if (header.magic == BinHeader::COMPACT_MAGIC32) {
+                const Factories *factories =
+                    TypeIdRegistry::Instance ().GetFactories (header.typeId);
+                return factories != 0 ? std::get<0> (*factories) : 0;
+            }
+            const Factories *factories = GetMap ().Find (header.type);
+            return factories != 0 ? std::get<0> (*factories) : 0;
+        }
+
+        void Serializable::TypeDictionary::Reset () {
+            writeEntries.clear ();
+            nextIndex = 0;
+            readEntries.clear ();
+        }
+
+        std::size_t Serializable::TypeDictionary::Size (
+                const Serializable &serializable) const {
+            const char *type = serializable.Type ();
+            std::size_t size = serializable.Size ();
+            std::size_t headerSize =
+                Serializer::Size (MAGIC32) +
+                Serializer::Size (serializable.Version ()) +
+                SizeT (size).Size ();
+            std::unordered_map<const char *, WriteEntry>::const_iterator it =
+                writeEntries.find (type);
+            if (it != writeEntries.end ()) {
+                headerSize += SizeT (it->second.typeId).Size ();
+            }
+            else {
+                ui32 typeId = TypeToTypeId (type);
+                headerSize += typeId != 0 ?
+                    SizeT (typeId).Size () :
+                    SizeT (nextIndex).Size () + Serializer::Size (std::string (type));
+            }
+            return headerSize + size;
+        }
+
+        void Serializable::TypeDictionary::Write (
+                Serializer &serializer,
+                const Serializable &serializable) {
+            const char *type = serializable.Type ();
+            std::unordered_map<const char *, WriteEntry>::iterator it =
+                writeEntries.find (type);
+            if (it == writeEntries.end ()) {
+                ui32 typeId = TypeToTypeId (type);
+                it = writeEntries.insert (
+                    std::unordered_map<const char *, WriteEntry>::value_type (
+                        type,
+                        typeId != 0 ?
+                            WriteEntry (BinHeader::COMPACT_MAGIC32, typeId) :
+                            WriteEntry (BinHeader::DICTIONARY_MAGIC32, nextIndex++))).first;
+            }
+            WriteEntry &entry = it->second;
+            serializer << entry.magic << SizeT (entry.typeId);
+            if (entry.magic == BinHeader::DICTIONARY_MAGIC32 && !entry.written) {
+                serializer << std::string (type);
+                entry.written = true;
+            }
+            serializer << serializable.Version () << SizeT (serializable.Size ());
+            serializable.Write (serializer);
+        }
+
+        void Serializable::TypeDictionary::ReadHeader (
+                Serializer &serializer,
+                BinHeader &header) {
+            ReadHeaderAndFactory (serializer, header);
+        }
+
+        Serializable::SharedPtr Serializable::TypeDictionary::Read (Serializer &serializer) {
+            BinHeader header;
+            return ReadHeaderAndFactory (serializer, header) (header, serializer);
+        }
+
+        Serializable::BinFactory Serializable::TypeDictionary::ReadHeaderAndFactory (
+                Serializer &serializer,
+                BinHeader &header) {
+            serializer >> header.magic;
+            if (header.magic != BinHeader::DICTIONARY_MAGIC32) {
+                ReadHeaderBody (serializer, header);
+                BinFactory factory = GetBinFactory (header);
+                if (factory == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "No registered factory for serializable '%s'.",
+                        header.type.c_str ());
+                }
+                return factory;
+            }
+            SizeT index;
+            serializer >> index;
+            if (index.value == readEntries.size ()) {
+                // First appearance, the type name follows.
+                std::string type;
+                serializer >> type;
+                const Factories *factories = GetMap ().Find (type);
+                if (factories == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "No registered factory for serializable '%s'.",
+                        type.c_str ());
+                }
+                readEntries.push_back (
+                    std::pair<std::string, const Factories *> (type, factories));
+            }
+            else if (index.value > readEntries.size ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Corrupt serializable dictionary index: " THEKOGANS_UTIL_UI64_FORMAT
+                    " (dictionary has " THEKOGANS_UTIL_SIZE_T_FORMAT " entries).",
+                    index.value, readEntries.size ());
+            }
+            const std::pair<std::string, const Factories *> &entry =
+                readEntries[(std::size_t)index.value];
+            header.type = entry.first;
+            header.typeId = (ui32)index.value;
+            serializer >> header.version >> header.size;
+            return std::get<0> (*entry.second);
+        }
+
         bool Serializable::ValidateType (const std::string &type) {
-            return GetMap ().find (type) != GetMap ().end ();
+            return GetMap ().Contains (type);
+        }
+
+        void Serializable::WriteCompact (
+                Serializer &serializer,
+                const Serializable &serializable) {
+            ui32 typeId = TypeToTypeId (serializable.Type ());
+            if (typeId != 0) {
+                serializer <<
+                    BinHeader (
+                        typeId,
+                        serializable.Type (),
+                        serializable.Version (),
+                        serializable.Size ());
+                serializable.Write (serializer);
+            }
+            else {
+                serializer << serializable;
+            }
+        }
+
+        std::size_t Serializable::CompactSize (const Serializable &serializable) {
+            ui32 typeId = TypeToTypeId (serializable.Type ());
+            if (typeId != 0) {
+                BinHeader header (
+                    typeId,
+                    serializable.Type (),
+                    serializable.Version (),
+                    serializable.Size ());
+                return header.Size () + header.size;
+            }
+            return Size (serializable);
         }
 
         std::size_t Serializable::Size (const Serializable &serializable) {
@@ -76,9 +346,34 @@ namespace thekogans {
             return header.Size () + header.size;
         }
 
+        _LIB_THEKOGANS_UTIL_DECL Serializer & _LIB_THEKOGANS_UTIL_API operator << (
+                Serializer &serializer,
+                const Serializable::BinHeader &header) {
+            serializer << header.magic;
+            if (header.magic == Serializable::BinHeader::COMPACT_MAGIC32) {
+                serializer << SizeT (header.typeId);
+            }
+            else {
+                serializer << header.type;
+            }
+            serializer <<
+                header.version <<
+                header.size;
+            return serializer;
+        }
+
+        _LIB_THEKOGANS_UTIL_DECL Serializer & _LIB_THEKOGANS_UTIL_API operator >> (
+                Serializer &serializer,
+                Serializable::BinHeader &header) {
+            serializer >> header.magic;
+            ReadHeaderBody (serializer, header);
+            return serializer;
+        }
+
         void ValueParser<Serializable::BinHeader>::Reset () {
             magicParser.Reset ();
             typeParser.Reset ();
+            typeIdParser.Reset ();
             versionParser.Reset ();
             sizeParser.Reset ();
             state = STATE_MAGIC;
@@ -88,8 +383,12 @@ namespace thekogans {
             if (state == STATE_MAGIC) {
                 if (magicParser.ParseValue (serializer)) {
                     if (value.magic == MAGIC32) {
+                        value.typeId = 0;
                         state = STATE_TYPE;
                     }
+                    else if (value.magic == Serializable::BinHeader::COMPACT_MAGIC32) {
+                        state = STATE_TYPE_ID;
+                    }
                     else {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                             "Corrupt serializable header: %u.",
@@ -109,6 +408,22 @@ namespace thekogans {
                     }
                 }
             }
+            if (state == STATE_TYPE_ID) {
+                if (typeIdParser.ParseValue (serializer)) {
+                    const std::string *type = typeId.value <= UI32_MAX ?
+                        Serializable::TypeIdToType ((ui32)typeId.value) : 0;
+                    if (type != 0) {
+                        value.typeId = (ui32)typeId.value;
+                        value.type = *type;
+                        state = STATE_VERSION;
+                    }
+                    else {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unknown serializable type id: " THEKOGANS_UTIL_UI64_FORMAT ".",
+                            typeId.value);
+                    }
+                }
+            }
             if (state == STATE_VERSION) {
                 if (versionParser.ParseValue (serializer)) {
                     state = STATE_SIZE;
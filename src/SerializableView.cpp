@@ -0,0 +1,111 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/SerializableView.h"
+
+namespace thekogans {
+    namespace util {
+
+        SerializableView::Slice SerializableView::Cursor::ReadRaw (std::size_t count) {
+            if (count > length - offset) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Field (" THEKOGANS_UTIL_SIZE_T_FORMAT ") runs past the end of the record ("
+                    THEKOGANS_UTIL_SIZE_T_FORMAT ").",
+                    count,
+                    length - offset);
+            }
+            Slice slice (data + offset, count);
+            offset += count;
+            return slice;
+        }
+
+        SerializableView::Slice SerializableView::Cursor::ReadString () {
+            SizeT count;
+            *this >> count;
+            if (count.value > length - offset) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Field (" THEKOGANS_UTIL_UI64_FORMAT ") runs past the end of the record ("
+                    THEKOGANS_UTIL_SIZE_T_FORMAT ").",
+                    count.value,
+                    length - offset);
+            }
+            return ReadRaw ((std::size_t)count.value);
+        }
+
+        SerializableView SerializableView::Cursor::ReadSerializable () {
+            SerializableView view (endianness, data + offset, length - offset);
+            offset += view.GetSize ();
+            return view;
+        }
+
+        void SerializableView::Cursor::SkipSerializable () {
+            // Only the header is parsed, the payload is skipped over.
+            ReadSerializable ();
+        }
+
+        SerializableView::SerializableView (
+                Endianness endianness_,
+                const void *data,
+                std::size_t length) :
+                endianness (endianness_),
+                record ((const ui8 *)data),
+                headerSize (0),
+                factory (0) {
+            TenantReadBuffer buffer (endianness, data, length);
+            buffer >> header;
+            headerSize = buffer.readOffset;
+            if (header.size > length - headerSize) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Truncated serializable '%s' (" THEKOGANS_UTIL_UI64_FORMAT
+                    " > " THEKOGANS_UTIL_SIZE_T_FORMAT ").",
+                    header.type.c_str (),
+                    header.size.value,
+                    length - headerSize);
+            }
+            factory = Serializable::GetBinFactory (header);
+            if (factory == 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "No registered factory for serializable '%s'.",
+                    header.type.c_str ());
+            }
+        }
+
+        SerializableView::SerializableView (const Buffer &buffer) :
+                SerializableView (
+                    buffer.endianness,
+                    buffer.GetReadPtr (),
+                    buffer.GetDataAvailableForReading ()) {}
+
+        Serializable::SharedPtr SerializableView::Materialize () const {
+            TenantReadBuffer payload (endianness, record + headerSize, (std::size_t)header.size);
+            return factory (header, payload);
+        }
+
+        void SerializableView::Materialize (Serializable &serializable) const {
+            if (header.type != serializable.Type ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Serializable type mismatch. Got %s, expecting %s.",
+                    header.type.c_str (),
+                    serializable.Type ());
+            }
+            TenantReadBuffer payload (endianness, record + headerSize, (std::size_t)header.size);
+            serializable.Read (header, payload);
+        }
+
+    } // namespace util
+} // namespace thekogans
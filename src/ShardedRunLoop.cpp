@@ -0,0 +1,260 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/GUID.h"
+#include "thekogans/util/CPUSet.h"
+#include "thekogans/util/CPUTopology.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/ShardedRunLoop.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Set (by Start) on every shard thread to identify
+            // the ShardedRunLoop and the shard it's running.
+            thread_local const ShardedRunLoop *currentShardedRunLoop = 0;
+            thread_local std::size_t currentShardIndex = ShardedRunLoop::NO_SHARD;
+
+            // Resolve the workerAffinity placement policy to
+            // the processor the given shard should be pinned to.
+            ui32 GetShardAffinity (
+                    ui32 workerAffinity,
+                    std::size_t shard,
+                    std::size_t shardCount) {
+                if (workerAffinity != THEKOGANS_UTIL_MAX_THREAD_AFFINITY) {
+                    CPUSet cpuSet = CPUTopology::Instance ().GetWorkerAffinity (
+                        workerAffinity, shard, shardCount);
+                    // Policies that resolve to more than one processor
+                    // (PHYSICAL_CORE, NUMA_NODE) still get a single
+                    // processor per shard. Rotate through the set so that
+                    // shards sharing it don't all land on it's first cpu.
+                    if (!cpuSet.IsEmpty ()) {
+                        return cpuSet.cpus[shard % cpuSet.GetCount ()];
+                    }
+                }
+                return THEKOGANS_UTIL_MAX_THREAD_AFFINITY;
+            }
+        }
+
+        ShardedRunLoop::ShardedRunLoop (
+                const std::string &name_,
+                std::size_t shardCount,
+                RunLoop::JobExecutionPolicy::SharedPtr jobExecutionPolicy,
+                std::size_t handoffCapacity,
+                i32 workerPriority,
+                ui32 workerAffinity,
+                RunLoop::WorkerCallback *workerCallback) :
+                id (GUID::FromRandom ().ToString ()),
+                name (name_) {
+            if (shardCount > 0 && jobExecutionPolicy.Get () != 0) {
+                shards.reserve (shardCount);
+                for (std::size_t i = 0; i < shardCount; ++i) {
+                    std::string shardName;
+                    if (!name.empty ()) {
+                        shardName = FormatString (
+                            "%s-" THEKOGANS_UTIL_SIZE_T_FORMAT,
+                            name.c_str (),
+                            i);
+                    }
+                    // Every shard is a single threaded JobQueue. Since
+                    // it's only worker is always worker 0, we resolve the
+                    // placement policy here, where we know the shard index.
+                    shards.push_back (
+                        JobQueue::SharedPtr (
+                            new JobQueue (
+                                shardName,
+                                jobExecutionPolicy,
+                                1,
+                                workerPriority,
+                                GetShardAffinity (workerAffinity, i, shardCount),
+                                workerCallback,
+                                handoffCapacity)));
+                }
+                Start ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        ShardedRunLoop::~ShardedRunLoop () {
+            Stop ();
+        }
+
+        std::size_t ShardedRunLoop::GetShardIndex (ui64 key) const {
+            // Keys are often sequential (or otherwise patterned) ids.
+            // Run them through a 64 bit finalizer (murmur3 fmix64) so
+            // that every bit of the key affects the shard it lands on.
+            key ^= key >> 33;
+            key *= THEKOGANS_UTIL_UI64_LITERAL (0xff51afd7ed558ccd);
+            key ^= key >> 33;
+            key *= THEKOGANS_UTIL_UI64_LITERAL (0xc4ceb9fe1a85ec53);
+            key ^= key >> 33;
+            return (std::size_t)(key % shards.size ());
+        }
+
+        JobQueue &ShardedRunLoop::GetShard (std::size_t index) {
+            if (index < shards.size ()) {
+                return *shards[index];
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t ShardedRunLoop::GetCurrentShardIndex () const {
+            return currentShardedRunLoop == this ? currentShardIndex : NO_SHARD;
+        }
+
+        void ShardedRunLoop::Start () {
+            for (std::size_t i = 0, count = shards.size (); i < count; ++i) {
+                // NOTE: JobQueue starts itself in it's ctor, so the
+                // shards are already running the first time through.
+                if (!shards[i]->IsRunning ()) {
+                    shards[i]->Start ();
+                }
+                // Tell the shard thread who it is before it runs
+                // anything else. Wait so that, once Start returns,
+                // GetCurrentShardIndex is valid in every job.
+                shards[i]->EnqJobFront (
+                    [this, i] (RunLoop::Job & /*job*/, const std::atomic<bool> & /*done*/) {
+                        currentShardedRunLoop = this;
+                        currentShardIndex = i;
+                    },
+                    true);
+            }
+        }
+
+        void ShardedRunLoop::Stop (
+                bool cancelRunningJobs,
+                bool cancelPendingJobs) {
+            for (std::size_t i = 0, count = shards.size (); i < count; ++i) {
+                shards[i]->Stop (cancelRunningJobs, cancelPendingJobs);
+            }
+        }
+
+        bool ShardedRunLoop::WaitForIdle (const TimeSpec &timeSpec) {
+            TimeSpec deadline = timeSpec == TimeSpec::Infinite ?
+                TimeSpec::Infinite : GetCurrentTime () + timeSpec;
+            // Jobs running on one shard can post to shards we've
+            // already waited on. Keep going until a pass finds
+            // them all idle.
+            for (;;) {
+                for (std::size_t i = 0, count = shards.size (); i < count; ++i) {
+                    if (deadline == TimeSpec::Infinite) {
+                        shards[i]->WaitForIdle ();
+                    }
+                    else {
+                        TimeSpec now = GetCurrentTime ();
+                        if (deadline <= now || !shards[i]->WaitForIdle (deadline - now)) {
+                            return false;
+                        }
+                    }
+                }
+                if (IsIdle ()) {
+                    return true;
+                }
+            }
+        }
+
+        bool ShardedRunLoop::IsIdle () {
+            for (std::size_t i = 0, count = shards.size (); i < count; ++i) {
+                if (!shards[i]->IsIdle ()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool ShardedRunLoop::EnqJob (
+                ui64 key,
+                RunLoop::Job::SharedPtr job,
+                bool wait,
+                const TimeSpec &timeSpec) {
+            return shards[GetShardIndex (key)]->EnqJob (job, wait, timeSpec);
+        }
+
+        std::pair<RunLoop::Job::SharedPtr, bool> ShardedRunLoop::EnqJob (
+                ui64 key,
+                const RunLoop::LambdaJob::Function &function,
+                bool wait,
+                const TimeSpec &timeSpec) {
+            return shards[GetShardIndex (key)]->EnqJob (function, wait, timeSpec);
+        }
+
+        void ShardedRunLoop::HandoffJob (
+                ui64 key,
+                RunLoop::Job::SharedPtr job) {
+            shards[GetShardIndex (key)]->HandoffJob (job);
+        }
+
+        RunLoop::Job::SharedPtr ShardedRunLoop::HandoffJob (
+                ui64 key,
+                const RunLoop::LambdaJob::Function &function) {
+            RunLoop::Job::SharedPtr job (new RunLoop::LambdaJob (function));
+            HandoffJob (key, job);
+            return job;
+        }
+
+        RunLoop::Stats ShardedRunLoop::GetStats () {
+            RunLoop::Stats stats (id, name);
+            for (std::size_t i = 0, count = shards.size (); i < count; ++i) {
+                RunLoop::Stats shardStats = shards[i]->GetStats ();
+                if (shardStats.totalJobs > 0) {
+                    if (stats.totalJobs == 0 ||
+                            stats.minJob.totalTime > shardStats.minJob.totalTime) {
+                        stats.minJob = shardStats.minJob;
+                    }
+                    if (stats.totalJobs == 0 ||
+                            stats.maxJob.totalTime < shardStats.maxJob.totalTime) {
+                        stats.maxJob = shardStats.maxJob;
+                    }
+                    if (stats.totalJobs == 0 ||
+                            stats.lastJob.endTime < shardStats.lastJob.endTime) {
+                        stats.lastJob = shardStats.lastJob;
+                    }
+                }
+                stats.totalJobs += shardStats.totalJobs;
+                stats.totalJobTime += shardStats.totalJobTime;
+                stats.queueDepth += shardStats.queueDepth;
+                stats.maxQueueDepth += shardStats.maxQueueDepth;
+                stats.workerCount += shardStats.workerCount;
+                stats.maxWorkerCount += shardStats.maxWorkerCount;
+                stats.spawnedWorkers += shardStats.spawnedWorkers;
+                stats.retiredWorkers += shardStats.retiredWorkers;
+                stats.waitTime.Merge (shardStats.waitTime);
+                stats.runTime.Merge (shardStats.runTime);
+            }
+            return stats;
+        }
+
+        RunLoop::Stats ShardedRunLoop::GetShardStats (std::size_t index) {
+            return GetShard (index).GetStats ();
+        }
+
+        void ShardedRunLoop::ResetStats () {
+            for (std::size_t i = 0, count = shards.size (); i < count; ++i) {
+                shards[i]->ResetStats ();
+            }
+        }
+
+    } // namespace util
+} // namespace thekogans
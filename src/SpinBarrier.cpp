@@ -0,0 +1,87 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/SpinBarrier.h"
+
+namespace thekogans {
+    namespace util {
+
+        namespace {
+            // Number of spins between time slice yields (power of 2).
+            const ui32 YIELD_INTERVAL = 32;
+        }
+
+        SpinBarrier::SpinBarrier (
+                std::size_t count_,
+                ui32 spinCount_) :
+                count (count_),
+                spinCount (spinCount_),
+                remaining (count_),
+                sense (0),
+                parked (0),
+                condition (mutex) {
+            if (count == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool SpinBarrier::Wait () {
+            ui32 currSense = sense.load (std::memory_order_acquire);
+            if (remaining.fetch_sub (1, std::memory_order_acq_rel) == 1) {
+                // Last one in. Reset for the next round before releasing
+                // anyone (they might come right back around).
+                remaining.store (count, std::memory_order_relaxed);
+                // The store to sense and the load of parked below (and
+                // their mirror images in the parking code) must be
+                // sequentially consistent. Otherwise a waiter could
+                // miss the flip and we could miss the waiter.
+                sense.fetch_add (1, std::memory_order_seq_cst);
+                if (parked.load (std::memory_order_seq_cst) > 0) {
+                    LockGuard<Mutex> guard (mutex);
+                    condition.SignalAll ();
+                }
+                return true;
+            }
+            for (ui32 i = 1; i <= spinCount; ++i) {
+                if (sense.load (std::memory_order_acquire) != currSense) {
+                    return false;
+                }
+                // Every so often give up the time slice. If there are more
+                // threads than cores, the thread we're waiting for might
+                // need it. If not, it's a cheap no-op.
+                if ((i & (YIELD_INTERVAL - 1)) == 0) {
+                    Thread::YieldSlice ();
+                }
+                else {
+                    Thread::Pause ();
+                }
+            }
+            LockGuard<Mutex> guard (mutex);
+            parked.fetch_add (1, std::memory_order_seq_cst);
+            while (sense.load (std::memory_order_seq_cst) == currSense) {
+                condition.Wait ();
+            }
+            parked.fetch_sub (1, std::memory_order_relaxed);
+            return false;
+        }
+
+    } // namespace util
+} // namespace thekogans
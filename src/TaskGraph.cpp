@@ -0,0 +1,372 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_util.
+//
+// libthekogans_util is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_util is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_util. If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <exception>
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/XMLUtils.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/TaskGraph.h"
+
+namespace thekogans {
+    namespace util {
+
+        TaskGraph::Node::Node (
+                TaskGraph &graph_,
+                std::size_t index_,
+                const std::string &name_,
+                const Function &function_) :
+                graph (graph_),
+                index (index_),
+                name (name_),
+                function (function_),
+                pendingPredecessors (0),
+                start (0),
+                end (0) {
+            if (function == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void TaskGraph::Node::SetState (State state_) {
+            if (state_ == Running) {
+                start = HRTimer::Click ();
+            }
+            else if (state_ == Completed && start != 0) {
+                end = HRTimer::Click ();
+            }
+            RunLoop::Job::SetState (state_);
+            if (state_ == Completed) {
+                // Return the borrowed queue (if any) to it's pool
+                // before releasing our successors (they might need it).
+                jobQueue.Reset ();
+                graph.FinishedNode (*this);
+            }
+        }
+
+        void TaskGraph::Node::Execute (const std::atomic<bool> &done) throw () {
+            if (!ShouldStop (done) && !graph.stopping) {
+                THEKOGANS_UTIL_TRY {
+                    function (*this, done);
+                }
+                THEKOGANS_UTIL_CATCH (Exception) {
+                    Fail (exception);
+                }
+                THEKOGANS_UTIL_CATCH (std::exception) {
+                    Fail (THEKOGANS_UTIL_STRING_EXCEPTION ("%s", exception.what ()));
+                }
+                THEKOGANS_UTIL_CATCH_ANY {
+                    Fail (THEKOGANS_UTIL_STRING_EXCEPTION ("%s", "Caught unknown exception!"));
+                }
+            }
+            else {
+                Cancel ();
+            }
+        }
+
+        TaskGraph::TaskGraph (const std::string &name_) :
+            name (name_),
+            runLoop (0),
+            jobQueuePool (0),
+            running (false),
+            stopping (false),
+            cancelled (false),
+            failed (false),
+            remainingNodes (0),
+            disposition (RunLoop::Job::Unknown),
+            start (0),
+            end (0) {}
+
+        TaskGraph::Node::SharedPtr TaskGraph::AddNode (
+                const std::string &nodeName,
+                const Node::Function &function) {
+            if (!running) {
+                Node::SharedPtr node (new Node (*this, nodes.size (), nodeName, function));
+                nodes.push_back (node);
+                return node;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "TaskGraph (%s) is running.", name.c_str ());
+            }
+        }
+
+        void TaskGraph::AddEdge (
+                Node::SharedPtr from,
+                Node::SharedPtr to) {
+            if (from.Get () != 0 && to.Get () != 0 && from.Get () != to.Get () &&
+                    &from->graph == this && &to->graph == this) {
+                if (!running) {
+                    if (std::find (from->successors.begin (), from->successors.end (),
+                            to.Get ()) == from->successors.end ()) {
+                        from->successors.push_back (to.Get ());
+                        to->predecessors.push_back (from.Get ());
+                    }
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "TaskGraph (%s) is running.", name.c_str ());
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void TaskGraph::Submit (RunLoop &runLoop_) {
+            std::vector<Node *> readyNodes = Prepare ();
+            runLoop = &runLoop_;
+            jobQueuePool = 0;
+            Start (readyNodes);
+        }
+
+        void TaskGraph::Submit (JobQueuePool &jobQueuePool_) {
+            std::vector<Node *> readyNodes = Prepare ();
+            runLoop = 0;
+            jobQueuePool = &jobQueuePool_;
+            Start (readyNodes);
+        }
+
+        void TaskGraph::Cancel () {
+            if (running) {
+                cancelled = true;
+                stopping = true;
+                for (std::size_t i = 0, count = nodes.size (); i < count; ++i) {
+                    if (nodes[i]->IsPending () || nodes[i]->IsRunning ()) {
+                        nodes[i]->Cancel ();
+                    }
+                }
+            }
+        }
+
+        ui64 TaskGraph::GetElapsedTime () const {
+            return end != 0 ? HRTimer::ComputeElapsedTime (start, end) : 0;
+        }
+
+        ui64 TaskGraph::GetCriticalPath (std::vector<Node::SharedPtr> &criticalPath) const {
+            criticalPath.clear ();
+            std::vector<Node *> order;
+            if (running || !TopologicalSort (order)) {
+                return 0;
+            }
+            // Longest (execution time weighted) path through the nodes that ran.
+            std::vector<ui64> pathTimes (nodes.size (), 0);
+            std::vector<Node *> pathPredecessors (nodes.size (), 0);
+            Node *last = 0;
+            for (std::size_t i = 0, count = order.size (); i < count; ++i) {
+                Node *node = order[i];
+                if (node->start != 0) {
+                    ui64 pathTime = 0;
+                    for (std::size_t j = 0, predecessorCount = node->predecessors.size ();
+                            j < predecessorCount; ++j) {
+                        Node *predecessor = node->predecessors[j];
+                        if (predecessor->start != 0 && pathTimes[predecessor->index] > pathTime) {
+                            pathTime = pathTimes[predecessor->index];
+                            pathPredecessors[node->index] = predecessor;
+                        }
+                    }
+                    pathTimes[node->index] = pathTime +
+                        HRTimer::ComputeElapsedTime (node->start, node->end);
+                    if (last == 0 || pathTimes[node->index] > pathTimes[last->index]) {
+                        last = node;
+                    }
+                }
+            }
+            if (last == 0) {
+                return 0;
+            }
+            for (Node *node = last; node != 0; node = pathPredecessors[node->index]) {
+                criticalPath.push_back (Node::SharedPtr (node));
+            }
+            std::reverse (criticalPath.begin (), criticalPath.end ());
+            return pathTimes[last->index];
+        }
+
+        namespace {
+            const char * const SCOPE_CRITICAL_PATH = "CriticalPath";
+            const char * const ATTR_ELAPSED = "Elapsed";
+            const char * const ATTR_CRITICAL_PATH = "CriticalPath";
+
+            void AddNodeTimer (
+                    HRTimerMgr::ScopeInfo &scope,
+                    const TaskGraph::Node &node) {
+                HRTimerMgr::TimerInfo *timer = scope.StartTimer (node.GetName ());
+                timer->start = node.GetStartTime ();
+                timer->stop = node.GetEndTime ();
+                scope.StopTimer ();
+            }
+        }
+
+        void TaskGraph::GetTimings (HRTimerMgr::ScopeInfo &scope) const {
+            std::vector<Node::SharedPtr> criticalPath;
+            ui64 criticalPathTime = GetCriticalPath (criticalPath);
+            HRTimerMgr::ScopeInfo *graphScope = scope.BeginScope (name);
+            graphScope->AddAttribute (
+                Attribute (ATTR_ELAPSED, f64Tostring (HRTimer::ToSeconds (GetElapsedTime ()))));
+            graphScope->AddAttribute (
+                Attribute (ATTR_CRITICAL_PATH, f64Tostring (HRTimer::ToSeconds (criticalPathTime))));
+            for (std::size_t i = 0, count = nodes.size (); i < count; ++i) {
+                if (nodes[i]->start != 0) {
+                    AddNodeTimer (*graphScope, *nodes[i]);
+                }
+            }
+            HRTimerMgr::ScopeInfo *criticalPathScope = graphScope->BeginScope (SCOPE_CRITICAL_PATH);
+            for (std::size_t i = 0, count = criticalPath.size (); i < count; ++i) {
+                AddNodeTimer (*criticalPathScope, *criticalPath[i]);
+            }
+            graphScope->EndScope ();
+            scope.EndScope ();
+        }
+
+        std::vector<TaskGraph::Node *> TaskGraph::Prepare () {
+            bool expected = false;
+            if (!running.compare_exchange_strong (expected, true)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "TaskGraph (%s) is running.", name.c_str ());
+            }
+            std::vector<Node *> order;
+            if (!TopologicalSort (order)) {
+                running = false;
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "TaskGraph (%s) has a cycle.", name.c_str ());
+            }
+            stopping = false;
+            cancelled = false;
+            failed = false;
+            remainingNodes = nodes.size ();
+            disposition = RunLoop::Job::Unknown;
+            start = HRTimer::Click ();
+            end = 0;
+            completed.Reset ();
+            std::vector<Node *> readyNodes;
+            for (std::size_t i = 0, count = nodes.size (); i < count; ++i) {
+                Node *node = nodes[i].Get ();
+                node->pendingPredecessors = node->predecessors.size ();
+                node->disposition = RunLoop::Job::Unknown;
+                node->start = 0;
+                node->end = 0;
+                if (node->predecessors.empty ()) {
+                    readyNodes.push_back (node);
+                }
+            }
+            return readyNodes;
+        }
+
+        void TaskGraph::Start (const std::vector<Node *> &readyNodes) {
+            if (!nodes.empty ()) {
+                // Released by FinishedNode when the last node completes.
+                AddRef ();
+                for (std::size_t i = 0, count = readyNodes.size (); i < count; ++i) {
+                    DispatchNode (*readyNodes[i]);
+                }
+            }
+            else {
+                end = start;
+                disposition = RunLoop::Job::Succeeded;
+                running = false;
+                completed.Signal ();
+            }
+        }
+
+        void TaskGraph::DispatchNode (Node &node) {
+            if (!stopping) {
+                THEKOGANS_UTIL_TRY {
+                    if (runLoop != 0) {
+                        runLoop->EnqJob (RunLoop::Job::SharedPtr (&node));
+                        return;
+                    }
+                    JobQueue::SharedPtr jobQueue = jobQueuePool->GetJobQueue ();
+                    if (jobQueue.Get () != 0) {
+                        // Set it before enqueueing, the node might
+                        // complete before EnqJob returns.
+                        node.jobQueue = jobQueue;
+                        THEKOGANS_UTIL_TRY {
+                            jobQueue->EnqJob (RunLoop::Job::SharedPtr (&node));
+                            return;
+                        }
+                        THEKOGANS_UTIL_CATCH (Exception) {
+                            node.jobQueue.Reset ();
+                            THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                        }
+                    }
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "TaskGraph (%s) unable to acquire a JobQueue for %s.",
+                        name.c_str (), node.name.c_str ());
+                }
+                THEKOGANS_UTIL_CATCH (Exception) {
+                    node.Fail (exception);
+                }
+            }
+            else {
+                node.Cancel ();
+            }
+            // The node never made it to a run loop. Finish it here.
+            FinishedNode (node);
+        }
+
+        void TaskGraph::FinishedNode (Node &node) {
+            if (!node.IsSucceeded ()) {
+                if (node.IsFailed ()) {
+                    failed = true;
+                }
+                stopping = true;
+            }
+            for (std::size_t i = 0, count = node.successors.size (); i < count; ++i) {
+                Node *successor = node.successors[i];
+                if (--successor->pendingPredecessors == 0) {
+                    DispatchNode (*successor);
+                }
+            }
+            if (--remainingNodes == 0) {
+                end = HRTimer::Click ();
+                disposition = failed ? RunLoop::Job::Failed :
+                    stopping ? RunLoop::Job::Cancelled : RunLoop::Job::Succeeded;
+                running = false;
+                completed.Signal ();
+                // NOTE: This might be the last reference.
+                // Don't touch any members after this.
+                Release ();
+            }
+        }
+
+        bool TaskGraph::TopologicalSort (std::vector<Node *> &order) const {
+            // Kahn's algorithm.
+            order.clear ();
+            order.reserve (nodes.size ());
+            std::vector<std::size_t> inDegrees (nodes.size ());
+            for (std::size_t i = 0, count = nodes.size (); i < count; ++i) {
+                inDegrees[i] = nodes[i]->predecessors.size ();
+                if (inDegrees[i] == 0) {
+                    order.push_back (nodes[i].Get ());
+                }
+            }
+            for (std::size_t i = 0; i < order.size (); ++i) {
+                const std::vector<Node *> &successors = order[i]->successors;
+                for (std::size_t j = 0, count = successors.size (); j < count; ++j) {
+                    if (--inDegrees[successors[j]->index] == 0) {
+                        order.push_back (successors[j]);
+                    }
+                }
+            }
+            return order.size () == nodes.size ();
+        }
+
+    } // namespace util
+} // namespace thekogans
@@ -29,6 +29,7 @@
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/TimeSpec.h"
 #include "thekogans/util/CPU.h"
+#include "thekogans/util/CPUTopology.h"
 #if defined (TOOLCHAIN_OS_Linux) || defined (TOOLCHAIN_OS_OSX)
     #include "thekogans/util/LockGuard.h"
 #if defined (TOOLCHAIN_OS_OSX)
@@ -124,7 +125,9 @@ namespace thekogans {
 
         void Thread::Create (
                 i32 priority,
-                ui32 affinity) {
+                ui32 affinity,
+                std::size_t worker,
+                std::size_t workerCount) {
         #if defined (TOOLCHAIN_OS_Windows)
             if (thread != THEKOGANS_UTIL_INVALID_HANDLE_VALUE) {
                 if (!CloseHandle (thread)) {
@@ -206,7 +209,8 @@ namespace thekogans {
         #endif // defined (TOOLCHAIN_OS_Windows)
             SetThreadPriority (thread, priority);
             if (affinity != THEKOGANS_UTIL_MAX_THREAD_AFFINITY) {
-                SetThreadAffinity (thread, affinity);
+                SetThreadAffinity (thread,
+                    CPUTopology::Instance ().GetWorkerAffinity (affinity, worker, workerCount));
             }
         }
 
@@ -380,6 +384,40 @@ namespace thekogans {
         #endif // defined (TOOLCHAIN_OS_Windows)
         }
 
+        void Thread::SetThreadAffinity (
+                THEKOGANS_UTIL_THREAD_HANDLE thread,
+                const CPUSet &affinity) {
+            if (!affinity.IsEmpty ()) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                DWORD_PTR affinityMask = 0;
+                for (std::size_t i = 0, count = affinity.GetCount (); i < count; ++i) {
+                    if (affinity.cpus[i] < sizeof (DWORD_PTR) * 8) {
+                        affinityMask |= (DWORD_PTR)1 << affinity.cpus[i];
+                    }
+                }
+                if (SetThreadAffinityMask (thread, affinityMask) == 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            #elif defined (TOOLCHAIN_OS_Linux)
+                cpu_set_t affinityMask;
+                CPU_ZERO (&affinityMask);
+                for (std::size_t i = 0, count = affinity.GetCount (); i < count; ++i) {
+                    if (affinity.cpus[i] < CPU_SETSIZE) {
+                        CPU_SET (affinity.cpus[i], &affinityMask);
+                    }
+                }
+                THEKOGANS_UTIL_ERROR_CODE errorCode =
+                    pthread_setaffinity_np (thread, sizeof (affinityMask), &affinityMask);
+                if (errorCode != 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+            #elif defined (TOOLCHAIN_OS_OSX)
+                SetThreadAffinity (thread, affinity.cpus[0]);
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+        }
+
         void Thread::Pause () {
             CPU::Pause ();
         }
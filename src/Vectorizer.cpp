@@ -18,7 +18,8 @@
 #include <cassert>
 #include <memory>
 #include <algorithm>
-#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/CPUTopology.h"
 #include "thekogans/util/Vectorizer.h"
 
 namespace thekogans {
@@ -26,24 +27,41 @@ namespace thekogans {
 
         Vectorizer::Vectorizer (
                 std::size_t workerCount_,
-                i32 workerPriority) :
+                i32 workerPriority,
+                ui32 workerAffinity,
+                ui32 spinCount) :
                 done (false),
-                barrier (workerCount_),
+                busy (false),
+                barrier (std::max<std::size_t> (workerCount_, 1), spinCount),
                 job (0),
                 workerCount (0),
-                chunkSize (0) {
+                chunkSize (0),
+                size (0),
+                schedule (ScheduleStatic),
+                next (0) {
             if (workerCount_ > 1) {
                 // NOTE: Unlike worker threads, we deliberately do not
                 // adjust our own priority. This is done because 1) When
                 // Execute is called, we are already running, and 2) Not
                 // to cause starvation by monopolizing the processor
                 // needlessly.
-                Thread::SetThreadAffinity (Thread::GetCurrThreadHandle (), 0);
+                if (workerAffinity != THEKOGANS_UTIL_MAX_THREAD_AFFINITY) {
+                    Thread::SetThreadAffinity (
+                        Thread::GetCurrThreadHandle (),
+                        CPUTopology::Instance ().GetWorkerAffinity (
+                            workerAffinity, 0, workerCount_));
+                }
                 // We are the first thread. Create workerCount_ - 1
                 // additional worker threads.
                 for (std::size_t i = 1; i < workerCount_; ++i) {
                     Worker::UniquePtr worker (
-                        new Worker (*this, i, FormatString ("Vectorizer-%u", i), workerPriority));
+                        new Worker (
+                            *this,
+                            i,
+                            FormatString ("Vectorizer-%u", i),
+                            workerPriority,
+                            workerAffinity,
+                            workerCount_));
                     workers.push_back (worker.get ());
                     worker.release ();
                 }
@@ -51,71 +69,81 @@ namespace thekogans {
         }
 
         Vectorizer::~Vectorizer () {
-            done = true;
-            struct DoneJob : public Job {
-                std::size_t workerCount;
-                explicit DoneJob (std::size_t workerCount_) :
-                    workerCount (workerCount_) {}
-                virtual void Execute (
-                    std::size_t /*startIndex*/,
-                    std::size_t /*endIndex*/,
-                    std::size_t /*rank*/) throw () {}
-                virtual std::size_t Size () const throw () {
-                    return workerCount;
+            if (!workers.empty ()) {
+                // Wait for the job in flight (if any) to finish.
+                for (bool expected = false; !busy.compare_exchange_weak (expected, true,
+                        std::memory_order_acquire, std::memory_order_relaxed); expected = false) {
+                    Thread::YieldSlice ();
+                }
+                done = true;
+                // Release the workers so that they can see done.
+                barrier.Wait ();
+                for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                    workers[i]->Wait ();
                 }
-            } doneJob (workers.size ());
-            Execute (doneJob, 1);
-            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
-                workers[i]->Wait ();
             }
         }
 
         void Vectorizer::Execute (
                 Job &job_,
-                std::size_t chunkSize_) {
-            if (job_.Size () > 0) {
+                std::size_t chunkSize_,
+                Schedule schedule_) {
+            std::size_t size_ = job_.Size ();
+            if (size_ > 0) {
                 // If we are running on a uni-processor, don't waste time with
-                // setup.
-                if (!workers.empty ()) {
-                    // Vectorizer is, as it's name implies, a global
-                    // resource. It is not re-entrant. We therefore need to
-                    // serialize access to the one and only entry point.
-                    LockGuard<Mutex> guard (mutex);
+                // setup. Same if the job is too small to split or if we're
+                // busy. Vectorizer runs one job at a time, so a concurrent
+                // (or nested, from inside Job::Execute) caller would have to
+                // wait (or dead lock). It's better to just do the work.
+                bool expected = false;
+                if (!workers.empty () && size_ > 1 &&
+                        busy.compare_exchange_strong (expected, true,
+                            std::memory_order_acquire, std::memory_order_relaxed)) {
                     assert (job == 0);
-                    assert (workerCount == 0);
-                    assert (chunkSize == 0);
                     job = &job_;
-                    if (chunkSize_ == SIZE_T_MAX ||
-                            chunkSize_ * (workers.size () + 1) < job->Size ()) {
-                        workerCount = workers.size () + 1;
-                        chunkSize = job->Size () / workerCount;
-                        if (workerCount * chunkSize < job->Size ()) {
-                            // Since we are holding workers constant, we
-                            // must update chunkSize to account for the
-                            // remainder.
-                            ++chunkSize;
+                    size = size_;
+                    schedule = schedule_;
+                    std::size_t width = workers.size () + 1;
+                    if (schedule == ScheduleStatic) {
+                        if (chunkSize_ == SIZE_T_MAX || chunkSize_ * width < size) {
+                            workerCount = width;
+                            chunkSize = size / workerCount;
+                            if (workerCount * chunkSize < size) {
+                                // Since we are holding workers constant, we
+                                // must update chunkSize to account for the
+                                // remainder.
+                                ++chunkSize;
+                            }
+                        }
+                        else {
+                            workerCount = size / chunkSize_;
+                            chunkSize = chunkSize_;
+                            if (workerCount * chunkSize < size) {
+                                // Since we are holding chunkSize constant,
+                                // we must update workerCount to account for
+                                // the remainder.
+                                ++workerCount;
+                            }
                         }
                     }
                     else {
-                        workerCount = job->Size () / chunkSize_;
-                        chunkSize = chunkSize_;
-                        if (workerCount * chunkSize < job->Size ()) {
-                            // Since we are holding chunkSize constant,
-                            // we must update workerCount to account for
-                            // the remainder.
-                            ++workerCount;
-                        }
+                        // Every rank pitches in, and keeps going until
+                        // there's nothing left.
+                        workerCount = std::min (width, size);
+                        chunkSize = chunkSize_ != SIZE_T_MAX && chunkSize_ > 0 ? chunkSize_ :
+                            schedule == ScheduleDynamic ?
+                                std::max<std::size_t> (size / (8 * width), 1) : 1;
+                        next.store (0, std::memory_order_relaxed);
                     }
                     assert (workerCount > 0);
-                    assert (workerCount <= workers.size () + 1);
+                    assert (workerCount <= width);
                     assert (chunkSize > 0);
-                    assert (chunkSize <= job->Size ());
                     // Scatter.
                     job->Prolog (workerCount);
                     // Release the workers.
                     barrier.Wait ();
-                    // Work on the first chunk.
-                    job->Execute (0, chunkSize, 0);
+                    // Work on our chunk(s).
+                    ExecuteChunks (0);
                     // Wait for the rest of the workers.
                     barrier.Wait ();
                     // Gather.
@@ -123,15 +151,68 @@ namespace thekogans {
                     job = 0;
                     workerCount = 0;
                     chunkSize = 0;
+                    size = 0;
+                    busy.store (false, std::memory_order_release);
                 }
                 else {
-                    job_.Prolog (1);
-                    job_.Execute (0, job_.Size (), 0);
-                    job_.Epilog ();
+                    ExecuteInline (job_);
                 }
             }
         }
 
+        void Vectorizer::ExecuteChunks (std::size_t rank) {
+            if (rank < workerCount) {
+                switch (schedule) {
+                    case ScheduleStatic: {
+                        std::size_t startIndex = rank * chunkSize;
+                        std::size_t endIndex = std::min (startIndex + chunkSize, size);
+                        // This test is necessary because of integer division
+                        // above (Execute).
+                        // By way of example;
+                        // 1. job size: 28
+                        // 2. workers: 8
+                        // 3. chunk size: 28 / 8 = 3 (integer division!)
+                        // 4. 8 * 3 = 24
+                        // 5. 24 < 28 so bump up chunk size (4)
+                        // 6. 7 * 4 = 28 <---- This means that the 8th worker
+                        // will have nothing to do, and hence the test below.
+                        if (startIndex < endIndex) {
+                            job->Execute (startIndex, endIndex, rank);
+                        }
+                        break;
+                    }
+                    case ScheduleDynamic: {
+                        for (std::size_t startIndex = next.fetch_add (chunkSize, std::memory_order_relaxed);
+                                startIndex < size;
+                                startIndex = next.fetch_add (chunkSize, std::memory_order_relaxed)) {
+                            job->Execute (startIndex, std::min (startIndex + chunkSize, size), rank);
+                        }
+                        break;
+                    }
+                    case ScheduleGuided: {
+                        std::size_t startIndex = next.load (std::memory_order_relaxed);
+                        while (startIndex < size) {
+                            std::size_t count = std::min (
+                                std::max ((size - startIndex) / (2 * workerCount), chunkSize),
+                                size - startIndex);
+                            if (next.compare_exchange_weak (startIndex, startIndex + count,
+                                    std::memory_order_relaxed, std::memory_order_relaxed)) {
+                                job->Execute (startIndex, startIndex + count, rank);
+                                startIndex = next.load (std::memory_order_relaxed);
+                            }
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        void Vectorizer::ExecuteInline (Job &job_) {
+            job_.Prolog (1);
+            job_.Execute (0, job_.Size (), 0);
+            job_.Epilog ();
+        }
+
         void Vectorizer::Worker::Run () throw () {
             // NOTE: No exception handling here. If we were to wrap
             // the while loop with try/catch, the first exception
@@ -142,27 +223,17 @@ namespace thekogans {
             // (and which leaves the job in an incomplete state).
             // It's better to just crash loudly, and let the engineer
             // fix his/her own code.
-            while (!vectorizer.done) {
-                // Wait until Execute releases us.
+            // NOTE: done is checked right after being released (and
+            // not at the top of the loop) so that there's no window
+            // for the dtor to set it while we're between rounds (we
+            // would leave, and it would wait for us forever).
+            for (;;) {
+                // Wait until Execute (or the dtor) releases us.
                 vectorizer.barrier.Wait ();
-                if (vectorizer.job != 0 && rank < vectorizer.workerCount) {
-                    std::size_t startIndex = rank * vectorizer.chunkSize;
-                    std::size_t endIndex = std::min (
-                        startIndex + vectorizer.chunkSize, vectorizer.job->Size ());
-                    // This test is necessary because of integer division
-                    // above (Execute).
-                    // By way of example;
-                    // 1. job size: 28
-                    // 2. workers: 8
-                    // 3. chunk size: 28 / 8 = 3 (integer division!)
-                    // 4. 8 * 3 = 24
-                    // 5. 24 < 28 so bump up chunk size (4)
-                    // 6. 7 * 4 = 28 <---- This means that the 8th worker
-                    // will have nothing to do, and hence the test below.
-                    if (startIndex < endIndex) {
-                        vectorizer.job->Execute (startIndex, endIndex, rank);
-                    }
+                if (vectorizer.done) {
+                    break;
                 }
+                vectorizer.ExecuteChunks (rank);
                 // Wait for all worker threads to finish.
                 vectorizer.barrier.Wait ();
             }